@@ -0,0 +1,159 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _VIDEO_FRAME_CLOCK_H
+#define _VIDEO_FRAME_CLOCK_H
+
+#include <math.h>
+
+#include <SupportDefs.h>
+
+// Performance times of a stream of frames at a fixed rate.
+// The rate is kept as an exact fraction of frames per second and every
+// frame time is computed from the base in integer math, rounded to the
+// nearest microsecond. Rounding never accumulates, frame N of a 29.97 fps
+// stream is as exact after a day as it is after a second.
+class FrameClock {
+public:
+							FrameClock();
+
+			// Picks the fraction the float stands for, 30000/1001 for
+			// 29.97 and so on. Zero stops the clock at its base.
+			void			SetRate(float fieldRate);
+			void			SetRate(uint32 numerator, uint32 denominator);
+
+			uint32			RateNumerator() const { return fNumerator; }
+			uint32			RateDenominator() const { return fDenominator; }
+
+			// frame is shown at time, later frames count from there
+			void			SetBase(bigtime_t time, uint32 frame);
+			// Restarts at the time frame would have had at the old rate
+			void			Rebase(uint32 frame);
+
+			bigtime_t		TimeFor(uint32 frame) const;
+			// Rounded, only for timeouts
+			bigtime_t		FramePeriod() const;
+
+private:
+	static	uint32			_GreatestCommonDivisor(uint32 a, uint32 b);
+
+			uint32			fNumerator;
+			uint32			fDenominator;
+			bigtime_t		fBaseTime;
+			uint32			fBaseFrame;
+};
+
+
+inline
+FrameClock::FrameClock()
+	: fNumerator(0)
+	, fDenominator(1)
+	, fBaseTime(0)
+	, fBaseFrame(0)
+{
+}
+
+
+inline void
+FrameClock::SetRate(float fieldRate)
+{
+	if (!(fieldRate > 0.0f) || fieldRate > 1000000.0f) {
+		SetRate(0, 1);
+		return;
+	}
+
+	// Whole rates and the NTSC ones at 1000/1001 of them
+	double whole = floor(fieldRate + 0.5);
+	if (fabs(fieldRate - whole) < 0.0005 * whole) {
+		SetRate((uint32)whole, 1);
+		return;
+	}
+
+	double ntsc = floor(fieldRate * 1.001 + 0.5);
+	if (fabs(fieldRate * 1.001 - ntsc) < 0.0005 * ntsc) {
+		SetRate((uint32)ntsc * 1000, 1001);
+		return;
+	}
+
+	SetRate((uint32)floor(fieldRate * 1000.0 + 0.5), 1000);
+}
+
+
+inline void
+FrameClock::SetRate(uint32 numerator, uint32 denominator)
+{
+	if (numerator == 0 || denominator == 0) {
+		fNumerator = 0;
+		fDenominator = 1;
+		return;
+	}
+
+	uint32 divisor = _GreatestCommonDivisor(numerator, denominator);
+	fNumerator = numerator / divisor;
+	fDenominator = denominator / divisor;
+}
+
+
+inline void
+FrameClock::SetBase(bigtime_t time, uint32 frame)
+{
+	fBaseTime = time;
+	fBaseFrame = frame;
+}
+
+
+inline void
+FrameClock::Rebase(uint32 frame)
+{
+	SetBase(TimeFor(frame), frame);
+}
+
+
+inline bigtime_t
+FrameClock::TimeFor(uint32 frame) const
+{
+	if (fNumerator == 0)
+		return fBaseTime;
+
+	// frames * 1000000 * den / num as long division, no product gets
+	// near overflowing for any rate or however long it runs
+	int64 frames = (int64)frame - fBaseFrame;
+	bool negative = frames < 0;
+	if (negative)
+		frames = -frames;
+
+	uint64 rest = (uint64)(frames % fNumerator) * fDenominator;
+	int64 offset = frames / fNumerator * 1000000LL * fDenominator
+		+ (int64)(rest / fNumerator) * 1000000LL
+		+ (int64)(((rest % fNumerator) * 1000000 + fNumerator / 2)
+			/ fNumerator);
+
+	return negative ? fBaseTime - offset : fBaseTime + offset;
+}
+
+
+inline bigtime_t
+FrameClock::FramePeriod() const
+{
+	if (fNumerator == 0)
+		return 0;
+
+	return (1000000LL * fDenominator + fNumerator / 2) / fNumerator;
+}
+
+
+inline uint32
+FrameClock::_GreatestCommonDivisor(uint32 a, uint32 b)
+{
+	while (b != 0) {
+		uint32 rest = a % b;
+		a = b;
+		b = rest;
+	}
+	return a;
+}
+
+#endif // _VIDEO_FRAME_CLOCK_H
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _VIDEO_TRIPLE_BUFFER_H
+#define _VIDEO_TRIPLE_BUFFER_H
+
+#include <stdlib.h>
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+// Latest frame mailbox between one writer and one reader thread.
+// The writer fills WriteBuffer() and calls Publish(), the reader gets the
+// newest published frame from ReadBuffer(). Each side owns one of the
+// three buffers and the third is swapped atomically, so neither side ever
+// waits and a frame is never read while it is being written.
+class TripleBuffer {
+public:
+							TripleBuffer();
+							~TripleBuffer();
+
+			// Neither side may use the buffers while these run
+			status_t		SetSize(size_t size);
+			void			Free();
+
+			size_t			Size() const { return fSize; }
+
+			// Writer side
+			uint8*			WriteBuffer() const;
+			void			Publish();
+
+			// Reader side, the buffer stays valid until the next call.
+			// Without a new frame the previous one is returned again,
+			// NULL until the first frame was published.
+			const uint8*	ReadBuffer(bool* fresh = NULL);
+
+private:
+	enum {
+		kIndexMask	= 0x3,
+		kFresh		= 0x4
+	};
+
+			uint8*			fMemory;
+			size_t			fSize;
+
+			// index of the buffer in between, plus kFresh while it holds
+			// a frame the reader hasn't taken yet
+			int32			fShared;
+			int32			fWriteIndex;
+			int32			fReadIndex;
+			// only used by the reader
+			bool			fHasFrame;
+};
+
+
+inline
+TripleBuffer::TripleBuffer()
+	: fMemory(NULL)
+	, fSize(0)
+	, fShared(1)
+	, fWriteIndex(0)
+	, fReadIndex(2)
+	, fHasFrame(false)
+{
+}
+
+
+inline
+TripleBuffer::~TripleBuffer()
+{
+	Free();
+}
+
+
+inline status_t
+TripleBuffer::SetSize(size_t size)
+{
+	Free();
+	if (size == 0)
+		return B_OK;
+
+	fMemory = (uint8*)calloc(3, size);
+	if (fMemory == NULL)
+		return B_NO_MEMORY;
+
+	fSize = size;
+	return B_OK;
+}
+
+
+inline void
+TripleBuffer::Free()
+{
+	free(fMemory);
+	fMemory = NULL;
+	fSize = 0;
+	fShared = 1;
+	fWriteIndex = 0;
+	fReadIndex = 2;
+	fHasFrame = false;
+}
+
+
+inline uint8*
+TripleBuffer::WriteBuffer() const
+{
+	return fMemory != NULL ? fMemory + fWriteIndex * fSize : NULL;
+}
+
+
+inline void
+TripleBuffer::Publish()
+{
+	int32 previous = atomic_get_and_set(&fShared, fWriteIndex | kFresh);
+	fWriteIndex = previous & kIndexMask;
+}
+
+
+inline const uint8*
+TripleBuffer::ReadBuffer(bool* fresh)
+{
+	// Only the reader clears kFresh, it can't go away before the swap
+	bool isFresh = (atomic_get(&fShared) & kFresh) != 0;
+	if (isFresh) {
+		int32 previous = atomic_get_and_set(&fShared, fReadIndex);
+		fReadIndex = previous & kIndexMask;
+		fHasFrame = true;
+	}
+
+	if (fresh != NULL)
+		*fresh = isFresh;
+
+	return fMemory != NULL && fHasFrame ? fMemory + fReadIndex * fSize : NULL;
+}
+
+#endif // _VIDEO_TRIPLE_BUFFER_H
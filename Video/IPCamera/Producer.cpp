@@ -50,7 +50,6 @@ VideoProducer::VideoProducer(
 	,fBrightness(0)
 	,fContrast(0)
 	,fSaturation(0)
-	,pFrameRGB(NULL)
 {
 	fOutput.destination = media_destination::null;
 	LoadAddonSettings();
@@ -344,15 +343,10 @@ VideoProducer::Connect(status_t error, const media_source &source,
 	fOutput.destination = destination;
 	strcpy(io_name, fOutput.name);
 
-	if (fOutput.format.u.raw_video.field_rate != 0.0f) {
-		fPerformanceTimeBase = fPerformanceTimeBase +
-				(bigtime_t)
-					((fFrame - fFrameBase) *
-					(1000000 / fOutput.format.u.raw_video.field_rate));
-		fFrameBase = fFrame;
-	}
+	fFrameClock.Rebase(fFrame);
 	
 	fConnectedFormat = format.u.raw_video;
+	fFrameClock.SetRate(fConnectedFormat.field_rate);
 
 	bigtime_t latency = 0;
 	media_node_id tsID = 0;
@@ -565,13 +559,17 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 		return;
 
 	fFrame = 0;
-	fFrameBase = 0;
-	fPerformanceTimeBase = performance_time;
+	fFrameClock.SetBase(performance_time, 0);
 
 	fFrameSync = create_sem(0, "frame synchronization");
 	if (fFrameSync < B_OK)
 		goto err1;
 
+	// One row and pixel more, sws_scale writes that far
+	if (fFrameBuffers.SetSize(((size_t)fConnectedFormat.display.line_width
+			* (fConnectedFormat.display.line_count + 1) + 1) * 4) != B_OK)
+		goto err2;
+
 	fStreamConnected = false;
 	if (!StreamReaderControl(S_START))
 		goto err2;
@@ -598,17 +596,14 @@ VideoProducer::HandleStop(void)
 	if (!fRunning)
 		return;
 
+	// Both threads use fFrameBuffers, they have to be gone first
 	delete_sem(fFrameSync);
-	if (fStreamConnected) {
-		status_t retval;
-		fStreamReaderQuitRequested = true;
-		wait_for_thread(fFrameGeneratorThread, &retval);
-	} else {
-		kill_thread(fFFMEGReaderThread);
-	}
+	status_t retval;
+	wait_for_thread(fFrameGeneratorThread, &retval);
 	fFrameGeneratorThread = -1;
 
 	StreamReaderControl(S_STOP);
+	fFrameBuffers.Free();
 
 	fRunning = false;
 }
@@ -616,16 +611,14 @@ VideoProducer::HandleStop(void)
 void
 VideoProducer::HandleTimeWarp(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
 void
 VideoProducer::HandleSeek(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
@@ -713,9 +706,8 @@ VideoProducer::FrameGenerator()
 
 		fFrame++;
 
-		wait_until = TimeSource()->RealTimeFor(fPerformanceTimeBase +
-			(bigtime_t)((fFrame - fFrameBase) *
-			(1000000 / fConnectedFormat.field_rate)), 0) - fProcessingLatency;
+		wait_until = TimeSource()->RealTimeFor(fFrameClock.TimeFor(fFrame), 0)
+			- fProcessingLatency;
 
 		if (wait_until < system_time())
 			continue;
@@ -739,9 +731,7 @@ VideoProducer::FrameGenerator()
 		h->time_source = TimeSource()->ID();
 		h->size_used = 4 * fConnectedFormat.display.line_width *
 			fConnectedFormat.display.line_count;
-		h->start_time = fPerformanceTimeBase +
-			(bigtime_t)((fFrame - fFrameBase) *
-			(1000000 / fConnectedFormat.field_rate));
+		h->start_time = fFrameClock.TimeFor(fFrame);
 		h->file_pos = 0;
 		h->orig_size = 0;
 		h->data_offset = 0;
@@ -756,22 +746,13 @@ VideoProducer::FrameGenerator()
 			uint32 bufferWidth = fConnectedFormat.display.line_width;
 			uint32 bufferHeight = fConnectedFormat.display.line_count;
 
-			if (fKeepAspect) {
+			// The stream reader already letterboxed it for fKeepAspect
+			const uint8* frameBuffer = fFrameBuffers.ReadBuffer();
+			if (frameBuffer != NULL) {
+				memcpy((unsigned char*)buffer->Data(), frameBuffer,
+					bufferWidth * bufferHeight * sizeof(uint32));
+			} else
 				memset((unsigned char*)buffer->Data(), 0, buffer->Size());
-				BPoint framePos(0, 0);
-				if (pFrameRGBFixed->width == bufferWidth)
-					framePos.Set(0, (bufferHeight - pFrameRGBFixed->height) /2);
-				if (pFrameRGBFixed->height == bufferHeight)
-					framePos.Set((bufferWidth - pFrameRGBFixed->width) /2, 0);
-				BPrivate::ConvertBits(pFrameRGBFixed->data[0], buffer->Data(),
-					pFrameRGBFixed->width * pFrameRGBFixed->height * sizeof(uint32), buffer->Size(),
-					pFrameRGBFixed->width * sizeof(uint32), bufferWidth * sizeof(uint32),
-					B_RGBA32, B_RGB32, BPoint(0, 0), framePos,
-					pFrameRGBFixed->width, pFrameRGBFixed->height);
-			} else {
-				memcpy((unsigned char*)buffer->Data(),
-					(unsigned char*)pFrameRGB->data[0], buffer->Size());
-			}
 			if (fFlipHorizontal) {
 				uint32 *ptr = (uint32*)buffer->Data();
 				for(int y = 0; y < bufferHeight; y++, ptr += bufferWidth)
@@ -835,8 +816,6 @@ VideoProducer::StreamReader()
 	AVCodec *pCodec;
 	AVFrame	*pFrame;
 	AVPacket *packet;
-	uint8_t *out_buffer;
-	uint8_t *out_buffer_fixed;
 	int	videoindex;
 	int ret, got_picture;
 	SwsContext *img_convert_ctx;
@@ -879,13 +858,9 @@ VideoProducer::StreamReader()
 	double delay = 1000000 / (num / den);
 
 	pFrame = av_frame_alloc();
-	pFrameRGB = av_frame_alloc();
-	pFrameRGBFixed = av_frame_alloc();
 
-	out_buffer = (uint8_t *)av_malloc(avpicture_get_size(AV_PIX_FMT_BGR0,
-		fConnectedFormat.display.line_width, (int)fConnectedFormat.display.line_count));
-	avpicture_fill((AVPicture *)pFrameRGB, out_buffer, AV_PIX_FMT_BGR0,
-		fConnectedFormat.display.line_width, (int)fConnectedFormat.display.line_count);
+	int bufferWidth = fConnectedFormat.display.line_width;
+	int bufferHeight = fConnectedFormat.display.line_count;
 
 	double dx = (double)fConnectedFormat.display.line_width / (double)pCodecCtx->width;
 	double dy = (double)fConnectedFormat.display.line_count / (double)pCodecCtx->height;
@@ -898,12 +873,13 @@ VideoProducer::StreamReader()
 		fixedHeight = fConnectedFormat.display.line_count;
 	}
 
-	pFrameRGBFixed->width = (int)fixedWidth;
-	pFrameRGBFixed->height = (int)fixedHeight;
-	out_buffer_fixed = (uint8_t *)av_malloc(avpicture_get_size(AV_PIX_FMT_BGR0,
-		(int)fixedWidth, (int)fixedHeight));
-	avpicture_fill((AVPicture *)pFrameRGBFixed, out_buffer_fixed, AV_PIX_FMT_BGR0,
-		(int)fixedWidth, (int)fixedHeight);
+	// Where the letterboxed picture goes in the frame
+	int fixedX = 0;
+	int fixedY = 0;
+	if ((int)fixedWidth == bufferWidth)
+		fixedY = (bufferHeight - (int)fixedHeight) / 2;
+	if ((int)fixedHeight == bufferHeight)
+		fixedX = (bufferWidth - (int)fixedWidth) / 2;
 
 	packet = (AVPacket *)av_malloc(sizeof(AVPacket));
 
@@ -936,16 +912,18 @@ VideoProducer::StreamReader()
 			sws_setColorspaceDetails(imgConvertCtx, inv_table, srcRange, table,
 				dstRange, brightness, contrast, saturation);
 
-			if (got_picture) {
-				if (imgConvertCtx == img_convert_ctx) {
-					sws_scale(imgConvertCtx, (const uint8_t* const*)pFrame->data,
-						pFrame->linesize, 0, pCodecCtx->height,
-						pFrameRGB->data, pFrameRGB->linesize);
-				} else {
-					sws_scale(imgConvertCtx, (const uint8_t* const*)pFrame->data,
-						pFrame->linesize, 0, pCodecCtx->height,
-						pFrameRGBFixed->data, pFrameRGBFixed->linesize);
+			uint8_t *frameBuffer = fFrameBuffers.WriteBuffer();
+			if (got_picture && frameBuffer != NULL) {
+				uint8_t *planes[4] = { frameBuffer, NULL, NULL, NULL };
+				int strides[4] = { bufferWidth * 4, 0, 0, 0 };
+				if (imgConvertCtx == img_convert_ctx_fixed) {
+					memset(frameBuffer, 0, fFrameBuffers.Size());
+					planes[0] += (fixedY * bufferWidth + fixedX) * 4;
 				}
+				sws_scale(imgConvertCtx, (const uint8_t* const*)pFrame->data,
+					pFrame->linesize, 0, pCodecCtx->height,
+					planes, strides);
+				fFrameBuffers.Publish();
 				fStreamConnected = true;
 				//snooze(delay);
 			}
@@ -958,8 +936,6 @@ VideoProducer::StreamReader()
 	sws_freeContext(img_convert_ctx);
 	sws_freeContext(img_convert_ctx_fixed);
 
-	av_frame_free(&pFrameRGBFixed);
-	av_frame_free(&pFrameRGB);
 	av_frame_free(&pFrame);
 	avcodec_close(pCodecCtx);
 	avformat_close_input(&pFormatCtx);
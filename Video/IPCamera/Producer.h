@@ -22,6 +22,9 @@
 #include <support/Locker.h>
 #include <private/interface/ColorConversion.h>
 
+#include "FrameClock.h"
+#include "TripleBuffer.h"
+
 extern "C"
 {
 	#include "libavcodec/avcodec.h"
@@ -124,8 +127,7 @@ private:
 	BBufferGroup		*fBufferGroup;
 
 	uint32				fFrame;
-	uint32				fFrameBase;
-	bigtime_t			fPerformanceTimeBase;
+	FrameClock			fFrameClock;
 	bigtime_t			fProcessingLatency;
 	media_output		fOutput;
 	media_raw_video_format	fConnectedFormat;
@@ -196,8 +198,9 @@ private:
 	bigtime_t			fLastSaturationChange;
 
 /* ffmeg */
-	AVFrame				*pFrameRGB;
-	AVFrame				*pFrameRGBFixed;
+	// converted frames, written by the stream reader and read by
+	// FrameGenerator without either waiting for the other
+	TripleBuffer		fFrameBuffers;
 	bool				fStreamConnected;
 };
 
@@ -51,7 +51,6 @@ VideoProducer::VideoProducer(
 	,fSaturation(0)
 	,fCameraIcon(NULL)
 	,fLEDIcon(NULL)
-	,pFrameRGB(NULL)
 {
 	fOutput.destination = media_destination::null;
 	LoadAddonSettings();
@@ -339,15 +338,10 @@ VideoProducer::Connect(status_t error, const media_source &source,
 	fOutput.destination = destination;
 	strcpy(io_name, fOutput.name);
 
-	if (fOutput.format.u.raw_video.field_rate != 0.0f) {
-		fPerformanceTimeBase = fPerformanceTimeBase +
-				(bigtime_t)
-					((fFrame - fFrameBase) *
-					(1000000 / fOutput.format.u.raw_video.field_rate));
-		fFrameBase = fFrame;
-	}
+	fFrameClock.Rebase(fFrame);
 	
 	fConnectedFormat = format.u.raw_video;
+	fFrameClock.SetRate(fConnectedFormat.field_rate);
 
 	bigtime_t latency = 0;
 	media_node_id tsID = 0;
@@ -547,13 +541,17 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 		return;
 
 	fFrame = 0;
-	fFrameBase = 0;
-	fPerformanceTimeBase = performance_time;
+	fFrameClock.SetBase(performance_time, 0);
 
 	fFrameSync = create_sem(0, "frame synchronization");
 	if (fFrameSync < B_OK)
 		goto err1;
 
+	// One row and pixel more, sws_scale writes that far
+	if (fFrameBuffers.SetSize(((size_t)fConnectedFormat.display.line_width
+			* (fConnectedFormat.display.line_count + 1) + 1) * 4) != B_OK)
+		goto err2;
+
 	fStreamConnected = false;
 	if (!StreamReaderControl(S_START))
 		goto err2;
@@ -580,19 +578,15 @@ VideoProducer::HandleStop(void)
 	if (!fRunning)
 		return;
 
+	// Both threads use fFrameBuffers, they have to be gone first
 	delete_sem(fFrameSync);
 
-	if (fStreamConnected) {
-		status_t retval;
-		fStreamReaderQuitRequested = true;
-		wait_for_thread(fFrameGeneratorThread, &retval);
-	} else {
-		kill_thread(fFFMEGReaderThread);
-	}
-
+	status_t retval;
+	wait_for_thread(fFrameGeneratorThread, &retval);
 	fFrameGeneratorThread = -1;
 
 	StreamReaderControl(S_STOP);
+	fFrameBuffers.Free();
 
 	fRunning = false;
 }
@@ -600,16 +594,14 @@ VideoProducer::HandleStop(void)
 void
 VideoProducer::HandleTimeWarp(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
 void
 VideoProducer::HandleSeek(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
@@ -694,9 +686,8 @@ VideoProducer::FrameGenerator()
 
 		fFrame++;
 
-		wait_until = TimeSource()->RealTimeFor(fPerformanceTimeBase +
-			(bigtime_t)((fFrame - fFrameBase) *
-			(1000000 / fConnectedFormat.field_rate)), 0) - fProcessingLatency;
+		wait_until = TimeSource()->RealTimeFor(fFrameClock.TimeFor(fFrame), 0)
+			- fProcessingLatency;
 
 		if (wait_until < system_time())
 			continue;
@@ -723,9 +714,7 @@ VideoProducer::FrameGenerator()
 		h->type = B_MEDIA_RAW_VIDEO;
 		h->time_source = TimeSource()->ID();
 		h->size_used = bufferSize;
-		h->start_time = fPerformanceTimeBase +
-			(bigtime_t)((fFrame - fFrameBase) *
-			(1000000 / fConnectedFormat.field_rate));
+		h->start_time = fFrameClock.TimeFor(fFrame);
 		h->file_pos = 0;
 		h->orig_size = 0;
 		h->data_offset = 0;
@@ -737,8 +726,11 @@ VideoProducer::FrameGenerator()
 		h->u.raw_video.line_count = bufferHeight;
 
 		if (fStreamConnected) {
-			memcpy((unsigned char*)buffer->Data(),
-				(unsigned char*)pFrameRGB->data[0], bufferSize);
+			const uint8* frameBuffer = fFrameBuffers.ReadBuffer();
+			if (frameBuffer != NULL)
+				memcpy((unsigned char*)buffer->Data(), frameBuffer, bufferSize);
+			else
+				memset((unsigned char*)buffer->Data(), 0, bufferSize);
 
 			if (fFlipHorizontal) {
 				uint32 *ptr = (uint32*)buffer->Data();
@@ -862,7 +854,6 @@ VideoProducer::StreamReader()
 	AVCodec *pCodec;
 	AVFrame	*pFrame;
 	AVPacket *packet;
-	uint8_t *out_buffer;
 	int	videoindex;
 	int ret, got_picture;
 	SwsContext *img_convert_ctx;
@@ -900,12 +891,6 @@ VideoProducer::StreamReader()
 		return -1;
 
 	pFrame = av_frame_alloc();
-	pFrameRGB = av_frame_alloc();
-
-	out_buffer = (uint8_t *)av_malloc(avpicture_get_size(AV_PIX_FMT_BGR0,
-		fConnectedFormat.display.line_width, (int)fConnectedFormat.display.line_count));
-	avpicture_fill((AVPicture *)pFrameRGB, out_buffer, AV_PIX_FMT_BGR0,
-		fConnectedFormat.display.line_width, (int)fConnectedFormat.display.line_count);
 
 	packet = (AVPacket *)av_malloc(sizeof(AVPacket));
 
@@ -932,10 +917,15 @@ VideoProducer::StreamReader()
 			sws_setColorspaceDetails(img_convert_ctx, inv_table, srcRange, table,
 				dstRange, brightness, contrast, saturation);
 
-			if (got_picture) {
+			uint8_t *frameBuffer = fFrameBuffers.WriteBuffer();
+			if (got_picture && frameBuffer != NULL) {
+				uint8_t *planes[4] = { frameBuffer, NULL, NULL, NULL };
+				int strides[4] = {
+					(int)fConnectedFormat.display.line_width * 4, 0, 0, 0 };
 				sws_scale(img_convert_ctx, (const uint8_t* const*)pFrame->data,
 					pFrame->linesize, 0, pCodecCtx->height,
-					pFrameRGB->data, pFrameRGB->linesize);
+					planes, strides);
+				fFrameBuffers.Publish();
 				fStreamConnected = true;
 			}
 		}
@@ -946,7 +936,6 @@ VideoProducer::StreamReader()
 
 	sws_freeContext(img_convert_ctx);
 
-	av_frame_free(&pFrameRGB);
 	av_frame_free(&pFrame);
 	avcodec_close(pCodecCtx);
 	avformat_close_input(&pFormatCtx);
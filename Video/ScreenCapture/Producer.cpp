@@ -318,15 +318,10 @@ VideoProducer::Connect(status_t error, const media_source &source,
 	fOutput.destination = destination;
 	strcpy(io_name, fOutput.name);
 
-	if (fOutput.format.u.raw_video.field_rate != 0.0f) {
-		fPerformanceTimeBase = fPerformanceTimeBase +
-				(bigtime_t)
-					((fFrame - fFrameBase) *
-					(1000000 / fOutput.format.u.raw_video.field_rate));
-		fFrameBase = fFrame;
-	}
+	fFrameClock.Rebase(fFrame);
 	
 	fConnectedFormat = format.u.raw_video;
+	fFrameClock.SetRate(fConnectedFormat.field_rate);
 
 	/* get the latency */
 	bigtime_t latency = 0;
@@ -487,8 +482,7 @@ VideoProducer::HandleStart(bigtime_t performance_time)
 	}
 
 	fFrame = 0;
-	fFrameBase = 0;
-	fPerformanceTimeBase = performance_time;
+	fFrameClock.SetBase(performance_time, 0);
 
 	fFrameSync = create_sem(0, "frame synchronization");
 	if (fFrameSync < B_OK)
@@ -526,16 +520,14 @@ VideoProducer::HandleStop(void)
 void
 VideoProducer::HandleTimeWarp(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
 void
 VideoProducer::HandleSeek(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fFrameClock.SetBase(performance_time, fFrame);
 	release_sem(fFrameSync);
 }
 
@@ -555,9 +547,8 @@ VideoProducer::FrameGenerator()
 
 		fFrame++;
 
-		wait_until = TimeSource()->RealTimeFor(fPerformanceTimeBase +
-				(bigtime_t)((fFrame - fFrameBase) *
-				(1000000 / fConnectedFormat.field_rate)), 0) - fProcessingLatency;
+		wait_until = TimeSource()->RealTimeFor(fFrameClock.TimeFor(fFrame), 0)
+			- fProcessingLatency;
 
 		if (wait_until < system_time())
 			continue;
@@ -582,9 +573,7 @@ VideoProducer::FrameGenerator()
 		h->time_source = TimeSource()->ID();
 		h->size_used = 4 * fConnectedFormat.display.line_width *
 			fConnectedFormat.display.line_count;
-		h->start_time = fPerformanceTimeBase +
-			(bigtime_t)((fFrame - fFrameBase) *
-			(1000000 / fConnectedFormat.field_rate));
+		h->start_time = fFrameClock.TimeFor(fFrame);
 		h->file_pos = 0;
 		h->orig_size = 0;
 		h->data_offset = 0;
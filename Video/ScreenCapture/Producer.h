@@ -20,6 +20,7 @@
 #include <StorageKit.h>
 #include <support/Locker.h>
 
+#include "FrameClock.h"
 #include "ScreenCapture.h"
 
 class VideoProducer :
@@ -118,8 +119,7 @@ private:
 	BBufferGroup		*fBufferGroup;
 
 	uint32				fFrame;
-	uint32				fFrameBase;
-	bigtime_t			fPerformanceTimeBase;
+	FrameClock			fFrameClock;
 	bigtime_t			fProcessingLatency;
 	media_output		fOutput;
 	media_raw_video_format	fConnectedFormat;
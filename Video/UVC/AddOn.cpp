@@ -9,102 +9,85 @@
 #include <unistd.h>
 
 #include <Autolock.h>
+#include <Directory.h>
+#include <Entry.h>
+#include <FindDirectory.h>
 #include <MediaFormats.h>
+#include <Path.h>
+#include <String.h>
 #include <media/MediaNode.h>
 
 #include "AddOn.h"
+#include "DecodePool.h"
 #include "Producer.h"
 
+// Only used without libusb hotplug support
+#define RESCAN_INTERVAL 2000000LL
+
 MediaAddOn::MediaAddOn(image_id imid)
 	: BMediaAddOn(imid)
 	, fContext(NULL)
-	, fDeviceList(NULL)
-	, fDeviceCount(0)
-	, fFlavorInfos(NULL)
-	, fMediaFormats(NULL)
+	, fDecodePool(NULL)
+	, fLock("uvc flavors")
+	, fNextFlavorID(0)
+	, fHotplug(false)
+	, fRescanSem(-1)
+	, fWatcherThread(-1)
 {
 	fInitStatus = uvc_init(&fContext, NULL);
-	if (fInitStatus < B_OK)
-		return;
-	
-	uvc_device_t **list;
-	fInitStatus = uvc_get_device_list(fContext, &list);
 	if (fInitStatus < B_OK) {
-		uvc_exit(fContext);
 		fContext = NULL;
 		return;
 	}
 
-	uvc_device_t *device;
-	int i = 0;
-	while ((device = list[i++]) != NULL) {
-		fDeviceCount++;
-	}
+	// Sized to the CPUs, however many cameras stream at once
+	fDecodePool = new DecodePool();
 
-	if (fDeviceCount == 0) {
-		uvc_free_device_list(list, 1);
-		uvc_exit(fContext);
-		fContext = NULL;
-		fInitStatus = B_ERROR;
-		return;
-	}
-
-	fFlavorInfos = new flavor_info[fDeviceCount];
-	fMediaFormats = new media_format[fDeviceCount];
-	fDeviceList = new uvc_device_t*[fDeviceCount];
+	// Only lists the devices, the media server would wait for their string
+	// descriptors. The watcher thread reads them and announces the names.
+	Rescan();
 
-	for (int32 i = 0; i < fDeviceCount; i++) {
-		uvc_device_t *device = list[i];
-		fDeviceList[i] = device;
+	// Recordings can be replayed without any camera attached
+	FindRecordings();
+	for (int32 i = 0; i < fReplayPaths.CountStrings(); i++)
+		fFlavors.AddItem(NewFlavor(NULL, fReplayPaths.StringAt(i).String()));
 
-		uvc_device_descriptor_t *desc = NULL;
-		uvc_get_device_descriptor(device, &desc);
-	
-		fFlavorInfos[i].name = strdup(desc ? desc->product : "UVC Camera");
-		fFlavorInfos[i].info = strdup(desc ? desc->manufacturer : "Unknown manufacturer");
-		fFlavorInfos[i].kinds = B_BUFFER_PRODUCER | B_CONTROLLABLE | B_PHYSICAL_INPUT;
-		fFlavorInfos[i].flavor_flags = 0;
-		fFlavorInfos[i].internal_id = i;
-		fFlavorInfos[i].possible_count = 1;
-		fFlavorInfos[i].in_format_count = 0;
-		fFlavorInfos[i].in_formats = NULL;
-		fFlavorInfos[i].out_format_count = 1;
-		fFlavorInfos[i].out_format_flags = 0;
+	fRescanSem = create_sem(0, "uvc rescan");
+	if (fRescanSem < B_OK)
+		return;
 
-		fMediaFormats[i].type = B_MEDIA_RAW_VIDEO;
-		fMediaFormats[i].u.raw_video = media_raw_video_format::wildcard;
-		fMediaFormats[i].u.raw_video.display.format = B_RGB32;
-		fFlavorInfos[i].out_formats = &fMediaFormats[i];
+	fHotplug = uvc_set_hotplug_callback(fContext, _hotplug_callback, this)
+		== UVC_SUCCESS;
 
-		if (desc)
-			uvc_free_device_descriptor(desc);
-	}
-
-	uvc_free_device_list(list, 0);
+	fWatcherThread = spawn_thread(_device_watcher, "uvc device watcher",
+		B_LOW_PRIORITY, this);
+	if (fWatcherThread >= B_OK)
+		resume_thread(fWatcherThread);
 }
 
 MediaAddOn::~MediaAddOn()
 {
-	if (fFlavorInfos) {
-		for (int32 i = 0; i < fDeviceCount; i++) {
-			free((void*)fFlavorInfos[i].name);
-			free((void*)fFlavorInfos[i].info);
-		}
-		delete[] fFlavorInfos;
-	}
+	if (fContext)
+		uvc_set_hotplug_callback(fContext, NULL, NULL);
 
-	if (fMediaFormats)
-		delete[] fMediaFormats;
+	if (fRescanSem >= B_OK)
+		delete_sem(fRescanSem);
 
-	if (fDeviceList) {
-		for (int32 i = 0; i < fDeviceCount; i++) {
-			uvc_unref_device(fDeviceList[i]);
-		}
-		delete[] fDeviceList;
+	if (fWatcherThread >= B_OK) {
+		status_t result;
+		wait_for_thread(fWatcherThread, &result);
 	}
 
+	while (!fFlavors.IsEmpty())
+		DeleteFlavor((Flavor*)fFlavors.RemoveItem((int32)0));
+
+	while (!fRemovedFlavors.IsEmpty())
+		DeleteFlavor((Flavor*)fRemovedFlavors.RemoveItem((int32)0));
+
 	if (fContext)
 		uvc_exit(fContext);
+
+	delete fDecodePool;
 }
 
 status_t
@@ -121,16 +104,20 @@ MediaAddOn::InitCheck(const char **out_failure_text)
 int32
 MediaAddOn::CountFlavors()
 {
-	return fDeviceCount;
+	BAutolock _(fLock);
+	return fFlavors.CountItems();
 }
 
 status_t
 MediaAddOn::GetFlavorAt(int32 n, const flavor_info **out_info)
 {
-	if (n < 0 || n >= fDeviceCount)
+	BAutolock _(fLock);
+
+	Flavor* flavor = (Flavor*)fFlavors.ItemAt(n);
+	if (flavor == NULL)
 		return B_BAD_INDEX;
 
-	*out_info = &fFlavorInfos[n];
+	*out_info = &flavor->info;
 	return B_OK;
 }
 
@@ -138,15 +125,35 @@ BMediaNode *
 MediaAddOn::InstantiateNodeFor(
         const flavor_info *info, BMessage *config, status_t *out_error)
 {
-	if (info->internal_id < 0 || info->internal_id >= fDeviceCount) {
+	BAutolock _(fLock);
+
+	// The camera may have been unplugged since the flavor was listed
+	Flavor* flavor = NULL;
+	for (int32 i = 0; i < fFlavors.CountItems(); i++) {
+		Flavor* item = (Flavor*)fFlavors.ItemAt(i);
+		if (item->info.internal_id == info->internal_id) {
+			flavor = item;
+			break;
+		}
+	}
+
+	if (flavor == NULL) {
 		*out_error = B_BAD_INDEX;
 		return NULL;
 	}
 
-	UVCProducer *node = new UVCProducer(this, 
-			fFlavorInfos[info->internal_id].name,
-			info->internal_id,
-			fDeviceList[info->internal_id]);
+	DescribeFlavor(flavor);
+
+	// Opening the device takes its own reference
+	UVCProducer *node;
+	if (flavor->device != NULL) {
+		node = new UVCProducer(this, flavor->info.name,
+			flavor->info.internal_id, flavor->device, fDecodePool);
+	} else {
+		node = new UVCProducer(this, flavor->info.name,
+			flavor->info.internal_id, NULL, fDecodePool,
+			flavor->replayPath.String());
+	}
 
 	if (node && (node->InitCheck() < B_OK)) {
 		delete node;
@@ -156,6 +163,288 @@ MediaAddOn::InstantiateNodeFor(
 	return node;
 }
 
+MediaAddOn::Flavor*
+MediaAddOn::NewFlavor(uvc_device_t* device, const char* replayPath)
+{
+	Flavor* flavor = new Flavor;
+	flavor->device = device;
+	flavor->replayPath = replayPath;
+	flavor->described = false;
+
+	// Until the device is described, the strings are never freed as the
+	// media server may still look at them when they are replaced
+	flavor->info.name = "UVC Camera";
+	flavor->info.info = "USB video device";
+	flavor->info.kinds = B_BUFFER_PRODUCER | B_CONTROLLABLE;
+	if (device != NULL)
+		flavor->info.kinds |= B_PHYSICAL_INPUT;
+	flavor->info.flavor_flags = 0;
+	// Never reused, a node of an unplugged camera can't pick up another
+	flavor->info.internal_id = fNextFlavorID++;
+	flavor->info.possible_count = 1;
+	flavor->info.in_format_count = 0;
+	flavor->info.in_formats = NULL;
+	flavor->info.out_format_count = 2;
+	flavor->info.out_format_flags = 0;
+
+	flavor->formats[0].type = B_MEDIA_RAW_VIDEO;
+	flavor->formats[0].u.raw_video = media_raw_video_format::wildcard;
+	flavor->formats[0].u.raw_video.display.format = B_RGB32;
+	flavor->formats[1] = flavor->formats[0];
+	flavor->formats[1].u.raw_video.display.format = B_YCbCr422;
+	flavor->info.out_formats = flavor->formats;
+
+	if (device == NULL) {
+		BPath path(replayPath);
+		BString name;
+		name << path.Leaf() << " (replay)";
+		SetDescription(flavor, name, "Recorded UVC payloads");
+	}
+
+	return flavor;
+}
+
+void
+MediaAddOn::ReadDescriptor(uvc_device_t* device, BString& product,
+	BString& manufacturer)
+{
+	// Reads the string descriptors from the device, this may take a while
+	uvc_device_descriptor_t *desc = NULL;
+	uvc_get_device_descriptor(device, &desc);
+
+	product = desc && desc->product ? desc->product : "UVC Camera";
+	manufacturer = desc && desc->manufacturer ? desc->manufacturer
+		: "Unknown manufacturer";
+
+	if (desc)
+		uvc_free_device_descriptor(desc);
+}
+
+void
+MediaAddOn::SetDescription(Flavor* flavor, const BString& product,
+	const BString& info)
+{
+	// Identical cameras of a rig need names that tell them apart
+	BString name = product;
+	for (int32 n = 2; IsNameInUse(name.String(), flavor); n++) {
+		name = product;
+		name << " " << n;
+	}
+
+	flavor->info.name = strdup(name.String());
+	flavor->info.info = strdup(info.String());
+	flavor->described = true;
+}
+
+void
+MediaAddOn::DescribeFlavor(Flavor* flavor)
+{
+	if (flavor->described || flavor->device == NULL)
+		return;
+
+	BString product;
+	BString manufacturer;
+	ReadDescriptor(flavor->device, product, manufacturer);
+	SetDescription(flavor, product, manufacturer);
+}
+
+bool
+MediaAddOn::DescribeFlavors()
+{
+	bool changed = false;
+
+	while (true) {
+		// The strings are read without the lock, GetFlavorAt() must not
+		// wait for the device
+		uvc_device_t* device = NULL;
+		fLock.Lock();
+		for (int32 i = 0; i < fFlavors.CountItems() && device == NULL; i++) {
+			Flavor* flavor = (Flavor*)fFlavors.ItemAt(i);
+			if (!flavor->described)
+				device = flavor->device;
+		}
+		if (device != NULL)
+			uvc_ref_device(device);
+		fLock.Unlock();
+
+		if (device == NULL)
+			break;
+
+		BString product;
+		BString manufacturer;
+		ReadDescriptor(device, product, manufacturer);
+
+		// Unless it was unplugged or instantiated in the meantime
+		fLock.Lock();
+		for (int32 i = 0; i < fFlavors.CountItems(); i++) {
+			Flavor* flavor = (Flavor*)fFlavors.ItemAt(i);
+			if (flavor->device == device && !flavor->described) {
+				SetDescription(flavor, product, manufacturer);
+				changed = true;
+			}
+		}
+		fLock.Unlock();
+
+		uvc_unref_device(device);
+	}
+
+	return changed;
+}
+
+bool
+MediaAddOn::IsNameInUse(const char* name, const Flavor* except) const
+{
+	for (int32 i = 0; i < fFlavors.CountItems(); i++) {
+		Flavor* flavor = (Flavor*)fFlavors.ItemAt(i);
+		if (flavor != except && flavor->described
+			&& strcmp(flavor->info.name, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+void
+MediaAddOn::DeleteFlavor(Flavor* flavor)
+{
+	if (flavor->device != NULL)
+		uvc_unref_device(flavor->device);
+
+	if (flavor->described) {
+		free((void*)flavor->info.name);
+		free((void*)flavor->info.info);
+	}
+	delete flavor;
+}
+
+bool
+MediaAddOn::Rescan()
+{
+	uvc_device_t **list;
+	if (uvc_get_device_list(fContext, &list) < 0)
+		return false;
+
+	BAutolock _(fLock);
+
+	bool changed = false;
+
+	// Unplugged cameras
+	for (int32 i = fFlavors.CountItems() - 1; i >= 0; i--) {
+		Flavor* flavor = (Flavor*)fFlavors.ItemAt(i);
+		if (flavor->device == NULL)
+			continue;
+
+		bool present = false;
+		for (int32 j = 0; list[j] != NULL && !present; j++)
+			present = uvc_is_same_device(list[j], flavor->device);
+		if (present)
+			continue;
+
+		fFlavors.RemoveItem(i);
+		uvc_unref_device(flavor->device);
+		flavor->device = NULL;
+		fRemovedFlavors.AddItem(flavor);
+		changed = true;
+	}
+
+	// New cameras go after the other cameras, before the recordings
+	int32 cameraCount = 0;
+	while (cameraCount < fFlavors.CountItems()
+		&& ((Flavor*)fFlavors.ItemAt(cameraCount))->device != NULL)
+		cameraCount++;
+
+	for (int32 j = 0; list[j] != NULL; j++) {
+		bool known = false;
+		for (int32 i = 0; i < cameraCount && !known; i++) {
+			Flavor* flavor = (Flavor*)fFlavors.ItemAt(i);
+			known = uvc_is_same_device(list[j], flavor->device);
+		}
+		if (known)
+			continue;
+
+		uvc_ref_device(list[j]);
+		fFlavors.AddItem(NewFlavor(list[j], NULL), cameraCount++);
+		changed = true;
+	}
+
+	uvc_free_device_list(list, 1);
+	return changed;
+}
+
+void
+MediaAddOn::_hotplug_callback(uvc_device_t* device,
+	enum uvc_hotplug_event event, void* cookie)
+{
+	// Runs on the libusb event thread, which must not block on fLock
+	MediaAddOn* addon = (MediaAddOn*)cookie;
+	release_sem_etc(addon->fRescanSem, 1, B_DO_NOT_RESCHEDULE);
+}
+
+int32
+MediaAddOn::_device_watcher(void* data)
+{
+	return ((MediaAddOn*)data)->DeviceWatcher();
+}
+
+int32
+MediaAddOn::DeviceWatcher()
+{
+	bigtime_t timeout = fHotplug ? B_INFINITE_TIMEOUT : RESCAN_INTERVAL;
+
+	// The cameras found when the add-on was loaded
+	if (DescribeFlavors())
+		NotifyFlavorChange();
+
+	while (true) {
+		status_t status = acquire_sem_etc(fRescanSem, 1, B_RELATIVE_TIMEOUT,
+			timeout);
+		if (status == B_INTERRUPTED)
+			continue;
+		if (status != B_OK && status != B_TIMED_OUT)
+			break;
+
+		// A hub brings several devices at once, one rescan covers them all
+		int32 count;
+		if (get_sem_count(fRescanSem, &count) == B_OK && count > 0)
+			acquire_sem_etc(fRescanSem, count, B_RELATIVE_TIMEOUT, 0);
+
+		// New cameras are described before they are announced
+		bool changed = Rescan();
+		if (DescribeFlavors())
+			changed = true;
+		if (changed)
+			NotifyFlavorChange();
+	}
+
+	return B_OK;
+}
+
+void
+MediaAddOn::FindRecordings()
+{
+	// Written by the "Record USB payloads" option of the nodes
+	BPath path;
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) != B_OK)
+		return;
+	path.Append("UVCMediaAddon");
+
+	BDirectory directory(path.Path());
+	if (directory.InitCheck() != B_OK)
+		return;
+
+	BEntry entry;
+	while (directory.GetNextEntry(&entry) == B_OK) {
+		BPath file;
+		if (entry.GetPath(&file) != B_OK || !entry.IsFile())
+			continue;
+
+		BString leaf(file.Leaf());
+		if (leaf.EndsWith(".uvcrec"))
+			fReplayPaths.Add(file.Path());
+	}
+
+	fReplayPaths.Sort();
+}
+
 BMediaAddOn *
 make_media_addon(image_id id)
 {
@@ -8,8 +8,14 @@
 #define _UVC_VIDEO_ADDON_H
 
 #include <media/MediaAddOn.h>
+#include <List.h>
+#include <Locker.h>
+#include <OS.h>
+#include <String.h>
+#include <StringList.h>
 #include <libuvc/libuvc.h>
 
+class DecodePool;
 class UVCProducer;
 
 extern "C" _EXPORT BMediaAddOn *make_media_addon(image_id you);
@@ -37,12 +43,53 @@ public:
 							int32 *out_internal_id, bool *out_has_more)	{ return B_ERROR; }
 
 private:
+	struct Flavor {
+		flavor_info		info;
+		media_format	formats[2];
+		// NULL for a recording
+		uvc_device_t*	device;
+		BString			replayPath;
+		// name and info are placeholders until read from the device
+		bool			described;
+	};
+
+	void				FindRecordings();
+	Flavor*				NewFlavor(uvc_device_t* device,
+							const char* replayPath);
+	static void			ReadDescriptor(uvc_device_t* device,
+							BString& product, BString& manufacturer);
+	void				SetDescription(Flavor* flavor,
+							const BString& product, const BString& info);
+	void				DescribeFlavor(Flavor* flavor);
+	bool				DescribeFlavors();
+	bool				IsNameInUse(const char* name,
+							const Flavor* except) const;
+	void				DeleteFlavor(Flavor* flavor);
+	bool				Rescan();
+
+	static void			_hotplug_callback(uvc_device_t* device,
+							enum uvc_hotplug_event event, void* cookie);
+	static int32		_device_watcher(void* data);
+	int32				DeviceWatcher();
+
 	status_t			fInitStatus;
+	// one USB event thread and one decode pool for all cameras
 	uvc_context_t*		fContext;
-	uvc_device_t**		fDeviceList;
-	int32				fDeviceCount;
-	flavor_info*		fFlavorInfos;
-	media_format*		fMediaFormats;
+	DecodePool*			fDecodePool;
+	// recorded payloads, one flavor each after the cameras
+	BStringList			fReplayPaths;
+
+	BLocker				fLock;
+	// cameras in the order they were found, then the recordings
+	BList				fFlavors;
+	// unplugged cameras, the media server may still hold their flavor_info
+	BList				fRemovedFlavors;
+	int32				fNextFlavorID;
+
+	// released on hotplug events, polls when libusb has no hotplug support
+	bool				fHotplug;
+	sem_id				fRescanSem;
+	thread_id			fWatcherThread;
 };
 
 #endif //_UVC_VIDEO_ADDON_H
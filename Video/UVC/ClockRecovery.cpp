@@ -0,0 +1,150 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdlib.h>
+
+#include "ClockRecovery.h"
+
+// Fewer samples don't give a usable drift estimate
+static const int32 kMinSamples = 8;
+
+// A sample further off the line than this means the device clock jumped,
+// e.g. after the stream was restarted, and the fit starts over
+static const bigtime_t kMaxError = 100000;
+
+ClockRecovery::ClockRecovery(int32 windowSize)
+	: fSamples(NULL)
+	, fWindowSize(windowSize < kMinSamples ? kMinSamples : windowSize)
+{
+	fSamples = new Sample[fWindowSize];
+	Reset(0);
+}
+
+ClockRecovery::~ClockRecovery()
+{
+	delete[] fSamples;
+}
+
+void
+ClockRecovery::Reset(uint32 clockFrequency)
+{
+	fCount = 0;
+	fNext = 0;
+	fClockFrequency = clockFrequency;
+	fLastTicks = 0;
+	fBaseTicks = 0;
+	fBaseTime = 0;
+	fSlope = 0;
+	fOffset = 0;
+	fFitted = false;
+}
+
+void
+ClockRecovery::AddSample(uint32 deviceTicks, bigtime_t systemTime)
+{
+	int64 ticks = _Unwrap(deviceTicks);
+
+	if (fFitted) {
+		bigtime_t expected = fBaseTime + (bigtime_t)(fOffset
+			+ fSlope * (ticks - fBaseTicks));
+		if (llabs(systemTime - expected) > kMaxError) {
+			Reset(fClockFrequency);
+			ticks = deviceTicks;
+		}
+	}
+
+	// Samples going back in time on either clock are of no use
+	if (fCount > 0) {
+		const Sample& last = fSamples[(fNext + fWindowSize - 1) % fWindowSize];
+		if (ticks <= last.ticks || systemTime <= last.time)
+			return;
+	}
+
+	fSamples[fNext].ticks = ticks;
+	fSamples[fNext].time = systemTime;
+	fNext = (fNext + 1) % fWindowSize;
+	if (fCount < fWindowSize)
+		fCount++;
+	fLastTicks = ticks;
+
+	_Fit();
+}
+
+status_t
+ClockRecovery::DeviceToSystem(uint32 deviceTicks, bigtime_t* systemTime) const
+{
+	if (!IsLocked())
+		return B_NO_INIT;
+
+	int64 ticks = _Unwrap(deviceTicks);
+	*systemTime = fBaseTime + (bigtime_t)(fOffset
+		+ fSlope * (ticks - fBaseTicks));
+	return B_OK;
+}
+
+bool
+ClockRecovery::IsLocked() const
+{
+	return fFitted && fCount >= kMinSamples;
+}
+
+float
+ClockRecovery::Drift() const
+{
+	if (!IsLocked() || fClockFrequency == 0)
+		return 0;
+
+	// fSlope is in microseconds per tick
+	return (1000000.0 / (fSlope * fClockFrequency) - 1.0) * 1000000.0;
+}
+
+int64
+ClockRecovery::_Unwrap(uint32 deviceTicks) const
+{
+	// The 32 bit counter wraps every minute or so at usual clock rates,
+	// take the value closest to the last sample
+	if (fCount == 0)
+		return deviceTicks;
+
+	return fLastTicks + (int32)(deviceTicks - (uint32)fLastTicks);
+}
+
+void
+ClockRecovery::_Fit()
+{
+	if (fCount < 2)
+		return;
+
+	// Fitted relative to the oldest sample, keeps the doubles precise
+	const Sample& first = fSamples[fCount < fWindowSize ? 0 : fNext];
+	fBaseTicks = first.ticks;
+	fBaseTime = first.time;
+
+	double meanX = 0;
+	double meanY = 0;
+	for (int32 i = 0; i < fCount; i++) {
+		meanX += fSamples[i].ticks - fBaseTicks;
+		meanY += fSamples[i].time - fBaseTime;
+	}
+	meanX /= fCount;
+	meanY /= fCount;
+
+	double sxx = 0;
+	double sxy = 0;
+	for (int32 i = 0; i < fCount; i++) {
+		double dx = fSamples[i].ticks - fBaseTicks - meanX;
+		double dy = fSamples[i].time - fBaseTime - meanY;
+		sxx += dx * dx;
+		sxy += dx * dy;
+	}
+
+	if (sxx <= 0 || sxy <= 0)
+		return;
+
+	fSlope = sxy / sxx;
+	fOffset = meanY - fSlope * meanX;
+	fFitted = true;
+}
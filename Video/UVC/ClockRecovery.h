@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_CLOCK_RECOVERY_H
+#define _UVC_CLOCK_RECOVERY_H
+
+#include <SupportDefs.h>
+
+// Maps the device clock of a UVC stream onto system_time(). Every source
+// clock reference (SCR) and the time its payload arrived make a sample,
+// a least squares line through the recent samples gives the offset and
+// the drift between the two clocks. Presentation time stamps (PTS) are
+// then converted with that line, which averages out the USB jitter.
+class ClockRecovery {
+public:
+							ClockRecovery(int32 windowSize = 64);
+							~ClockRecovery();
+
+			void			Reset(uint32 clockFrequency);
+			uint32			ClockFrequency() const
+								{ return fClockFrequency; }
+
+			void			AddSample(uint32 deviceTicks,
+								bigtime_t systemTime);
+			status_t		DeviceToSystem(uint32 deviceTicks,
+								bigtime_t* systemTime) const;
+
+			bool			IsLocked() const;
+			// Device clock speed relative to the nominal frequency,
+			// in parts per million, 0 while not locked
+			float			Drift() const;
+
+private:
+	struct Sample {
+		int64		ticks;
+		bigtime_t	time;
+	};
+
+			int64			_Unwrap(uint32 deviceTicks) const;
+			void			_Fit();
+
+			Sample*			fSamples;
+			int32			fWindowSize;
+			int32			fCount;
+			int32			fNext;
+
+			uint32			fClockFrequency;
+			int64			fLastTicks;
+
+			// time = fBaseTime + fOffset + fSlope * (ticks - fBaseTicks)
+			int64			fBaseTicks;
+			bigtime_t		fBaseTime;
+			double			fSlope;
+			double			fOffset;
+			bool			fFitted;
+};
+
+#endif // _UVC_CLOCK_RECOVERY_H
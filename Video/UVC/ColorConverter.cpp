@@ -0,0 +1,955 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <string.h>
+
+#include "ColorConverter.h"
+
+#if defined(__GNUC__) && __GNUC__ >= 5 \
+	&& (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// All SIMD paths use the fixed point coefficients of IYUYV2BGR_2:
+//   r = (22987 * v') >> 14
+//   g = (-5636 * u' - 11698 * v') >> 14
+//   b = (29049 * u') >> 14
+// with u' = u - 128, v' = v - 128. The products are computed exactly in
+// 32 bit and shifted arithmetically, so the results match the macro bit
+// for bit, including the saturation done by sat().
+
+static inline void
+yuv_pair_to_bgra(int y0, int y1, int u, int v, uint8* pbgr)
+{
+	int r = (22987 * (v - 128)) >> 14;
+	int g = (-5636 * (u - 128) - 11698 * (v - 128)) >> 14;
+	int b = (29049 * (u - 128)) >> 14;
+	pbgr[0] = sat(y0 + b);
+	pbgr[1] = sat(y0 + g);
+	pbgr[2] = sat(y0 + r);
+	pbgr[3] = 255;
+	pbgr[4] = sat(y1 + b);
+	pbgr[5] = sat(y1 + g);
+	pbgr[6] = sat(y1 + r);
+	pbgr[7] = 255;
+}
+
+
+static void
+yuyv_to_bgra_c(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const uint8* end = src + (srcBytes & ~(size_t)15);
+	while (src < end) {
+		IYUYV2BGR_8(src, dst);
+		dst += 4 * 8;
+		src += 2 * 8;
+	}
+
+	end = src + (srcBytes & 15 & ~(size_t)3);
+	while (src < end) {
+		IYUYV2BGR_2(src, dst);
+		dst += 4 * 2;
+		src += 2 * 2;
+	}
+}
+
+
+static void
+uyvy_to_bgra_c(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const uint8* end = src + (srcBytes & ~(size_t)3);
+	while (src < end) {
+		yuv_pair_to_bgra(src[1], src[3], src[0], src[2], dst);
+		dst += 4 * 2;
+		src += 2 * 2;
+	}
+}
+
+
+static void
+nv12_row_to_bgra_c(const uint8* y, const uint8* uv, uint8* dst,
+	uint32 width)
+{
+	for (uint32 x = 0; x + 1 < width; x += 2) {
+		yuv_pair_to_bgra(y[0], y[1], uv[0], uv[1], dst);
+		y += 2;
+		uv += 2;
+		dst += 8;
+	}
+}
+
+
+static void
+gray_row_to_bgra_c(const uint8* y, uint8* dst, uint32 width)
+{
+	for (uint32 x = 0; x < width; x++) {
+		dst[0] = dst[1] = dst[2] = y[x];
+		dst[3] = 255;
+		dst += 4;
+	}
+}
+
+
+static void
+swap16_row_c(const uint8* src, uint8* dst, size_t bytes)
+{
+	for (size_t i = 0; i + 1 < bytes; i += 2) {
+		uint8 first = src[i];
+		dst[i] = src[i + 1];
+		dst[i + 1] = first;
+	}
+}
+
+
+// High byte of little endian 16 bit samples, used for GRAY16 and P010
+static void
+narrow16_row_c(const uint8* src, uint8* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = src[i * 2 + 1];
+}
+
+
+static void
+nv12_row_to_ycbcr422_c(const uint8* y, const uint8* uv, uint8* dst,
+	uint32 width)
+{
+	for (uint32 x = 0; x + 1 < width; x += 2) {
+		dst[0] = y[x];
+		dst[1] = uv[x];
+		dst[2] = y[x + 1];
+		dst[3] = uv[x + 1];
+		dst += 4;
+	}
+}
+
+
+static void
+gray_row_to_ycbcr422_c(const uint8* y, uint8* dst, uint32 width)
+{
+	for (uint32 x = 0; x < width; x++) {
+		dst[0] = y[x];
+		dst[1] = 128;
+		dst += 2;
+	}
+}
+
+
+#ifdef USE_X86_SIMD
+
+// Interleaves 16 bit B, G and R of 8 pixels into BGRA. The first pixel of
+// macropixels 0..3 is in the low half of each vector, the second pixel in
+// the high half.
+static inline void
+store_bgra_sse2(uint8* dst, __m128i b, __m128i g, __m128i r)
+{
+	const __m128i alpha = _mm_set1_epi16(255);
+
+	__m128i bg = _mm_packus_epi16(b, g);
+	__m128i ra = _mm_packus_epi16(r, alpha);
+
+	bg = _mm_unpacklo_epi8(bg, _mm_srli_si128(bg, 8));
+	ra = _mm_unpacklo_epi8(ra, _mm_srli_si128(ra, 8));
+
+	__m128i first = _mm_unpacklo_epi16(bg, ra);
+	__m128i second = _mm_unpackhi_epi16(bg, ra);
+
+	_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(first, second));
+	_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi32(first, second));
+}
+
+
+template<bool uyvy>
+__attribute__((target("sse2")))
+static void
+packed422_to_bgra_sse2(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const __m128i lowByte = _mm_set1_epi32(0xff);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i coefR = _mm_set1_epi32(22987 << 16);
+	const __m128i coefG = _mm_set1_epi32(
+		(int32)(((uint32)(uint16)-11698 << 16) | (uint16)-5636));
+	const __m128i coefB = _mm_set1_epi32(29049);
+
+	size_t blocks = srcBytes / 16;
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)src);
+		if (uyvy)
+			x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+
+		__m128i y0 = _mm_and_si128(x, lowByte);
+		__m128i y1 = _mm_and_si128(_mm_srli_epi32(x, 16), lowByte);
+		__m128i u = _mm_and_si128(_mm_srli_epi32(x, 8), lowByte);
+		__m128i v = _mm_srli_epi32(x, 24);
+		__m128i uv = _mm_sub_epi16(_mm_or_si128(u, _mm_slli_epi32(v, 16)),
+			bias);
+
+		__m128i r = _mm_srai_epi32(_mm_madd_epi16(uv, coefR), 14);
+		__m128i g = _mm_srai_epi32(_mm_madd_epi16(uv, coefG), 14);
+		__m128i b = _mm_srai_epi32(_mm_madd_epi16(uv, coefB), 14);
+
+		__m128i y = _mm_packs_epi32(y0, y1);
+		store_bgra_sse2(dst,
+			_mm_add_epi16(y, _mm_packs_epi32(b, b)),
+			_mm_add_epi16(y, _mm_packs_epi32(g, g)),
+			_mm_add_epi16(y, _mm_packs_epi32(r, r)));
+
+		src += 16;
+		dst += 32;
+	}
+
+	if (uyvy)
+		uyvy_to_bgra_c(src, dst, srcBytes - blocks * 16);
+	else
+		yuyv_to_bgra_c(src, dst, srcBytes - blocks * 16);
+}
+
+
+template<bool uyvy>
+__attribute__((target("ssse3")))
+static void
+packed422_to_bgra_ssse3(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i coefR = _mm_set1_epi32(22987 << 16);
+	const __m128i coefG = _mm_set1_epi32(
+		(int32)(((uint32)(uint16)-11698 << 16) | (uint16)-5636));
+	const __m128i coefB = _mm_set1_epi32(29049);
+	// UYVY has luma and chroma bytes the other way round
+	const int o = uyvy ? 1 : 0;
+	const __m128i shuffleY = _mm_setr_epi8(0 + o, -1, 4 + o, -1, 8 + o, -1,
+		12 + o, -1, 2 + o, -1, 6 + o, -1, 10 + o, -1, 14 + o, -1);
+	const __m128i shuffleUV = _mm_setr_epi8(1 - o, -1, 3 - o, -1, 5 - o, -1,
+		7 - o, -1, 9 - o, -1, 11 - o, -1, 13 - o, -1, 15 - o, -1);
+
+	size_t blocks = srcBytes / 16;
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)src);
+
+		__m128i y = _mm_shuffle_epi8(x, shuffleY);
+		__m128i uv = _mm_sub_epi16(_mm_shuffle_epi8(x, shuffleUV), bias);
+
+		__m128i r = _mm_srai_epi32(_mm_madd_epi16(uv, coefR), 14);
+		__m128i g = _mm_srai_epi32(_mm_madd_epi16(uv, coefG), 14);
+		__m128i b = _mm_srai_epi32(_mm_madd_epi16(uv, coefB), 14);
+
+		store_bgra_sse2(dst,
+			_mm_add_epi16(y, _mm_packs_epi32(b, b)),
+			_mm_add_epi16(y, _mm_packs_epi32(g, g)),
+			_mm_add_epi16(y, _mm_packs_epi32(r, r)));
+
+		src += 16;
+		dst += 32;
+	}
+
+	if (uyvy)
+		uyvy_to_bgra_c(src, dst, srcBytes - blocks * 16);
+	else
+		yuyv_to_bgra_c(src, dst, srcBytes - blocks * 16);
+}
+
+
+template<bool uyvy>
+__attribute__((target("avx2")))
+static void
+packed422_to_bgra_avx2(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const __m256i bias = _mm256_set1_epi16(128);
+	const __m256i alpha = _mm256_set1_epi16(255);
+	const __m256i coefR = _mm256_set1_epi32(22987 << 16);
+	const __m256i coefG = _mm256_set1_epi32(
+		(int32)(((uint32)(uint16)-11698 << 16) | (uint16)-5636));
+	const __m256i coefB = _mm256_set1_epi32(29049);
+	const int o = uyvy ? 1 : 0;
+	const __m256i shuffleY = _mm256_setr_epi8(0 + o, -1, 4 + o, -1, 8 + o, -1,
+		12 + o, -1, 2 + o, -1, 6 + o, -1, 10 + o, -1, 14 + o, -1,
+		0 + o, -1, 4 + o, -1, 8 + o, -1, 12 + o, -1,
+		2 + o, -1, 6 + o, -1, 10 + o, -1, 14 + o, -1);
+	const __m256i shuffleUV = _mm256_setr_epi8(1 - o, -1, 3 - o, -1, 5 - o, -1,
+		7 - o, -1, 9 - o, -1, 11 - o, -1, 13 - o, -1, 15 - o, -1,
+		1 - o, -1, 3 - o, -1, 5 - o, -1, 7 - o, -1,
+		9 - o, -1, 11 - o, -1, 13 - o, -1, 15 - o, -1);
+
+	// Every step below works within 128 bit lanes, so each lane holds
+	// the result for its own 16 source bytes until the final permute.
+	size_t blocks = srcBytes / 32;
+	for (size_t i = 0; i < blocks; i++) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)src);
+
+		__m256i y = _mm256_shuffle_epi8(x, shuffleY);
+		__m256i uv = _mm256_sub_epi16(_mm256_shuffle_epi8(x, shuffleUV),
+			bias);
+
+		__m256i r = _mm256_srai_epi32(_mm256_madd_epi16(uv, coefR), 14);
+		__m256i g = _mm256_srai_epi32(_mm256_madd_epi16(uv, coefG), 14);
+		__m256i b = _mm256_srai_epi32(_mm256_madd_epi16(uv, coefB), 14);
+
+		b = _mm256_add_epi16(y, _mm256_packs_epi32(b, b));
+		g = _mm256_add_epi16(y, _mm256_packs_epi32(g, g));
+		r = _mm256_add_epi16(y, _mm256_packs_epi32(r, r));
+
+		__m256i bg = _mm256_packus_epi16(b, g);
+		__m256i ra = _mm256_packus_epi16(r, alpha);
+
+		bg = _mm256_unpacklo_epi8(bg, _mm256_srli_si256(bg, 8));
+		ra = _mm256_unpacklo_epi8(ra, _mm256_srli_si256(ra, 8));
+
+		__m256i first = _mm256_unpacklo_epi16(bg, ra);
+		__m256i second = _mm256_unpackhi_epi16(bg, ra);
+
+		__m256i lo = _mm256_unpacklo_epi32(first, second);
+		__m256i hi = _mm256_unpackhi_epi32(first, second);
+
+		_mm256_storeu_si256((__m256i*)dst,
+			_mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + 32),
+			_mm256_permute2x128_si256(lo, hi, 0x31));
+
+		src += 32;
+		dst += 64;
+	}
+
+	packed422_to_bgra_ssse3<uyvy>(src, dst, srcBytes - blocks * 32);
+}
+
+
+__attribute__((target("sse2")))
+static void
+nv12_row_to_bgra_sse2(const uint8* py, const uint8* puv, uint8* dst,
+	uint32 width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowWord = _mm_set1_epi32(0xffff);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i coefR = _mm_set1_epi32(22987 << 16);
+	const __m128i coefG = _mm_set1_epi32(
+		(int32)(((uint32)(uint16)-11698 << 16) | (uint16)-5636));
+	const __m128i coefB = _mm_set1_epi32(29049);
+
+	// Same layout as the YUYV kernels: 4 chroma pairs per step, the even
+	// pixels in the low half of y, the odd ones in the high half
+	uint32 blocks = width / 8;
+	for (uint32 i = 0; i < blocks; i++) {
+		__m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)py),
+			zero);
+		__m128i y = _mm_packs_epi32(_mm_and_si128(y16, lowWord),
+			_mm_srli_epi32(y16, 16));
+		__m128i uv = _mm_sub_epi16(_mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i*)puv), zero), bias);
+
+		__m128i r = _mm_srai_epi32(_mm_madd_epi16(uv, coefR), 14);
+		__m128i g = _mm_srai_epi32(_mm_madd_epi16(uv, coefG), 14);
+		__m128i b = _mm_srai_epi32(_mm_madd_epi16(uv, coefB), 14);
+
+		store_bgra_sse2(dst,
+			_mm_add_epi16(y, _mm_packs_epi32(b, b)),
+			_mm_add_epi16(y, _mm_packs_epi32(g, g)),
+			_mm_add_epi16(y, _mm_packs_epi32(r, r)));
+
+		py += 8;
+		puv += 8;
+		dst += 32;
+	}
+
+	nv12_row_to_bgra_c(py, puv, dst, width - blocks * 8);
+}
+
+
+__attribute__((target("sse2")))
+static void
+gray_row_to_bgra_sse2(const uint8* y, uint8* dst, uint32 width)
+{
+	const __m128i alpha = _mm_set1_epi8((char)255);
+
+	uint32 blocks = width / 16;
+	for (uint32 i = 0; i < blocks; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)y);
+		__m128i yy = _mm_unpacklo_epi8(x, x);
+		__m128i ya = _mm_unpacklo_epi8(x, alpha);
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(yy, ya));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(yy, ya));
+		yy = _mm_unpackhi_epi8(x, x);
+		ya = _mm_unpackhi_epi8(x, alpha);
+		_mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(yy, ya));
+		_mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(yy, ya));
+		y += 16;
+		dst += 64;
+	}
+
+	gray_row_to_bgra_c(y, dst, width - blocks * 16);
+}
+
+
+__attribute__((target("sse2")))
+static void
+swap16_row_sse2(const uint8* src, uint8* dst, size_t bytes)
+{
+	size_t blocks = bytes / 16;
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)src);
+		_mm_storeu_si128((__m128i*)dst,
+			_mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+		src += 16;
+		dst += 16;
+	}
+
+	swap16_row_c(src, dst, bytes - blocks * 16);
+}
+
+
+__attribute__((target("sse2")))
+static void
+narrow16_row_sse2(const uint8* src, uint8* dst, size_t count)
+{
+	size_t blocks = count / 16;
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i low = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)src), 8);
+		__m128i high = _mm_srli_epi16(
+			_mm_loadu_si128((const __m128i*)(src + 16)), 8);
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(low, high));
+		src += 32;
+		dst += 16;
+	}
+
+	narrow16_row_c(src, dst, count - blocks * 16);
+}
+
+
+__attribute__((target("sse2")))
+static void
+nv12_row_to_ycbcr422_sse2(const uint8* y, const uint8* uv, uint8* dst,
+	uint32 width)
+{
+	// Y0 U Y1 V is just luma and the chroma pairs interleaved bytewise
+	uint32 blocks = width / 16;
+	for (uint32 i = 0; i < blocks; i++) {
+		__m128i luma = _mm_loadu_si128((const __m128i*)(y + i * 16));
+		__m128i chroma = _mm_loadu_si128((const __m128i*)(uv + i * 16));
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(luma, chroma));
+		_mm_storeu_si128((__m128i*)(dst + 16),
+			_mm_unpackhi_epi8(luma, chroma));
+		dst += 32;
+	}
+
+	nv12_row_to_ycbcr422_c(y + blocks * 16, uv + blocks * 16, dst,
+		width - blocks * 16);
+}
+
+
+__attribute__((target("sse2")))
+static void
+gray_row_to_ycbcr422_sse2(const uint8* y, uint8* dst, uint32 width)
+{
+	const __m128i chroma = _mm_set1_epi8((char)128);
+
+	uint32 blocks = width / 16;
+	for (uint32 i = 0; i < blocks; i++) {
+		__m128i luma = _mm_loadu_si128((const __m128i*)(y + i * 16));
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(luma, chroma));
+		_mm_storeu_si128((__m128i*)(dst + 16),
+			_mm_unpackhi_epi8(luma, chroma));
+		dst += 32;
+	}
+
+	gray_row_to_ycbcr422_c(y + blocks * 16, dst, width - blocks * 16);
+}
+
+#endif // USE_X86_SIMD
+
+
+#ifdef USE_NEON
+
+static inline int16x8_t
+narrow_shift_14(int32x4_t low, int32x4_t high)
+{
+	return vcombine_s16(vshrn_n_s32(low, 14), vshrn_n_s32(high, 14));
+}
+
+
+template<bool uyvy>
+static void
+packed422_to_bgra_neon(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	const int16x8_t bias = vdupq_n_s16(128);
+	const uint8x8_t alpha = vdup_n_u8(255);
+
+	size_t blocks = srcBytes / 32;
+	for (size_t i = 0; i < blocks; i++) {
+		// YUYV: val[0] = Y0, val[1] = U, val[2] = Y1, val[3] = V
+		// UYVY: val[0] = U, val[1] = Y0, val[2] = V, val[3] = Y1
+		uint8x8x4_t x = vld4_u8(src);
+		const int o = uyvy ? 1 : 0;
+
+		int16x8_t y0 = vreinterpretq_s16_u16(vmovl_u8(x.val[0 + o]));
+		int16x8_t y1 = vreinterpretq_s16_u16(vmovl_u8(x.val[2 + o]));
+		int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(x.val[1 - o])),
+			bias);
+		int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(x.val[3 - o])),
+			bias);
+
+		int16x8_t r = narrow_shift_14(
+			vmull_n_s16(vget_low_s16(v), 22987),
+			vmull_n_s16(vget_high_s16(v), 22987));
+		int16x8_t g = narrow_shift_14(
+			vmlal_n_s16(vmull_n_s16(vget_low_s16(u), -5636),
+				vget_low_s16(v), -11698),
+			vmlal_n_s16(vmull_n_s16(vget_high_s16(u), -5636),
+				vget_high_s16(v), -11698));
+		int16x8_t b = narrow_shift_14(
+			vmull_n_s16(vget_low_s16(u), 29049),
+			vmull_n_s16(vget_high_s16(u), 29049));
+
+		uint8x8x2_t blue = vzip_u8(vqmovun_s16(vaddq_s16(y0, b)),
+			vqmovun_s16(vaddq_s16(y1, b)));
+		uint8x8x2_t green = vzip_u8(vqmovun_s16(vaddq_s16(y0, g)),
+			vqmovun_s16(vaddq_s16(y1, g)));
+		uint8x8x2_t red = vzip_u8(vqmovun_s16(vaddq_s16(y0, r)),
+			vqmovun_s16(vaddq_s16(y1, r)));
+
+		uint8x8x4_t out;
+		out.val[3] = alpha;
+		for (int half = 0; half < 2; half++) {
+			out.val[0] = blue.val[half];
+			out.val[1] = green.val[half];
+			out.val[2] = red.val[half];
+			vst4_u8(dst + half * 32, out);
+		}
+
+		src += 32;
+		dst += 64;
+	}
+
+	if (uyvy)
+		uyvy_to_bgra_c(src, dst, srcBytes - blocks * 32);
+	else
+		yuyv_to_bgra_c(src, dst, srcBytes - blocks * 32);
+}
+
+#endif // USE_NEON
+
+
+// Bilinear demosaic of count pixels of row y of 8 bit Bayer data, starting
+// at column x0. pattern gives the colors of the top left 2x2 cell in
+// reading order (0 = R, 1 = G, 2 = B). Edges are mirrored.
+static void
+bayer_row_to_bgra(const uint8* src, size_t step, uint32 width, uint32 height,
+	uint32 y, uint32 x0, uint32 count, const uint8 pattern[4], uint8* dst)
+{
+	const uint8* row = src + y * step;
+	const uint8* up = src + (y > 0 ? y - 1 : (height > 1 ? 1 : 0)) * step;
+	const uint8* down = src
+		+ (y + 1 < height ? y + 1 : (y > 0 ? y - 1 : 0)) * step;
+	const uint8* colors = pattern + (y & 1) * 2;
+
+	for (uint32 x = x0; x < x0 + count; x++) {
+		uint32 l = x > 0 ? x - 1 : (width > 1 ? 1 : 0);
+		uint32 r = x + 1 < width ? x + 1 : (x > 0 ? x - 1 : 0);
+
+		int color = colors[x & 1];
+		int cross = (up[x] + down[x] + row[l] + row[r] + 2) >> 2;
+		int diagonal = (up[l] + up[r] + down[l] + down[r] + 2) >> 2;
+		int horizontal = (row[l] + row[r] + 1) >> 1;
+		int vertical = (up[x] + down[x] + 1) >> 1;
+
+		int red, green, blue;
+		if (color == 0) {
+			red = row[x];
+			green = cross;
+			blue = diagonal;
+		} else if (color == 2) {
+			blue = row[x];
+			green = cross;
+			red = diagonal;
+		} else {
+			green = row[x];
+			// Red or blue neighbours left and right, the other one
+			// above and below
+			if (colors[(x + 1) & 1] == 0) {
+				red = horizontal;
+				blue = vertical;
+			} else {
+				blue = horizontal;
+				red = vertical;
+			}
+		}
+
+		dst[0] = blue;
+		dst[1] = green;
+		dst[2] = red;
+		dst[3] = 255;
+		dst += 4;
+	}
+}
+
+
+// Full range BT.601, the inverse of the YUV to RGB coefficients above.
+// Chroma is averaged over the pixel pair.
+static void
+bgra_row_to_ycbcr422(const uint8* src, uint8* dst, uint32 width)
+{
+	for (uint32 x = 0; x + 1 < width; x += 2) {
+		int b = src[0] + src[4];
+		int g = src[1] + src[5];
+		int r = src[2] + src[6];
+
+		dst[0] = (19595 * src[2] + 38470 * src[1] + 7471 * src[0]
+			+ 32768) >> 16;
+		dst[2] = (19595 * src[6] + 38470 * src[5] + 7471 * src[4]
+			+ 32768) >> 16;
+		dst[1] = sat(((-11059 * r - 21709 * g + 32768 * b) >> 17) + 128);
+		dst[3] = sat(((32768 * r - 27439 * g - 5329 * b) >> 17) + 128);
+
+		src += 8;
+		dst += 4;
+	}
+}
+
+
+static bool
+bayer_pattern(uvc_frame_format format, uint8 pattern[4])
+{
+	static const uint8 kRGGB[4] = { 0, 1, 1, 2 };
+	static const uint8 kGRBG[4] = { 1, 0, 2, 1 };
+	static const uint8 kGBRG[4] = { 1, 2, 0, 1 };
+	static const uint8 kBGGR[4] = { 2, 1, 1, 0 };
+
+	const uint8* source;
+	switch (format) {
+		case UVC_FRAME_FORMAT_SRGGB8:
+			source = kRGGB;
+			break;
+		// BY8 doesn't name its order, the cameras using it are GRBG
+		case UVC_FRAME_FORMAT_BY8:
+		case UVC_FRAME_FORMAT_SGRBG8:
+			source = kGRBG;
+			break;
+		case UVC_FRAME_FORMAT_SGBRG8:
+			source = kGBRG;
+			break;
+		// BA81 is the V4L2 name of BGGR
+		case UVC_FRAME_FORMAT_BA81:
+		case UVC_FRAME_FORMAT_SBGGR8:
+			source = kBGGR;
+			break;
+		default:
+			return false;
+	}
+
+	memcpy(pattern, source, 4);
+	return true;
+}
+
+
+struct converter_impl {
+	ColorConverter::convert_func	yuyv_to_bgra;
+	ColorConverter::convert_func	uyvy_to_bgra;
+	void	(*nv12_row_to_bgra)(const uint8* y, const uint8* uv, uint8* dst,
+				uint32 width);
+	void	(*gray_row_to_bgra)(const uint8* y, uint8* dst, uint32 width);
+	void	(*swap16_row)(const uint8* src, uint8* dst, size_t bytes);
+	void	(*narrow16_row)(const uint8* src, uint8* dst, size_t count);
+	void	(*nv12_row_to_ycbcr422)(const uint8* y, const uint8* uv,
+				uint8* dst, uint32 width);
+	void	(*gray_row_to_ycbcr422)(const uint8* y, uint8* dst,
+				uint32 width);
+	const char*	name;
+};
+
+
+static converter_impl
+select_converters()
+{
+	converter_impl impl = {
+		yuyv_to_bgra_c,
+		uyvy_to_bgra_c,
+		nv12_row_to_bgra_c,
+		gray_row_to_bgra_c,
+		swap16_row_c,
+		narrow16_row_c,
+		nv12_row_to_ycbcr422_c,
+		gray_row_to_ycbcr422_c,
+		"C"
+	};
+
+#ifdef USE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		impl.yuyv_to_bgra = packed422_to_bgra_sse2<false>;
+		impl.uyvy_to_bgra = packed422_to_bgra_sse2<true>;
+		impl.nv12_row_to_bgra = nv12_row_to_bgra_sse2;
+		impl.gray_row_to_bgra = gray_row_to_bgra_sse2;
+		impl.swap16_row = swap16_row_sse2;
+		impl.narrow16_row = narrow16_row_sse2;
+		impl.nv12_row_to_ycbcr422 = nv12_row_to_ycbcr422_sse2;
+		impl.gray_row_to_ycbcr422 = gray_row_to_ycbcr422_sse2;
+		impl.name = "SSE2";
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		impl.yuyv_to_bgra = packed422_to_bgra_ssse3<false>;
+		impl.uyvy_to_bgra = packed422_to_bgra_ssse3<true>;
+		impl.name = "SSSE3";
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		impl.yuyv_to_bgra = packed422_to_bgra_avx2<false>;
+		impl.uyvy_to_bgra = packed422_to_bgra_avx2<true>;
+		impl.name = "AVX2";
+	}
+#endif
+
+#ifdef USE_NEON
+	impl.yuyv_to_bgra = packed422_to_bgra_neon<false>;
+	impl.uyvy_to_bgra = packed422_to_bgra_neon<true>;
+	impl.name = "NEON";
+#endif
+
+	return impl;
+}
+
+
+static const converter_impl sConverters = select_converters();
+
+
+void
+ColorConverter::YUYVToBGRA(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	sConverters.yuyv_to_bgra(src, dst, srcBytes);
+}
+
+
+const char*
+ColorConverter::YUYVToBGRAName()
+{
+	return sConverters.name;
+}
+
+
+bool
+ColorConverter::IsSupported(uvc_frame_format format)
+{
+	uint8 pattern[4];
+	switch (format) {
+		case UVC_FRAME_FORMAT_YUYV:
+		case UVC_FRAME_FORMAT_UYVY:
+		case UVC_FRAME_FORMAT_NV12:
+		case UVC_FRAME_FORMAT_P010:
+		case UVC_FRAME_FORMAT_GRAY8:
+		case UVC_FRAME_FORMAT_GRAY16:
+			return true;
+		default:
+			return bayer_pattern(format, pattern);
+	}
+}
+
+
+const char*
+ColorConverter::FormatName(uvc_frame_format format)
+{
+	switch (format) {
+		case UVC_FRAME_FORMAT_YUYV:
+			return "YUYV";
+		case UVC_FRAME_FORMAT_UYVY:
+			return "UYVY";
+		case UVC_FRAME_FORMAT_NV12:
+			return "NV12";
+		case UVC_FRAME_FORMAT_P010:
+			return "P010";
+		case UVC_FRAME_FORMAT_GRAY8:
+			return "GRAY8";
+		case UVC_FRAME_FORMAT_GRAY16:
+			return "GRAY16";
+		case UVC_FRAME_FORMAT_BY8:
+			return "Bayer BY8";
+		case UVC_FRAME_FORMAT_BA81:
+			return "Bayer BA81";
+		case UVC_FRAME_FORMAT_SGRBG8:
+			return "Bayer GRBG";
+		case UVC_FRAME_FORMAT_SGBRG8:
+			return "Bayer GBRG";
+		case UVC_FRAME_FORMAT_SRGGB8:
+			return "Bayer RGGB";
+		case UVC_FRAME_FORMAT_SBGGR8:
+			return "Bayer BGGR";
+		case UVC_FRAME_FORMAT_MJPEG:
+			return "MJPEG";
+		default:
+			return "Unknown";
+	}
+}
+
+
+status_t
+ColorConverter::Convert(const uvc_frame_t* frame, uint8* dst, uint32 width,
+	uint32 height, size_t bytesPerRow, color_space space)
+{
+	if (frame->width != width || frame->height > height)
+		return B_BAD_VALUE;
+
+	if (space != B_RGB32 && (space != B_YCbCr422 || (width & 1) != 0))
+		return B_BAD_VALUE;
+
+	const uint8* src = (const uint8*)frame->data;
+	uint32 rows = frame->height;
+	bool rgb = space == B_RGB32;
+	size_t outBytes = width * (rgb ? 4 : 2);
+
+	// Bytes per sample row of the luma (or only) plane
+	size_t sampleSize = 1;
+	switch (frame->frame_format) {
+		case UVC_FRAME_FORMAT_YUYV:
+		case UVC_FRAME_FORMAT_UYVY:
+		case UVC_FRAME_FORMAT_P010:
+		case UVC_FRAME_FORMAT_GRAY16:
+			sampleSize = 2;
+			break;
+		default:
+			break;
+	}
+
+	size_t step = frame->step != 0 ? frame->step : width * sampleSize;
+	if (step < width * sampleSize || outBytes > bytesPerRow)
+		return B_BAD_VALUE;
+
+	size_t needed = step * rows;
+	if (frame->frame_format == UVC_FRAME_FORMAT_NV12
+		|| frame->frame_format == UVC_FRAME_FORMAT_P010)
+		needed += step * ((rows + 1) / 2);
+
+	// YUYV keeps converting whatever arrived, like it always did
+	if (frame->frame_format == UVC_FRAME_FORMAT_YUYV) {
+		size_t bytes = frame->data_bytes < needed ? frame->data_bytes : needed;
+		if (step == width * 2 && bytesPerRow == outBytes) {
+			if (rgb)
+				sConverters.yuyv_to_bgra(src, dst, bytes);
+			else
+				memcpy(dst, src, bytes);
+			return B_OK;
+		}
+		rows = bytes / step;
+	} else if (frame->data_bytes < needed)
+		return B_BAD_VALUE;
+
+	// Narrowed 16 bit samples are converted in chunks of this many pixels
+	const uint32 kChunk = 256;
+	uint8 luma[kChunk];
+	uint8 chroma[kChunk];
+	uint8 pixels[kChunk * 4];
+	uint8 pattern[4];
+
+	switch (frame->frame_format) {
+		case UVC_FRAME_FORMAT_YUYV:
+			for (uint32 y = 0; y < rows; y++) {
+				if (rgb)
+					sConverters.yuyv_to_bgra(src + y * step, dst, width * 2);
+				else
+					memcpy(dst, src + y * step, width * 2);
+				dst += bytesPerRow;
+			}
+			return B_OK;
+
+		case UVC_FRAME_FORMAT_UYVY:
+			for (uint32 y = 0; y < rows; y++) {
+				if (rgb)
+					sConverters.uyvy_to_bgra(src + y * step, dst, width * 2);
+				else
+					sConverters.swap16_row(src + y * step, dst, width * 2);
+				dst += bytesPerRow;
+			}
+			return B_OK;
+
+		case UVC_FRAME_FORMAT_NV12:
+		{
+			const uint8* uvPlane = src + step * rows;
+			for (uint32 y = 0; y < rows; y++) {
+				const uint8* uv = uvPlane + (y / 2) * step;
+				if (rgb)
+					sConverters.nv12_row_to_bgra(src + y * step, uv, dst, width);
+				else
+					sConverters.nv12_row_to_ycbcr422(src + y * step, uv, dst, width);
+				dst += bytesPerRow;
+			}
+			return B_OK;
+		}
+
+		case UVC_FRAME_FORMAT_P010:
+		{
+			const uint8* uvPlane = src + step * rows;
+			for (uint32 y = 0; y < rows; y++) {
+				const uint8* row = src + y * step;
+				const uint8* uv = uvPlane + (y / 2) * step;
+				for (uint32 x = 0; x < width; x += kChunk) {
+					uint32 count = width - x < kChunk ? width - x : kChunk;
+					sConverters.narrow16_row(row + x * 2, luma, count);
+					sConverters.narrow16_row(uv + x * 2, chroma, count);
+					if (rgb) {
+						sConverters.nv12_row_to_bgra(luma, chroma,
+							dst + x * 4, count);
+					} else {
+						sConverters.nv12_row_to_ycbcr422(luma, chroma,
+							dst + x * 2, count);
+					}
+				}
+				dst += bytesPerRow;
+			}
+			return B_OK;
+		}
+
+		case UVC_FRAME_FORMAT_GRAY8:
+			for (uint32 y = 0; y < rows; y++) {
+				if (rgb)
+					sConverters.gray_row_to_bgra(src + y * step, dst, width);
+				else
+					sConverters.gray_row_to_ycbcr422(src + y * step, dst, width);
+				dst += bytesPerRow;
+			}
+			return B_OK;
+
+		case UVC_FRAME_FORMAT_GRAY16:
+			for (uint32 y = 0; y < rows; y++) {
+				const uint8* row = src + y * step;
+				for (uint32 x = 0; x < width; x += kChunk) {
+					uint32 count = width - x < kChunk ? width - x : kChunk;
+					sConverters.narrow16_row(row + x * 2, luma, count);
+					if (rgb)
+						sConverters.gray_row_to_bgra(luma, dst + x * 4, count);
+					else {
+						sConverters.gray_row_to_ycbcr422(luma, dst + x * 2,
+							count);
+					}
+				}
+				dst += bytesPerRow;
+			}
+			return B_OK;
+
+		default:
+			break;
+	}
+
+	if (!bayer_pattern(frame->frame_format, pattern))
+		return B_NOT_SUPPORTED;
+
+	for (uint32 y = 0; y < rows; y++) {
+		if (rgb)
+			bayer_row_to_bgra(src, step, width, rows, y, 0, width, pattern, dst);
+		else {
+			// Demosaiced a chunk at a time, chunks keep pixel pairs whole
+			for (uint32 x = 0; x < width; x += kChunk) {
+				uint32 count = width - x < kChunk ? width - x : kChunk;
+				bayer_row_to_bgra(src, step, width, rows, y, x, count, pattern,
+					pixels);
+				bgra_row_to_ycbcr422(pixels, dst + x * 2, count);
+			}
+		}
+		dst += bytesPerRow;
+	}
+
+	return B_OK;
+}
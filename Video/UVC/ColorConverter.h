@@ -0,0 +1,60 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * Copyright 2010-2012 Ken Tossell
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_COLOR_CONVERTER_H
+#define _UVC_COLOR_CONVERTER_H
+
+#include <GraphicsDefs.h>
+#include <SupportDefs.h>
+
+#include "libuvc/libuvc.h"
+
+#define IYUYV2BGR_2(pyuv, pbgr) { \
+		int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
+		int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
+		int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
+		(pbgr)[0] = sat(*(pyuv) + b); \
+		(pbgr)[1] = sat(*(pyuv) + g); \
+		(pbgr)[2] = sat(*(pyuv) + r); \
+		(pbgr)[3] = 255; \
+		(pbgr)[4] = sat((pyuv)[2] + b); \
+		(pbgr)[5] = sat((pyuv)[2] + g); \
+		(pbgr)[6] = sat((pyuv)[2] + r); \
+		(pbgr)[7] = 255; \
+	}
+#define IYUYV2BGR_8(pyuv, pbgr) IYUYV2BGR_4(pyuv, pbgr); IYUYV2BGR_4(pyuv + 8, pbgr + 16);
+#define IYUYV2BGR_4(pyuv, pbgr) IYUYV2BGR_2(pyuv, pbgr); IYUYV2BGR_2(pyuv + 4, pbgr + 8);
+
+static inline unsigned char sat(int i) {
+	return (unsigned char)( i >= 255 ? 255 : (i < 0 ? 0 : i));
+}
+
+// Converts uncompressed UVC frames to B_RGB32 (BGRA in memory) or
+// B_YCbCr422. The vectorized implementations give exactly the same output
+// as the IYUYV2BGR macros, the best one for the running CPU is picked on
+// first use.
+class ColorConverter {
+public:
+	typedef void			(*convert_func)(const uint8* src, uint8* dst,
+								size_t srcBytes);
+
+	static	void			YUYVToBGRA(const uint8* src, uint8* dst,
+								size_t srcBytes);
+	static	const char*		YUYVToBGRAName();
+
+	static	bool			IsSupported(uvc_frame_format format);
+	static	const char*		FormatName(uvc_frame_format format);
+
+	// Converts a whole frame, using its step as the source row stride.
+	// Fails with B_BAD_VALUE if the frame doesn't match the output or is
+	// shorter than its format needs.
+	static	status_t		Convert(const uvc_frame_t* frame, uint8* dst,
+								uint32 width, uint32 height,
+								size_t bytesPerRow, color_space space);
+};
+
+#endif // _UVC_COLOR_CONVERTER_H
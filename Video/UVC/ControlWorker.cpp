@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+
+#include "ControlWorker.h"
+
+ControlWorker::ControlWorker(ControlWriter* writer, bigtime_t minInterval)
+	: fInitStatus(B_NO_INIT)
+	, fWriter(writer)
+	, fMinInterval(minInterval)
+	, fLastWrite(0)
+	, fLock("control worker")
+	, fPendingCount(0)
+	, fSequence(0)
+	, fWorkSem(-1)
+	, fThread(-1)
+{
+	fWorkSem = create_sem(0, "control writes");
+	if (fWorkSem < B_OK) {
+		fInitStatus = fWorkSem;
+		return;
+	}
+
+	fThread = spawn_thread(_worker, "uvc control writer",
+		B_NORMAL_PRIORITY, this);
+	if (fThread < B_OK) {
+		fInitStatus = fThread;
+		return;
+	}
+
+	resume_thread(fThread);
+	fInitStatus = B_OK;
+}
+
+ControlWorker::~ControlWorker()
+{
+	// Writes still waiting are dropped, one in progress is finished
+	if (fWorkSem >= B_OK)
+		delete_sem(fWorkSem);
+
+	if (fThread >= B_OK) {
+		status_t result;
+		wait_for_thread(fThread, &result);
+	}
+}
+
+uint32
+ControlWorker::Write(int32 id, float value)
+{
+	BAutolock _(fLock);
+
+	// Never 0, that is no write
+	if (++fSequence == 0)
+		fSequence = 1;
+
+	for (int32 i = 0; i < fPendingCount; i++) {
+		if (fPending[i].id == id) {
+			fPending[i].value = value;
+			fPending[i].sequence = fSequence;
+			return fSequence;
+		}
+	}
+
+	if (fPendingCount == MAX_PENDING)
+		return 0;
+
+	fPending[fPendingCount].id = id;
+	fPending[fPendingCount].value = value;
+	fPending[fPendingCount].sequence = fSequence;
+	fPendingCount++;
+
+	release_sem_etc(fWorkSem, 1, B_DO_NOT_RESCHEDULE);
+	return fSequence;
+}
+
+bool
+ControlWorker::_IsPending(int32 id)
+{
+	BAutolock _(fLock);
+
+	for (int32 i = 0; i < fPendingCount; i++) {
+		if (fPending[i].id == id)
+			return true;
+	}
+	return false;
+}
+
+int32
+ControlWorker::_worker(void* data)
+{
+	return ((ControlWorker*)data)->Worker();
+}
+
+int32
+ControlWorker::Worker()
+{
+	while (true) {
+		status_t status = acquire_sem(fWorkSem);
+		if (status == B_INTERRUPTED)
+			continue;
+		if (status != B_OK)
+			break;
+
+		// One release per control that became pending, in that order
+		fLock.Lock();
+		if (fPendingCount == 0) {
+			fLock.Unlock();
+			continue;
+		}
+		Pending pending = fPending[0];
+		fPendingCount--;
+		for (int32 i = 0; i < fPendingCount; i++)
+			fPending[i] = fPending[i + 1];
+		fLock.Unlock();
+
+		snooze_until(fLastWrite + fMinInterval, B_SYSTEM_TIMEBASE);
+
+		float applied = pending.value;
+		status = fWriter->WriteControl(pending.id, pending.value, &applied);
+		fLastWrite = system_time();
+
+		// A newer value would only be reported back over. One queued
+		// right after this check is caught by its sequence number.
+		if (status == B_OK && !_IsPending(pending.id))
+			fWriter->ControlWritten(pending.id, applied, pending.sequence);
+	}
+
+	return B_OK;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_CONTROL_WORKER_H
+#define _UVC_CONTROL_WORKER_H
+
+#include <Locker.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+// Writes camera controls for a ControlWorker, on its thread
+class ControlWriter {
+public:
+	virtual					~ControlWriter() {}
+
+	// Sets the control and stores the value the camera settled on
+	virtual	status_t		WriteControl(int32 id, float value,
+								float* applied) = 0;
+	// Called after a write unless a newer value for the control is
+	// already waiting, with the sequence number Write() returned for it
+	virtual	void			ControlWritten(int32 id, float applied,
+								uint32 sequence) = 0;
+};
+
+// Applies control changes of one camera on a thread of its own, so a
+// dragged slider doesn't hold up the node's control thread with a USB
+// transfer per step. Only the latest value of each control is written,
+// and writes to the camera are at least the minimum interval apart.
+class ControlWorker {
+public:
+							ControlWorker(ControlWriter* writer,
+								bigtime_t minInterval = 20000);
+							~ControlWorker();
+
+			status_t		InitCheck() const { return fInitStatus; }
+
+			// Never waits for the camera. Returns the sequence number
+			// ControlWritten() reports the write with, a later Write()
+			// of the control replaces it.
+			uint32			Write(int32 id, float value);
+
+private:
+	enum {
+		MAX_PENDING = 32
+	};
+
+	struct Pending {
+		int32			id;
+		float			value;
+		uint32			sequence;
+	};
+
+			bool			_IsPending(int32 id);
+
+	static	int32			_worker(void* data);
+			int32			Worker();
+
+			status_t		fInitStatus;
+			ControlWriter*	fWriter;
+			bigtime_t		fMinInterval;
+			bigtime_t		fLastWrite;
+
+			BLocker			fLock;
+			Pending			fPending[MAX_PENDING];
+			int32			fPendingCount;
+			uint32			fSequence;
+			sem_id			fWorkSem;
+			thread_id		fThread;
+};
+
+#endif // _UVC_CONTROL_WORKER_H
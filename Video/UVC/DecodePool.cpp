@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+
+#include "DecodePool.h"
+
+#define MAX_DECODE_THREADS 16
+
+DecodeJob::DecodeJob()
+	: fCount(0)
+	, fNext(0)
+	, fPending(0)
+	, fQueueNext(NULL)
+{
+	fDoneSem = create_sem(0, "decode job done");
+}
+
+DecodeJob::~DecodeJob()
+{
+	if (fDoneSem >= B_OK)
+		delete_sem(fDoneSem);
+}
+
+DecodePool::DecodePool(int32 threads)
+	: fInitStatus(B_NO_INIT)
+	, fLock("decode pool")
+	, fQueueHead(NULL)
+	, fQueueTail(NULL)
+	, fWorkSem(-1)
+	, fThreads(NULL)
+	, fThreadCount(0)
+{
+	if (threads <= 0) {
+		system_info info;
+		if (get_system_info(&info) == B_OK)
+			threads = info.cpu_count;
+	}
+	threads = max_c(1, min_c(threads, MAX_DECODE_THREADS));
+
+	fWorkSem = create_sem(0, "decode pool work");
+	if (fWorkSem < B_OK) {
+		fInitStatus = fWorkSem;
+		return;
+	}
+
+	// The thread running a job takes parts of it too
+	fThreads = new thread_id[threads];
+	for (int32 i = 0; i < threads - 1; i++) {
+		thread_id thread = spawn_thread(_worker, "uvc decoder",
+			B_NORMAL_PRIORITY, this);
+		if (thread < B_OK)
+			break;
+		resume_thread(thread);
+		fThreads[fThreadCount++] = thread;
+	}
+
+	fInitStatus = B_OK;
+}
+
+DecodePool::~DecodePool()
+{
+	if (fWorkSem >= B_OK)
+		delete_sem(fWorkSem);
+
+	for (int32 i = 0; i < fThreadCount; i++) {
+		status_t result;
+		wait_for_thread(fThreads[i], &result);
+	}
+
+	delete[] fThreads;
+}
+
+void
+DecodePool::Run(DecodeJob* job, int32 count)
+{
+	if (count <= 0)
+		return;
+
+	job->fCount = count;
+	job->fNext = 0;
+	job->fPending = count;
+
+	int32 helpers = min_c(count - 1, fThreadCount);
+	if (helpers > 0 && job->fDoneSem >= B_OK) {
+		fLock.Lock();
+		job->fQueueNext = NULL;
+		if (fQueueTail != NULL)
+			fQueueTail->fQueueNext = job;
+		else
+			fQueueHead = job;
+		fQueueTail = job;
+		fLock.Unlock();
+
+		release_sem_etc(fWorkSem, helpers, B_DO_NOT_RESCHEDULE);
+	} else
+		helpers = 0;
+
+	bool finished = false;
+	int32 index;
+	while (_TakePart(job, &index)) {
+		job->RunPart(index);
+		if (atomic_add(&job->fPending, -1) == 1)
+			finished = true;
+	}
+
+	// Whoever finishes the last part wakes us up
+	if (!finished)
+		acquire_sem(job->fDoneSem);
+
+	if (helpers == 0)
+		return;
+
+	BAutolock locker(fLock);
+	DecodeJob* previous = NULL;
+	for (DecodeJob* queued = fQueueHead; queued != NULL;
+			queued = queued->fQueueNext) {
+		if (queued != job) {
+			previous = queued;
+			continue;
+		}
+		if (previous != NULL)
+			previous->fQueueNext = job->fQueueNext;
+		else
+			fQueueHead = job->fQueueNext;
+		if (fQueueTail == job)
+			fQueueTail = previous;
+		break;
+	}
+}
+
+bool
+DecodePool::_TakePart(DecodeJob* job, int32* index)
+{
+	BAutolock locker(fLock);
+	if (job->fNext >= job->fCount)
+		return false;
+
+	*index = job->fNext++;
+	return true;
+}
+
+int32
+DecodePool::_worker(void* data)
+{
+	return ((DecodePool*)data)->Worker();
+}
+
+int32
+DecodePool::Worker()
+{
+	while (acquire_sem(fWorkSem) == B_OK) {
+		while (true) {
+			// Oldest job with parts left, the job stays alive until its
+			// last part is done
+			DecodeJob* job = NULL;
+			int32 index = 0;
+
+			fLock.Lock();
+			for (job = fQueueHead; job != NULL; job = job->fQueueNext) {
+				if (job->fNext < job->fCount) {
+					index = job->fNext++;
+					break;
+				}
+			}
+			fLock.Unlock();
+
+			if (job == NULL)
+				break;
+
+			job->RunPart(index);
+			if (atomic_add(&job->fPending, -1) == 1)
+				release_sem(job->fDoneSem);
+		}
+	}
+
+	return B_OK;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_DECODE_POOL_H
+#define _UVC_DECODE_POOL_H
+
+#include <Locker.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+class DecodePool;
+
+// Work that can be split into parts decoded on any thread, like the
+// bands of a frame. A job is run by one thread at a time and may be
+// reused for the next frame once Run() returned.
+class DecodeJob {
+public:
+							DecodeJob();
+	virtual					~DecodeJob();
+
+	virtual	void			RunPart(int32 index) = 0;
+
+private:
+	friend class DecodePool;
+
+			sem_id			fDoneSem;
+			int32			fCount;
+			int32			fNext;
+			int32			fPending;
+			DecodeJob*		fQueueNext;
+};
+
+// Worker threads shared by all cameras of the add-on, one per CPU less
+// the thread that runs a job, which takes parts of it too. Jobs of
+// several cameras are worked on in the order they came in, so a rig of
+// cameras gets no more decoding threads than there are CPUs.
+class DecodePool {
+public:
+							DecodePool(int32 threads = 0);
+							~DecodePool();
+
+			status_t		InitCheck() const { return fInitStatus; }
+			int32			CountThreads() const { return fThreadCount; }
+
+			// Runs parts 0 to count - 1 of the job, returns when all of
+			// them are done
+			void			Run(DecodeJob* job, int32 count);
+
+private:
+			bool			_TakePart(DecodeJob* job, int32* index);
+
+	static	int32			_worker(void* data);
+			int32			Worker();
+
+			status_t		fInitStatus;
+
+			BLocker			fLock;
+			DecodeJob*		fQueueHead;
+			DecodeJob*		fQueueTail;
+			sem_id			fWorkSem;
+
+			thread_id*		fThreads;
+			int32			fThreadCount;
+};
+
+#endif // _UVC_DECODE_POOL_H
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Autolock.h>
+
+#include "FrameQueue.h"
+
+FrameQueue::FrameQueue(int32 capacity, int32 consumerSlots)
+	: fLock("frame queue")
+	, fFrameSem(-1)
+	, fSlots(NULL)
+	, fSlotCount(0)
+	, fFree(NULL)
+	, fFreeCount(0)
+	, fQueue(NULL)
+	, fQueueHead(0)
+	, fQueueCount(0)
+	, fCapacity(capacity < 1 ? 1 : capacity)
+	, fDropped(0)
+	, fLastSequence(0)
+	, fWoken(false)
+{
+	// The extra slots are held by the consumer, one while it decodes
+	fSlotCount = fCapacity + (consumerSlots < 1 ? 1 : consumerSlots);
+	fSlots = new Slot[fSlotCount];
+	fFree = new Slot*[fSlotCount];
+	fQueue = new Slot*[fCapacity];
+
+	memset(fSlots, 0, sizeof(Slot) * fSlotCount);
+	for (int32 i = 0; i < fSlotCount; i++)
+		fFree[fFreeCount++] = &fSlots[i];
+}
+
+FrameQueue::~FrameQueue()
+{
+	Close();
+
+	for (int32 i = 0; i < fSlotCount; i++)
+		free(fSlots[i].data);
+
+	delete[] fSlots;
+	delete[] fFree;
+	delete[] fQueue;
+}
+
+status_t
+FrameQueue::Open()
+{
+	BAutolock locker(fLock);
+
+	if (fFrameSem >= B_OK)
+		return B_OK;
+
+	fFrameSem = create_sem(0, "uvc frames");
+	if (fFrameSem < B_OK)
+		return fFrameSem;
+
+	fDropped = 0;
+	fLastSequence = 0;
+	fWoken = false;
+	return B_OK;
+}
+
+void
+FrameQueue::Close()
+{
+	BAutolock locker(fLock);
+
+	if (fFrameSem >= B_OK) {
+		delete_sem(fFrameSem);
+		fFrameSem = -1;
+	}
+
+	while (fQueueCount > 0) {
+		_Release(fQueue[fQueueHead]);
+		fFree[fFreeCount++] = fQueue[fQueueHead];
+		fQueueHead = (fQueueHead + 1) % fCapacity;
+		fQueueCount--;
+	}
+}
+
+status_t
+FrameQueue::Push(const uvc_frame_t* frame)
+{
+	BAutolock locker(fLock);
+
+	if (fFrameSem < B_OK)
+		return B_NO_INIT;
+
+	// Frames libuvc gave up on leave a gap in the sequence
+	if (fLastSequence != 0 && frame->sequence > fLastSequence + 1)
+		fDropped += frame->sequence - fLastSequence - 1;
+	fLastSequence = frame->sequence;
+
+	if (fFreeCount == 0 && fQueueCount == 0)
+		return B_BUSY;
+
+	bool replaced = false;
+	Slot* slot = NULL;
+	if (fFreeCount > 0 && fQueueCount < fCapacity) {
+		slot = fFree[--fFreeCount];
+	} else {
+		// Full, reuse the oldest waiting frame
+		slot = fQueue[fQueueHead];
+		fQueueHead = (fQueueHead + 1) % fCapacity;
+		fQueueCount--;
+		fDropped++;
+		replaced = true;
+		_Release(slot);
+	}
+
+	uvc_frame_buffer_t* held = uvc_hold_frame_buffer(frame);
+	if (held == NULL && slot->capacity < frame->data_bytes) {
+		void* data = realloc(slot->data, frame->data_bytes);
+		if (data == NULL) {
+			free(slot->data);
+			slot->data = NULL;
+			slot->capacity = 0;
+			fFree[fFreeCount++] = slot;
+			if (replaced)
+				acquire_sem_etc(fFrameSem, 1, B_RELATIVE_TIMEOUT, 0);
+			return B_NO_MEMORY;
+		}
+		slot->data = data;
+		slot->capacity = frame->data_bytes;
+	}
+
+	slot->frame = *frame;
+	slot->frame.metadata = NULL;
+	slot->frame.metadata_bytes = 0;
+	slot->frame.library_owns_data = 0;
+	slot->frame.buffer = NULL;
+	slot->held = held;
+	if (held == NULL) {
+		slot->frame.data = slot->data;
+		memcpy(slot->data, frame->data, frame->data_bytes);
+	}
+
+	fQueue[(fQueueHead + fQueueCount) % fCapacity] = slot;
+	fQueueCount++;
+
+	// A replaced frame was already counted
+	if (!replaced)
+		release_sem_etc(fFrameSem, 1, B_DO_NOT_RESCHEDULE);
+
+	return B_OK;
+}
+
+uvc_frame_t*
+FrameQueue::Pop(bool* woken)
+{
+	while (true) {
+		fLock.Lock();
+		sem_id sem = fFrameSem;
+		fLock.Unlock();
+
+		if (sem < B_OK || acquire_sem(sem) != B_OK)
+			return NULL;
+
+		BAutolock locker(fLock);
+		if (fQueueCount == 0) {
+			// Only the consumer asking for it is woken without a frame
+			if (fWoken && woken != NULL) {
+				fWoken = false;
+				*woken = true;
+				return NULL;
+			}
+			continue;
+		}
+
+		// A new frame answers a Wake() as well
+		fWoken = false;
+		Slot* slot = fQueue[fQueueHead];
+		fQueueHead = (fQueueHead + 1) % fCapacity;
+		fQueueCount--;
+
+		return &slot->frame;
+	}
+}
+
+void
+FrameQueue::Wake()
+{
+	BAutolock locker(fLock);
+
+	if (fFrameSem < B_OK || fWoken)
+		return;
+
+	fWoken = true;
+	release_sem_etc(fFrameSem, 1, B_DO_NOT_RESCHEDULE);
+}
+
+void
+FrameQueue::Recycle(uvc_frame_t* frame)
+{
+	if (frame == NULL)
+		return;
+
+	Slot* slot = _Slot(frame);
+	_Release(slot);
+
+	BAutolock locker(fLock);
+	fFree[fFreeCount++] = slot;
+}
+
+FrameQueue::Slot*
+FrameQueue::_Slot(uvc_frame_t* frame) const
+{
+	return (Slot*)((uint8*)frame - offsetof(Slot, frame));
+}
+
+void
+FrameQueue::_Release(Slot* slot)
+{
+	if (slot->held == NULL)
+		return;
+
+	uvc_release_frame_buffer(slot->held);
+	slot->held = NULL;
+	slot->frame.data = NULL;
+	slot->frame.data_bytes = 0;
+}
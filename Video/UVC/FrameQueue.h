@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_FRAME_QUEUE_H
+#define _UVC_FRAME_QUEUE_H
+
+#include <OS.h>
+#include <Locker.h>
+#include <SupportDefs.h>
+
+#include <libuvc/libuvc.h>
+
+// Bounded queue of raw frames between the libuvc callback and the decode
+// thread. Push() never blocks, when the queue is full the oldest waiting
+// frame is dropped so the decoder always gets the newest one.
+// Frames of zero-copy streams keep their libuvc buffer until recycled,
+// other frames are copied. Dropped() also counts the frames lost in
+// libuvc, they show up as gaps in the frame sequence numbers.
+// The consumer may have up to consumerSlots frames popped and not yet
+// recycled. Wake() makes a waiting Pop() return without a frame.
+class FrameQueue {
+public:
+							FrameQueue(int32 capacity,
+								int32 consumerSlots = 1);
+							~FrameQueue();
+
+			status_t		Open();
+			void			Close();
+
+			status_t		Push(const uvc_frame_t* frame);
+			uvc_frame_t*	Pop(bool* woken = NULL);
+			void			Recycle(uvc_frame_t* frame);
+			void			Wake();
+
+			uint32			Dropped() const { return fDropped; }
+			// frames it holds at most, waiting or out for decoding
+			int32			CountSlots() const { return fSlotCount; }
+
+private:
+	struct Slot {
+		uvc_frame_t		frame;
+		// copy of the frame data, unless held points to the libuvc buffer
+		void*			data;
+		size_t			capacity;
+		uvc_frame_buffer_t* held;
+	};
+
+			Slot*			_Slot(uvc_frame_t* frame) const;
+	static	void			_Release(Slot* slot);
+
+			BLocker			fLock;
+			sem_id			fFrameSem;
+
+			Slot*			fSlots;
+			int32			fSlotCount;
+
+			Slot**			fFree;
+			int32			fFreeCount;
+
+			Slot**			fQueue;
+			int32			fQueueHead;
+			int32			fQueueCount;
+			int32			fCapacity;
+
+			uint32			fDropped;
+			uint32			fLastSequence;
+			bool			fWoken;
+};
+
+#endif // _UVC_FRAME_QUEUE_H
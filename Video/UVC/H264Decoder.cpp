@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <errno.h>
+
+#include "H264Decoder.h"
+
+H264Decoder::H264Decoder()
+	: fInitStatus(B_NO_INIT)
+	, fContext(NULL)
+	, fPacket(NULL)
+	, fFrame(NULL)
+	, fScaler(NULL)
+	, fWaitForIDR(true)
+	, fLastDecodeTime(0)
+	, fAverageDecodeTime(0)
+{
+	const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+	if (codec == NULL) {
+		fInitStatus = B_NOT_SUPPORTED;
+		return;
+	}
+
+	fContext = avcodec_alloc_context3(codec);
+	fPacket = av_packet_alloc();
+	fFrame = av_frame_alloc();
+	if (fContext == NULL || fPacket == NULL || fFrame == NULL) {
+		fInitStatus = B_NO_MEMORY;
+		return;
+	}
+
+	// Frame threads hold back one picture per thread, slices don't
+	system_info info;
+	get_system_info(&info);
+	fContext->thread_count = info.cpu_count;
+	fContext->thread_type = FF_THREAD_SLICE;
+	fContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+	if (avcodec_open2(fContext, codec, NULL) < 0) {
+		fInitStatus = B_ERROR;
+		return;
+	}
+
+	fInitStatus = B_OK;
+}
+
+H264Decoder::~H264Decoder()
+{
+	sws_freeContext(fScaler);
+	av_frame_free(&fFrame);
+	av_packet_free(&fPacket);
+	avcodec_free_context(&fContext);
+}
+
+status_t
+H264Decoder::Decode(const uint8* data, size_t size, uint8* dest,
+	uint32 width, uint32 height, size_t bytesPerRow, color_space space)
+{
+	if (fInitStatus != B_OK)
+		return fInitStatus;
+
+	if (data == NULL || size == 0)
+		return B_BAD_VALUE;
+
+	if (dest != NULL && space != B_RGB32
+		&& (space != B_YCbCr422 || (width & 1) != 0))
+		return B_BAD_VALUE;
+
+	// Decoding P frames without their references only gives garbage
+	if (fWaitForIDR) {
+		if (!_HasIDR(data, size))
+			return B_WOULD_BLOCK;
+		fWaitForIDR = false;
+	}
+
+	bigtime_t start = system_time();
+
+	fPacket->data = (uint8_t*)data;
+	fPacket->size = size;
+	int result = avcodec_send_packet(fContext, fPacket);
+	fPacket->data = NULL;
+	fPacket->size = 0;
+	if (result < 0) {
+		Resync();
+		return B_BAD_DATA;
+	}
+
+	// In low delay mode there is at most one picture per access unit
+	result = avcodec_receive_frame(fContext, fFrame);
+	if (result == AVERROR(EAGAIN))
+		return B_WOULD_BLOCK;
+	if (result < 0) {
+		Resync();
+		return B_BAD_DATA;
+	}
+
+	status_t status = B_OK;
+	if (dest != NULL)
+		status = _Convert(dest, width, height, bytesPerRow, space);
+	av_frame_unref(fFrame);
+
+	if (status != B_OK)
+		return status;
+
+	fLastDecodeTime = system_time() - start;
+	if (fAverageDecodeTime == 0)
+		fAverageDecodeTime = fLastDecodeTime;
+	else
+		fAverageDecodeTime = (fAverageDecodeTime * 15 + fLastDecodeTime) / 16;
+
+	return B_OK;
+}
+
+void
+H264Decoder::Resync()
+{
+	if (fInitStatus != B_OK)
+		return;
+
+	avcodec_flush_buffers(fContext);
+	fWaitForIDR = true;
+}
+
+bool
+H264Decoder::_HasIDR(const uint8* data, size_t size)
+{
+	// Annex B byte stream, look for a NAL unit of type 5 behind any
+	// 00 00 01 start code (the 4 byte one ends in the same three bytes)
+	for (size_t i = 0; i + 3 < size; i++) {
+		if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+			continue;
+
+		if ((data[i + 3] & 0x1f) == 5)
+			return true;
+		i += 2;
+	}
+
+	return false;
+}
+
+status_t
+H264Decoder::_Convert(uint8* dest, uint32 width, uint32 height,
+	size_t bytesPerRow, color_space space)
+{
+	AVPixelFormat format = space == B_YCbCr422
+		? AV_PIX_FMT_YUYV422 : AV_PIX_FMT_BGRA;
+
+	// Cached, only rebuilt when the stream or the output changes
+	fScaler = sws_getCachedContext(fScaler, fFrame->width, fFrame->height,
+		(AVPixelFormat)fFrame->format, width, height, format,
+		SWS_FAST_BILINEAR, NULL, NULL, NULL);
+	if (fScaler == NULL)
+		return B_NO_MEMORY;
+
+	uint8_t* planes[4] = { dest, NULL, NULL, NULL };
+	int strides[4] = { (int)bytesPerRow, 0, 0, 0 };
+	sws_scale(fScaler, (const uint8_t* const*)fFrame->data, fFrame->linesize, 0, fFrame->height,
+		planes, strides);
+
+	return B_OK;
+}
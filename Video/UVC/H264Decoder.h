@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_H264_DECODER_H
+#define _UVC_H264_DECODER_H
+
+#include <GraphicsDefs.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+extern "C" {
+	#include "libavcodec/avcodec.h"
+	#include "libswscale/swscale.h"
+}
+
+// H.264 decoder for frame-based UVC streams. Every access unit gives one
+// picture right away: the codec runs in low delay mode with slice threads,
+// so pictures leave in the order and at the time their frames came in,
+// like MJPEG. After a lost frame nothing is shown until the next IDR.
+class H264Decoder {
+public:
+							H264Decoder();
+							~H264Decoder();
+
+			status_t		InitCheck() const { return fInitStatus; }
+
+			// A NULL dest only updates the reference pictures, returns
+			// B_WOULD_BLOCK when there was no picture to show
+			status_t		Decode(const uint8* data, size_t size,
+								uint8* dest, uint32 width, uint32 height,
+								size_t bytesPerRow,
+								color_space space = B_RGB32);
+			void			Resync();
+
+			bigtime_t		LastDecodeTime() const { return fLastDecodeTime; }
+			bigtime_t		AverageDecodeTime() const
+								{ return fAverageDecodeTime; }
+
+private:
+	static	bool			_HasIDR(const uint8* data, size_t size);
+			status_t		_Convert(uint8* dest, uint32 width,
+								uint32 height, size_t bytesPerRow,
+								color_space space);
+
+			status_t		fInitStatus;
+
+			AVCodecContext*	fContext;
+			AVPacket*		fPacket;
+			AVFrame*		fFrame;
+			SwsContext*		fScaler;
+
+			bool			fWaitForIDR;
+
+			bigtime_t		fLastDecodeTime;
+			bigtime_t		fAverageDecodeTime;
+};
+
+#endif // _UVC_H264_DECODER_H
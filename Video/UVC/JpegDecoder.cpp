@@ -0,0 +1,306 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <jerror.h>
+
+#include "JpegDecoder.h"
+
+// JFIF samples use the full 0..255 range, B_YCbCr422 is video range with
+// Y in 16..235 and Cb, Cr in 16..240
+struct VideoRange {
+	uint8	luma[256];
+	uint8	chroma[256];
+
+	VideoRange()
+	{
+		for (int i = 0; i < 256; i++) {
+			luma[i] = 16 + (i * 219 + 127) / 255;
+			chroma[i] = 16 + (i * 224 + 127) / 255;
+		}
+	}
+};
+
+static const VideoRange sVideoRange;
+
+JpegDecoder::JpegDecoder()
+	: fRows(NULL)
+	, fRowCount(0)
+	, fScratch(NULL)
+	, fScratchSize(0)
+	, fScratchRows(NULL)
+	, fScratchRowCount(0)
+	, fLastDecodeTime(0)
+	, fAverageDecodeTime(0)
+{
+	fInfo.err = jpeg_std_error(&fError.pub);
+	fError.pub.error_exit = _ErrorExit;
+	fError.pub.output_message = _OutputMessage;
+	jpeg_create_decompress(&fInfo);
+}
+
+JpegDecoder::~JpegDecoder()
+{
+	jpeg_destroy_decompress(&fInfo);
+	free(fRows);
+	free(fScratch);
+	free(fScratchRows);
+}
+
+void
+JpegDecoder::_ErrorExit(j_common_ptr cinfo)
+{
+	ErrorManager* error = (ErrorManager*)cinfo->err;
+	longjmp(error->setjmp_buffer, 1);
+}
+
+void
+JpegDecoder::_OutputMessage(j_common_ptr cinfo)
+{
+	// Corrupt-data warnings are common on USB and not worth a message
+}
+
+status_t
+JpegDecoder::Decode(const uint8* data, size_t size, uint8* dest,
+	uint32 width, uint32 height, size_t bytesPerRow, color_space space)
+{
+	if (data == NULL || size == 0 || dest == NULL)
+		return B_BAD_VALUE;
+
+	if (space != B_RGB32 && (space != B_YCbCr422 || (width & 1) != 0))
+		return B_BAD_VALUE;
+
+	if (fRowCount < height) {
+		JSAMPROW* rows = (JSAMPROW*)realloc(fRows, height * sizeof(JSAMPROW));
+		if (rows == NULL)
+			return B_NO_MEMORY;
+		fRows = rows;
+		fRowCount = height;
+	}
+
+	bigtime_t start = system_time();
+
+	status_t status = _Decode(data, size, dest, width, height, bytesPerRow,
+		space);
+	if (status != B_OK)
+		return status;
+
+	fLastDecodeTime = system_time() - start;
+	if (fAverageDecodeTime == 0)
+		fAverageDecodeTime = fLastDecodeTime;
+	else
+		fAverageDecodeTime = (fAverageDecodeTime * 15 + fLastDecodeTime) / 16;
+
+	return B_OK;
+}
+
+status_t
+JpegDecoder::_Decode(const uint8* data, size_t size, uint8* dest,
+	uint32 width, uint32 height, size_t bytesPerRow, color_space space)
+{
+	// Kept apart from Decode() so no local there lives across the longjmp
+	if (setjmp(fError.setjmp_buffer)) {
+		// Leaves the object ready for the next frame
+		jpeg_abort_decompress(&fInfo);
+		return B_ERROR;
+	}
+
+	jpeg_mem_src(&fInfo, (unsigned char*)data, size);
+	if (jpeg_read_header(&fInfo, TRUE) != JPEG_HEADER_OK) {
+		jpeg_abort_decompress(&fInfo);
+		return B_ERROR;
+	}
+
+	// Let the IDCT scale the image down when the destination is half,
+	// a quarter or an eighth of its size
+	fInfo.scale_num = 1;
+	fInfo.scale_denom = 1;
+	for (uint32 denom = 2; denom <= 8; denom *= 2) {
+		if (width != fInfo.image_width
+			&& width == (fInfo.image_width + denom - 1) / denom) {
+			fInfo.scale_denom = denom;
+			break;
+		}
+	}
+
+	size_t bytesPerPixel = 4;
+	bool raw = false;
+	if (space == B_YCbCr422) {
+		bytesPerPixel = 2;
+		raw = _CanReadRaw();
+		fInfo.out_color_space = fInfo.num_components == 1
+			? JCS_GRAYSCALE : JCS_YCbCr;
+	} else
+		fInfo.out_color_space = JCS_EXT_BGRA;
+
+	fInfo.raw_data_out = raw ? TRUE : FALSE;
+	jpeg_start_decompress(&fInfo);
+
+	if (fInfo.output_width != width || fInfo.output_height > height
+		|| fInfo.output_width * bytesPerPixel > bytesPerRow) {
+		jpeg_abort_decompress(&fInfo);
+		return B_BAD_VALUE;
+	}
+
+	if (raw)
+		_ReadRawYCbCr422(dest, bytesPerRow);
+	else if (space == B_YCbCr422)
+		_ReadYCbCr422(dest, bytesPerRow);
+	else {
+		for (uint32 i = 0; i < fInfo.output_height; i++)
+			fRows[i] = dest + i * bytesPerRow;
+
+		while (fInfo.output_scanline < fInfo.output_height) {
+			jpeg_read_scanlines(&fInfo, fRows + fInfo.output_scanline,
+				fInfo.output_height - fInfo.output_scanline);
+		}
+	}
+
+	jpeg_finish_decompress(&fInfo);
+
+	return B_OK;
+}
+
+bool
+JpegDecoder::_CanReadRaw() const
+{
+	// YCbCr with chroma halved horizontally, and optionally vertically.
+	// A scaled IDCT may already upsample the chroma, so only at full size.
+	if (fInfo.num_components != 3 || fInfo.jpeg_color_space != JCS_YCbCr
+		|| fInfo.scale_denom != 1)
+		return false;
+
+	const jpeg_component_info* comp = fInfo.comp_info;
+	return comp[0].h_samp_factor == 2
+		&& (comp[0].v_samp_factor == 1 || comp[0].v_samp_factor == 2)
+		&& comp[1].h_samp_factor == 1 && comp[1].v_samp_factor == 1
+		&& comp[2].h_samp_factor == 1 && comp[2].v_samp_factor == 1;
+}
+
+uint8*
+JpegDecoder::_Scratch(size_t size, uint32 rows)
+{
+	if (fScratchSize < size) {
+		uint8* scratch = (uint8*)realloc(fScratch, size);
+		if (scratch == NULL)
+			return NULL;
+		fScratch = scratch;
+		fScratchSize = size;
+	}
+
+	if (fScratchRowCount < rows) {
+		JSAMPROW* scratchRows = (JSAMPROW*)realloc(fScratchRows,
+			rows * sizeof(JSAMPROW));
+		if (scratchRows == NULL)
+			return NULL;
+		fScratchRows = scratchRows;
+		fScratchRowCount = rows;
+	}
+
+	return fScratch;
+}
+
+void
+JpegDecoder::_ReadRawYCbCr422(uint8* dest, size_t bytesPerRow)
+{
+	// The planes come out of the IDCT an iMCU row at a time, only the
+	// interleaving into Y0 Cb Y1 Cr is left to do
+	uint32 blockSize = DCTSIZE;
+	uint32 lumaFactor = fInfo.comp_info[0].v_samp_factor;
+	uint32 lumaRows = lumaFactor * blockSize;
+	uint32 chromaRows = blockSize;
+	size_t lumaStride = fInfo.comp_info[0].width_in_blocks * blockSize;
+	size_t chromaStride = max_c(fInfo.comp_info[1].width_in_blocks,
+		fInfo.comp_info[2].width_in_blocks) * blockSize;
+
+	uint8* scratch = _Scratch(lumaRows * lumaStride
+		+ 2 * chromaRows * chromaStride, lumaRows + 2 * chromaRows);
+	if (scratch == NULL)
+		ERREXIT(&fInfo, JERR_OUT_OF_MEMORY);
+
+	JSAMPARRAY planes[3];
+	planes[0] = fScratchRows;
+	planes[1] = fScratchRows + lumaRows;
+	planes[2] = fScratchRows + lumaRows + chromaRows;
+	for (uint32 i = 0; i < lumaRows; i++)
+		planes[0][i] = scratch + i * lumaStride;
+	scratch += lumaRows * lumaStride;
+	for (uint32 i = 0; i < chromaRows; i++) {
+		planes[1][i] = scratch + i * chromaStride;
+		planes[2][i] = scratch + (chromaRows + i) * chromaStride;
+	}
+
+	uint32 pairs = fInfo.output_width / 2;
+	while (fInfo.output_scanline < fInfo.output_height) {
+		uint32 first = fInfo.output_scanline;
+		if (jpeg_read_raw_data(&fInfo, planes, lumaRows) == 0)
+			break;
+
+		uint32 count = min_c(lumaRows, fInfo.output_height - first);
+		for (uint32 row = 0; row < count; row++) {
+			const uint8* y = planes[0][row];
+			const uint8* cb = planes[1][row / lumaFactor];
+			const uint8* cr = planes[2][row / lumaFactor];
+			uint8* out = dest + (first + row) * bytesPerRow;
+			for (uint32 i = 0; i < pairs; i++) {
+				out[0] = sVideoRange.luma[y[0]];
+				out[1] = sVideoRange.chroma[cb[i]];
+				out[2] = sVideoRange.luma[y[1]];
+				out[3] = sVideoRange.chroma[cr[i]];
+				out += 4;
+				y += 2;
+			}
+		}
+	}
+}
+
+void
+JpegDecoder::_ReadYCbCr422(uint8* dest, size_t bytesPerRow)
+{
+	// Other layouts are upsampled by libjpeg, chroma of every even pixel
+	// is kept
+	uint32 rows = max_c(1, fInfo.rec_outbuf_height);
+	size_t stride = fInfo.output_width * fInfo.output_components;
+
+	uint8* scratch = _Scratch(rows * stride, rows);
+	if (scratch == NULL)
+		ERREXIT(&fInfo, JERR_OUT_OF_MEMORY);
+
+	for (uint32 i = 0; i < rows; i++)
+		fScratchRows[i] = scratch + i * stride;
+
+	bool gray = fInfo.output_components == 1;
+	uint32 pairs = fInfo.output_width / 2;
+	while (fInfo.output_scanline < fInfo.output_height) {
+		uint32 first = fInfo.output_scanline;
+		uint32 count = jpeg_read_scanlines(&fInfo, fScratchRows, rows);
+		if (count == 0)
+			break;
+
+		for (uint32 row = 0; row < count; row++) {
+			const uint8* in = fScratchRows[row];
+			uint8* out = dest + (first + row) * bytesPerRow;
+			for (uint32 i = 0; i < pairs; i++) {
+				if (gray) {
+					out[0] = sVideoRange.luma[in[0]];
+					out[1] = 128;
+					out[2] = sVideoRange.luma[in[1]];
+					out[3] = 128;
+					in += 2;
+				} else {
+					out[0] = sVideoRange.luma[in[0]];
+					out[1] = sVideoRange.chroma[in[1]];
+					out[2] = sVideoRange.luma[in[3]];
+					out[3] = sVideoRange.chroma[in[2]];
+					in += 6;
+				}
+				out += 4;
+			}
+		}
+	}
+}
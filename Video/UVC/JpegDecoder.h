@@ -0,0 +1,72 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_JPEG_DECODER_H
+#define _UVC_JPEG_DECODER_H
+
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <GraphicsDefs.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include <jpeglib.h>
+
+// Long-lived MJPEG decoder, the decompressor and its allocations are kept
+// between frames and rows are decoded straight into the destination.
+// A destination of 1/2, 1/4 or 1/8 of the image size is decoded scaled.
+// Output is B_RGB32 or B_YCbCr422, the latter skips color conversion and
+// for the usual 4:2:x MJPEG layouts also chroma upsampling. Its samples
+// are mapped from the full JFIF range to the video range B_YCbCr422 has.
+class JpegDecoder {
+public:
+							JpegDecoder();
+							~JpegDecoder();
+
+			status_t		Decode(const uint8* data, size_t size,
+								uint8* dest, uint32 width, uint32 height,
+								size_t bytesPerRow,
+								color_space space = B_RGB32);
+
+			bigtime_t		LastDecodeTime() const { return fLastDecodeTime; }
+			bigtime_t		AverageDecodeTime() const
+								{ return fAverageDecodeTime; }
+
+private:
+	struct ErrorManager {
+		struct jpeg_error_mgr	pub;
+		jmp_buf					setjmp_buffer;
+	};
+
+	static	void			_ErrorExit(j_common_ptr cinfo);
+	static	void			_OutputMessage(j_common_ptr cinfo);
+
+			status_t		_Decode(const uint8* data, size_t size,
+								uint8* dest, uint32 width, uint32 height,
+								size_t bytesPerRow, color_space space);
+			bool			_CanReadRaw() const;
+			uint8*			_Scratch(size_t size, uint32 rows);
+			void			_ReadRawYCbCr422(uint8* dest,
+								size_t bytesPerRow);
+			void			_ReadYCbCr422(uint8* dest, size_t bytesPerRow);
+
+			struct jpeg_decompress_struct fInfo;
+			ErrorManager	fError;
+
+			JSAMPROW*		fRows;
+			uint32			fRowCount;
+
+			uint8*			fScratch;
+			size_t			fScratchSize;
+			JSAMPROW*		fScratchRows;
+			uint32			fScratchRowCount;
+
+			bigtime_t		fLastDecodeTime;
+			bigtime_t		fAverageDecodeTime;
+};
+
+#endif // _UVC_JPEG_DECODER_H
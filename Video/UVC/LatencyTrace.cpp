@@ -0,0 +1,229 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <string.h>
+
+#include <OS.h>
+#include <String.h>
+
+#include "LatencyTrace.h"
+
+static const char* kStageNames[] = {
+	"Frame assembly",
+	"libuvc callback",
+	"Decode queue",
+	"Decode",
+	"Buffer request",
+	"Send wait",
+	"Total"
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void
+LatencyHistogram::Record(bigtime_t latency)
+{
+	if (latency < 0)
+		latency = 0;
+
+	atomic_add(&fBuckets[_BucketFor(latency)], 1);
+	atomic_add(&fCount, 1);
+	atomic_add64(&fSum, latency);
+
+	int64 max = atomic_get64(&fMax);
+	while (latency > max) {
+		int64 previous = atomic_test_and_set64(&fMax, latency, max);
+		if (previous == max)
+			break;
+		max = previous;
+	}
+}
+
+void
+LatencyHistogram::Reset()
+{
+	// Not atomic as a whole, a sample recorded meanwhile may be half gone
+	for (int32 i = 0; i < kBucketCount; i++)
+		atomic_set(&fBuckets[i], 0);
+	atomic_set(&fCount, 0);
+	atomic_set64(&fSum, 0);
+	atomic_set64(&fMax, 0);
+}
+
+uint32
+LatencyHistogram::Count() const
+{
+	return (uint32)atomic_get((int32*)&fCount);
+}
+
+bigtime_t
+LatencyHistogram::Mean() const
+{
+	uint32 count = Count();
+	if (count == 0)
+		return 0;
+	return atomic_get64((int64*)&fSum) / count;
+}
+
+bigtime_t
+LatencyHistogram::Max() const
+{
+	return atomic_get64((int64*)&fMax);
+}
+
+bigtime_t
+LatencyHistogram::Percentile(float percent) const
+{
+	// Sum the buckets themselves, Count() may already include samples
+	// whose bucket wasn't counted yet
+	uint64 total = 0;
+	for (int32 i = 0; i < kBucketCount; i++)
+		total += (uint32)atomic_get((int32*)&fBuckets[i]);
+	if (total == 0)
+		return 0;
+
+	uint64 wanted = (uint64)(total * percent / 100 + 0.5);
+	if (wanted < 1)
+		wanted = 1;
+	if (wanted > total)
+		wanted = total;
+
+	uint64 seen = 0;
+	for (int32 i = 0; i < kBucketCount; i++) {
+		seen += (uint32)atomic_get((int32*)&fBuckets[i]);
+		if (seen >= wanted) {
+			bigtime_t end = _BucketEnd(i);
+			bigtime_t max = Max();
+			return max > 0 && max < end ? max : end;
+		}
+	}
+
+	return Max();
+}
+
+status_t
+LatencyHistogram::WriteBuckets(BDataIO* output) const
+{
+	for (int32 i = 0; i < kBucketCount; i++) {
+		int32 count = atomic_get((int32*)&fBuckets[i]);
+		if (count == 0)
+			continue;
+
+		BString line;
+		line.SetToFormat("\t%" B_PRIdBIGTIME " - %" B_PRIdBIGTIME " us\t%"
+			B_PRId32 "\n", _BucketStart(i), _BucketEnd(i), count);
+		status_t status = output->WriteExactly(line.String(), line.Length());
+		if (status != B_OK)
+			return status;
+	}
+	return B_OK;
+}
+
+int32
+LatencyHistogram::_BucketFor(bigtime_t latency)
+{
+	// Exact below 2 * kSubBuckets, then kSubBuckets per power of two
+	if (latency < 2 * kSubBuckets)
+		return (int32)latency;
+
+	if (latency >= (bigtime_t)1 << kMaxBits)
+		return kBucketCount - 1;
+
+	int32 bits = 0;
+	while ((latency >> bits) >= 2 * kSubBuckets)
+		bits++;
+
+	return bits * kSubBuckets + (int32)(latency >> bits);
+}
+
+bigtime_t
+LatencyHistogram::_BucketStart(int32 bucket)
+{
+	if (bucket < 2 * kSubBuckets)
+		return bucket;
+
+	int32 bits = bucket / kSubBuckets - 1;
+	return (bigtime_t)(bucket % kSubBuckets + kSubBuckets) << bits;
+}
+
+bigtime_t
+LatencyHistogram::_BucketEnd(int32 bucket)
+{
+	if (bucket < 2 * kSubBuckets)
+		return bucket;
+
+	int32 bits = bucket / kSubBuckets - 1;
+	return _BucketStart(bucket) + ((bigtime_t)1 << bits) - 1;
+}
+
+LatencyTrace::LatencyTrace()
+	: fEnabled(0)
+{
+}
+
+void
+LatencyTrace::SetEnabled(bool enabled)
+{
+	atomic_set(&fEnabled, enabled ? 1 : 0);
+}
+
+void
+LatencyTrace::Record(int32 stage, bigtime_t latency)
+{
+	if (stage < 0 || stage >= kStageCount || !IsEnabled())
+		return;
+
+	fStages[stage].Record(latency);
+}
+
+void
+LatencyTrace::Reset()
+{
+	for (int32 i = 0; i < kStageCount; i++)
+		fStages[i].Reset();
+}
+
+const char*
+LatencyTrace::StageName(int32 stage)
+{
+	if (stage < 0 || stage >= kStageCount)
+		return NULL;
+	return kStageNames[stage];
+}
+
+status_t
+LatencyTrace::WriteTo(BDataIO* output) const
+{
+	BString header;
+	header.SetToFormat("%-16s%10s%10s%10s%10s%10s%10s%10s\n", "Stage (us)",
+		"Frames", "Mean", "50%", "90%", "99%", "99.9%", "Max");
+	status_t status = output->WriteExactly(header.String(), header.Length());
+
+	for (int32 i = 0; i < kStageCount && status == B_OK; i++) {
+		const LatencyHistogram& stage = fStages[i];
+		BString line;
+		line.SetToFormat("%-16s%10" B_PRIu32 "%10" B_PRIdBIGTIME
+			"%10" B_PRIdBIGTIME "%10" B_PRIdBIGTIME "%10" B_PRIdBIGTIME
+			"%10" B_PRIdBIGTIME "%10" B_PRIdBIGTIME "\n", kStageNames[i],
+			stage.Count(), stage.Mean(), stage.Percentile(50),
+			stage.Percentile(90), stage.Percentile(99),
+			stage.Percentile(99.9f), stage.Max());
+		status = output->WriteExactly(line.String(), line.Length());
+	}
+
+	for (int32 i = 0; i < kStageCount && status == B_OK; i++) {
+		BString title;
+		title.SetToFormat("\n%s\n", kStageNames[i]);
+		status = output->WriteExactly(title.String(), title.Length());
+		if (status == B_OK)
+			status = fStages[i].WriteBuckets(output);
+	}
+
+	return status;
+}
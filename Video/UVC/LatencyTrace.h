@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_LATENCY_TRACE_H
+#define _UVC_LATENCY_TRACE_H
+
+#include <DataIO.h>
+#include <SupportDefs.h>
+
+// Log-linear histogram of latencies in microseconds, every power of two
+// is split into 16 buckets, so values are kept within 1/16 of their size
+// from 0 up to about half an hour. Record() is lock free and may be called
+// from any number of threads.
+class LatencyHistogram {
+public:
+							LatencyHistogram();
+
+			void			Record(bigtime_t latency);
+			void			Reset();
+
+			uint32			Count() const;
+			bigtime_t		Mean() const;
+			bigtime_t		Max() const;
+			// Highest latency of the lowest percent of the samples
+			bigtime_t		Percentile(float percent) const;
+
+			status_t		WriteBuckets(BDataIO* output) const;
+
+private:
+	enum {
+		kSubBucketBits	= 4,
+		kSubBuckets		= 1 << kSubBucketBits,
+		kMaxBits		= 31,
+		kBucketCount	= (kMaxBits - kSubBucketBits + 1) * kSubBuckets
+	};
+
+	static	int32			_BucketFor(bigtime_t latency);
+	static	bigtime_t		_BucketStart(int32 bucket);
+	static	bigtime_t		_BucketEnd(int32 bucket);
+
+			int32			fBuckets[kBucketCount];
+			int32			fCount;
+			int64			fSum;
+			int64			fMax;
+};
+
+// Per stage latency histograms of the UVC pipeline, from the USB transfer
+// that completed a frame to the SendBuffer() of the frame.
+class LatencyTrace {
+public:
+	enum {
+		// last USB transfer of the frame back to frame complete
+		kFrameAssembly = 0,
+		// frame complete to the libuvc callback thread
+		kCallback,
+		// libuvc callback to the decode thread
+		kDecodeQueue,
+		kDecode,
+		kBufferRequest,
+		// decoded to sent
+		kSendWait,
+		// last USB transfer of the frame to sent
+		kTotal,
+		kStageCount
+	};
+
+							LatencyTrace();
+
+			// Nothing is recorded while disabled
+			void			SetEnabled(bool enabled);
+			bool			IsEnabled() const { return fEnabled != 0; }
+
+			void			Record(int32 stage, bigtime_t latency);
+			void			Reset();
+
+			const LatencyHistogram& Stage(int32 stage) const
+								{ return fStages[stage]; }
+	static	const char*		StageName(int32 stage);
+
+			status_t		WriteTo(BDataIO* output) const;
+
+private:
+			int32			fEnabled;
+			LatencyHistogram fStages[kStageCount];
+};
+
+#endif // _UVC_LATENCY_TRACE_H
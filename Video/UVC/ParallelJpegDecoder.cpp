@@ -0,0 +1,325 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ParallelJpegDecoder.h"
+
+#define MAX_BANDS 8
+
+static inline uint32
+read_be16(const uint8* data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+static uint32
+gcd(uint32 a, uint32 b)
+{
+	while (b != 0) {
+		uint32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+ParallelJpegDecoder::ParallelJpegDecoder(DecodePool* pool)
+	: fInitStatus(B_NO_INIT)
+	, fPool(pool)
+	, fBands(NULL)
+	, fBandCount(0)
+	, fWidth(0)
+	, fBytesPerRow(0)
+	, fColorSpace(B_RGB32)
+	, fMarkers(NULL)
+	, fMarkerCapacity(0)
+	, fLastDecodeTime(0)
+	, fAverageDecodeTime(0)
+{
+	if (fPool == NULL || fPool->InitCheck() != B_OK)
+		return;
+
+	// One band per pool thread and one for the calling thread
+	int32 bands = max_c(1, min_c(fPool->CountThreads() + 1, MAX_BANDS));
+
+	fBands = new Band[bands];
+	for (int32 i = 0; i < bands; i++) {
+		fBands[i].data = NULL;
+		fBands[i].size = 0;
+		fBands[i].capacity = 0;
+		fBands[i].dest = NULL;
+		fBands[i].height = 0;
+		fBands[i].status = B_OK;
+	}
+
+	fBandCount = bands;
+	fInitStatus = B_OK;
+}
+
+ParallelJpegDecoder::~ParallelJpegDecoder()
+{
+	for (int32 i = 0; i < fBandCount; i++)
+		free(fBands[i].data);
+
+	delete[] fBands;
+	free(fMarkers);
+}
+
+status_t
+ParallelJpegDecoder::Decode(const uint8* data, size_t size, uint8* dest,
+	uint32 width, uint32 height, size_t bytesPerRow, color_space space)
+{
+	bigtime_t start = system_time();
+
+	status_t status = B_ERROR;
+	int32 jobs = 0;
+	if (fInitStatus == B_OK)
+		jobs = _Split(data, size, dest, width, height, bytesPerRow);
+
+	if (jobs > 1) {
+		fWidth = width;
+		fBytesPerRow = bytesPerRow;
+		fColorSpace = space;
+
+		fPool->Run(this, jobs);
+
+		status = B_OK;
+		for (int32 i = 0; i < jobs; i++) {
+			if (fBands[i].status != B_OK)
+				status = fBands[i].status;
+		}
+	}
+
+	// No usable restart markers, or a band was damaged
+	if (status != B_OK && fBands != NULL) {
+		status = fBands[0].decoder.Decode(data, size, dest, width, height,
+			bytesPerRow, space);
+	}
+
+	if (status != B_OK)
+		return status;
+
+	fLastDecodeTime = system_time() - start;
+	if (fAverageDecodeTime == 0)
+		fAverageDecodeTime = fLastDecodeTime;
+	else
+		fAverageDecodeTime = (fAverageDecodeTime * 15 + fLastDecodeTime) / 16;
+
+	return B_OK;
+}
+
+int32
+ParallelJpegDecoder::_Split(const uint8* data, size_t size, uint8* dest,
+	uint32 width, uint32 height, size_t bytesPerRow)
+{
+	if (fBandCount < 2 || data == NULL || size < 4
+		|| data[0] != 0xFF || data[1] != 0xD8)
+		return 0;
+
+	// Walk the header up to the start of scan
+	size_t sofOffset = 0;
+	size_t scanStart = 0;
+	uint32 imageWidth = 0;
+	uint32 imageHeight = 0;
+	uint32 components = 0;
+	uint32 maxH = 1;
+	uint32 maxV = 1;
+	uint32 restartInterval = 0;
+
+	size_t pos = 2;
+	while (scanStart == 0 && pos + 4 <= size) {
+		if (data[pos] != 0xFF)
+			return 0;
+
+		uint8 marker = data[pos + 1];
+		if (marker == 0xFF) {
+			pos++;
+			continue;
+		}
+
+		uint32 length = read_be16(data + pos + 2);
+		if (length < 2 || pos + 2 + length > size)
+			return 0;
+
+		const uint8* segment = data + pos + 4;
+		switch (marker) {
+			case 0xC0:
+			case 0xC1:
+				if (length < 8)
+					return 0;
+				sofOffset = pos + 5;
+				imageHeight = read_be16(segment + 1);
+				imageWidth = read_be16(segment + 3);
+				components = segment[5];
+				if (components == 0 || length < 8 + components * 3)
+					return 0;
+				for (uint32 i = 0; i < components; i++) {
+					maxH = max_c(maxH, (uint32)(segment[7 + i * 3] >> 4));
+					maxV = max_c(maxV, (uint32)(segment[7 + i * 3] & 0x0F));
+				}
+				break;
+			// Progressive, lossless and arithmetic coded frames
+			case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+			case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+				return 0;
+			case 0xDD:
+				if (length < 4)
+					return 0;
+				restartInterval = read_be16(segment);
+				break;
+			case 0xDA:
+				// Only a single interleaved scan can be split
+				if (sofOffset == 0 || segment[0] != components)
+					return 0;
+				scanStart = pos + 2 + length;
+				break;
+		}
+
+		pos += 2 + length;
+	}
+
+	if (scanStart == 0 || restartInterval == 0 || imageHeight == 0)
+		return 0;
+
+	// Same reduction the band decoders will pick from the width
+	uint32 scale = 1;
+	for (uint32 denom = 2; denom <= 8; denom *= 2) {
+		if (width != imageWidth && width == (imageWidth + denom - 1) / denom) {
+			scale = denom;
+			break;
+		}
+	}
+
+	if ((imageWidth + scale - 1) / scale != width
+		|| (imageHeight + scale - 1) / scale > height)
+		return 0;
+
+	// A non-interleaved scan codes one block per MCU
+	if (components == 1) {
+		maxH = 1;
+		maxV = 1;
+	}
+
+	uint32 mcuHeight = 8 * maxV;
+	uint32 mcusPerRow = (imageWidth + 8 * maxH - 1) / (8 * maxH);
+	uint32 mcuRows = (imageHeight + mcuHeight - 1) / mcuHeight;
+	uint32 intervals = (mcusPerRow * mcuRows + restartInterval - 1)
+		/ restartInterval;
+
+	// Find the restart markers in the entropy coded data
+	if (fMarkerCapacity < (int32)intervals) {
+		size_t* markers = (size_t*)realloc(fMarkers,
+			intervals * sizeof(size_t));
+		if (markers == NULL)
+			return 0;
+		fMarkers = markers;
+		fMarkerCapacity = intervals;
+	}
+
+	uint32 markerCount = 0;
+	size_t scanEnd = size;
+	for (size_t i = scanStart; i + 1 < size; i++) {
+		if (data[i] != 0xFF)
+			continue;
+
+		uint8 marker = data[i + 1];
+		if (marker == 0x00 || marker == 0xFF)
+			continue;
+
+		if (marker >= 0xD0 && marker <= 0xD7) {
+			if (markerCount + 1 >= intervals)
+				return 0;
+			fMarkers[markerCount++] = i;
+			i++;
+			continue;
+		}
+
+		scanEnd = i;
+		break;
+	}
+
+	if (markerCount + 1 != intervals)
+		return 0;
+
+	// Bands may only start on MCU rows that begin a restart interval
+	uint32 step = restartInterval / gcd(mcusPerRow, restartInterval);
+	uint32 units = mcuRows / step;
+	int32 bands = min_c((uint32)fBandCount, units);
+	if (bands < 2)
+		return 0;
+
+	for (int32 k = 0; k < bands; k++) {
+		uint32 firstRow = (k * units / bands) * step;
+		uint32 lastRow = k + 1 == bands ? mcuRows
+			: ((k + 1) * units / bands) * step;
+
+		uint32 firstInterval = firstRow * mcusPerRow / restartInterval;
+		uint32 lastInterval = k + 1 == bands ? intervals
+			: lastRow * mcusPerRow / restartInterval;
+
+		size_t start = firstInterval == 0 ? scanStart
+			: fMarkers[firstInterval - 1] + 2;
+		size_t end = lastInterval == intervals ? scanEnd
+			: fMarkers[lastInterval - 1];
+
+		uint32 firstLine = firstRow * mcuHeight;
+		uint32 bandHeight = min_c(lastRow * mcuHeight, imageHeight) - firstLine;
+
+		Band& band = fBands[k];
+		if (_BuildBand(band, data, scanStart, sofOffset, start, end,
+				bandHeight) != B_OK)
+			return 0;
+
+		// Restart markers count from RST0 again in every band
+		for (uint32 j = firstInterval; j + 1 < lastInterval; j++) {
+			band.data[scanStart + fMarkers[j] - start + 1]
+				= 0xD0 + ((j - firstInterval) & 7);
+		}
+
+		// Band edges are on MCU rows, so they divide by the scale
+		band.dest = dest + firstLine / scale * bytesPerRow;
+		band.height = (bandHeight + scale - 1) / scale;
+		band.status = B_OK;
+	}
+
+	return bands;
+}
+
+status_t
+ParallelJpegDecoder::_BuildBand(Band& band, const uint8* data,
+	size_t headerSize, size_t sofOffset, size_t scanStart, size_t scanEnd,
+	uint32 bandHeight)
+{
+	size_t size = headerSize + (scanEnd - scanStart) + 2;
+	if (band.capacity < size) {
+		uint8* buffer = (uint8*)realloc(band.data, size);
+		if (buffer == NULL)
+			return B_NO_MEMORY;
+		band.data = buffer;
+		band.capacity = size;
+	}
+
+	memcpy(band.data, data, headerSize);
+	band.data[sofOffset] = bandHeight >> 8;
+	band.data[sofOffset + 1] = bandHeight & 0xFF;
+
+	memcpy(band.data + headerSize, data + scanStart, scanEnd - scanStart);
+	band.data[size - 2] = 0xFF;
+	band.data[size - 1] = 0xD9;
+	band.size = size;
+
+	return B_OK;
+}
+
+void
+ParallelJpegDecoder::RunPart(int32 index)
+{
+	Band& band = fBands[index];
+	band.status = band.decoder.Decode(band.data, band.size, band.dest,
+		fWidth, band.height, fBytesPerRow, fColorSpace);
+}
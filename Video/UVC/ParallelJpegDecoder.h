@@ -0,0 +1,77 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_PARALLEL_JPEG_DECODER_H
+#define _UVC_PARALLEL_JPEG_DECODER_H
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include "DecodePool.h"
+#include "JpegDecoder.h"
+
+// Decodes baseline MJPEG frames that carry restart markers on the threads
+// of a DecodePool, which may be shared with other decoders. The scan is
+// cut at restart markers that fall on MCU row boundaries, every band is
+// rebuilt into a small JPEG of its own and decoded into its rows of the
+// destination. Frames without restart markers are decoded on the calling
+// thread. With vertically subsampled
+// chroma the rows next to a cut may differ slightly from a single pass,
+// the upsampler can't look across it.
+class ParallelJpegDecoder : private DecodeJob {
+public:
+							ParallelJpegDecoder(DecodePool* pool);
+							~ParallelJpegDecoder();
+
+			status_t		InitCheck() const { return fInitStatus; }
+			int32			CountThreads() const { return fBandCount; }
+
+			status_t		Decode(const uint8* data, size_t size,
+								uint8* dest, uint32 width, uint32 height,
+								size_t bytesPerRow,
+								color_space space = B_RGB32);
+
+			bigtime_t		LastDecodeTime() const { return fLastDecodeTime; }
+			bigtime_t		AverageDecodeTime() const
+								{ return fAverageDecodeTime; }
+
+private:
+	struct Band {
+		JpegDecoder		decoder;
+		uint8*			data;
+		size_t			size;
+		size_t			capacity;
+		uint8*			dest;
+		uint32			height;
+		status_t		status;
+	};
+
+			int32			_Split(const uint8* data, size_t size,
+								uint8* dest, uint32 width, uint32 height,
+								size_t bytesPerRow);
+			status_t		_BuildBand(Band& band, const uint8* data,
+								size_t headerSize, size_t sofOffset,
+								size_t scanStart, size_t scanEnd,
+								uint32 bandHeight);
+	virtual	void			RunPart(int32 index);
+
+			status_t		fInitStatus;
+			DecodePool*		fPool;
+
+			Band*			fBands;
+			int32			fBandCount;
+			uint32			fWidth;
+			size_t			fBytesPerRow;
+			color_space		fColorSpace;
+
+			size_t*			fMarkers;
+			int32			fMarkerCapacity;
+
+			bigtime_t		fLastDecodeTime;
+			bigtime_t		fAverageDecodeTime;
+};
+
+#endif // _UVC_PARALLEL_JPEG_DECODER_H
@@ -8,6 +8,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <Buffer.h>
 #include <BufferGroup.h>
 #include <ParameterWeb.h>
@@ -19,21 +21,30 @@
 
 #include "Producer.h"
 
-#include <jpeglib.h>
-#include <setjmp.h>
+// libuvc stamps CLOCK_MONOTONIC, the system_time() clock
+static inline bigtime_t
+monotonic_to_system_time(const struct timespec& time)
+{
+	return (bigtime_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
 
-struct JpegErrorManager {
-	struct jpeg_error_mgr pub;
-	jmp_buf setjmp_buffer;
-};
+// All zero is green in B_YCbCr422, black is Y 16 with neutral chroma
+static void
+fill_black(uint8 *dest, size_t size, color_space space)
+{
+	if (space != B_YCbCr422) {
+		memset(dest, 0, size);
+		return;
+	}
 
-void JpegErrorExit(j_common_ptr cinfo) {
-	JpegErrorManager* myerr = (JpegErrorManager*)cinfo->err;
-	longjmp(myerr->setjmp_buffer, 1);
+	static const uint8 kBlack[4] = { 16, 128, 16, 128 };
+	for (size_t i = 0; i + sizeof(kBlack) <= size; i += sizeof(kBlack))
+		memcpy(dest + i, kBlack, sizeof(kBlack));
 }
 
 UVCProducer::UVCProducer(
-		BMediaAddOn *addon, const char *name, int32 internal_id, uvc_device_t* device)
+		BMediaAddOn *addon, const char *name, int32 internal_id, uvc_device_t* device,
+		DecodePool* decodePool, const char* replayPath)
 	: BMediaNode(name)
 	, BMediaEventLooper()
 	, BBufferProducer(B_MEDIA_RAW_VIDEO)
@@ -43,26 +54,67 @@ UVCProducer::UVCProducer(
 	, fAddOn(addon)
 	, fBufferGroup(NULL)
 	, fThread(-1)
-	, fFrame(0)
-	, fFrameBase(0)
 	, fFrameSync(-1)
-	, fPerformanceTimeBase(0)
+	, fFrame(0)
 	, fProcessingLatency(0LL)
 	, fRunning(false)
 	, fConnected(false)
 	, fEnabled(false)
+	, fFrameBufferSize(0)
+	, fFrameQueue(2, 2)
+	, fDecodeThread(-1)
+	, fDirectDecode(true)
+	, fPendingBuffer(NULL)
+	, fCameraClock(true)
+	, fCaptureTime(0)
+	, fCaptureLatency(0)
+	, fCaptureDelayCount(0)
+	, fCaptureDelayIndex(0)
+	, fClockDrift(0)
+	, fTraceTransferTime(0)
+	, fTraceDecodedTime(0)
+	, fTraceSequence(0)
+	, fTraceSentSequence(0)
+	, fDecodePool(decodePool)
+	, fParallelDecoder(NULL)
+	, fParallelDecode(true)
+	, fH264Decoder(NULL)
+	, fH264Dropped(0)
+	, fDecodeTime(0)
 	, fDevice(device)
 	, fDeviceHandle(NULL)
+	, fDeviceDescriptor(NULL)
+	, fRecordPayloads(false)
+	, fReplayPath(replayPath)
+	, fReplayMaxSpeed(false)
+	, fRefreshThread(-1)
+	, fControlWorker(NULL)
 	, fCurrentFormatIndex(1)
 	, fCurrentResolutionIndex(1)
 	, fCurrentFrameRateIndex(1)
-	, fFrameBuffer(NULL)
-	, fFrameBufferSize(0)
+	, fScale(1)
 	, fLastFormatChange(0)
 	, fLastResolutionChange(0)
 	, fLastFrameRateChange(0)
 	, fLastPresetChange(0)
+	, fLastDirectDecodeChange(0)
+	, fLastParallelDecodeChange(0)
+	, fLastScaleChange(0)
+	, fLastCameraClockChange(0)
+	, fLastLatencyTraceChange(0)
+	, fLastStreamModeChange(0)
+	, fLastLatencySavedChange(0)
+	, fLastRecordChange(0)
+	, fLastReplaySpeedChange(0)
+	, fLastHoldFrameRateChange(0)
+	, fLastStillCaptureChange(0)
+	, fHoldFrameRate(false)
+	, fStillPending(0)
+	, fStillThread(-1)
+	, fStillWriter(NULL)
 {
+	memset(&fStreamCtrl, 0, sizeof(fStreamCtrl));
+
 	fOutput.destination = media_destination::null;
 	fOutput.format.type = B_MEDIA_RAW_VIDEO;
 	fOutput.format.u.raw_video = media_raw_video_format::wildcard;
@@ -73,6 +125,11 @@ UVCProducer::UVCProducer(
 
 UVCProducer::~UVCProducer()
 {
+	if (fRefreshThread >= B_OK) {
+		status_t result;
+		wait_for_thread(fRefreshThread, &result);
+	}
+
 	SaveAddonSettings();
 
 	CleanupDevice();
@@ -88,17 +145,32 @@ UVCProducer::~UVCProducer()
 
 	while (!fControls.IsEmpty())
 		delete (ControlDesc*)fControls.RemoveItem((int32)0);
-
-	delete[] fFrameBuffer;
 }
 
 status_t
 UVCProducer::SetupDevice()
 {
+	if (!fReplayPath.IsEmpty()) {
+		// Loops, a benchmark runs as long as the node does
+		if (uvc_replay_open(fReplayPath.String(), UVC_REPLAY_LOOP,
+				&fDeviceHandle) < 0)
+			return B_ERROR;
+
+		if (uvc_replay_get_device_descriptor(fDeviceHandle,
+				&fDeviceDescriptor) < 0)
+			return B_ERROR;
+
+		return B_OK;
+	}
+
 	uvc_error_t res = uvc_open(fDevice, &fDeviceHandle);
 	if (res < 0)
 		return B_ERROR;
 
+	fControlWorker = new ControlWorker(this);
+	if (fControlWorker->InitCheck() != B_OK)
+		return fControlWorker->InitCheck();
+
     
     res = uvc_get_device_descriptor(fDevice, &fDeviceDescriptor);
     if (res < 0)	        
@@ -123,12 +195,38 @@ UVCProducer::CleanupDevice()
 		fDeviceDescriptor = NULL;
 	}
 
+	// Finishes a write in progress, the device has to stay open for it
+	delete fControlWorker;
+	fControlWorker = NULL;
+
 	if (fDeviceHandle) {
 		uvc_close(fDeviceHandle);
 		fDeviceHandle = NULL;
 	}
 }
 
+UVCProducer::FormatDesc*
+UVCProducer::CurrentFormat() const
+{
+	for (int32 i = 0; i < fFormats.CountItems(); i++) {
+		FormatDesc* desc = (FormatDesc*)fFormats.ItemAt(i);
+		if (desc->index == fCurrentFormatIndex)
+			return desc;
+	}
+	return NULL;
+}
+
+UVCProducer::FrameRateDesc*
+UVCProducer::CurrentFrameRate() const
+{
+	for (int32 i = 0; i < fFrameRates.CountItems(); i++) {
+		FrameRateDesc* desc = (FrameRateDesc*)fFrameRates.ItemAt(i);
+		if (desc->index == fCurrentFrameRateIndex)
+			return desc;
+	}
+	return NULL;
+}
+
 status_t
 UVCProducer::CollectFormats()
 {
@@ -142,12 +240,29 @@ UVCProducer::CollectFormats()
 			strcpy(desc->name, "MJPEG");
 			fFormats.AddItem(desc);
 		}
+		else if (format_desc->bDescriptorSubtype == UVC_VS_FORMAT_FRAME_BASED) {
+			// Frame based formats are offered when they carry H.264
+			if (uvc_frame_format_for_guid(format_desc->guidFormat)
+					== UVC_FRAME_FORMAT_H264) {
+				FormatDesc* desc = new FormatDesc;
+				desc->index = format_desc->bFormatIndex;
+				desc->format = UVC_FRAME_FORMAT_H264;
+				strcpy(desc->name, "H.264");
+				fFormats.AddItem(desc);
+			}
+		}
 		else if (format_desc->bDescriptorSubtype == UVC_VS_FORMAT_UNCOMPRESSED) {
-			FormatDesc* desc = new FormatDesc;
-			desc->index = format_desc->bFormatIndex;
-			desc->format = UVC_FRAME_FORMAT_YUYV;
-			strcpy(desc->name, "YUYV");
-			fFormats.AddItem(desc);
+			// The GUID tells which uncompressed format this is, formats
+			// we can't convert are not offered at all
+			uvc_frame_format frameFormat
+				= uvc_frame_format_for_guid(format_desc->guidFormat);
+			if (ColorConverter::IsSupported(frameFormat)) {
+				FormatDesc* desc = new FormatDesc;
+				desc->index = format_desc->bFormatIndex;
+				desc->format = frameFormat;
+				strcpy(desc->name, ColorConverter::FormatName(frameFormat));
+				fFormats.AddItem(desc);
+			}
 		}
 		format_desc = format_desc->next;
 	}
@@ -215,6 +330,7 @@ UVCProducer::CollectFrameRates(uint8_t formatIndex, uint8_t frameIndex)
 		if (fps > 0) {
 			FrameRateDesc* desc = new FrameRateDesc;
 			desc->fps = fps;
+			desc->interval = *interval;
 			desc->index = index;
 			fFrameRates.AddItem(desc);
 		}
@@ -225,70 +341,408 @@ UVCProducer::CollectFrameRates(uint8_t formatIndex, uint8_t frameIndex)
 	return fFrameRates.IsEmpty() ? B_ERROR : B_OK;
 }
 
+const UVCProducer::ControlInfo UVCProducer::kControlInfos[] = {
+	{ P_BRIGHTNESS, "Brightness", CONTROL_PROCESSING, 0,
+		UVC_PU_BRIGHTNESS_CONTROL, 2, true, CONTROL_RANGE },
+	{ P_CONTRAST, "Contrast", CONTROL_PROCESSING, 1,
+		UVC_PU_CONTRAST_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_CONTRAST_AUTO, "Auto contrast", CONTROL_PROCESSING, 18,
+		UVC_PU_CONTRAST_AUTO_CONTROL, 1, false, CONTROL_TOGGLE },
+	{ P_HUE, "Hue", CONTROL_PROCESSING, 2,
+		UVC_PU_HUE_CONTROL, 2, true, CONTROL_RANGE },
+	{ P_HUE_AUTO, "Auto hue", CONTROL_PROCESSING, 11,
+		UVC_PU_HUE_AUTO_CONTROL, 1, false, CONTROL_TOGGLE },
+	{ P_SATURATION, "Saturation", CONTROL_PROCESSING, 3,
+		UVC_PU_SATURATION_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_SHARPNESS, "Sharpness", CONTROL_PROCESSING, 4,
+		UVC_PU_SHARPNESS_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_GAMMA, "Gamma", CONTROL_PROCESSING, 5,
+		UVC_PU_GAMMA_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_WHITE_BALANCE, "White balance", CONTROL_PROCESSING, 6,
+		UVC_PU_WHITE_BALANCE_TEMPERATURE_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_WHITE_BALANCE_AUTO, "Auto white balance", CONTROL_PROCESSING, 12,
+		UVC_PU_WHITE_BALANCE_TEMPERATURE_AUTO_CONTROL, 1, false,
+		CONTROL_TOGGLE },
+	{ P_BACKLIGHT, "Backlight compensation", CONTROL_PROCESSING, 8,
+		UVC_PU_BACKLIGHT_COMPENSATION_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_GAIN, "Gain", CONTROL_PROCESSING, 9,
+		UVC_PU_GAIN_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_POWER_LINE, "Power line frequency", CONTROL_PROCESSING, 10,
+		UVC_PU_POWER_LINE_FREQUENCY_CONTROL, 1, false, CONTROL_MENU },
+	{ P_AE_MODE, "Exposure mode", CONTROL_CAMERA, 1,
+		UVC_CT_AE_MODE_CONTROL, 1, false, CONTROL_MENU },
+	{ P_AE_PRIORITY, "Lower frame rate in low light", CONTROL_CAMERA, 2,
+		UVC_CT_AE_PRIORITY_CONTROL, 1, false, CONTROL_TOGGLE },
+	{ P_EXPOSURE, "Exposure time", CONTROL_CAMERA, 3,
+		UVC_CT_EXPOSURE_TIME_ABSOLUTE_CONTROL, 4, false, CONTROL_RANGE },
+	{ P_IRIS, "Iris", CONTROL_CAMERA, 7,
+		UVC_CT_IRIS_ABSOLUTE_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_FOCUS, "Focus", CONTROL_CAMERA, 5,
+		UVC_CT_FOCUS_ABSOLUTE_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_FOCUS_AUTO, "Auto focus", CONTROL_CAMERA, 17,
+		UVC_CT_FOCUS_AUTO_CONTROL, 1, false, CONTROL_TOGGLE },
+	{ P_ZOOM, "Zoom", CONTROL_CAMERA, 9,
+		UVC_CT_ZOOM_ABSOLUTE_CONTROL, 2, false, CONTROL_RANGE },
+	{ P_ROLL, "Roll", CONTROL_CAMERA, 13,
+		UVC_CT_ROLL_ABSOLUTE_CONTROL, 2, true, CONTROL_RANGE },
+	{ P_PRIVACY, "Privacy shutter", CONTROL_CAMERA, 18,
+		UVC_CT_PRIVACY_CONTROL, 1, false, CONTROL_TOGGLE },
+	{ 0, NULL, 0, 0, 0, 0, false, 0 }
+};
+
+const UVCProducer::AutoControl UVCProducer::kAutoControls[] = {
+	{ P_CONTRAST, P_CONTRAST_AUTO, 0 },
+	{ P_HUE, P_HUE_AUTO, 0 },
+	{ P_WHITE_BALANCE, P_WHITE_BALANCE_AUTO, 0 },
+	// Manual and shutter priority
+	{ P_EXPOSURE, P_AE_MODE, 1 | 4 },
+	// Manual and aperture priority
+	{ P_IRIS, P_AE_MODE, 1 | 8 },
+	{ P_FOCUS, P_FOCUS_AUTO, 0 },
+	{ 0, 0, 0 }
+};
+
+bool
+UVCProducer::IsModeControl(int32 id)
+{
+	return id == P_AE_MODE || id == P_AE_PRIORITY || id == P_CONTRAST_AUTO
+		|| id == P_HUE_AUTO || id == P_WHITE_BALANCE_AUTO
+		|| id == P_FOCUS_AUTO;
+}
+
 status_t
 UVCProducer::InitControls()
 {
 	while (!fControls.IsEmpty())
 		delete (ControlDesc*)fControls.RemoveItem((int32)0);
 	
-	int16_t reqInt16;
-	uint16_t reqUint16;
-	
+	const uvc_input_terminal_t *camera_terminal = uvc_get_camera_terminal(fDeviceHandle);
 	const uvc_processing_unit_t *processing_unit = uvc_get_processing_units(fDeviceHandle);
-	if (processing_unit) {
-		uint32_t bmControls = processing_unit->bmControls;
-		if (bmControls & (1 << 0)) {
-			ControlDesc *ctrl = new ControlDesc;
-			ctrl->param_id = P_BRIGHTNESS;
-			strcpy(ctrl->name, "Brightness");
-			uvc_get_brightness(fDeviceHandle, &reqInt16, UVC_GET_MIN); ctrl->min = (float)reqInt16;
-			uvc_get_brightness(fDeviceHandle, &reqInt16, UVC_GET_MAX); ctrl->max = (float)reqInt16;
-			uvc_get_brightness(fDeviceHandle, &reqInt16, UVC_GET_DEF); ctrl->def = (float)reqInt16;
-			ctrl->value = ctrl->def;
-			ctrl->prev_value = ctrl->def;
-			ctrl->changed = 0;
-			fControls.AddItem(ctrl);	
-		}
-		if (bmControls & (1 << 1)) {
-			ControlDesc *ctrl = new ControlDesc;
-			ctrl->param_id = P_CONTRAST;
-			strcpy(ctrl->name, "Contrast");
-			uvc_get_contrast(fDeviceHandle, &reqUint16, UVC_GET_MIN); ctrl->min = (float)reqUint16;
-			uvc_get_contrast(fDeviceHandle, &reqUint16, UVC_GET_MAX); ctrl->max = (float)reqUint16;
-			uvc_get_contrast(fDeviceHandle, &reqUint16, UVC_GET_DEF); ctrl->def = (float)reqUint16;
-			ctrl->value = ctrl->def;
-			ctrl->prev_value = ctrl->def;
-			ctrl->changed = 0;
-			fControls.AddItem(ctrl);
-		}
-		if (bmControls & (1 << 2)) {
-			ControlDesc *ctrl = new ControlDesc;
-			ctrl->param_id = P_HUE;
-			strcpy(ctrl->name, "Hue");
-			uvc_get_hue(fDeviceHandle, &reqInt16, UVC_GET_MIN); ctrl->min = (float)reqInt16;
-			uvc_get_hue(fDeviceHandle, &reqInt16, UVC_GET_MAX); ctrl->max = (float)reqInt16;
-			uvc_get_hue(fDeviceHandle, &reqInt16, UVC_GET_DEF); ctrl->def = (float)reqInt16;
-			ctrl->value = ctrl->def;
-			ctrl->prev_value = ctrl->def;
-			ctrl->changed = 0;
-			fControls.AddItem(ctrl);
-		}
-		if (bmControls & (1 << 3)) {
-			ControlDesc *ctrl = new ControlDesc;
-			ctrl->param_id = P_SATURATION;
-			strcpy(ctrl->name, "Saturation");
-			uvc_get_saturation(fDeviceHandle, &reqUint16, UVC_GET_MIN); ctrl->min = (float)reqUint16;
-			uvc_get_saturation(fDeviceHandle, &reqUint16, UVC_GET_MAX); ctrl->max = (float)reqUint16;
-			uvc_get_saturation(fDeviceHandle, &reqUint16, UVC_GET_DEF); ctrl->def = (float)reqUint16;
-			ctrl->value = ctrl->def;
-			ctrl->prev_value = ctrl->def;
-			ctrl->changed = 0;
-			fControls.AddItem(ctrl);
+	if (!camera_terminal && !processing_unit)
+		return B_ERROR;
+
+	for (int32 i = 0; kControlInfos[i].name != NULL; i++) {
+		const ControlInfo& info = kControlInfos[i];
+		uint8 unitID;
+		if (!HasControl(info, &unitID))
+			continue;
+
+		ControlDesc *ctrl = new ControlDesc;
+		ctrl->param_id = info.param_id;
+		strcpy(ctrl->name, info.name);
+		ctrl->info = &info;
+		ctrl->unit_id = unitID;
+		ctrl->min = 0;
+		ctrl->max = 0;
+		ctrl->def = 0;
+		ctrl->changed = 0;
+		ctrl->sequence = 0;
+		fControls.AddItem(ctrl);
+	}
+
+	// Every range costs three control transfers, some cameras take tens of
+	// milliseconds for each. Cached ranges are checked again in the
+	// background once the node is up.
+	bool cached = LoadCapabilityCache() == B_OK;
+	if (!cached) {
+		for (int32 i = fControls.CountItems() - 1; i >= 0; i--) {
+			ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+			ControlRange range;
+			range.param_id = ctrl->param_id;
+			if (QueryControlRange(range) != B_OK) {
+				// Advertised but without a range, not a control to offer
+				delete (ControlDesc*)fControls.RemoveItem(i);
+				continue;
+			}
+			ctrl->min = range.min;
+			ctrl->max = range.max;
+			ctrl->def = range.def;
 		}
-		return B_OK;
 	}
 
-	return B_ERROR;
+	for (int32 i = 0; i < fControls.CountItems(); i++) {
+		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+		ctrl->value = ctrl->def;
+		ctrl->prev_value = ctrl->def;
+	}
+
+	if (cached) {
+		fRefreshThread = spawn_thread(_capability_refresh,
+			"uvc capability refresh", B_LOW_PRIORITY, this);
+		if (fRefreshThread >= B_OK)
+			resume_thread(fRefreshThread);
+	} else
+		SaveCapabilityCache();
+
+	return B_OK;
+}
+
+bool
+UVCProducer::HasControl(const ControlInfo& info, uint8* unitID) const
+{
+	uint64_t bmControls;
+	if (info.unit == CONTROL_CAMERA) {
+		const uvc_input_terminal_t *camera_terminal = uvc_get_camera_terminal(fDeviceHandle);
+		if (!camera_terminal)
+			return false;
+		bmControls = camera_terminal->bmControls;
+		*unitID = camera_terminal->bTerminalID;
+	} else {
+		const uvc_processing_unit_t *processing_unit = uvc_get_processing_units(fDeviceHandle);
+		if (!processing_unit)
+			return false;
+		bmControls = processing_unit->bmControls;
+		*unitID = processing_unit->bUnitID;
+	}
+
+	return (bmControls & ((uint64_t)1 << info.bit)) != 0;
+}
+
+UVCProducer::ControlDesc*
+UVCProducer::FindControl(int32 id) const
+{
+	for (int32 i = 0; i < fControls.CountItems(); i++) {
+		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+		if (ctrl->param_id == id)
+			return ctrl;
+	}
+	return NULL;
+}
+
+bool
+UVCProducer::IsManual(const ControlDesc* ctrl) const
+{
+	for (int32 i = 0; kAutoControls[i].param_id != 0; i++) {
+		if (kAutoControls[i].param_id != ctrl->param_id)
+			continue;
+
+		ControlDesc* automatic = FindControl(kAutoControls[i].auto_id);
+		if (automatic == NULL)
+			return true;
+		if (automatic->param_id == P_AE_MODE)
+			return ((uint32)automatic->value & kAutoControls[i].manual_modes) != 0;
+		return automatic->value == 0;
+	}
+	return true;
+}
+
+void
+UVCProducer::QueueChangedControls(bool reset, bigtime_t when)
+{
+	// The modes first, a manual value written while its automatic control
+	// is still on gets ignored or refused. Manual values are kept until
+	// their automatic control is turned off.
+	for (int32 pass = 0; pass < 2; pass++) {
+		for (int32 i = 0; i < fControls.CountItems(); i++) {
+			ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+			if (IsModeControl(ctrl->param_id) != (pass == 0)
+				|| ctrl->value == ctrl->def)
+				continue;
+
+			if (reset) {
+				ctrl->value = ctrl->def;
+				ctrl->changed = when;
+				BroadcastControl(ctrl);
+			}
+			if (IsManual(ctrl))
+				QueueControl(ctrl);
+		}
+	}
+}
+
+void
+UVCProducer::BroadcastControl(ControlDesc* ctrl)
+{
+	// Sliders take a float, toggles and menus an index
+	if (ctrl->info->kind == CONTROL_RANGE) {
+		BroadcastNewParameterValue(ctrl->changed, ctrl->param_id,
+			&ctrl->value, sizeof(ctrl->value));
+	} else {
+		uint32 value = (uint32)ctrl->value;
+		BroadcastNewParameterValue(ctrl->changed, ctrl->param_id,
+			&value, sizeof(value));
+	}
+}
+
+void
+UVCProducer::QueueControl(ControlDesc* ctrl)
+{
+	if (fControlWorker != NULL)
+		ctrl->sequence = fControlWorker->Write(ctrl->param_id, ctrl->value);
+}
+
+float
+UVCProducer::ExposureLimit() const
+{
+	ControlDesc* exposure = FindControl(P_EXPOSURE);
+	if (exposure == NULL)
+		return 0;
+
+	// The exposure time is in 100 us units, the frame interval in 100 ns
+	FrameRateDesc* frameRate = CurrentFrameRate();
+	if (fHoldFrameRate && frameRate != NULL)
+		return max_c(exposure->min, min_c(exposure->max,
+			(float)(frameRate->interval / 1000)));
+
+	return exposure->max;
+}
+
+void
+UVCProducer::HoldFrameRate(bigtime_t when)
+{
+	if (!fHoldFrameRate)
+		return;
+
+	// With AE priority the camera may stretch the frame interval
+	ControlDesc* priority = FindControl(P_AE_PRIORITY);
+	if (priority != NULL && priority->value != 0) {
+		priority->value = 0;
+		priority->changed = when;
+		QueueControl(priority);
+		BroadcastControl(priority);
+	}
+
+	// Only applies while the exposure is set by hand, the AE mode says
+	ControlDesc* exposure = FindControl(P_EXPOSURE);
+	float limit = ExposureLimit();
+	if (exposure != NULL && IsManual(exposure) && exposure->value > limit) {
+		exposure->value = limit;
+		exposure->changed = when;
+		QueueControl(exposure);
+		BroadcastControl(exposure);
+	}
+}
+
+status_t
+UVCProducer::GetControlValue(int32 id, enum uvc_req_code req, float* value)
+{
+	ControlDesc* ctrl = FindControl(id);
+	if (ctrl == NULL)
+		return B_BAD_VALUE;
+
+	uint8 data[4];
+	int size = ctrl->info->size;
+	if (uvc_get_ctrl(fDeviceHandle, ctrl->unit_id, ctrl->info->selector,
+			data, size, req) != size)
+		return B_ERROR;
+
+	// Little endian, of the size of the control
+	uint32 raw = 0;
+	for (int i = size - 1; i >= 0; i--)
+		raw = (raw << 8) | data[i];
+
+	if (!ctrl->info->is_signed)
+		*value = (float)raw;
+	else if (size == 1)
+		*value = (float)(int8)raw;
+	else if (size == 2)
+		*value = (float)(int16)raw;
+	else
+		*value = (float)(int32)raw;
+
+	return B_OK;
+}
+
+status_t
+UVCProducer::QueryControlRange(ControlRange& range)
+{
+	ControlDesc* ctrl = FindControl(range.param_id);
+	if (ctrl == NULL)
+		return B_BAD_VALUE;
+
+	if (ctrl->info->kind == CONTROL_TOGGLE) {
+		// Most cameras answer only GET_CUR and GET_DEF for these
+		range.min = 0;
+		range.max = 1;
+	} else if (range.param_id == P_AE_MODE) {
+		range.min = 0;
+		if (GetControlValue(range.param_id, UVC_GET_RES, &range.max) != B_OK)
+			return B_ERROR;
+	} else if (GetControlValue(range.param_id, UVC_GET_MIN, &range.min) != B_OK
+		|| GetControlValue(range.param_id, UVC_GET_MAX, &range.max) != B_OK)
+		return B_ERROR;
+
+	if (GetControlValue(range.param_id, UVC_GET_DEF, &range.def) != B_OK
+		&& GetControlValue(range.param_id, UVC_GET_CUR, &range.def) != B_OK)
+		range.def = range.min;
+
+	return B_OK;
+}
+
+status_t
+UVCProducer::WriteControl(int32 id, float value, float* applied)
+{
+	// Runs on the control writer, the list doesn't change after
+	// InitControls()
+	ControlDesc* ctrl = FindControl(id);
+	if (ctrl == NULL)
+		return B_BAD_VALUE;
+
+	uint8 data[4];
+	int size = ctrl->info->size;
+	uint32 raw = (uint32)(int32)value;
+	for (int i = 0; i < size; i++) {
+		data[i] = raw & 0xff;
+		raw >>= 8;
+	}
+
+	if (uvc_set_ctrl(fDeviceHandle, ctrl->unit_id, ctrl->info->selector,
+			data, size) != size)
+		return B_ERROR;
+
+	// Cameras round to their step size or clamp, read back what they took
+	if (GetControlValue(id, UVC_GET_CUR, applied) != B_OK)
+		*applied = value;
+
+	return B_OK;
+}
+
+void
+UVCProducer::ControlWritten(int32 id, float applied, uint32 sequence)
+{
+	// Runs on the control writer, only the control thread changes the
+	// controls
+	ControlValue message;
+	message.param_id = id;
+	message.value = applied;
+	message.sequence = sequence;
+	write_port_etc(ControlPort(), MSG_CONTROL_APPLIED, &message,
+		sizeof(message), B_RELATIVE_TIMEOUT, 1000000);
+}
+
+bool
+UVCProducer::ApplyControlRanges(const ControlRange* ranges, int32 count)
+{
+	bool changed = false;
+	for (int32 i = 0; i < count; i++) {
+		for (int32 j = 0; j < fControls.CountItems(); j++) {
+			ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(j);
+			if (ctrl->param_id != ranges[i].param_id)
+				continue;
+
+			if (ctrl->min == ranges[i].min && ctrl->max == ranges[i].max
+				&& ctrl->def == ranges[i].def)
+				break;
+
+			// Controls left at the default follow it, on the camera and
+			// in the panels as well
+			bool follow = ctrl->value == ctrl->def
+				&& ctrl->value != ranges[i].def;
+			ctrl->min = ranges[i].min;
+			ctrl->max = ranges[i].max;
+			ctrl->def = ranges[i].def;
+			if (follow) {
+				ctrl->value = ranges[i].def;
+				ctrl->changed = system_time();
+				if (IsManual(ctrl))
+					QueueControl(ctrl);
+				BroadcastControl(ctrl);
+			}
+			changed = true;
+			break;
+		}
+	}
+	return changed;
 }
 
 void
@@ -301,7 +755,12 @@ UVCProducer::NodeRegistered()
 		
 	InitControls();
 	LoadAddonSettings();
+
+	// The camera starts out with its defaults
+	QueueChangedControls(false, system_time());
+
 	CollectFormats();
+	HoldFrameRate(system_time());
 	MakeParameterWeb();	
 
 	fOutput.node = Node();
@@ -345,19 +804,114 @@ UVCProducer::MakeParameterWeb()
 			snprintf(name, sizeof(name), "%d fps", desc->fps);
 			fpsParam->AddItem(desc->index, name);
 		}
+
+		// Only MJPEG can be decoded at a reduced size
+		FormatDesc* format = CurrentFormat();
+		if (format != NULL && format->format == UVC_FRAME_FORMAT_MJPEG) {
+			BDiscreteParameter* scaleParam = format_param_group->MakeDiscreteParameter(
+					P_SCALE, B_MEDIA_RAW_VIDEO, "Output size", B_GENERIC);
+			scaleParam->AddItem(1, "Full");
+			scaleParam->AddItem(2, "1/2");
+			scaleParam->AddItem(4, "1/4");
+			scaleParam->AddItem(8, "1/8");
+		}
+
+		format_param_group->MakeDiscreteParameter(P_DIRECT_DECODE,
+				B_MEDIA_RAW_VIDEO, "Decode into output buffers", B_ENABLE);
+		format_param_group->MakeDiscreteParameter(P_PARALLEL_DECODE,
+				B_MEDIA_RAW_VIDEO, "Multi-threaded MJPEG decoding", B_ENABLE);
+
+		BDiscreteParameter* deliveryParam = format_param_group->MakeDiscreteParameter(
+				P_CAMERA_CLOCK, B_MEDIA_RAW_VIDEO, "Frame delivery", B_GENERIC);
+		deliveryParam->AddItem(1, "As the camera sends them");
+		deliveryParam->AddItem(0, "At the nominal frame rate");
+	}
+
+	BParameterGroup *stats_param_group = uvc_param_group->MakeGroup("Statistics");
+	stats_param_group->MakeContinuousParameter(P_DECODE_TIME, B_MEDIA_RAW_VIDEO,
+		"Decode time", B_GENERIC, "ms", 0, 100, 0.01);
+	stats_param_group->MakeContinuousParameter(P_CLOCK_DRIFT, B_MEDIA_RAW_VIDEO,
+		"Camera clock drift", B_GENERIC, "ppm", -1000, 1000, 0.1);
+	stats_param_group->MakeContinuousParameter(P_DROPPED_FRAMES,
+		B_MEDIA_RAW_VIDEO, "Dropped frames", B_GENERIC, "", 0, 100000, 1);
+	stats_param_group->MakeTextParameter(P_STREAM_MODE, B_MEDIA_RAW_VIDEO,
+		"Streaming mode", B_GENERIC, 64);
+
+	BParameterGroup *latency_param_group = uvc_param_group->MakeGroup("Latency");
+	latency_param_group->MakeDiscreteParameter(P_LATENCY_TRACE,
+		B_MEDIA_RAW_VIDEO, "Trace latency", B_ENABLE);
+	latency_param_group->MakeDiscreteParameter(P_LATENCY_SAVE,
+		B_MEDIA_RAW_VIDEO, "Save histograms to file", B_ENABLE);
+	latency_param_group->MakeTextParameter(P_LATENCY_SAVED,
+		B_MEDIA_RAW_VIDEO, "Saved histograms", B_GENERIC, 128);
+	for (int32 i = 0; i < LatencyTrace::kStageCount; i++) {
+		BString name;
+		name << LatencyTrace::StageName(i) << " (99%)";
+		latency_param_group->MakeContinuousParameter(P_LATENCY_STAGE + i,
+			B_MEDIA_RAW_VIDEO, name.String(), B_GENERIC, "ms", 0, 1000, 0.01);
+	}
+
+	BParameterGroup *record_param_group = uvc_param_group->MakeGroup("Recording");
+	record_param_group->MakeDiscreteParameter(P_RECORD,
+		B_MEDIA_RAW_VIDEO, "Record USB payloads", B_ENABLE);
+	if (!fReplayPath.IsEmpty()) {
+		record_param_group->MakeDiscreteParameter(P_REPLAY_SPEED,
+			B_MEDIA_RAW_VIDEO, "Replay at full speed", B_ENABLE);
 	}
 
+	BParameterGroup *still_param_group = uvc_param_group->MakeGroup("Still image");
+	still_param_group->MakeDiscreteParameter(P_STILL_CAPTURE,
+		B_MEDIA_RAW_VIDEO, "Capture still image", B_ENABLE);
+
 	if (!fControls.IsEmpty()) {
 		BDiscreteParameter* presetParam = format_param_group->MakeDiscreteParameter(
 				P_PRESET, B_MEDIA_RAW_VIDEO, "Preset", B_GENERIC);
 		presetParam->AddItem(0, "Default");
 		presetParam->AddItem(1, "Custom");
 
+		if (FindControl(P_AE_PRIORITY) != NULL || FindControl(P_EXPOSURE) != NULL) {
+			BParameterGroup *hold_param_group = uvc_param_group->MakeGroup("Frame rate");
+			hold_param_group->MakeDiscreteParameter(P_HOLD_FRAMERATE,
+				B_MEDIA_RAW_VIDEO, "Hold frame rate", B_ENABLE);
+		}
+
 		for (int32 i = 0; i < fControls.CountItems(); i++) {
 			ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
 			BParameterGroup *control_param_group = uvc_param_group->MakeGroup(ctrl->name);
-			control_param_group->MakeContinuousParameter(ctrl->param_id, B_MEDIA_RAW_VIDEO,
-			ctrl->name, B_GAIN, "", ctrl->min, ctrl->max, 1);
+			switch (ctrl->info->kind) {
+				case CONTROL_RANGE:
+				{
+					float max = ctrl->param_id == P_EXPOSURE ? ExposureLimit() : ctrl->max;
+					control_param_group->MakeContinuousParameter(ctrl->param_id, B_MEDIA_RAW_VIDEO,
+						ctrl->name, B_GAIN, "", ctrl->min, max, 1);
+					break;
+				}
+				case CONTROL_TOGGLE:
+					control_param_group->MakeDiscreteParameter(ctrl->param_id, B_MEDIA_RAW_VIDEO,
+						ctrl->name, B_ENABLE);
+					break;
+				case CONTROL_MENU:
+				{
+					BDiscreteParameter* menuParam = control_param_group->MakeDiscreteParameter(
+							ctrl->param_id, B_MEDIA_RAW_VIDEO, ctrl->name, B_GENERIC);
+					if (ctrl->param_id == P_AE_MODE) {
+						// Only the modes set in the GET_RES bitmap
+						static const char* kModes[] = { "Manual", "Auto",
+							"Shutter priority", "Aperture priority" };
+						for (int32 mode = 0; mode < 4; mode++) {
+							if (((uint32)ctrl->max & (1 << mode)) != 0)
+								menuParam->AddItem(1 << mode, kModes[mode]);
+						}
+					} else if (ctrl->param_id == P_POWER_LINE) {
+						static const char* kFrequencies[] = { "Disabled",
+							"50 Hz", "60 Hz", "Auto" };
+						for (int32 item = (int32)ctrl->min;
+								item <= (int32)ctrl->max && item < 4; item++)
+							menuParam->AddItem(item, kFrequencies[item]);
+					}
+					break;
+				}
+			}
 		}
 	}
 
@@ -371,18 +925,56 @@ UVCProducer::HandleStart(bigtime_t performance_time)
 		return;
 
 	fFrame = 0;
-	fFrameBase = 0;
-	fPerformanceTimeBase = performance_time;
+	fFrameClock.SetBase(performance_time, 0);
+	fCaptureLatency = 0;
+	fCaptureDelayCount = 0;
+	fCaptureDelayIndex = 0;
 
 	fFrameSync = create_sem(0, "frame synchronization");
 	if (fFrameSync < B_OK)
 		return;
 
+	if (fFrameQueue.Open() != B_OK) {
+		delete_sem(fFrameSync);
+		return;
+	}
+
+	SetupParallelDecoder();
+
+	fDecodeThread = spawn_thread(_frame_decoder, "frame decoder",
+			B_NORMAL_PRIORITY, this);
+	if (fDecodeThread < B_OK) {
+		fFrameQueue.Close();
+		delete fParallelDecoder;
+		fParallelDecoder = NULL;
+		delete_sem(fFrameSync);
+		return;
+	}
+
+	resume_thread(fDecodeThread);
+
+	// Without it the node runs on, only the still images are lost
+	BPath stillPath;
+	if (GetStillPath(&stillPath) == B_OK) {
+		fStillWriter = new StillWriter(stillPath.Path());
+		if (fStillWriter->InitCheck() != B_OK) {
+			delete fStillWriter;
+			fStillWriter = NULL;
+		}
+	}
+
 	StartStreaming();
 
 	fThread = spawn_thread(_frame_generator, "frame generator",
 			B_NORMAL_PRIORITY, this);
 	if (fThread < B_OK) {
+		StopStreaming();
+		fFrameQueue.Close();
+		wait_for_thread(fDecodeThread, &fDecodeThread);
+		delete fParallelDecoder;
+		fParallelDecoder = NULL;
+		delete fStillWriter;
+		fStillWriter = NULL;
 		delete_sem(fFrameSync);
 		return;
 	}	
@@ -392,6 +984,26 @@ UVCProducer::HandleStart(bigtime_t performance_time)
 	fRunning = true;	
 }
 
+void
+UVCProducer::SetupParallelDecoder()
+{
+	// Called before the decode thread starts, or with fDecodeLock held
+	delete fParallelDecoder;
+	fParallelDecoder = NULL;
+
+	// Only pays off with restart markers, the decoder falls back to a
+	// single thread when a frame has none
+	if (!fParallelDecode)
+		return;
+
+	fParallelDecoder = new ParallelJpegDecoder(fDecodePool);
+	if (fParallelDecoder->InitCheck() != B_OK
+		|| fParallelDecoder->CountThreads() < 2) {
+		delete fParallelDecoder;
+		fParallelDecoder = NULL;
+	}
+}
+
 void
 UVCProducer::HandleStop()
 {
@@ -400,32 +1012,56 @@ UVCProducer::HandleStop()
 
 	StopStreaming();
 
+	fFrameQueue.Close();
+	wait_for_thread(fDecodeThread, &fDecodeThread);
+
+	// Writes the images taken so far before it goes
+	delete fStillWriter;
+	fStillWriter = NULL;
+
+	delete fParallelDecoder;
+	fParallelDecoder = NULL;
+	delete fH264Decoder;
+	fH264Decoder = NULL;
+	fH264Dropped = 0;
+
 	delete_sem(fFrameSync);
 	wait_for_thread(fThread, &fThread);
 
+	fLock.Lock();
+	if (fPendingBuffer != NULL) {
+		fPendingBuffer->Recycle();
+		fPendingBuffer = NULL;
+	}
+	fLock.Unlock();
+
 	fRunning = false;	
 }
 
 void
 UVCProducer::HandleTimeWarp(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fLock.Lock();
+	fFrameClock.SetBase(performance_time, fFrame);
+	fLock.Unlock();
 	release_sem(fFrameSync);
 }
 
 void
 UVCProducer::HandleSeek(bigtime_t performance_time)
 {
-	fPerformanceTimeBase = performance_time;
-	fFrameBase = fFrame;
+	fLock.Lock();
+	fFrameClock.SetBase(performance_time, fFrame);
+	fLock.Unlock();
 	release_sem(fFrameSync);
 }
 
 void
 UVCProducer::HandleParameter(uint32 parameter)
 {
-	if (parameter == P_FORMAT || parameter == P_RESOLUTION || parameter == P_PRESET)
+	// The exposure slider ends at the frame interval while it is held
+	if (parameter == P_FORMAT || parameter == P_RESOLUTION || parameter == P_PRESET
+		|| parameter == P_FRAMERATE || parameter == P_HOLD_FRAMERATE)
 		MakeParameterWeb();
 
 	SaveAddonSettings();
@@ -452,6 +1088,30 @@ UVCProducer::AddOn(int32 *internal_id) const
 status_t
 UVCProducer::HandleMessage(int32 message, const void *data, size_t size)
 {
+	if (message == MSG_CONTROL_RANGES) {
+		// The camera answered differently than the cache
+		if (ApplyControlRanges((const ControlRange*)data,
+				size / sizeof(ControlRange))) {
+			MakeParameterWeb();
+			SaveCapabilityCache();
+		}
+		return B_OK;
+	}
+
+	if (message == MSG_CONTROL_APPLIED && size >= sizeof(ControlValue)) {
+		const ControlValue* applied = (const ControlValue*)data;
+		ControlDesc* ctrl = FindControl(applied->param_id);
+		// The control may have changed again while the message was on
+		// its way, then the value is stale
+		if (ctrl != NULL && ctrl->sequence == applied->sequence
+			&& ctrl->value != applied->value) {
+			ctrl->value = applied->value;
+			ctrl->changed = system_time();
+			BroadcastControl(ctrl);
+		}
+		return B_OK;
+	}
+
 	return B_ERROR;
 }
 
@@ -491,7 +1151,14 @@ UVCProducer::FormatProposal(const media_source &output, media_format *format)
 	if (format->type != B_MEDIA_RAW_VIDEO)
 		return B_MEDIA_BAD_FORMAT;
 
+	// B_YCbCr422 is offered next to B_RGB32 so YUV consumers get the
+	// camera data without a round trip through RGB
+	color_space space = format->u.raw_video.display.format;
+
 	*format = fOutput.format;
+	format->u.raw_video.display.format
+		= space == B_YCbCr422 ? B_YCbCr422 : B_RGB32;
+
 	return B_OK;
 }
 
@@ -562,10 +1229,38 @@ UVCProducer::PrepareToConnect(const media_source &source,
 	if (!frameRate)
 		return B_ERROR;
 
-	format->u.raw_video.display.line_width = resolution->width;
-	format->u.raw_video.display.line_count = resolution->height;
+	uint32 width = resolution->width;
+	uint32 height = resolution->height;
+
+	// MJPEG is decoded at 1/2, 1/4 or 1/8 of the camera size when the
+	// consumer asks for it, otherwise the Output size parameter decides
+	FormatDesc* cameraFormat = CurrentFormat();
+	if (cameraFormat != NULL && cameraFormat->format == UVC_FRAME_FORMAT_MJPEG) {
+		uint32 scale = fScale;
+		media_video_display_info &display = format->u.raw_video.display;
+		if (display.line_width != 0 || display.line_count != 0) {
+			scale = 1;
+			for (uint32 denom = 2; denom <= 8; denom *= 2) {
+				if (display.line_width == (width + denom - 1) / denom
+					&& display.line_count == (height + denom - 1) / denom)
+					scale = denom;
+			}
+		}
+		width = (width + scale - 1) / scale;
+		height = (height + scale - 1) / scale;
+	}
+
+	color_space space = B_RGB32;
+	if (format->u.raw_video.display.format == B_YCbCr422 && (width & 1) == 0)
+		space = B_YCbCr422;
+
+	format->u.raw_video.display.line_width = width;
+	format->u.raw_video.display.line_count = height;
+	format->u.raw_video.display.bytes_per_row = width * (space == B_YCbCr422 ? 2 : 4);
 	format->u.raw_video.field_rate = frameRate->fps;
-	format->u.raw_video.display.format = B_RGB32;
+	format->u.raw_video.display.format = space;
+
+	fOutput.format.u.raw_video.display.format = space;
 
 	*out_source = fOutput.source;
 	strcpy(out_name, fOutput.name);
@@ -588,29 +1283,23 @@ UVCProducer::Connect(status_t error, const media_source &source,
 	fOutput.destination = destination;
 	strcpy(io_name, fOutput.name);
 
-	if (fOutput.format.u.raw_video.field_rate != 0.0f) {
-		fPerformanceTimeBase = fPerformanceTimeBase +
-				(bigtime_t)
-					((fFrame - fFrameBase) *
-					(1000000 / fOutput.format.u.raw_video.field_rate));
-		fFrameBase = fFrame;
-	}
-
 	fConnectedFormat = format.u.raw_video;
-	
+	UpdateFrameRate();
+
 	bigtime_t latency = 0;
 	media_node_id tsID = 0;
 	FindLatencyFor(fOutput.destination, &latency, &tsID);
 	#define NODE_LATENCY 2000
 	SetEventLatency(latency + NODE_LATENCY);
 
-	fFrameBufferSize = fConnectedFormat.display.line_width * fConnectedFormat.display.line_count * 4;
-	delete[] fFrameBuffer;
-	fFrameBuffer = new uint8_t[fFrameBufferSize];
+	BAutolock decodeLocker(fDecodeLock);
+	fLock.Lock();
+
+	fFrameBufferSize = fConnectedFormat.display.line_width * fConnectedFormat.display.line_count
+		* (fConnectedFormat.display.format == B_YCbCr422 ? 2 : 4);
+	SetupFrameBuffers();
 
-	bigtime_t now = system_time();
-	memset(fFrameBuffer, 0, fFrameBufferSize);
-	fProcessingLatency = system_time() - now;
+	fLock.Unlock();
 
 	fBufferGroup = new BBufferGroup(fFrameBufferSize, 16);
 
@@ -628,6 +1317,54 @@ UVCProducer::Connect(status_t error, const media_source &source,
 	release_sem(fFrameSync);
 }
 
+void
+UVCProducer::UpdateFrameRate()
+{
+	// While streaming the rate is the one the camera agreed to, it is
+	// lower than the selected one when the bus had no room for that. The
+	// frame interval is exact in 100ns units, field_rate is only the whole
+	// frames per second.
+	uint32 interval = fStreamCtrl.dwFrameInterval;
+	FrameRateDesc* frameRate = CurrentFrameRate();
+	if (interval == 0 && frameRate != NULL
+		&& frameRate->fps == fConnectedFormat.field_rate)
+		interval = frameRate->interval;
+
+	// FrameGenerator counts frames and reads the clock under the lock,
+	// it never sees the old base with the new rate
+	BAutolock locker(fLock);
+	fFrameClock.Rebase(fFrame);
+	if (interval == 0) {
+		fFrameClock.SetRate(fConnectedFormat.field_rate);
+		return;
+	}
+
+	fFrameClock.SetRate(10000000, interval);
+	fConnectedFormat.field_rate = 10000000.0f / interval;
+}
+
+void
+UVCProducer::SetupFrameBuffers()
+{
+	// Called with fDecodeLock and fLock held, so neither HandleFrame nor
+	// FrameGenerator is at a buffer of the mode that is left
+	fFrameBuffers.Free();
+	fProcessingLatency = 0;
+
+	if (fPendingBuffer != NULL) {
+		fPendingBuffer->Recycle();
+		fPendingBuffer = NULL;
+	}
+
+	// In direct decode mode frames go straight into the output buffers,
+	// the intermediate frame buffers are only needed for the copy mode.
+	if (!fDirectDecode && fFrameBufferSize > 0) {
+		bigtime_t now = system_time();
+		fFrameBuffers.SetSize(fFrameBufferSize);
+		fProcessingLatency = system_time() - now;
+	}
+}
+
 void
 UVCProducer::Disconnect(const media_source &source,
 		const media_destination &destination)
@@ -642,6 +1379,7 @@ UVCProducer::Disconnect(const media_source &source,
 
 	fEnabled = false;
 	fOutput.destination = media_destination::null;
+	fOutput.format.u.raw_video.display.format = B_RGB32;
 
 	fLock.Lock();
 		delete fBufferGroup;
@@ -708,24 +1446,147 @@ UVCProducer::GetParameterValue(int32 id, bigtime_t *last_change,
 			*(uint32 *)value = state;
 			break;
 		}
-		case P_BRIGHTNESS:
-		case P_CONTRAST:
-		case P_HUE:
-		case P_SATURATION:
+		case P_DIRECT_DECODE:
 		{
-			for (int32 i = 0; i < fControls.CountItems(); i++) {
-				ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
-				if (ctrl->param_id == id) {
-					*last_change = ctrl->changed;
+			*last_change = fLastDirectDecodeChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fDirectDecode ? 1 : 0;
+			break;
+		}
+		case P_CAMERA_CLOCK:
+		{
+			*last_change = fLastCameraClockChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fCameraClock ? 1 : 0;
+			break;
+		}
+		case P_PARALLEL_DECODE:
+		{
+			*last_change = fLastParallelDecodeChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fParallelDecode ? 1 : 0;
+			break;
+		}
+		case P_SCALE:
+		{
+			*last_change = fLastScaleChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fScale;
+			break;
+		}
+		case P_DECODE_TIME:
+		{
+			// Read only, average decode time of the recent frames
+			*last_change = system_time();
+			*size = sizeof(float);
+			*(float *)value = atomic_get64(&fDecodeTime) / 1000.0f;
+			break;
+		}
+		case P_CLOCK_DRIFT:
+		{
+			// Read only, set by the decode thread
+			*last_change = system_time();
+			*size = sizeof(float);
+			*(float *)value = fClockDrift;
+			break;
+		}
+		case P_DROPPED_FRAMES:
+		{
+			// Read only, lost in libuvc or the frame queue since streaming
+			// started
+			*last_change = system_time();
+			*size = sizeof(float);
+			*(float *)value = fFrameQueue.Dropped();
+			break;
+		}
+		case P_STREAM_MODE:
+		{
+			// Read only, set by StartStreaming()
+			if (*size < (size_t)fStreamMode.Length() + 1)
+				return EINVAL;
+			*last_change = fLastStreamModeChange;
+			*size = fStreamMode.Length() + 1;
+			memcpy(value, fStreamMode.String(), *size);
+			break;
+		}
+		case P_LATENCY_SAVED:
+		{
+			// Read only, set when the histograms are saved
+			if (*size < (size_t)fLatencySaved.Length() + 1)
+				return EINVAL;
+			*last_change = fLastLatencySavedChange;
+			*size = fLatencySaved.Length() + 1;
+			memcpy(value, fLatencySaved.String(), *size);
+			break;
+		}
+		case P_LATENCY_TRACE:
+		{
+			*last_change = fLastLatencyTraceChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fLatencyTrace.IsEnabled() ? 1 : 0;
+			break;
+		}
+		case P_LATENCY_SAVE:
+		{
+			*last_change = fLastLatencyTraceChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = 0;
+			break;
+		}
+		case P_RECORD:
+		{
+			*last_change = fLastRecordChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fRecordPayloads ? 1 : 0;
+			break;
+		}
+		case P_REPLAY_SPEED:
+		{
+			*last_change = fLastReplaySpeedChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fReplayMaxSpeed ? 1 : 0;
+			break;
+		}
+		case P_HOLD_FRAMERATE:
+		{
+			*last_change = fLastHoldFrameRateChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = fHoldFrameRate ? 1 : 0;
+			break;
+		}
+		case P_STILL_CAPTURE:
+		{
+			*last_change = fLastStillCaptureChange;
+			*size = sizeof(uint32);
+			*(uint32 *)value = 0;
+			break;
+		}
+		default:
+		{
+			ControlDesc* ctrl = FindControl(id);
+			if (ctrl != NULL) {
+				*last_change = ctrl->changed;
+				if (ctrl->info->kind == CONTROL_RANGE) {
 					*size = sizeof(float);
 					*(float *)value = ctrl->value;
-					break;
+				} else {
+					*size = sizeof(uint32);
+					*(uint32 *)value = (uint32)ctrl->value;
 				}
+				break;
 			}
+
+			if (id < P_LATENCY_STAGE
+				|| id >= P_LATENCY_STAGE + LatencyTrace::kStageCount)
+				return B_BAD_VALUE;
+
+			// Read only, 99th percentile of the stage since tracing started
+			*last_change = system_time();
+			*size = sizeof(float);
+			*(float *)value = fLatencyTrace.Stage(id - P_LATENCY_STAGE)
+				.Percentile(99) / 1000.0f;
 			break;
 		}
-		default:
-			return B_BAD_VALUE;
 	}
 
 	return B_OK;
@@ -738,7 +1599,67 @@ UVCProducer::SetParameterValue(int32 id, bigtime_t when,
 	if (value == nullptr || size == 0)
 		return;
 
-	bool needRestart = fRunning;
+	// Statistics are read only
+	if (id == P_DECODE_TIME || id == P_CLOCK_DRIFT || id == P_DROPPED_FRAMES
+		|| id == P_STREAM_MODE || id == P_LATENCY_SAVED
+		|| (id >= P_LATENCY_STAGE
+			&& id < P_LATENCY_STAGE + LatencyTrace::kStageCount))
+		return;
+
+	// Tracing doesn't touch the stream, no restart
+	if (id == P_LATENCY_TRACE) {
+		bool enabled = *(uint32 *)value != 0;
+		if (enabled != fLatencyTrace.IsEnabled()) {
+			if (enabled) {
+				fLatencyTrace.Reset();
+				atomic_set(&fTraceSentSequence, atomic_get(&fTraceSequence));
+			}
+			fLatencyTrace.SetEnabled(enabled);
+			if (fDeviceHandle != NULL)
+				uvc_set_tracing(fDeviceHandle, enabled);
+			fLastLatencyTraceChange = when;
+			uint32 newValue = enabled ? 1 : 0;
+			BroadcastNewParameterValue(fLastLatencyTraceChange,
+				P_LATENCY_TRACE, &newValue, sizeof(newValue));
+		}
+		return;
+	}
+
+	if (id == P_LATENCY_SAVE) {
+		// Acts as a button, it is always shown unchecked again.
+		// Where the file went, or why it didn't, is shown next to it.
+		if (*(uint32 *)value != 0) {
+			BPath path;
+			status_t status = SaveLatencyTrace(&path);
+			fLatencySaved = "";
+			if (status == B_OK)
+				fLatencySaved << "Saved to " << path.Leaf();
+			else
+				fLatencySaved << "Not saved: " << strerror(status);
+			fLastLatencySavedChange = when;
+			BroadcastNewParameterValue(when, P_LATENCY_SAVED,
+				(void*)fLatencySaved.String(), fLatencySaved.Length() + 1);
+		}
+		uint32 newValue = 0;
+		BroadcastNewParameterValue(when, P_LATENCY_SAVE, &newValue,
+			sizeof(newValue));
+		return;
+	}
+
+	if (id == P_STILL_CAPTURE) {
+		// A button as well, the preview keeps running while it is taken
+		if (*(uint32 *)value != 0)
+			CaptureStill();
+		fLastStillCaptureChange = when;
+		uint32 newValue = 0;
+		BroadcastNewParameterValue(when, P_STILL_CAPTURE, &newValue,
+			sizeof(newValue));
+		return;
+	}
+
+	// Camera controls are changed while the stream runs
+	bool needRestart = fRunning && id != P_PRESET && id != P_HOLD_FRAMERATE
+		&& id != P_PARALLEL_DECODE && FindControl(id) == NULL;
 
 	if (needRestart)
 		StopStreaming();
@@ -802,41 +1723,146 @@ UVCProducer::SetParameterValue(int32 id, bigtime_t when,
 		{
 			uint32 newValue = *(uint32 *)value;
 			if (newValue == 0) {
-				for (int32 i = 0; i < fControls.CountItems(); i++) {
-					ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
-					if (ctrl->value != ctrl->def) {
-						float newValue = *(float *)value;
-						if (newValue != ctrl->value) {
-							ctrl->value = ctrl->def;
-							ctrl->changed = when;
-							ctrl->Apply(fDeviceHandle);
-							BroadcastNewParameterValue(ctrl->changed, id, &ctrl->value, sizeof(ctrl->value));						
-						}
-					}
-				}
+				QueueChangedControls(true, when);
+				HoldFrameRate(when);
 				fLastPresetChange = when;
 				BroadcastNewParameterValue(fLastPresetChange, P_PRESET, &newValue, sizeof(uint32));
 			}
 			break;
 		}
-		case P_BRIGHTNESS:
-		case P_CONTRAST:
-		case P_HUE:
-		case P_SATURATION:
+		case P_DIRECT_DECODE:
 		{
-			uint32 state = 0;
-			for (int32 i = 0; i < fControls.CountItems(); i++) {
-				ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
-				if (ctrl->param_id == id) {
-					float newValue = *(float *)value;
-					if (newValue != ctrl->value) {
-						ctrl->value = newValue;
-						ctrl->changed = when;
-						ctrl->Apply(fDeviceHandle);
-						BroadcastNewParameterValue(ctrl->changed, id, &ctrl->value, sizeof(ctrl->value));
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if ((newValue != 0) != fDirectDecode) {
+				// While connected the buffers of the new mode are needed
+				// right away, not only on the next connection
+				BAutolock decodeLocker(fDecodeLock);
+				fLock.Lock();
+				fDirectDecode = newValue != 0;
+				if (fConnected)
+					SetupFrameBuffers();
+				fLock.Unlock();
+
+				fLastDirectDecodeChange = when;
+				BroadcastNewParameterValue(fLastDirectDecodeChange, P_DIRECT_DECODE, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_CAMERA_CLOCK:
+		{
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if ((newValue != 0) != fCameraClock) {
+				fCameraClock = newValue != 0;
+				fLastCameraClockChange = when;
+				BroadcastNewParameterValue(fLastCameraClockChange, P_CAMERA_CLOCK, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_PARALLEL_DECODE:
+		{
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if ((newValue != 0) != fParallelDecode) {
+				fParallelDecode = newValue != 0;
+				// Takes effect with the next frame, the stream goes on
+				if (fRunning) {
+					BAutolock decodeLocker(fDecodeLock);
+					SetupParallelDecoder();
+				}
+				fLastParallelDecodeChange = when;
+				BroadcastNewParameterValue(fLastParallelDecodeChange, P_PARALLEL_DECODE, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_RECORD:
+		{
+			// The restart starts a new recording or completes the file
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if ((newValue != 0) != fRecordPayloads) {
+				fRecordPayloads = newValue != 0;
+				fLastRecordChange = when;
+				BroadcastNewParameterValue(fLastRecordChange, P_RECORD, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_REPLAY_SPEED:
+		{
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if (!fReplayPath.IsEmpty() && (newValue != 0) != fReplayMaxSpeed) {
+				fReplayMaxSpeed = newValue != 0;
+				uvc_replay_set_flags(fDeviceHandle, UVC_REPLAY_LOOP
+					| (fReplayMaxSpeed ? UVC_REPLAY_MAX_SPEED : 0));
+				fLastReplaySpeedChange = when;
+				BroadcastNewParameterValue(fLastReplaySpeedChange, P_REPLAY_SPEED, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_SCALE:
+		{
+			uint32 newValue = *(uint32 *)value;
+			if (newValue != 1 && newValue != 2 && newValue != 4 && newValue != 8)
+				break;
+			if (newValue != fScale) {
+				fScale = newValue;
+				fLastScaleChange = when;
+				BroadcastNewParameterValue(fLastScaleChange, P_SCALE, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		case P_HOLD_FRAMERATE:
+		{
+			uint32 newValue = *(uint32 *)value != 0 ? 1 : 0;
+			if ((newValue != 0) != fHoldFrameRate) {
+				fHoldFrameRate = newValue != 0;
+				fLastHoldFrameRateChange = when;
+				HoldFrameRate(when);
+				BroadcastNewParameterValue(fLastHoldFrameRateChange, P_HOLD_FRAMERATE, &newValue, sizeof(newValue));
+			}
+			break;
+		}
+		default:
+		{
+			ControlDesc* ctrl = FindControl(id);
+			if (ctrl == NULL)
+				break;
+
+			float newValue = ctrl->info->kind == CONTROL_RANGE
+				? *(float *)value : (float)*(uint32 *)value;
+			if (id == P_EXPOSURE)
+				newValue = min_c(newValue, ExposureLimit());
+
+			if (newValue != ctrl->value) {
+				ctrl->value = newValue;
+				ctrl->changed = when;
+				// Written later, only the last of quick changes. Manual
+				// values wait for their automatic control to go off.
+				if (IsManual(ctrl))
+					QueueControl(ctrl);
+				BroadcastControl(ctrl);
+
+				if (IsModeControl(id)) {
+					for (int32 i = 0; kAutoControls[i].param_id != 0; i++) {
+						ControlDesc* manual = FindControl(kAutoControls[i].param_id);
+						if (kAutoControls[i].auto_id == id && manual != NULL
+							&& IsManual(manual))
+							QueueControl(manual);
 					}
+					if (id == P_AE_MODE)
+						HoldFrameRate(when);
 				}
-				if (ctrl->value != ctrl->def)
+			}
+
+			// Letting the camera lower the frame rate again ends holding it
+			if (id == P_AE_PRIORITY && newValue != 0 && fHoldFrameRate) {
+				fHoldFrameRate = false;
+				fLastHoldFrameRateChange = when;
+				uint32 hold = 0;
+				BroadcastNewParameterValue(fLastHoldFrameRateChange, P_HOLD_FRAMERATE, &hold, sizeof(hold));
+			}
+
+			uint32 state = 0;
+			for (int32 i = 0; i < fControls.CountItems(); i++) {
+				ControlDesc* other = (ControlDesc*)fControls.ItemAt(i);
+				if (other->value != other->def)
 					state = 1;
 			}
 			if (state == 1) {
@@ -847,6 +1873,10 @@ UVCProducer::SetParameterValue(int32 id, bigtime_t when,
 		}
 	}
 
+	// A new frame interval moves the exposure limit
+	if (id == P_FORMAT || id == P_RESOLUTION || id == P_FRAMERATE)
+		HoldFrameRate(when);
+
 	if (needRestart)
 		StartStreaming();
 
@@ -913,6 +1943,141 @@ UVCProducer::DeleteHook(BMediaNode * node)
 	return BMediaEventLooper::DeleteHook(node);
 }
 
+status_t
+UVCProducer::OpenCapabilityCache(BFile& file, uint32 mode)
+{
+	// Recordings have no controls to ask for
+	if (!fReplayPath.IsEmpty() || fDeviceDescriptor == NULL)
+		return B_NOT_SUPPORTED;
+
+	BPath path;
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) != B_OK)
+		return B_ERROR;
+
+	path.Append("UVCMediaAddon");
+	mkdir(path.Path(), ALLPERMS);
+	path.Append("Capabilities");
+	mkdir(path.Path(), ALLPERMS);
+
+	// A firmware update may change the ranges, it usually bumps bcdDevice
+	BString filename;
+	filename.SetToFormat("%04x-%04x-%04x-%s", fDeviceDescriptor->idVendor,
+		fDeviceDescriptor->idProduct, fDeviceDescriptor->bcdDevice,
+		fDeviceDescriptor->serialNumber != NULL
+			? fDeviceDescriptor->serialNumber : "none");
+	path.Append(filename);
+
+	return file.SetTo(path.Path(), mode);
+}
+
+status_t
+UVCProducer::LoadCapabilityCache()
+{
+	BFile file;
+	status_t status = OpenCapabilityCache(file, B_READ_ONLY);
+	if (status != B_OK)
+		return status;
+
+	BMessage cache;
+	status = cache.Unflatten(&file);
+	if (status != B_OK)
+		return status;
+
+	// Every control of the camera needs a cached range, or to be one
+	// that had none
+	BList unsupported;
+	for (int32 i = 0; i < fControls.CountItems(); i++) {
+		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+		int32 id;
+		int32 index = 0;
+		while (cache.FindInt32("Unsupported", index, &id) == B_OK) {
+			if (id == ctrl->param_id) {
+				unsupported.AddItem(ctrl);
+				break;
+			}
+			index++;
+		}
+		if (unsupported.HasItem(ctrl))
+			continue;
+
+		index = 0;
+		while (cache.FindInt32("Control", index, &id) == B_OK
+			&& id != ctrl->param_id)
+			index++;
+
+		if (cache.FindFloat("Min", index, &ctrl->min) != B_OK
+			|| cache.FindFloat("Max", index, &ctrl->max) != B_OK
+			|| cache.FindFloat("Default", index, &ctrl->def) != B_OK)
+			return B_ENTRY_NOT_FOUND;
+	}
+
+	for (int32 i = 0; i < unsupported.CountItems(); i++) {
+		fControls.RemoveItem(unsupported.ItemAt(i));
+		delete (ControlDesc*)unsupported.ItemAt(i);
+	}
+
+	return B_OK;
+}
+
+status_t
+UVCProducer::SaveCapabilityCache()
+{
+	BFile file;
+	status_t status = OpenCapabilityCache(file,
+		B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+	if (status != B_OK)
+		return status;
+
+	BMessage cache('UVCc');
+	for (int32 i = 0; i < fControls.CountItems(); i++) {
+		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
+		cache.AddInt32("Control", ctrl->param_id);
+		cache.AddFloat("Min", ctrl->min);
+		cache.AddFloat("Max", ctrl->max);
+		cache.AddFloat("Default", ctrl->def);
+	}
+
+	// Advertised controls dropped for the lack of a range
+	for (int32 i = 0; kControlInfos[i].name != NULL; i++) {
+		uint8 unitID;
+		if (HasControl(kControlInfos[i], &unitID)
+			&& FindControl(kControlInfos[i].param_id) == NULL)
+			cache.AddInt32("Unsupported", kControlInfos[i].param_id);
+	}
+
+	return cache.Flatten(&file);
+}
+
+int32
+UVCProducer::_capability_refresh(void *data)
+{
+	return ((UVCProducer *)data)->CapabilityRefresh();
+}
+
+int32
+UVCProducer::CapabilityRefresh()
+{
+	// Only the control thread changes the controls, the fresh ranges are
+	// handed to it through the control port
+	int32 count = fControls.CountItems();
+	ControlRange* ranges = new ControlRange[count];
+
+	int32 valid = 0;
+	for (int32 i = 0; i < count; i++) {
+		ranges[valid].param_id = ((ControlDesc*)fControls.ItemAt(i))->param_id;
+		if (QueryControlRange(ranges[valid]) == B_OK)
+			valid++;
+	}
+
+	if (valid > 0) {
+		write_port_etc(ControlPort(), MSG_CONTROL_RANGES, ranges,
+			valid * sizeof(ControlRange), B_RELATIVE_TIMEOUT, 1000000);
+	}
+
+	delete[] ranges;
+	return B_OK;
+}
+
 status_t
 UVCProducer::OpenAddonSettings(BFile& file, uint32 mode)
 {
@@ -951,6 +2116,22 @@ UVCProducer::LoadAddonSettings()
 	if (settings.FindUInt8("FrameRate", &fCurrentFrameRateIndex) != B_OK)
 		fCurrentFrameRateIndex = 1;
 
+	if (settings.FindBool("DirectDecode", &fDirectDecode) != B_OK)
+		fDirectDecode = true;
+
+	if (settings.FindBool("ParallelDecode", &fParallelDecode) != B_OK)
+		fParallelDecode = true;
+
+	if (settings.FindBool("CameraClock", &fCameraClock) != B_OK)
+		fCameraClock = true;
+
+	if (settings.FindBool("HoldFrameRate", &fHoldFrameRate) != B_OK)
+		fHoldFrameRate = false;
+
+	if (settings.FindUInt8("Scale", &fScale) != B_OK
+		|| (fScale != 1 && fScale != 2 && fScale != 4 && fScale != 8))
+		fScale = 1;
+
 	for (int32 i = 0; i < fControls.CountItems(); i++) {
 		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
 		if (settings.FindFloat(ctrl->name, &ctrl->value) != B_OK)
@@ -972,6 +2153,11 @@ UVCProducer::SaveAddonSettings()
 	settings.AddUInt8("Format", fCurrentFormatIndex);
 	settings.AddUInt8("Resolution", fCurrentResolutionIndex);
 	settings.AddUInt8("FrameRate", fCurrentFrameRateIndex);
+	settings.AddBool("DirectDecode", fDirectDecode);
+	settings.AddBool("ParallelDecode", fParallelDecode);
+	settings.AddBool("CameraClock", fCameraClock);
+	settings.AddUInt8("Scale", fScale);
+	settings.AddBool("HoldFrameRate", fHoldFrameRate);
 
 	for (int32 i = 0; i < fControls.CountItems(); i++) {
 		ControlDesc* ctrl = (ControlDesc*)fControls.ItemAt(i);
@@ -1020,102 +2206,627 @@ UVCProducer::StartStreaming()
 	if (!format || !resolution || !frameRate)
 		return B_ERROR;
 
-	uvc_error_t res = uvc_get_stream_ctrl_format_size(
-		fDeviceHandle,
-		&fStreamCtrl,
-		format->format,
-		resolution->width,
-		resolution->height,
-		frameRate->fps
-	);
+	uvc_set_tracing(fDeviceHandle, fLatencyTrace.IsEnabled());
+
+	uvc_error_t res = OpenStream(format->format, resolution->width,
+		resolution->height, frameRate->fps, 0);
+	if (res == UVC_ERROR_NO_BANDWIDTH) {
+		// Other devices on the bus left too little bandwidth, settle for
+		// the best mode that still fits at the same resolution
+		res = OpenFallbackStream(format->format, resolution->width,
+			resolution->height, frameRate->fps);
+	}
 
 	if (res < 0)
-		return B_ERROR;
+		fStreamCtrl.dwFrameInterval = 0;
+	if (fConnected)
+		UpdateFrameRate();
+
+	BString mode;
+	if (res < 0)
+		mode.SetToFormat("Not streaming: %s", uvc_strerror(res));
+	else {
+		const char* name = format->name;
+		for (int32 i = 0; i < fFormats.CountItems(); i++) {
+			FormatDesc* desc = (FormatDesc*)fFormats.ItemAt(i);
+			if (desc->index == fStreamCtrl.bFormatIndex)
+				name = desc->name;
+		}
+		uint32 fps = fStreamCtrl.dwFrameInterval > 0
+			? 10000000 / fStreamCtrl.dwFrameInterval : 0;
+		mode.SetToFormat("%s %ux%u, %" B_PRIu32 " fps%s", name,
+			resolution->width, resolution->height, fps,
+			fStreamCtrl.bFormatIndex != format->index || fps != frameRate->fps
+				? " (reduced, bus busy)" : "");
+	}
 
-	res = uvc_start_streaming(
-		fDeviceHandle,
-		&fStreamCtrl,
-		_uvc_callback,
-		this,
-		0
-	);
+	if (mode != fStreamMode) {
+		fStreamMode = mode;
+		fLastStreamModeChange = system_time();
+		BroadcastNewParameterValue(fLastStreamModeChange, P_STREAM_MODE,
+			(void*)fStreamMode.String(), fStreamMode.Length() + 1);
+	}
 
 	return res < 0 ? B_ERROR : B_OK;
 }
 
+uvc_error_t
+UVCProducer::OpenStream(uvc_frame_format format, uint16 width, uint16 height,
+	uint32 fps, uint8 flags)
+{
+	uvc_error_t res = uvc_get_stream_ctrl_format_size(fDeviceHandle,
+		&fStreamCtrl, format, width, height, fps);
+	if (res < 0)
+		return res;
+
+	uvc_stream_handle_t* stream;
+	res = uvc_stream_open_ctrl(fDeviceHandle, &stream, &fStreamCtrl);
+	if (res < 0)
+		return res;
+
+	BPath recording;
+	if (fRecordPayloads && GetRecordingPath(&recording) == B_OK)
+		uvc_stream_record(stream, recording.Path());
+
+	// The callback only queues frames, a second slot absorbs the odd
+	// scheduling hiccup of the callback thread. Late frames still give way
+	// to newer ones and show up in the dropped frames count.
+	uvc_stream_set_ring(stream, 2, UVC_RING_LATEST);
+	// Zero-copy frames keep their libuvc buffer while queued or decoded,
+	// the stream needs no more buffers than that for them
+	uvc_stream_set_held_buffers(stream, fFrameQueue.CountSlots());
+
+	res = uvc_stream_start(stream, _uvc_callback, this,
+		UVC_STREAM_ZERO_COPY | flags);
+	if (res < 0)
+		uvc_stream_close(stream);
+
+	return res;
+}
+
+uvc_error_t
+UVCProducer::OpenFallbackStream(uvc_frame_format format, uint16 width,
+	uint16 height, uint32 fps)
+{
+	// Uncompressed frames may fit once only their real bandwidth is asked
+	// for, many cameras ask for much more
+	uvc_error_t res = UVC_ERROR_NO_BANDWIDTH;
+	if (ColorConverter::IsSupported(format)) {
+		res = OpenStream(format, width, height, fps, UVC_STREAM_FIX_BANDWIDTH);
+		if (res != UVC_ERROR_NO_BANDWIDTH)
+			return res;
+	}
+
+	// Then lower frame rates of the same format, and the compressed
+	// formats from the selected rate down, they take a fraction of the
+	// bandwidth of uncompressed ones
+	const uvc_frame_format candidates[] = {
+		format,
+		UVC_FRAME_FORMAT_MJPEG,
+		UVC_FRAME_FORMAT_H264
+	};
+
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		if (i > 0 && candidates[i] == format)
+			continue;
+
+		const uvc_frame_desc_t* frame = FindFrameDesc(candidates[i], width,
+			height);
+		if (frame == NULL || frame->intervals == NULL)
+			continue;
+
+		uint8 flags = ColorConverter::IsSupported(candidates[i])
+			? UVC_STREAM_FIX_BANDWIDTH : 0;
+		uint32 below = i == 0 ? fps : fps + 1;
+		while (true) {
+			uint32 rate = 0;
+			for (const uint32_t* interval = frame->intervals; *interval;
+					interval++) {
+				uint32 candidate = 10000000 / *interval;
+				if (candidate > rate && candidate < below)
+					rate = candidate;
+			}
+			if (rate == 0)
+				break;
+
+			res = OpenStream(candidates[i], width, height, rate, flags);
+			if (res == UVC_SUCCESS)
+				return res;
+			below = rate;
+		}
+	}
+
+	return res;
+}
+
+const uvc_frame_desc_t*
+UVCProducer::FindFrameDesc(uvc_frame_format format, uint16 width,
+	uint16 height) const
+{
+	// Only formats we can decode
+	bool offered = false;
+	for (int32 i = 0; i < fFormats.CountItems(); i++) {
+		if (((FormatDesc*)fFormats.ItemAt(i))->format == format)
+			offered = true;
+	}
+	if (!offered)
+		return NULL;
+
+	const uvc_format_desc_t *format_desc = uvc_get_format_descs(fDeviceHandle);
+	for (; format_desc != NULL; format_desc = format_desc->next) {
+		uvc_frame_format frameFormat
+			= format_desc->bDescriptorSubtype == UVC_VS_FORMAT_MJPEG
+				? UVC_FRAME_FORMAT_MJPEG
+				: uvc_frame_format_for_guid(format_desc->guidFormat);
+		if (frameFormat != format)
+			continue;
+
+		const uvc_frame_desc_t *frame_desc = format_desc->frame_descs;
+		for (; frame_desc != NULL; frame_desc = frame_desc->next) {
+			if (frame_desc->wWidth == width && frame_desc->wHeight == height)
+				return frame_desc;
+		}
+	}
+
+	return NULL;
+}
+
 void
 UVCProducer::StopStreaming()
 {
+	// A capture uses the stream, the read gives up once cancelled instead
+	// of waiting for the camera
+	if (fStillThread >= B_OK) {
+		if (fDeviceHandle)
+			uvc_cancel_still(fDeviceHandle);
+		status_t result;
+		wait_for_thread(fStillThread, &result);
+		fStillThread = -1;
+	}
+
 	if (fDeviceHandle)
 		uvc_stop_streaming(fDeviceHandle);
+	fStreamCtrl.dwFrameInterval = 0;
+}
+
+int
+UVCProducer::SetupStill(uvc_still_ctrl_t* still)
+{
+	if (uvc_is_replay(fDeviceHandle))
+		return 0;
+
+	// The largest image the camera takes in the format it streams
+	uint16 width = 0;
+	uint16 height = 0;
+	const uvc_format_desc_t *format_desc = uvc_get_format_descs(fDeviceHandle);
+	for (; format_desc != NULL; format_desc = format_desc->next) {
+		if (format_desc->bFormatIndex != fStreamCtrl.bFormatIndex)
+			continue;
+
+		const uvc_still_frame_desc_t *still = format_desc->still_frame_desc;
+		for (; still != NULL; still = still->next) {
+			const uvc_still_frame_res_t *size = still->imageSizePatterns;
+			for (; size != NULL; size = size->next) {
+				if ((uint32)size->wWidth * size->wHeight
+						> (uint32)width * height) {
+					width = size->wWidth;
+					height = size->wHeight;
+				}
+			}
+		}
+	}
+
+	if (width == 0
+		|| uvc_get_still_ctrl_format_size(fDeviceHandle, &fStreamCtrl,
+			still, width, height) < 0)
+		return 0;
+
+	return uvc_get_still_method(fDeviceHandle, fStreamCtrl.bInterfaceNumber);
+}
+
+status_t
+UVCProducer::CaptureStill()
+{
+	if (!fRunning || fStillWriter == NULL)
+		return B_NOT_ALLOWED;
+
+	// One at a time, the thread waits for the camera
+	thread_info info;
+	if (fStillThread >= B_OK && get_thread_info(fStillThread, &info) == B_OK)
+		return B_BUSY;
+
+	fStillThread = spawn_thread(_still_capture, "uvc still capture",
+		B_NORMAL_PRIORITY, this);
+	if (fStillThread < B_OK)
+		return fStillThread;
+
+	resume_thread(fStillThread);
+	return B_OK;
+}
+
+int32
+UVCProducer::_still_capture(void *data)
+{
+	return ((UVCProducer *)data)->StillCapture();
+}
+
+int32
+UVCProducer::StillCapture()
+{
+	// Long enough for a large image over a busy bus
+	const int kStillTimeout = 2000;
+
+	// Negotiated only now, a method 2 image needs a buffer of its size
+	// while it comes in through the stream
+	uvc_still_ctrl_t still;
+	int method = SetupStill(&still);
+	if (method >= 2
+		&& uvc_trigger_still(fDeviceHandle, &still) == UVC_SUCCESS) {
+		uvc_frame_t* frame = uvc_allocate_frame(0);
+		if (frame != NULL) {
+			uvc_error_t res = uvc_read_still(fDeviceHandle, &still, frame,
+				kStillTimeout);
+			if (res == UVC_SUCCESS)
+				fStillWriter->Add(frame);
+			uvc_free_frame(frame);
+			// Cancelled, the stream stops
+			if (res == UVC_SUCCESS || res == UVC_ERROR_INTERRUPTED)
+				return B_OK;
+		}
+	}
+
+	// Otherwise the next frame of the stream is the image, at the
+	// resolution of the stream. A full resolution one would take
+	// restarting the stream at that size, the very pause capturing
+	// while the preview runs avoids.
+	atomic_set(&fStillPending, 1);
+	return B_OK;
+}
+
+void
+UVCProducer::SaveDecodedStill(const uint8* bits)
+{
+	if (fStillWriter == NULL)
+		return;
+
+	uint32 width = fConnectedFormat.display.line_width;
+	uint32 height = fConnectedFormat.display.line_count;
+	if (fConnectedFormat.display.format == B_RGB32) {
+		fStillWriter->AddBitmap(bits, width, height, width * 4);
+		return;
+	}
+
+	// B_YCbCr422 is laid out like YUYV frames
+	uvc_frame_t frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.data = (void*)bits;
+	frame.data_bytes = width * height * 2;
+	frame.width = width;
+	frame.height = height;
+	frame.step = width * 2;
+	frame.frame_format = UVC_FRAME_FORMAT_YUYV;
+	fStillWriter->Add(&frame);
 }
 
 void
 UVCProducer::_uvc_callback(uvc_frame_t *frame, void *ptr)
 {
+	// Runs on the libuvc thread, only queue the frame so a slow decode
+	// never holds up the USB side. The queue holds on to the libuvc buffer
+	// the frame was assembled in, nothing is copied.
 	UVCProducer *producer = static_cast<UVCProducer*>(ptr);
-	producer->HandleFrame(frame);    
+	producer->fFrameQueue.Push(frame);
+}
+
+int32
+UVCProducer::_frame_decoder(void *data)
+{
+	return ((UVCProducer *)data)->FrameDecoder();
+}
+
+int32
+UVCProducer::FrameDecoder()
+{
+	// The newest frame is kept, FrameGenerator wakes this thread to
+	// decode it again when the camera stalls in direct decode mode
+	uvc_frame_t *last = NULL;
+	while (true) {
+		bool woken = false;
+		uvc_frame_t *frame = fFrameQueue.Pop(&woken);
+		if (woken) {
+			if (last != NULL)
+				RepeatFrame(last);
+			continue;
+		}
+		if (frame == NULL)
+			break;
+
+		HandleFrame(frame);
+		fFrameQueue.Recycle(last);
+		last = frame;
+	}
+
+	fFrameQueue.Recycle(last);
+	return B_OK;
 }
 
 void
 UVCProducer::HandleFrame(uvc_frame_t *frame)
 {
-	if (fFrameBuffer == NULL || fFrameBufferSize == 0)
-		return;
-	
-	BAutolock frameLocker(fLock);
+	// Every SCR keeps the device clock mapping up to date, even when the
+	// frame itself is not used
+	if (frame->scr != 0) {
+		if (fClockRecovery.ClockFrequency() != fStreamCtrl.dwClockFrequency)
+			fClockRecovery.Reset(fStreamCtrl.dwClockFrequency);
+		fClockRecovery.AddSample(frame->scr,
+			monotonic_to_system_time(frame->scr_time));
+		fClockDrift = fClockRecovery.Drift();
+	}
 
-	// MJPEG frame
-	if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
-		struct jpeg_decompress_struct cinfo;
-		struct JpegErrorManager jerr;
+	if (fFrameBufferSize == 0)
+		return;
 
-		cinfo.err = jpeg_std_error(&jerr.pub);
-		jerr.pub.error_exit = JpegErrorExit;
+	// A still image of a camera that takes none of its own, at the
+	// resolution of the stream whatever the output size. H.264 frames are
+	// only a picture once decoded.
+	if (frame->frame_format != UVC_FRAME_FORMAT_H264
+		&& atomic_test_and_set(&fStillPending, 0, 1) == 1
+		&& fStillWriter != NULL)
+		fStillWriter->Add(frame);
+
+	bool tracing = fLatencyTrace.IsEnabled();
+
+	if (!fDirectDecode) {
+		// Decode into the writer's buffer, neither this thread nor
+		// FrameGenerator ever waits for the other one
+		BAutolock decodeLocker(fDecodeLock);
+		uint8* back = fFrameBuffers.WriteBuffer();
+		if (back == NULL)
+			return;
 
-		if (setjmp(jerr.setjmp_buffer)) {
-			jpeg_destroy_decompress(&cinfo);
+		bigtime_t decodeStart = tracing ? system_time() : 0;
+		if (DecodeFrame(frame, back, fFrameBufferSize) != B_OK)
 			return;
-		}
+		if (tracing)
+			TraceFrame(frame, decodeStart);
+		if (frame->frame_format == UVC_FRAME_FORMAT_H264
+			&& atomic_test_and_set(&fStillPending, 0, 1) == 1)
+			SaveDecodedStill(back);
+
+		fFrameBuffers.Publish();
+		FrameReady(frame);
+		return;
+	}
 
-		jpeg_create_decompress(&cinfo);
-		jpeg_mem_src(&cinfo, (unsigned char*)frame->data, frame->data_bytes);
-		jpeg_read_header(&cinfo, TRUE);
-		cinfo.out_color_space = JCS_EXT_BGRA;
-		jpeg_start_decompress(&cinfo);
+	// The decode thread is stopped before the buffer group goes away,
+	// so it is safe to use it here.
+	if (fBufferGroup == NULL)
+		return;
 
-		int row_stride = cinfo.output_width * cinfo.output_components;
-		JSAMPARRAY buffer_array = (*cinfo.mem->alloc_sarray)(
-				(j_common_ptr)&cinfo, JPOOL_IMAGE, row_stride, 1);
+	bigtime_t requestStart = tracing ? system_time() : 0;
+	BBuffer *buffer = fBufferGroup->RequestBuffer(fFrameBufferSize, 0LL);
+	if (tracing) {
+		fLatencyTrace.Record(LatencyTrace::kBufferRequest,
+			system_time() - requestStart);
+	}
+	if (buffer == NULL) {
+		// Later H.264 frames still need this one as a reference
+		if (frame->frame_format == UVC_FRAME_FORMAT_H264)
+			DecodeFrame(frame, NULL, 0);
+		return;
+	}
 
-		uint8_t* out_data = fFrameBuffer;
-		while (cinfo.output_scanline < cinfo.output_height) {
-			jpeg_read_scanlines(&cinfo, buffer_array, 1);
-			memcpy(out_data, buffer_array[0], row_stride);
-			out_data += row_stride;
-		}
+	// The lock keeps the decoders while a parameter change swaps them
+	bigtime_t decodeStart = tracing ? system_time() : 0;
+	fDecodeLock.Lock();
+	status_t status = DecodeFrame(frame, (uint8*)buffer->Data(),
+		fFrameBufferSize);
+	fDecodeLock.Unlock();
+	if (status != B_OK) {
+		buffer->Recycle();
+		return;
+	}
+	if (tracing)
+		TraceFrame(frame, decodeStart);
+	if (frame->frame_format == UVC_FRAME_FORMAT_H264
+		&& atomic_test_and_set(&fStillPending, 0, 1) == 1)
+		SaveDecodedStill((const uint8*)buffer->Data());
+
+	// Publish the newest frame, a frame that was never sent is dropped.
+	// So is this one if copy mode was selected while it was decoded.
+	fLock.Lock();
+	BBuffer *stale = buffer;
+	if (fDirectDecode) {
+		stale = fPendingBuffer;
+		fPendingBuffer = buffer;
+	}
+	fLock.Unlock();
 
-		jpeg_finish_decompress(&cinfo);
-		jpeg_destroy_decompress(&cinfo);
-	// YUYV frame
-	} else if (frame->frame_format == UVC_FRAME_FORMAT_YUYV) {
-		uint8_t* yuyv_data = (uint8_t*)frame->data;
-		uint8_t* rgb32_data = fFrameBuffer;
+	if (stale != NULL)
+		stale->Recycle();
 
-		uint8_t *prgb = (uint8_t*)fFrameBuffer;
-		uint8_t *pyuv = (uint8_t*)frame->data;
-		uint8_t *pyuv_end = pyuv + frame->data_bytes;
+	FrameReady(frame);
+}
 
-		while (pyuv < pyuv_end) {
-			IYUYV2BGR_8(pyuv, prgb);	
-			prgb += 4 * 8;
-			pyuv += 2 * 8;
+void
+UVCProducer::RepeatFrame(uvc_frame_t *frame)
+{
+	// Copy mode resends its read buffer instead. Decoding an H.264 frame
+	// twice would break the references of the frames after it.
+	if (!fDirectDecode || fBufferGroup == NULL || fFrameBufferSize == 0
+		|| frame->frame_format == UVC_FRAME_FORMAT_H264)
+		return;
+
+	BBuffer *buffer = fBufferGroup->RequestBuffer(fFrameBufferSize, 0LL);
+	if (buffer == NULL)
+		return;
+
+	fDecodeLock.Lock();
+	status_t status = DecodeFrame(frame, (uint8*)buffer->Data(),
+		fFrameBufferSize);
+	fDecodeLock.Unlock();
+
+	// A frame the camera sent in the meantime wins
+	fLock.Lock();
+	if (status == B_OK && fDirectDecode && fPendingBuffer == NULL) {
+		fPendingBuffer = buffer;
+		buffer = NULL;
+	}
+	fLock.Unlock();
+
+	if (buffer != NULL)
+		buffer->Recycle();
+}
+
+void
+UVCProducer::FrameReady(uvc_frame_t *frame)
+{
+	// The PTS is when the camera started capturing the frame. Without it,
+	// or before the clocks are locked, the time libuvc got the last byte
+	// is the best guess.
+	bigtime_t captureTime = 0;
+	if (frame->pts == 0
+		|| fClockRecovery.DeviceToSystem(frame->pts, &captureTime) != B_OK)
+		captureTime = monotonic_to_system_time(frame->capture_time_finished);
+	if (captureTime == 0)
+		captureTime = system_time();
+	atomic_set64(&fCaptureTime, captureTime);
+
+	if (fCameraClock)
+		release_sem_etc(fFrameSync, 1, B_DO_NOT_RESCHEDULE);
+}
+
+void
+UVCProducer::TraceFrame(uvc_frame_t *frame, bigtime_t decodeStart)
+{
+	bigtime_t decoded = system_time();
+	fLatencyTrace.Record(LatencyTrace::kDecode, decoded - decodeStart);
+
+	// Tracing may have been enabled while the frame was on its way
+	if (frame->transfer_time.tv_sec == 0)
+		return;
+
+	bigtime_t transfer = monotonic_to_system_time(frame->transfer_time);
+	bigtime_t complete = monotonic_to_system_time(
+		frame->capture_time_finished);
+	bigtime_t callback = monotonic_to_system_time(frame->callback_time);
+	fLatencyTrace.Record(LatencyTrace::kFrameAssembly, complete - transfer);
+	fLatencyTrace.Record(LatencyTrace::kCallback, callback - complete);
+	fLatencyTrace.Record(LatencyTrace::kDecodeQueue, decodeStart - callback);
+
+	// Left before the frame is published. Should a newer frame overtake
+	// it, its send is accounted to the newer one, good enough for stats.
+	atomic_set64(&fTraceTransferTime, transfer);
+	atomic_set64(&fTraceDecodedTime, decoded);
+	atomic_add(&fTraceSequence, 1);
+}
+
+status_t
+UVCProducer::SaveLatencyTrace(BPath* path)
+{
+	status_t status = find_directory(B_USER_SETTINGS_DIRECTORY, path);
+	if (status != B_OK)
+		return status;
+
+	path->Append("UVCMediaAddon");
+	mkdir(path->Path(), ALLPERMS);
+	BString filename;
+	filename << fDeviceDescriptor->product << " - "
+		<< fDeviceDescriptor->serialNumber << " latency.txt";
+	path->Append(filename);
+
+	BFile file;
+	status = file.SetTo(path->Path(),
+		B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+	if (status != B_OK)
+		return status;
+
+	return fLatencyTrace.WriteTo(&file);
+}
+
+status_t
+UVCProducer::GetRecordingPath(BPath* path) const
+{
+	// The add-on offers the recordings of this folder for replay
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, path) != B_OK)
+		return B_ERROR;
+
+	path->Append("UVCMediaAddon");
+	mkdir(path->Path(), ALLPERMS);
+	BString filename;
+	filename << fDeviceDescriptor->product << " - "
+		<< fDeviceDescriptor->serialNumber << ".uvcrec";
+	return path->Append(filename);
+}
+
+status_t
+UVCProducer::GetStillPath(BPath* path) const
+{
+	// StillWriter numbers the images taken with this base name
+	if (find_directory(B_USER_SETTINGS_DIRECTORY, path) != B_OK)
+		return B_ERROR;
+
+	path->Append("UVCMediaAddon");
+	mkdir(path->Path(), ALLPERMS);
+	BString filename;
+	filename << fDeviceDescriptor->product << " - "
+		<< fDeviceDescriptor->serialNumber << " still";
+	return path->Append(filename);
+}
+
+status_t
+UVCProducer::DecodeFrame(uvc_frame_t *frame, uint8 *dest, size_t size)
+{
+	uint32 width = fConnectedFormat.display.line_width;
+	uint32 height = fConnectedFormat.display.line_count;
+	color_space space = fConnectedFormat.display.format;
+	size_t row_stride = width * (space == B_YCbCr422 ? 2 : 4);
+
+	status_t status = B_OK;
+	bigtime_t decodeTime = 0;
+
+	// MJPEG frame
+	if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+		if (fParallelDecoder != NULL) {
+			status = fParallelDecoder->Decode((const uint8*)frame->data,
+				frame->data_bytes, dest, width, height, row_stride, space);
+			decodeTime = fParallelDecoder->AverageDecodeTime();
+		} else {
+			status = fJpegDecoder.Decode((const uint8*)frame->data,
+				frame->data_bytes, dest, width, height, row_stride, space);
+			decodeTime = fJpegDecoder.AverageDecodeTime();
+		}
+	// H.264 frame
+	} else if (frame->frame_format == UVC_FRAME_FORMAT_H264) {
+		if (fH264Decoder == NULL) {
+			fH264Decoder = new H264Decoder();
+			fH264Dropped = fFrameQueue.Dropped();
+		}
+
+		// A frame the queue dropped breaks the reference chain
+		uint32 dropped = fFrameQueue.Dropped();
+		if (dropped != fH264Dropped) {
+			fH264Dropped = dropped;
+			fH264Decoder->Resync();
 		}
+
+		status = fH264Decoder->Decode((const uint8*)frame->data,
+			frame->data_bytes, dest, width, height, row_stride, space);
+		decodeTime = fH264Decoder->AverageDecodeTime();
+	// Uncompressed frame
+	} else if (ColorConverter::IsSupported(frame->frame_format)) {
+		status = ColorConverter::Convert(frame, dest, width, height,
+			row_stride, space);
 	// Not supported frame
 	} else {
-		memset(fFrameBuffer, 0, fFrameBufferSize);
-		return;
+		fill_black(dest, size, space);
 	}
+
+	// The control thread reads this copy, the decoders are only ever
+	// touched by this thread
+	atomic_set64(&fDecodeTime, decodeTime);
+
+	return status;
 }
 
 int32
@@ -1127,7 +2838,14 @@ UVCProducer::_frame_generator(void *data)
 int32 
 UVCProducer::FrameGenerator()
 {
+	// The fallback timer repeats the last frame after this many frame
+	// periods without one from the camera. In direct decode mode the
+	// decode thread first has to decode it again, it is sent a frame
+	// period later.
+	const int32 kStallPeriods = 3;
+
 	bigtime_t wait_until = system_time();
+	bool cameraClocked = false;
 
 	while (1) {
 		status_t err = acquire_sem_etc(fFrameSync, 1, B_ABSOLUTE_TIMEOUT,
@@ -1136,14 +2854,61 @@ UVCProducer::FrameGenerator()
 		if ((err != B_OK) && (err != B_TIMED_OUT))
 			break;
 
+		if (fCameraClock) {
+			cameraClocked = true;
+
+			if (!fConnected || !fRunning || !fEnabled) {
+				wait_until = system_time() + 100000;
+				continue;
+			}
+
+			// The clock and the frame count only change under the lock
+			BAutolock frameLocker(fLock);
+			wait_until = system_time()
+				+ kStallPeriods * fFrameClock.FramePeriod();
+
+			// B_OK is a frame from HandleFrame (or a wakeup, then there
+			// is nothing new to send), a timeout a stalled camera
+			BBuffer *buffer = TakeFrameBuffer(err == B_OK);
+			if (buffer == NULL) {
+				if (err == B_TIMED_OUT && fDirectDecode) {
+					fFrameQueue.Wake();
+					wait_until = system_time() + fFrameClock.FramePeriod();
+				}
+				continue;
+			}
+
+			// Stamped with the capture time plus the usual delay between
+			// capture and sending. Keeping that delay steady keeps the
+			// offset to audio steady too.
+			bigtime_t now = system_time();
+			bigtime_t captured = now - fCaptureLatency;
+			if (err == B_OK) {
+				captured = atomic_get64(&fCaptureTime);
+				UpdateCaptureLatency(now - captured);
+			}
+			fFrame++;
+			SendFrameBuffer(buffer, TimeSource()->PerformanceTimeFor(captured)
+				+ fCaptureLatency + EventLatency());
+			continue;
+		}
+
+		BAutolock frameLocker(fLock);
+
+		if (cameraClocked) {
+			// Back on the timer, it counts from now on
+			cameraClocked = false;
+			fFrameClock.SetBase(
+				TimeSource()->PerformanceTimeFor(system_time()), fFrame);
+		}
+
 		fFrame++;
 
 		if (!fConnected || !fRunning || !fEnabled)
 			continue;
 
-		wait_until = TimeSource()->RealTimeFor(fPerformanceTimeBase +
-				(bigtime_t)((fFrame - fFrameBase) *
-				(1000000 / fConnectedFormat.field_rate)), 0) - fProcessingLatency;
+		wait_until = TimeSource()->RealTimeFor(fFrameClock.TimeFor(fFrame), 0)
+			- fProcessingLatency;
 
 		if (wait_until < system_time())
 			continue;
@@ -1151,41 +2916,114 @@ UVCProducer::FrameGenerator()
 		if (err == B_OK)
 			continue;
 
-		BAutolock frameLocker(fLock);
-
-		BBuffer *buffer = fBufferGroup->RequestBuffer(
-			4 * fConnectedFormat.display.line_width *
-			fConnectedFormat.display.line_count, 0LL);
-
+		BBuffer *buffer = TakeFrameBuffer(false);
 		if (!buffer)
 			continue;
 
-		media_header *h = buffer->Header();
-		h->type = B_MEDIA_RAW_VIDEO;
-		h->time_source = TimeSource()->ID();
-		h->size_used = 4 * fConnectedFormat.display.line_width *
-				fConnectedFormat.display.line_count;
-		h->start_time = fPerformanceTimeBase +
-				(bigtime_t)((fFrame - fFrameBase) *
-				(1000000 / fConnectedFormat.field_rate));
-		h->file_pos = 0;
-		h->orig_size = 0;
-		h->data_offset = 0;
-		h->u.raw_video.field_gamma = 1.0;
-		h->u.raw_video.field_sequence = fFrame;
-		h->u.raw_video.field_number = 0;
-		h->u.raw_video.pulldown_number = 0;
-		h->u.raw_video.first_active_line = 1;
-		h->u.raw_video.line_count = fConnectedFormat.display.line_count;
-
-		if (fFrameBuffer == NULL || fFrameBufferSize == 0)
-			memset((unsigned char*)buffer->Data(), 0, h->size_used);
-		else
-			memcpy((unsigned char*)buffer->Data(), fFrameBuffer, fFrameBufferSize);
-
-		if (SendBuffer(buffer, fOutput.source, fOutput.destination) < B_OK)
-			buffer->Recycle();
+		SendFrameBuffer(buffer, fFrameClock.TimeFor(fFrame));
 	}
 
 	return B_OK;
 }
+
+void
+UVCProducer::UpdateCaptureLatency(bigtime_t delay)
+{
+	// The 95th percentile of the last couple of seconds, so a single
+	// stall doesn't delay every later frame. It goes up at once, or most
+	// frames would be stamped late, and comes down slowly, so the stamps
+	// never step back by more than a fraction of a frame.
+	const int32 kPercentile = 95;
+	const int32 kFallShift = 4;
+
+	fCaptureDelays[fCaptureDelayIndex] = max_c(delay, (bigtime_t)0);
+	fCaptureDelayIndex = (fCaptureDelayIndex + 1) % CAPTURE_DELAY_WINDOW;
+	if (fCaptureDelayCount < CAPTURE_DELAY_WINDOW)
+		fCaptureDelayCount++;
+
+	bigtime_t sorted[CAPTURE_DELAY_WINDOW];
+	memcpy(sorted, fCaptureDelays, fCaptureDelayCount * sizeof(bigtime_t));
+	int32 rank = (fCaptureDelayCount - 1) * kPercentile / 100;
+	std::nth_element(sorted, sorted + rank, sorted + fCaptureDelayCount);
+	bigtime_t target = sorted[rank];
+
+	if (target > fCaptureLatency)
+		fCaptureLatency = target;
+	else
+		fCaptureLatency -= (fCaptureLatency - target) >> kFallShift;
+}
+
+BBuffer*
+UVCProducer::TakeFrameBuffer(bool newOnly)
+{
+	// Already decoded by HandleFrame or RepeatFrame, nothing new means
+	// nothing to send
+	if (fDirectDecode) {
+		BBuffer *buffer = fPendingBuffer;
+		fPendingBuffer = NULL;
+		return buffer;
+	}
+
+	bool fresh = false;
+	const uint8* frameBuffer = fFrameBuffers.ReadBuffer(&fresh);
+	if (newOnly && !fresh)
+		return NULL;
+
+	bool tracing = fLatencyTrace.IsEnabled();
+	bigtime_t requestStart = tracing ? system_time() : 0;
+	BBuffer *buffer = fBufferGroup->RequestBuffer(fFrameBufferSize, 0LL);
+	if (tracing) {
+		fLatencyTrace.Record(LatencyTrace::kBufferRequest,
+			system_time() - requestStart);
+	}
+	if (buffer == NULL)
+		return NULL;
+
+	// Nothing decoded yet is black, in the output's color space
+	if (frameBuffer == NULL) {
+		fill_black((uint8*)buffer->Data(), fFrameBufferSize,
+			fConnectedFormat.display.format);
+	}
+	else
+		memcpy((unsigned char*)buffer->Data(), frameBuffer, fFrameBufferSize);
+
+	return buffer;
+}
+
+void
+UVCProducer::SendFrameBuffer(BBuffer *buffer, bigtime_t start_time)
+{
+	media_header *h = buffer->Header();
+	h->type = B_MEDIA_RAW_VIDEO;
+	h->time_source = TimeSource()->ID();
+	h->size_used = fFrameBufferSize;
+	h->start_time = start_time;
+	h->file_pos = 0;
+	h->orig_size = 0;
+	h->data_offset = 0;
+	h->u.raw_video.field_gamma = 1.0;
+	h->u.raw_video.field_sequence = fFrame;
+	h->u.raw_video.field_number = 0;
+	h->u.raw_video.pulldown_number = 0;
+	h->u.raw_video.first_active_line = 1;
+	h->u.raw_video.line_count = fConnectedFormat.display.line_count;
+
+	if (SendBuffer(buffer, fOutput.source, fOutput.destination) < B_OK) {
+		buffer->Recycle();
+		return;
+	}
+
+	// Only the first send of a frame counts, the timer resends the
+	// previous frame when there is no new one
+	if (fLatencyTrace.IsEnabled()) {
+		int32 sequence = atomic_get(&fTraceSequence);
+		if (sequence != fTraceSentSequence) {
+			fTraceSentSequence = sequence;
+			bigtime_t now = system_time();
+			fLatencyTrace.Record(LatencyTrace::kSendWait,
+				now - atomic_get64(&fTraceDecodedTime));
+			fLatencyTrace.Record(LatencyTrace::kTotal,
+				now - atomic_get64(&fTraceTransferTime));
+		}
+	}
+}
@@ -17,40 +17,36 @@
 #include <Locker.h>
 #include <File.h>
 #include <Path.h>
+#include <String.h>
 
 #include <libuvc/libuvc.h>
 
-#define IYUYV2BGR_2(pyuv, pbgr) { \
-		int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-		int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-		int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-		(pbgr)[0] = sat(*(pyuv) + b); \
-		(pbgr)[1] = sat(*(pyuv) + g); \
-		(pbgr)[2] = sat(*(pyuv) + r); \
-		(pbgr)[3] = 255; \
-		(pbgr)[4] = sat((pyuv)[2] + b); \
-		(pbgr)[5] = sat((pyuv)[2] + g); \
-		(pbgr)[6] = sat((pyuv)[2] + r); \
-		(pbgr)[7] = 255; \
-	}
-#define IYUYV2BGR_8(pyuv, pbgr) IYUYV2BGR_4(pyuv, pbgr); IYUYV2BGR_4(pyuv + 8, pbgr + 16);
-#define IYUYV2BGR_4(pyuv, pbgr) IYUYV2BGR_2(pyuv, pbgr); IYUYV2BGR_2(pyuv + 4, pbgr + 8);
-
-static inline unsigned char sat(int i) {
-	return (unsigned char)( i >= 255 ? 255 : (i < 0 ? 0 : i));
-}
+#include "ClockRecovery.h"
+#include "ColorConverter.h"
+#include "ControlWorker.h"
+#include "FrameClock.h"
+#include "FrameQueue.h"
+#include "H264Decoder.h"
+#include "JpegDecoder.h"
+#include "LatencyTrace.h"
+#include "ParallelJpegDecoder.h"
+#include "StillWriter.h"
+#include "TripleBuffer.h"
 
 class UVCProducer :
 	public virtual BMediaNode,
 	public BMediaEventLooper,
 	public BBufferProducer,
-	public BControllable
+	public BControllable,
+	private ControlWriter
 {
 public:
 							UVCProducer(BMediaAddOn *addon,
 								const char *name, 
 								int32 internal_id,
-								uvc_device_t* device);
+								uvc_device_t* device,
+								DecodePool* decodePool,
+								const char* replayPath = NULL);
 	virtual					~UVCProducer();
 
 	virtual status_t		InitCheck() const { return fInitStatus; }
@@ -126,7 +122,42 @@ private:
 		P_BRIGHTNESS,
 		P_CONTRAST,
 		P_HUE,
-		P_SATURATION
+		P_SATURATION,
+		P_DIRECT_DECODE,
+		P_PARALLEL_DECODE,
+		P_SCALE,
+		P_DECODE_TIME,
+		P_CAMERA_CLOCK,
+		P_CLOCK_DRIFT,
+		P_DROPPED_FRAMES,
+		P_STREAM_MODE,
+		P_LATENCY_TRACE,
+		P_LATENCY_SAVE,
+		P_RECORD,
+		P_REPLAY_SPEED,
+		P_SHARPNESS,
+		P_GAMMA,
+		P_GAIN,
+		P_BACKLIGHT,
+		P_POWER_LINE,
+		P_WHITE_BALANCE,
+		P_WHITE_BALANCE_AUTO,
+		P_HUE_AUTO,
+		P_CONTRAST_AUTO,
+		P_AE_MODE,
+		P_AE_PRIORITY,
+		P_EXPOSURE,
+		P_IRIS,
+		P_FOCUS,
+		P_FOCUS_AUTO,
+		P_ZOOM,
+		P_ROLL,
+		P_PRIVACY,
+		P_HOLD_FRAMERATE,
+		P_STILL_CAPTURE,
+		P_LATENCY_SAVED,
+		// one read only value per LatencyTrace stage
+		P_LATENCY_STAGE
 	};
 
 	struct FormatDesc {
@@ -143,35 +174,82 @@ private:
 
 	struct FrameRateDesc {
 		uint32_t	fps;
+		uint32_t	interval;
 		uint8_t		index;
 	};
 
+	// control ranges read by the refresh thread and values the camera
+	// settled on after a write, sent to the control port
+	enum {
+		MSG_CONTROL_RANGES = 'uvcr',
+		MSG_CONTROL_APPLIED = 'uvca'
+	};
+
+	struct ControlValue {
+		int32		param_id;
+		float		value;
+		uint32		sequence;
+	};
+
+	struct ControlRange {
+		int32		param_id;
+		float		min;
+		float		max;
+		float		def;
+	};
+
+	enum {
+		CONTROL_CAMERA,			// camera terminal
+		CONTROL_PROCESSING		// processing unit
+	};
+
+	enum {
+		CONTROL_RANGE,			// slider
+		CONTROL_TOGGLE,			// on or off
+		CONTROL_MENU			// one of a few values
+	};
+
+	// Controls with a single value, the bit in bmControls of the unit
+	// tells whether the camera has them
+	struct ControlInfo {
+		int32		param_id;
+		const char*	name;
+		uint8		unit;
+		uint8		bit;
+		uint8		selector;
+		uint8		size;
+		bool		is_signed;
+		uint8		kind;
+	};
+
+	static const ControlInfo kControlInfos[];
+
+	// Manual controls the camera ignores or refuses while the control
+	// that sets them automatically is on. For the AE mode the bitmap of
+	// the modes that leave them to the user, for toggles 0.
+	struct AutoControl {
+		int32		param_id;
+		int32		auto_id;
+		uint8		manual_modes;
+	};
+
+	static const AutoControl kAutoControls[];
+
 	struct ControlDesc {
 		int32		param_id;
 		char		name[32];
+		const ControlInfo* info;
+		uint8		unit_id;
 		float		min;
+		// the GET_RES bitmap of the supported modes for the AE mode
 		float		max;
 		float		def;
 		float		value;
 		float		prev_value;
 		bigtime_t	changed;
-		
-		void Apply(uvc_device_handle_t *fDeviceHandle) {
-			switch (param_id) {
-				case P_BRIGHTNESS:
-					uvc_set_brightness(fDeviceHandle, value);
-					break;
-				case P_CONTRAST:
-					uvc_set_contrast(fDeviceHandle, value);
-					break;
-				case P_HUE:
-					uvc_set_hue(fDeviceHandle, value);
-					break;
-				case P_SATURATION:
-					uvc_set_saturation(fDeviceHandle, value);
-					break;				
-			}
-		};
+		// of the last write queued, older reports of applied values are
+		// stale
+		uint32		sequence;
 	};
 
 private:
@@ -185,23 +263,84 @@ private:
 	status_t				SetupDevice();
 	void					CleanupDevice();
 
+	FormatDesc*				CurrentFormat() const;
+	FrameRateDesc*			CurrentFrameRate() const;
+
 	status_t				CollectFormats();
 	status_t				CollectResolutions(uint8_t formatIndex);
 	status_t				CollectFrameRates(uint8_t formatIndex, uint8_t resolutionIndex);
 	status_t				InitControls();
+	bool					HasControl(const ControlInfo& info,
+								uint8* unitID) const;
+	ControlDesc*			FindControl(int32 id) const;
+	static bool				IsModeControl(int32 id);
+	bool					IsManual(const ControlDesc* ctrl) const;
+	void					QueueChangedControls(bool reset,
+								bigtime_t when);
+	void					BroadcastControl(ControlDesc* ctrl);
+	void					QueueControl(ControlDesc* ctrl);
+	float					ExposureLimit() const;
+	void					HoldFrameRate(bigtime_t when);
+	status_t				GetControlValue(int32 id, enum uvc_req_code req,
+								float* value);
+	status_t				QueryControlRange(ControlRange& range);
+	bool					ApplyControlRanges(const ControlRange* ranges,
+								int32 count);
+
+	status_t				OpenCapabilityCache(BFile& file, uint32 mode);
+	status_t				LoadCapabilityCache();
+	status_t				SaveCapabilityCache();
+	virtual	status_t		WriteControl(int32 id, float value,
+								float* applied);
+	virtual	void			ControlWritten(int32 id, float applied,
+								uint32 sequence);
+	static int32			_capability_refresh(void *data);
+	int32					CapabilityRefresh();
 	
 	status_t				OpenAddonSettings(BFile& file, uint32 mode);
 	status_t				LoadAddonSettings();
 	status_t				SaveAddonSettings();
 
+	void					SetupFrameBuffers();
+	void					SetupParallelDecoder();
+	void					UpdateFrameRate();
+
 	status_t				StartStreaming();
 	void					StopStreaming();
+	uvc_error_t				OpenStream(uvc_frame_format format,
+								uint16 width, uint16 height, uint32 fps,
+								uint8 flags);
+	uvc_error_t				OpenFallbackStream(uvc_frame_format format,
+								uint16 width, uint16 height, uint32 fps);
+	const uvc_frame_desc_t*	FindFrameDesc(uvc_frame_format format,
+								uint16 width, uint16 height) const;
 
 	static void				_uvc_callback(uvc_frame_t *frame, void *ptr);
 	void					HandleFrame(uvc_frame_t *frame);
+	void					RepeatFrame(uvc_frame_t *frame);
+	void					FrameReady(uvc_frame_t *frame);
+	void					TraceFrame(uvc_frame_t *frame,
+								bigtime_t decodeStart);
+	status_t				SaveLatencyTrace(BPath* path);
+	status_t				GetRecordingPath(BPath* path) const;
+	status_t				GetStillPath(BPath* path) const;
+	int						SetupStill(uvc_still_ctrl_t* still);
+	status_t				CaptureStill();
+	static int32			_still_capture(void *data);
+	int32					StillCapture();
+	void					SaveDecodedStill(const uint8* bits);
+	status_t				DecodeFrame(uvc_frame_t *frame, uint8 *dest,
+								size_t size);
 	
 	static int32			_frame_generator(void *data);
 	int32					FrameGenerator();
+	BBuffer*				TakeFrameBuffer(bool newOnly);
+	void					SendFrameBuffer(BBuffer *buffer,
+								bigtime_t start_time);
+	void					UpdateCaptureLatency(bigtime_t delay);
+
+	static int32			_frame_decoder(void *data);
+	int32					FrameDecoder();
 
 private:
 	status_t				fInitStatus;
@@ -214,8 +353,7 @@ private:
 	thread_id				fThread;
 	sem_id					fFrameSync;
 	uint32					fFrame;
-	uint32					fFrameBase;
-	bigtime_t				fPerformanceTimeBase;
+	FrameClock				fFrameClock;
 	bigtime_t				fProcessingLatency;
 	media_output			fOutput;
 	media_raw_video_format	fConnectedFormat;
@@ -223,31 +361,122 @@ private:
 	bool					fConnected;
 	bool					fEnabled;
 
-	// frame buffer
-	uint8*					fFrameBuffer;
+	// copy mode frames, the decode thread writes and FrameGenerator reads
+	TripleBuffer			fFrameBuffers;
 	size_t					fFrameBufferSize;
+	BLocker					fDecodeLock;
+
+	// raw frames from libuvc waiting for the decode thread
+	FrameQueue				fFrameQueue;
+	thread_id				fDecodeThread;
+
+	// direct decode, frames are decoded into buffers of fBufferGroup
+	bool					fDirectDecode;
+	BBuffer*				fPendingBuffer;
+
+	// camera clocked delivery, every decoded frame releases fFrameSync
+	// and is sent stamped with fCaptureTime
+	bool					fCameraClock;
+	bigtime_t				fCaptureTime;
+	bigtime_t				fCaptureLatency;
+
+	// recent delays between capture and sending, fCaptureLatency follows
+	// a high percentile of them
+	enum {
+		CAPTURE_DELAY_WINDOW = 64
+	};
+	bigtime_t				fCaptureDelays[CAPTURE_DELAY_WINDOW];
+	int32					fCaptureDelayCount;
+	int32					fCaptureDelayIndex;
+
+	// device clock to system_time() mapping from the PTS/SCR stamps,
+	// only used by the decode thread
+	ClockRecovery			fClockRecovery;
+	float					fClockDrift;
+
+	// per stage latency histograms while tracing is enabled, the decode
+	// thread leaves the stamps of its newest frame for SendFrameBuffer
+	LatencyTrace			fLatencyTrace;
+	// where the histograms went, or why they couldn't be saved
+	BString					fLatencySaved;
+	bigtime_t				fTraceTransferTime;
+	bigtime_t				fTraceDecodedTime;
+	int32					fTraceSequence;
+	int32					fTraceSentSequence;
+
+	JpegDecoder				fJpegDecoder;
+	// bands run on the threads the add-on shares between all cameras
+	DecodePool*				fDecodePool;
+	ParallelJpegDecoder*	fParallelDecoder;
+	bool					fParallelDecode;
+
+	// created by the decode thread on the first H.264 frame
+	H264Decoder*			fH264Decoder;
+	uint32					fH264Dropped;
+
+	// average decode time of the decoder in use, for the statistics
+	bigtime_t				fDecodeTime;
 
 	// UVC specific
 	uvc_device_t*			fDevice;
 	uvc_device_handle_t*	fDeviceHandle;
 	uvc_stream_ctrl_t		fStreamCtrl;
+	// the mode the camera actually streams in, may be a lower bandwidth
+	// one than selected when the bus is busy
+	BString					fStreamMode;
 	uvc_device_descriptor_t* fDeviceDescriptor;
 
+	// streams write their USB payloads to a file in the settings folder
+	// while fRecordPayloads is set. A node with fReplayPath plays such a
+	// file back in place of a camera.
+	bool					fRecordPayloads;
+	BString					fReplayPath;
+	bool					fReplayMaxSpeed;
+
 	// Format parameters
 	BList					fFormats;
 	BList					fResolutions;
 	BList					fFrameRates;
 	BList					fControls;
+	// re-reads the control ranges when they came from the cache
+	thread_id				fRefreshThread;
+	// control changes go to the camera on its thread
+	ControlWorker*			fControlWorker;
 
 	uint8					fCurrentFormatIndex;
 	uint8					fCurrentResolutionIndex;
 	uint8					fCurrentFrameRateIndex;
+	uint8					fScale;
 
 	// Parameter change times
 	bigtime_t				fLastFormatChange;
 	bigtime_t				fLastResolutionChange;
 	bigtime_t				fLastFrameRateChange;
 	bigtime_t				fLastPresetChange;
+	bigtime_t				fLastDirectDecodeChange;
+	bigtime_t				fLastParallelDecodeChange;
+	bigtime_t				fLastScaleChange;
+	bigtime_t				fLastCameraClockChange;
+	bigtime_t				fLastLatencyTraceChange;
+	bigtime_t				fLastStreamModeChange;
+	bigtime_t				fLastLatencySavedChange;
+	bigtime_t				fLastRecordChange;
+	bigtime_t				fLastReplaySpeedChange;
+	bigtime_t				fLastHoldFrameRateChange;
+	bigtime_t				fLastStillCaptureChange;
+
+	// keeps AE priority off and the exposure within a frame interval, so
+	// the camera doesn't lower the frame rate in low light
+	bool					fHoldFrameRate;
+
+	// full resolution still images while the preview runs. fStillThread
+	// negotiates, triggers and reads a capture. Cameras without method 2
+	// or 3 have fStillPending make the decode thread save the next frame
+	// instead, at the resolution of the stream. Images are written on the
+	// thread of fStillWriter, which lives while the node runs.
+	int32					fStillPending;
+	thread_id				fStillThread;
+	StillWriter*			fStillWriter;
 };
 
 #endif // _UVC_PRODUCER_H
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <File.h>
+
+#include <jpeglib.h>
+
+#include "ColorConverter.h"
+#include "StillWriter.h"
+
+// A still is worth a few more bytes than a video frame
+static const int kStillQuality = 95;
+
+struct StillErrorManager {
+	struct jpeg_error_mgr	pub;
+	jmp_buf					setjmp_buffer;
+};
+
+static void
+still_error_exit(j_common_ptr cinfo)
+{
+	StillErrorManager* error = (StillErrorManager*)cinfo->err;
+	longjmp(error->setjmp_buffer, 1);
+}
+
+StillWriter::StillWriter(const char* basePath)
+	: fInitStatus(B_NO_INIT)
+	, fBasePath(basePath)
+	, fLock("still writer")
+	, fPendingCount(0)
+	, fWorkSem(-1)
+	, fThread(-1)
+{
+	fWorkSem = create_sem(0, "still images");
+	if (fWorkSem < B_OK) {
+		fInitStatus = fWorkSem;
+		return;
+	}
+
+	fThread = spawn_thread(_writer, "uvc still writer",
+		B_LOW_PRIORITY, this);
+	if (fThread < B_OK) {
+		fInitStatus = fThread;
+		return;
+	}
+
+	resume_thread(fThread);
+	fInitStatus = B_OK;
+}
+
+StillWriter::~StillWriter()
+{
+	// Images already taken are still written, nobody could take them again
+	if (fWorkSem >= B_OK)
+		delete_sem(fWorkSem);
+
+	if (fThread >= B_OK) {
+		status_t result;
+		wait_for_thread(fThread, &result);
+	}
+
+	for (int32 i = 0; i < fPendingCount; i++) {
+		if (fPending[i].frame != NULL)
+			uvc_free_frame(fPending[i].frame);
+		free(fPending[i].bits);
+	}
+}
+
+status_t
+StillWriter::Add(const uvc_frame_t* frame)
+{
+	Still still = { NULL, NULL, frame->width, frame->height };
+	still.frame = uvc_allocate_frame(0);
+	if (still.frame == NULL)
+		return B_NO_MEMORY;
+
+	if (uvc_duplicate_frame((uvc_frame_t*)frame, still.frame) != UVC_SUCCESS) {
+		uvc_free_frame(still.frame);
+		return B_NO_MEMORY;
+	}
+
+	status_t status = _Queue(still);
+	if (status != B_OK)
+		uvc_free_frame(still.frame);
+	return status;
+}
+
+status_t
+StillWriter::AddBitmap(const uint8* bits, uint32 width, uint32 height,
+	size_t bytesPerRow)
+{
+	Still still = { NULL, NULL, width, height };
+	still.bits = (uint8*)malloc((size_t)width * height * 4);
+	if (still.bits == NULL)
+		return B_NO_MEMORY;
+
+	for (uint32 y = 0; y < height; y++) {
+		memcpy(still.bits + (size_t)y * width * 4, bits + y * bytesPerRow,
+			width * 4);
+	}
+
+	status_t status = _Queue(still);
+	if (status != B_OK)
+		free(still.bits);
+	return status;
+}
+
+status_t
+StillWriter::_Queue(const Still& still)
+{
+	BAutolock _(fLock);
+
+	if (fInitStatus != B_OK)
+		return fInitStatus;
+	if (fPendingCount == MAX_PENDING)
+		return B_BUSY;
+
+	fPending[fPendingCount++] = still;
+	release_sem_etc(fWorkSem, 1, B_DO_NOT_RESCHEDULE);
+	return B_OK;
+}
+
+int32
+StillWriter::_writer(void* data)
+{
+	return ((StillWriter*)data)->Writer();
+}
+
+int32
+StillWriter::Writer()
+{
+	while (true) {
+		// Once the semaphore is gone, what is left is written and the
+		// thread quits
+		status_t status = acquire_sem(fWorkSem);
+		if (status == B_INTERRUPTED)
+			continue;
+
+		fLock.Lock();
+		if (fPendingCount == 0) {
+			fLock.Unlock();
+			if (status != B_OK)
+				break;
+			continue;
+		}
+		Still still = fPending[0];
+		fPendingCount--;
+		for (int32 i = 0; i < fPendingCount; i++)
+			fPending[i] = fPending[i + 1];
+		fLock.Unlock();
+
+		_Write(still);
+
+		if (still.frame != NULL)
+			uvc_free_frame(still.frame);
+		free(still.bits);
+	}
+
+	return B_OK;
+}
+
+status_t
+StillWriter::_Write(const Still& still)
+{
+	const uint8* jpeg = NULL;
+	size_t size = 0;
+	uint8* compressed = NULL;
+	uint8* converted = NULL;
+	status_t status = B_OK;
+
+	if (still.frame != NULL
+		&& still.frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+		jpeg = (const uint8*)still.frame->data;
+		size = still.frame->data_bytes;
+	} else {
+		const uint8* bits = still.bits;
+		if (still.frame != NULL) {
+			if (!ColorConverter::IsSupported(still.frame->frame_format))
+				return B_NOT_SUPPORTED;
+
+			converted = (uint8*)malloc((size_t)still.width * still.height * 4);
+			if (converted == NULL)
+				return B_NO_MEMORY;
+
+			status = ColorConverter::Convert(still.frame, converted,
+				still.width, still.height, still.width * 4, B_RGB32);
+			bits = converted;
+		}
+
+		unsigned long compressedSize = 0;
+		if (status == B_OK) {
+			status = _Compress(bits, still.width, still.height, &compressed,
+				&compressedSize);
+		}
+		jpeg = compressed;
+		size = compressedSize;
+	}
+
+	BString path;
+	if (status == B_OK)
+		status = _NextPath(&path);
+
+	if (status == B_OK) {
+		BFile file;
+		status = file.SetTo(path.String(),
+			B_WRITE_ONLY | B_CREATE_FILE | B_FAIL_IF_EXISTS);
+		if (status == B_OK) {
+			ssize_t written = file.Write(jpeg, size);
+			if (written != (ssize_t)size)
+				status = written < 0 ? written : B_IO_ERROR;
+		}
+	}
+
+	free(converted);
+	free(compressed);
+	return status;
+}
+
+status_t
+StillWriter::_Compress(const uint8* bits, uint32 width, uint32 height,
+	uint8** jpeg, unsigned long* size)
+{
+	struct jpeg_compress_struct info;
+	StillErrorManager error;
+
+	*jpeg = NULL;
+	*size = 0;
+
+	info.err = jpeg_std_error(&error.pub);
+	error.pub.error_exit = still_error_exit;
+	if (setjmp(error.setjmp_buffer)) {
+		jpeg_destroy_compress(&info);
+		free(*jpeg);
+		*jpeg = NULL;
+		return B_ERROR;
+	}
+
+	jpeg_create_compress(&info);
+	jpeg_mem_dest(&info, jpeg, size);
+
+	info.image_width = width;
+	info.image_height = height;
+	info.input_components = 4;
+	info.in_color_space = JCS_EXT_BGRA;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info, kStillQuality, TRUE);
+
+	jpeg_start_compress(&info, TRUE);
+	while (info.next_scanline < info.image_height) {
+		JSAMPROW row = (JSAMPROW)(bits + (size_t)info.next_scanline * width * 4);
+		jpeg_write_scanlines(&info, &row, 1);
+	}
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+
+	return B_OK;
+}
+
+status_t
+StillWriter::_NextPath(BString* path)
+{
+	// Only this thread creates the files, the first free number stays free
+	for (int32 number = 1; number < 100000; number++) {
+		path->SetToFormat("%s %" B_PRId32 ".jpg", fBasePath.String(), number);
+		if (!BEntry(path->String()).Exists())
+			return B_OK;
+	}
+
+	return B_NAME_IN_USE;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _UVC_STILL_WRITER_H
+#define _UVC_STILL_WRITER_H
+
+#include <Locker.h>
+#include <OS.h>
+#include <String.h>
+#include <SupportDefs.h>
+
+#include <libuvc/libuvc.h>
+
+// Saves still images as JPEG files on a thread of its own, so neither the
+// libuvc callback nor the decode thread waits for the encoder or the disk.
+// MJPEG images are written as the camera sent them, uncompressed ones and
+// decoded B_RGB32 pixels are compressed first. Files are named after the
+// base path with a number that isn't taken yet.
+class StillWriter {
+public:
+							StillWriter(const char* basePath);
+							~StillWriter();
+
+			status_t		InitCheck() const { return fInitStatus; }
+
+			// Both copy the image and never wait for the disk
+			status_t		Add(const uvc_frame_t* frame);
+			status_t		AddBitmap(const uint8* bits, uint32 width,
+								uint32 height, size_t bytesPerRow);
+
+private:
+	enum {
+		MAX_PENDING = 4
+	};
+
+	// Either a frame from the camera or B_RGB32 pixels
+	struct Still {
+		uvc_frame_t*	frame;
+		uint8*			bits;
+		uint32			width;
+		uint32			height;
+	};
+
+			status_t		_Queue(const Still& still);
+			status_t		_Write(const Still& still);
+			status_t		_Compress(const uint8* bits, uint32 width,
+								uint32 height, uint8** jpeg,
+								unsigned long* size);
+			status_t		_NextPath(BString* path);
+
+	static	int32			_writer(void* data);
+			int32			Writer();
+
+			status_t		fInitStatus;
+			BString			fBasePath;
+
+			BLocker			fLock;
+			Still			fPending[MAX_PENDING];
+			int32			fPendingCount;
+			sem_id			fWorkSem;
+			thread_id		fThread;
+};
+
+#endif // _UVC_STILL_WRITER_H
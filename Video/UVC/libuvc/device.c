@@ -389,7 +389,8 @@ static uvc_error_t uvc_open_internal(
   }
 
   if (dev->ctx->own_usb_ctx && dev->ctx->open_devices == NULL) {
-    /* Since this is our first device, we need to spawn the event handler thread */
+    /* Since this is our first device, we need to spawn the event handler
+     * thread, unless a hotplug callback already keeps it running */
     uvc_start_handler_thread(dev->ctx);
   }
 
@@ -608,6 +609,7 @@ uvc_error_t uvc_get_device_descriptor(
   desc_internal = calloc(1, sizeof(*desc_internal));
   desc_internal->idVendor = usb_desc.idVendor;
   desc_internal->idProduct = usb_desc.idProduct;
+  desc_internal->bcdDevice = usb_desc.bcdDevice;
 
   if (libusb_open(dev->usb_dev, &usb_devh) == 0) {
     unsigned char buf[64];
@@ -666,6 +668,69 @@ void uvc_free_device_descriptor(
   UVC_EXIT_VOID();
 }
 
+/** @internal
+ * @brief Check whether a USB device has a video streaming interface
+ */
+static int _uvc_is_video_device(struct libusb_device *usb_dev) {
+  struct libusb_config_descriptor *config;
+  struct libusb_device_descriptor desc;
+  uint8_t got_interface = 0;
+
+  /* per interface */
+  int interface_idx;
+  const struct libusb_interface *interface;
+
+  /* per altsetting */
+  int altsetting_idx;
+  const struct libusb_interface_descriptor *if_desc;
+
+  if (libusb_get_config_descriptor(usb_dev, 0, &config) != 0)
+    return 0;
+
+  if ( libusb_get_device_descriptor ( usb_dev, &desc ) != LIBUSB_SUCCESS ) {
+    libusb_free_config_descriptor(config);
+    return 0;
+  }
+
+  for (interface_idx = 0;
+	 !got_interface && interface_idx < config->bNumInterfaces;
+	 ++interface_idx) {
+    interface = &config->interface[interface_idx];
+
+    for (altsetting_idx = 0;
+	   !got_interface && altsetting_idx < interface->num_altsetting;
+	   ++altsetting_idx) {
+	if_desc = &interface->altsetting[altsetting_idx];
+
+      // Skip TIS cameras that definitely aren't UVC even though they might
+      // look that way
+
+      if ( 0x199e == desc.idVendor && desc.idProduct  >= 0x8201 &&
+          desc.idProduct <= 0x8208 ) {
+        continue;
+      }
+
+      // Special case for Imaging Source cameras
+	/* Video, Streaming */
+      if ( 0x199e == desc.idVendor && ( 0x8101 == desc.idProduct ||
+          0x8102 == desc.idProduct ) &&
+          if_desc->bInterfaceClass == 255 &&
+          if_desc->bInterfaceSubClass == 2 ) {
+	  got_interface = 1;
+	}
+
+	/* Video, Streaming */
+	if (if_desc->bInterfaceClass == 14 && if_desc->bInterfaceSubClass == 2) {
+	  got_interface = 1;
+	}
+    }
+  }
+
+  libusb_free_config_descriptor(config);
+
+  return got_interface;
+}
+
 /**
  * @brief Get a list of the UVC devices attached to the system
  * @ingroup device
@@ -688,17 +753,6 @@ uvc_error_t uvc_get_device_list(
 
   /* per device */
   int dev_idx;
-  struct libusb_config_descriptor *config;
-  struct libusb_device_descriptor desc;
-  uint8_t got_interface;
-
-  /* per interface */
-  int interface_idx;
-  const struct libusb_interface *interface;
-
-  /* per altsetting */
-  int altsetting_idx;
-  const struct libusb_interface_descriptor *if_desc;
 
   UVC_ENTER();
 
@@ -716,51 +770,7 @@ uvc_error_t uvc_get_device_list(
   dev_idx = -1;
 
   while ((usb_dev = usb_dev_list[++dev_idx]) != NULL) {
-    got_interface = 0;
-
-    if (libusb_get_config_descriptor(usb_dev, 0, &config) != 0)
-      continue;
-
-    if ( libusb_get_device_descriptor ( usb_dev, &desc ) != LIBUSB_SUCCESS )
-      continue;
-
-    for (interface_idx = 0;
-	 !got_interface && interface_idx < config->bNumInterfaces;
-	 ++interface_idx) {
-      interface = &config->interface[interface_idx];
-
-      for (altsetting_idx = 0;
-	   !got_interface && altsetting_idx < interface->num_altsetting;
-	   ++altsetting_idx) {
-	if_desc = &interface->altsetting[altsetting_idx];
-
-        // Skip TIS cameras that definitely aren't UVC even though they might
-        // look that way
-
-        if ( 0x199e == desc.idVendor && desc.idProduct  >= 0x8201 &&
-            desc.idProduct <= 0x8208 ) {
-          continue;
-        }
-
-        // Special case for Imaging Source cameras
-	/* Video, Streaming */
-        if ( 0x199e == desc.idVendor && ( 0x8101 == desc.idProduct ||
-            0x8102 == desc.idProduct ) &&
-            if_desc->bInterfaceClass == 255 &&
-            if_desc->bInterfaceSubClass == 2 ) {
-	  got_interface = 1;
-	}
-
-	/* Video, Streaming */
-	if (if_desc->bInterfaceClass == 14 && if_desc->bInterfaceSubClass == 2) {
-	  got_interface = 1;
-	}
-      }
-    }
-
-    libusb_free_config_descriptor(config);
-
-    if (got_interface) {
+    if (_uvc_is_video_device(usb_dev)) {
       uvc_device_t *uvc_dev = malloc(sizeof(*uvc_dev));
       uvc_dev->ctx = ctx;
       uvc_dev->ref = 0;
@@ -963,6 +973,127 @@ void uvc_unref_device(uvc_device_t *dev) {
   UVC_EXIT_VOID();
 }
 
+/**
+ * @brief Check whether two devices refer to the same USB device
+ * @ingroup device
+ *
+ * Devices from separate uvc_get_device_list() calls or hotplug events are
+ * distinct objects, this compares the underlying USB device.
+ *
+ * @return 1 if both refer to the same device, 0 otherwise
+ */
+int uvc_is_same_device(uvc_device_t *a, uvc_device_t *b) {
+  return a != NULL && b != NULL && a->usb_dev == b->usb_dev;
+}
+
+/** @internal
+ * @brief Hotplug callback registered with libusb
+ */
+static int LIBUSB_CALL _uvc_hotplug_cb(struct libusb_context *usb_ctx,
+    struct libusb_device *usb_dev, libusb_hotplug_event usb_event,
+    void *user_ptr) {
+  uvc_context_t *ctx = (uvc_context_t *) user_ptr;
+  uvc_hotplug_callback_t *cb = ctx->hotplug_cb;
+  enum uvc_hotplug_event event;
+  uvc_device_t *dev;
+
+  if (cb == NULL)
+    return 0;
+
+  if (usb_event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+    if (!_uvc_is_video_device(usb_dev))
+      return 0;
+    event = UVC_HOTPLUG_ARRIVED;
+  } else {
+    /* The descriptors of a device that left can't be read anymore */
+    event = UVC_HOTPLUG_LEFT;
+  }
+
+  dev = malloc(sizeof(*dev));
+  if (dev == NULL)
+    return 0;
+
+  dev->ctx = ctx;
+  dev->ref = 0;
+  dev->usb_dev = usb_dev;
+  uvc_ref_device(dev);
+
+  cb(dev, event, ctx->hotplug_user_ptr);
+
+  uvc_unref_device(dev);
+  return 0;
+}
+
+/**
+ * @brief Get notified when UVC devices are plugged in or unplugged
+ * @ingroup device
+ *
+ * The callback runs on the context's event handler thread, which is kept
+ * running while a callback is registered, so it must not call this
+ * function. Only available when libuvc owns the USB context and libusb
+ * supports hotplug on this platform.
+ *
+ * @param ctx UVC context
+ * @param cb Callback to invoke, or NULL to remove the current one
+ * @param user_ptr User data passed to the callback
+ * @return UVC_ERROR_NOT_SUPPORTED if hotplug isn't available
+ */
+uvc_error_t uvc_set_hotplug_callback(uvc_context_t *ctx,
+                                     uvc_hotplug_callback_t *cb,
+                                     void *user_ptr) {
+  int ret;
+  int stop_thread;
+
+  UVC_ENTER();
+
+  if (ctx->hotplug_cb != NULL) {
+    /* Without open devices nothing needs the handler thread anymore.
+     * Deregistering wakes it up, it then sees the flag and exits. */
+    stop_thread = ctx->handler_running && ctx->open_devices == NULL;
+    if (stop_thread)
+      ctx->kill_handler_thread = 1;
+
+    libusb_hotplug_deregister_callback(ctx->usb_ctx, ctx->hotplug_handle);
+    ctx->hotplug_cb = NULL;
+    ctx->hotplug_user_ptr = NULL;
+
+    if (stop_thread) {
+      pthread_join(ctx->handler_thread, NULL);
+      ctx->handler_running = 0;
+    }
+  }
+
+  if (cb == NULL) {
+    UVC_EXIT(UVC_SUCCESS);
+    return UVC_SUCCESS;
+  }
+
+  if (!ctx->own_usb_ctx || !libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    UVC_EXIT(UVC_ERROR_NOT_SUPPORTED);
+    return UVC_ERROR_NOT_SUPPORTED;
+  }
+
+  ctx->hotplug_cb = cb;
+  ctx->hotplug_user_ptr = user_ptr;
+
+  /* Devices already present are found with uvc_get_device_list() */
+  ret = libusb_hotplug_register_callback(ctx->usb_ctx,
+      LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+      0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+      LIBUSB_HOTPLUG_MATCH_ANY, _uvc_hotplug_cb, ctx, &ctx->hotplug_handle);
+  if (ret != LIBUSB_SUCCESS) {
+    ctx->hotplug_cb = NULL;
+    ctx->hotplug_user_ptr = NULL;
+    UVC_EXIT(ret);
+    return ret;
+  }
+
+  uvc_start_handler_thread(ctx);
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
 /** @internal
  * Claim a UVC interface, detaching the kernel driver if necessary.
  * @ingroup device
@@ -975,6 +1106,12 @@ uvc_error_t uvc_claim_if(uvc_device_handle_t *devh, int idx) {
 
   UVC_ENTER();
 
+  /* A replay device has no interfaces to claim */
+  if (devh->replay) {
+    UVC_EXIT(ret);
+    return ret;
+  }
+
   if ( devh->claimed & ( 1 << idx )) {
     UVC_DEBUG("attempt to claim already-claimed interface %d\n", idx );
     UVC_EXIT(ret);
@@ -1721,21 +1858,33 @@ void uvc_free_devh(uvc_device_handle_t *devh) {
  */
 void uvc_close(uvc_device_handle_t *devh) {
   UVC_ENTER();
-  uvc_context_t *ctx = devh->dev->ctx;
+  uvc_context_t *ctx;
 
   if (devh->streams)
     uvc_stop_streaming(devh);
 
+  if (devh->replay) {
+    _uvc_replay_close(devh);
+    uvc_free_devh(devh);
+    UVC_EXIT_VOID();
+    return;
+  }
+
+  ctx = devh->dev->ctx;
+
   uvc_release_if(devh, devh->info->ctrl_if.bInterfaceNumber);
 
   /* If we are managing the libusb context and this is the last open device,
    * then we need to cancel the handler thread. When we call libusb_close,
    * it'll cause a return from the thread's libusb_handle_events call, after
-   * which the handler thread will check the flag we set and then exit. */
-  if (ctx->own_usb_ctx && ctx->open_devices == devh && devh->next == NULL) {
+   * which the handler thread will check the flag we set and then exit.
+   * A registered hotplug callback still needs the thread. */
+  if (ctx->own_usb_ctx && ctx->handler_running && ctx->hotplug_cb == NULL
+      && ctx->open_devices == devh && devh->next == NULL) {
     ctx->kill_handler_thread = 1;
     libusb_close(devh->usb_devh);
     pthread_join(ctx->handler_thread, NULL);
+    ctx->handler_running = 0;
   } else {
     libusb_close(devh->usb_devh);
   }
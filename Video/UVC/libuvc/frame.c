@@ -123,6 +123,7 @@ uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   memcpy(out->data, in->data, in->data_bytes);
 
@@ -186,6 +187,7 @@ uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *prgb = out->data;
@@ -237,6 +239,7 @@ uvc_error_t uvc_yuyv2bgr(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *pbgr = out->data;
@@ -277,6 +280,7 @@ uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *py = out->data;
@@ -317,6 +321,7 @@ uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *puv = out->data;
@@ -367,6 +372,7 @@ uvc_error_t uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *prgb = out->data;
@@ -417,6 +423,7 @@ uvc_error_t uvc_uyvy2bgr(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->still = in->still;
 
   uint8_t *pyuv = in->data;
   uint8_t *pbgr = out->data;
@@ -136,9 +136,12 @@ uvc_error_t uvc_init(uvc_context_t **pctx, struct libusb_context *usb_ctx) {
  * @param ctx UVC context to shut down
  */
 void uvc_exit(uvc_context_t *ctx) {
-  uvc_device_handle_t *devh;
+  uvc_device_handle_t *devh, *tmp;
 
-  DL_FOREACH(ctx->open_devices, devh) {
+  /* The handler thread then stops with the last device */
+  uvc_set_hotplug_callback(ctx, NULL, NULL);
+
+  DL_FOREACH_SAFE(ctx->open_devices, devh, tmp) {
     uvc_close(devh);
   }
 
@@ -154,10 +157,17 @@ void uvc_exit(uvc_context_t *ctx) {
  * @ingroup init
  *
  * This should be called at the end of a successful uvc_open if no devices
- * are already open (and being handled).
+ * are already open (and being handled), and when a hotplug callback is
+ * registered. Does nothing if the thread is already running.
  */
 void uvc_start_handler_thread(uvc_context_t *ctx) {
-  if (ctx->own_usb_ctx)
-    pthread_create(&ctx->handler_thread, NULL, _uvc_handle_events, (void*) ctx);
+  if (!ctx->own_usb_ctx || ctx->handler_running)
+    return;
+
+  /* The flag is still set if an earlier thread was stopped */
+  ctx->kill_handler_thread = 0;
+  if (pthread_create(&ctx->handler_thread, NULL, _uvc_handle_events,
+      (void*) ctx) == 0)
+    ctx->handler_running = 1;
 }
 
@@ -49,6 +49,8 @@ typedef enum uvc_error {
   UVC_ERROR_INVALID_MODE = -51,
   /** Resource has a callback (can't use polling and async) */
   UVC_ERROR_CALLBACK_EXISTS = -52,
+  /** Not enough USB bandwidth left for the stream */
+  UVC_ERROR_NO_BANDWIDTH = -53,
   /** Undefined error */
   UVC_ERROR_OTHER = -99
 } uvc_error_t;
@@ -430,6 +432,26 @@ typedef void(uvc_button_callback_t)(int button,
                                     int state,
                                     void *user_ptr);
 
+/** Hotplug events reported to a uvc_hotplug_callback_t
+ * @ingroup device
+ */
+enum uvc_hotplug_event {
+  /** A UVC device was plugged in */
+  UVC_HOTPLUG_ARRIVED = 1,
+  /** A device was unplugged, it may not have been a UVC one */
+  UVC_HOTPLUG_LEFT = 2
+};
+
+/** A callback function to accept hotplug events
+ *
+ * Runs on the event handler thread. The device is only valid during the
+ * call, take a reference with uvc_ref_device() to keep it.
+ * @ingroup device
+ */
+typedef void(uvc_hotplug_callback_t)(uvc_device_t *dev,
+                                     enum uvc_hotplug_event event,
+                                     void *user_ptr);
+
 /** Structure representing a UVC device descriptor.
  *
  * (This isn't a standard structure.)
@@ -441,6 +463,8 @@ typedef struct uvc_device_descriptor {
   uint16_t idProduct;
   /** UVC compliance level, e.g. 0x0100 (1.0), 0x0110 */
   uint16_t bcdUVC;
+  /** Device release number, changes with the firmware on most devices */
+  uint16_t bcdDevice;
   /** Serial number (null if unavailable) */
   const char *serialNumber;
   /** Device-reported manufacturer name (or null) */
@@ -449,6 +473,11 @@ typedef struct uvc_device_descriptor {
   const char *product;
 } uvc_device_descriptor_t;
 
+/** Library owned buffer of a zero-copy stream, see UVC_STREAM_ZERO_COPY
+ * @ingroup streaming
+ */
+typedef struct uvc_frame_buffer uvc_frame_buffer_t;
+
 /** An image frame received from the UVC device
  * @ingroup streaming
  */
@@ -485,6 +514,23 @@ typedef struct uvc_frame {
   void *metadata;
   /** Size of metadata buffer */
   size_t metadata_bytes;
+  /** Presentation time stamp in device clock ticks (0 if not sent) */
+  uint32_t pts;
+  /** Source clock reference of the last payload that had one: device
+   * clock ticks (0 if not sent) and 1 kHz USB SOF counter */
+  uint32_t scr;
+  uint16_t scr_sof;
+  /** CLOCK_MONOTONIC time when the payload carrying scr arrived */
+  struct timespec scr_time;
+  /** CLOCK_MONOTONIC times when the USB transfer that completed the frame
+   * came back and when the callback thread picked the frame up. Only set
+   * while tracing is enabled with uvc_set_tracing(), zero otherwise. */
+  struct timespec transfer_time;
+  struct timespec callback_time;
+  /** Buffer that data points into on zero-copy streams, NULL otherwise */
+  uvc_frame_buffer_t *buffer;
+  /** Set if the frame is a still image from uvc_read_still() */
+  uint8_t still;
 } uvc_frame_t;
 
 /** A callback function to handle incoming assembled UVC frames
@@ -492,6 +538,58 @@ typedef struct uvc_frame {
  */
 typedef void(uvc_frame_callback_t)(struct uvc_frame *frame, void *user_ptr);
 
+/** Stream flag: the callback gets the buffer the frame was assembled in
+ * instead of a copy of it. The data is only valid during the callback
+ * unless the callback holds the buffer with uvc_hold_frame_buffer().
+ * @ingroup streaming
+ */
+#define UVC_STREAM_ZERO_COPY 0x02
+
+/** Stream flag: pick the isochronous altsetting from the bandwidth the
+ * frames of an uncompressed format actually take instead of the
+ * dwMaxPayloadTransferSize the camera asked for. Some cameras ask for far
+ * more, this leaves room for other devices on the bus.
+ * @ingroup streaming
+ */
+#define UVC_STREAM_FIX_BANDWIDTH 0x04
+
+/** What a stream does with a completed frame while its ring is full
+ * @ingroup streaming
+ */
+enum uvc_ring_policy {
+  /** Replace the oldest queued frame, the callback gets the newest ones */
+  UVC_RING_LATEST = 0,
+  /** Keep every queued frame and drop the new one. The camera can't be
+   * paused, so a full ring blocks new frames rather than the USB side. */
+  UVC_RING_BLOCKING = 1
+};
+
+/** Replay flag: play the payloads back as fast as frames are taken from
+ * the stream instead of at the pace they were recorded
+ * @ingroup replay
+ */
+#define UVC_REPLAY_MAX_SPEED 0x01
+
+/** Replay flag: start over at the end of the recording
+ * @ingroup replay
+ */
+#define UVC_REPLAY_LOOP 0x02
+
+/** Frame counters of a stream since it was started
+ * @ingroup streaming
+ */
+typedef struct uvc_stream_stats {
+  /** Frames completed by the camera */
+  uint32_t frames;
+  /** Queued frames replaced by newer ones */
+  uint32_t overwritten;
+  /** Completed frames that were never queued: the ring was full with
+   * UVC_RING_BLOCKING, or the user held every buffer */
+  uint32_t dropped;
+  /** Frames waiting in the ring right now */
+  uint32_t queued;
+} uvc_stream_stats_t;
+
 /** Streaming mode, includes all information needed to select stream
  * @ingroup streaming
  */
@@ -573,6 +671,11 @@ struct libusb_device_handle *uvc_get_libusb_handle(uvc_device_handle_t *devh);
 
 void uvc_ref_device(uvc_device_t *dev);
 void uvc_unref_device(uvc_device_t *dev);
+int uvc_is_same_device(uvc_device_t *a, uvc_device_t *b);
+
+uvc_error_t uvc_set_hotplug_callback(uvc_context_t *ctx,
+                                     uvc_hotplug_callback_t *cb,
+                                     void *user_ptr);
 
 void uvc_set_status_callback(uvc_device_handle_t *devh,
                              uvc_status_callback_t cb,
@@ -607,7 +710,20 @@ uvc_error_t uvc_trigger_still(
     uvc_device_handle_t *devh,
     uvc_still_ctrl_t *still_ctrl);
 
+int uvc_get_still_method(
+    uvc_device_handle_t *devh,
+    uint8_t interface_number);
+
+uvc_error_t uvc_read_still(
+    uvc_device_handle_t *devh,
+    uvc_still_ctrl_t *still_ctrl,
+    uvc_frame_t *frame,
+    int timeout_ms);
+
+void uvc_cancel_still(uvc_device_handle_t *devh);
+
 const uvc_format_desc_t *uvc_get_format_descs(uvc_device_handle_t* );
+enum uvc_frame_format uvc_frame_format_for_guid(const uint8_t guid[16]);
 
 uvc_error_t uvc_probe_stream_ctrl(
     uvc_device_handle_t *devh,
@@ -632,8 +748,22 @@ uvc_error_t uvc_start_iso_streaming(
 
 void uvc_stop_streaming(uvc_device_handle_t *devh);
 
+void uvc_set_tracing(uvc_device_handle_t *devh, int enable);
+
+uvc_frame_buffer_t *uvc_hold_frame_buffer(const uvc_frame_t *frame);
+void uvc_release_frame_buffer(uvc_frame_buffer_t *buffer);
+
 uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t **strmh, uvc_stream_ctrl_t *ctrl);
 uvc_error_t uvc_stream_ctrl(uvc_stream_handle_t *strmh, uvc_stream_ctrl_t *ctrl);
+uvc_error_t uvc_stream_set_ring(uvc_stream_handle_t *strmh, int depth,
+    enum uvc_ring_policy policy);
+uvc_error_t uvc_stream_set_held_buffers(uvc_stream_handle_t *strmh,
+    int count);
+void uvc_stream_get_stats(uvc_stream_handle_t *strmh,
+    uvc_stream_stats_t *stats);
+uvc_error_t uvc_stream_set_transfers(uvc_stream_handle_t *strmh,
+    int num_transfers, int packets_per_transfer);
+uvc_error_t uvc_stream_record(uvc_stream_handle_t *strmh, const char *path);
 uvc_error_t uvc_stream_start(uvc_stream_handle_t *strmh,
     uvc_frame_callback_t *cb,
     void *user_ptr,
@@ -649,6 +779,13 @@ uvc_error_t uvc_stream_get_frame(
 uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh);
 void uvc_stream_close(uvc_stream_handle_t *strmh);
 
+uvc_error_t uvc_replay_open(const char *path, int flags,
+    uvc_device_handle_t **devh);
+uvc_error_t uvc_replay_set_flags(uvc_device_handle_t *devh, int flags);
+int uvc_is_replay(uvc_device_handle_t *devh);
+uvc_error_t uvc_replay_get_device_descriptor(uvc_device_handle_t *devh,
+    uvc_device_descriptor_t **desc);
+
 int uvc_get_ctrl_len(uvc_device_handle_t *devh, uint8_t unit, uint8_t ctrl);
 int uvc_get_ctrl(uvc_device_handle_t *devh, uint8_t unit, uint8_t ctrl, void *data, int len, enum uvc_req_code req_code);
 int uvc_set_ctrl(uvc_device_handle_t *devh, uint8_t unit, uint8_t ctrl, void *data, int len);
@@ -216,23 +216,100 @@ typedef struct uvc_device_info {
 } uvc_device_info_t;
 
 /*
-  set a high number of transfer buffers. This uses a lot of ram, but
-  avoids problems with scheduling delays on slow boards causing missed
-  transfers. A better approach may be to make the transfer thread FIFO
-  scheduled (if we have root).
-  Default number of transfer buffers can be overwritten by defining
-  this macro.
+  The number of transfers and the packets per isochronous transfer are
+  worked out from the negotiated stream when it starts, see
+  _uvc_size_transfers(). A stream keeps about LIBUVC_TRANSFER_QUEUE_US of
+  video in flight, so scheduling delays on slow boards don't cause missed
+  transfers, split into transfers of about a quarter frame each but no
+  fewer than LIBUVC_MIN_PACKETS_PER_TRANSFER isochronous packets. The
+  limits below can be overwritten by defining the macros, or per stream
+  with uvc_stream_set_transfers().
  */
-#ifndef LIBUVC_NUM_TRANSFER_BUFS
+#ifndef LIBUVC_MAX_TRANSFER_BUFS
 #if defined(__APPLE__) && defined(__MACH__)
-#define LIBUVC_NUM_TRANSFER_BUFS 20
+#define LIBUVC_MAX_TRANSFER_BUFS 20
 #else
-#define LIBUVC_NUM_TRANSFER_BUFS 100
+#define LIBUVC_MAX_TRANSFER_BUFS 100
 #endif
 #endif
 
+#ifndef LIBUVC_MIN_TRANSFER_BUFS
+#define LIBUVC_MIN_TRANSFER_BUFS 4
+#endif
+
+#ifndef LIBUVC_MIN_PACKETS_PER_TRANSFER
+#define LIBUVC_MIN_PACKETS_PER_TRANSFER 32
+#endif
+
+#ifndef LIBUVC_MAX_PACKETS_PER_TRANSFER
+#define LIBUVC_MAX_PACKETS_PER_TRANSFER 128
+#endif
+
+#ifndef LIBUVC_TRANSFERS_PER_FRAME
+#define LIBUVC_TRANSFERS_PER_FRAME 4
+#endif
+
+#ifndef LIBUVC_TRANSFER_QUEUE_US
+#define LIBUVC_TRANSFER_QUEUE_US 100000
+#endif
+
 #define LIBUVC_XFER_META_BUF_SIZE ( 4 * 1024 )
 
+/* Completed frames a stream can queue for the callback thread or poller,
+ * see uvc_stream_set_ring() */
+#define LIBUVC_MAX_FRAME_RING 16
+#ifndef LIBUVC_DEFAULT_FRAME_RING
+#define LIBUVC_DEFAULT_FRAME_RING 1
+#endif
+
+/* Extra buffers of a zero-copy stream for frames the user holds, unless
+ * set with uvc_stream_set_held_buffers(). They are only allocated once
+ * the user actually holds that many. */
+#ifndef LIBUVC_NUM_HELD_BUFS
+#define LIBUVC_NUM_HELD_BUFS 3
+#endif
+#define LIBUVC_MAX_HELD_BUFS 16
+
+/* Longest a method 3 still read blocks in a bulk transfer before it looks
+ * whether it was cancelled */
+#define LIBUVC_STILL_POLL_MS 100
+
+struct uvc_frame_pool;
+
+struct uvc_frame_buffer {
+  struct uvc_frame_pool *pool;
+  struct uvc_frame_buffer *next_free;
+  uint8_t *data;
+  uint8_t *meta;
+  /** references: the stream while filling or queued, the callback thread
+   * and every uvc_hold_frame_buffer() */
+  int refs;
+
+  /* the frame in it, set when it is complete */
+  size_t bytes, meta_bytes;
+  uint32_t seq;
+  uint32_t pts;
+  uint32_t scr;
+  uint16_t scr_sof;
+  struct timespec scr_time;
+  struct timespec capture_time_finished;
+  struct timespec transfer_time;
+};
+
+/** Outlives its stream until the user released every held buffer */
+struct uvc_frame_pool {
+  pthread_mutex_t mutex;
+  struct uvc_frame_buffer *buffers;
+  /** buffers there may be, the first allocated of them have their data */
+  int count;
+  int allocated;
+  size_t buffer_size;
+  struct uvc_frame_buffer *free_list;
+  int free_count;
+  /** set when the stream stopped, the last release frees the pool */
+  int closed;
+};
+
 struct uvc_stream_handle {
   struct uvc_device_handle *devh;
   struct uvc_stream_handle *prev, *next;
@@ -243,29 +320,72 @@ struct uvc_stream_handle {
   /** Current control block */
   struct uvc_stream_ctrl cur_ctrl;
 
-  /* listeners may only access hold*, and only when holding a
-   * lock on cb_mutex (probably signaled with cb_cond) */
+  /* state of the frame being assembled, only used by the transfer
+   * callbacks */
   uint8_t fid;
-  uint32_t seq, hold_seq;
-  uint32_t pts, hold_pts;
-  uint32_t last_scr, hold_last_scr;
-  size_t got_bytes, hold_bytes;
-  uint8_t *outbuf, *holdbuf;
+  uint32_t seq;
+  uint32_t pts;
+  uint32_t last_scr;
+  uint16_t last_scr_sof;
+  struct timespec last_scr_time;
+  struct timespec transfer_time;
+  size_t got_bytes;
+  /** data of fill_buf */
+  uint8_t *outbuf;
   pthread_mutex_t cb_mutex;
   pthread_cond_t cb_cond;
   pthread_t cb_thread;
-  uint32_t last_polled_seq;
   uvc_frame_callback_t *user_cb;
   void *user_ptr;
-  struct libusb_transfer *transfers[LIBUVC_NUM_TRANSFER_BUFS];
-  uint8_t *transfer_bufs[LIBUVC_NUM_TRANSFER_BUFS];
+  /* num_transfers of each, allocated when the stream starts */
+  struct libusb_transfer **transfers;
+  uint8_t **transfer_bufs;
+  int num_transfers;
+  /* uvc_stream_set_transfers() overrides, 0 to compute them */
+  int req_num_transfers;
+  int req_packets_per_transfer;
   struct uvc_frame frame;
   enum uvc_frame_format frame_format;
-  struct timespec capture_time_finished;
 
-  /* raw metadata buffer if available */
-  uint8_t *meta_outbuf, *meta_holdbuf;
-  size_t meta_got_bytes, meta_hold_bytes;
+  /* Frames are assembled in fill_buf and queued in ring until the callback
+   * thread or a poller takes them, all buffers come from pool. Listeners
+   * may only access the ring and counters when holding a lock on cb_mutex
+   * (probably signaled with cb_cond). */
+  struct uvc_frame_pool *pool;
+  struct uvc_frame_buffer *fill_buf;
+  struct uvc_frame_buffer *ring[LIBUVC_MAX_FRAME_RING];
+  int ring_head, ring_count, ring_size;
+  enum uvc_ring_policy ring_policy;
+  uint8_t zero_copy;
+  int held_bufs;
+  uint32_t frames_completed, frames_overwritten, frames_dropped;
+
+  /* raw metadata of the frame being assembled, the meta of fill_buf */
+  uint8_t *meta_outbuf;
+  size_t meta_got_bytes;
+
+  /* uvc_stream_record() file, payloads are appended from the transfer
+   * callbacks while streaming. record_time is when the last one came. */
+  FILE *record_file;
+  struct timespec record_time;
+
+  /* Method 2 still image, assembled in still_buf apart from the pool so
+   * the video buffers keep the size of a video frame. uvc_trigger_still()
+   * allocates it, uvc_read_still() takes the image and frees it again.
+   * still_state and still_cancel are guarded by cb_mutex. sti is set
+   * while the frame being assembled is a still image: 1 into still_buf,
+   * 2 dropped because nobody waits for one. */
+  uint8_t *still_buf;
+  size_t still_size, still_got_bytes;
+  uint16_t still_width, still_height;
+  enum {
+    UVC_STILL_IDLE,
+    UVC_STILL_ARMED,
+    UVC_STILL_FILLING,
+    UVC_STILL_READY
+  } still_state;
+  int still_cancel;
+  uint8_t sti;
 };
 
 /** Handle on an open UVC device
@@ -291,6 +411,10 @@ struct uvc_device_handle {
   /** Whether the camera is an iSight that sends one header per frame */
   uint8_t is_isight;
   uint32_t claimed;
+  /** Whether frames get transfer_time and callback_time stamps */
+  volatile int tracing;
+  /** Set for a device that plays back a recording, see uvc_replay_open() */
+  struct uvc_replay *replay;
 };
 
 /** Context within which we communicate with devices */
@@ -303,6 +427,12 @@ struct uvc_context {
   uvc_device_handle_t *open_devices;
   pthread_t handler_thread;
   int kill_handler_thread;
+  /** True while handler_thread is running */
+  uint8_t handler_running;
+  /** Hotplug callback, the handler thread runs while one is set */
+  uvc_hotplug_callback_t *hotplug_cb;
+  void *hotplug_user_ptr;
+  libusb_hotplug_callback_handle hotplug_handle;
 };
 
 uvc_error_t uvc_query_stream_ctrl(
@@ -314,6 +444,18 @@ uvc_error_t uvc_query_stream_ctrl(
 void uvc_start_handler_thread(uvc_context_t *ctx);
 uvc_error_t uvc_claim_if(uvc_device_handle_t *devh, int idx);
 uvc_error_t uvc_release_if(uvc_device_handle_t *devh, int idx);
+uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes);
+
+void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t payload_len);
+void _uvc_record_start(uvc_stream_handle_t *strmh, uvc_frame_desc_t *frame_desc);
+void _uvc_record_payload(uvc_stream_handle_t *strmh, const uint8_t *payload,
+    size_t payload_len);
+void _uvc_record_stop(uvc_stream_handle_t *strmh);
+uvc_error_t _uvc_replay_query_stream_ctrl(uvc_device_handle_t *devh,
+    uvc_stream_ctrl_t *ctrl, enum uvc_req_code req);
+uvc_error_t _uvc_replay_start(uvc_stream_handle_t *strmh);
+void _uvc_replay_stop(uvc_stream_handle_t *strmh);
+void _uvc_replay_close(uvc_device_handle_t *devh);
 
 #endif // !def(LIBUVC_INTERNAL_H)
 /** @endcond */
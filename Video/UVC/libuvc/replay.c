@@ -0,0 +1,533 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2024 Gerasim Troeglazov
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @defgroup replay Payload recording and replay
+ * @brief Record the payloads of a stream and play them back without a camera
+ *
+ * A recording holds every payload _uvc_process_payload() got from the
+ * camera, with the time since the payload before it, behind a header with
+ * the negotiated format. Replaying one feeds the payloads through the same
+ * frame assembly, so everything after the USB transfers can be run and
+ * measured without the hardware.
+ *
+ * File layout, all values little endian:
+ *
+ *   offset  size
+ *        0     4  "UVCR"
+ *        4     2  version, 1
+ *        6     1  bDescriptorSubtype of the format
+ *        7     1  1 for an iSight
+ *        8    16  guidFormat
+ *       24     2  width
+ *       26     2  height
+ *       28     4  dwFrameInterval
+ *       32     4  dwMaxVideoFrameSize
+ *       36     4  dwMaxPayloadTransferSize
+ *       40     4  dwClockFrequency
+ *       44     2  bcdUVC
+ *       46     1  bmFramingInfo
+ *       47     1  reserved
+ *
+ * followed by one record per payload: microseconds since the previous
+ * payload (4), payload length (4) and the payload, header included.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+#define REPLAY_MAGIC "UVCR"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE 48
+#define REPLAY_RECORD_SIZE 8
+
+/* Longest sleep between checks whether the stream was stopped */
+#define REPLAY_MAX_SLEEP_US 10000
+/* Falling further behind than this starts the clock over */
+#define REPLAY_MAX_LAG_US 100000
+
+struct uvc_replay {
+  FILE *file;
+  /** Offset of the first payload record */
+  long data_offset;
+  int flags;
+  /** Negotiated block of the recorded stream */
+  uvc_stream_ctrl_t ctrl;
+  /** File name, shown as the product name */
+  char *name;
+  pthread_t thread;
+};
+
+static int64_t _uvc_timespec_us(const struct timespec *time) {
+  return (int64_t) time->tv_sec * 1000000 + time->tv_nsec / 1000;
+}
+
+/** Record the payloads of the next streaming session of a stream.
+ * @ingroup replay
+ *
+ * Recording starts with uvc_stream_start() and ends, with the file
+ * complete, when the stream is stopped. Call again to record the next
+ * session.
+ *
+ * @param strmh UVC stream handle, must not be streaming
+ * @param path File to write, replaced if it exists. NULL to cancel a
+ * recording that didn't start yet.
+ */
+uvc_error_t uvc_stream_record(uvc_stream_handle_t *strmh, const char *path) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (strmh->record_file) {
+    fclose(strmh->record_file);
+    strmh->record_file = NULL;
+  }
+
+  if (!path)
+    return UVC_SUCCESS;
+
+  strmh->record_file = fopen(path, "wb");
+  if (!strmh->record_file)
+    return UVC_ERROR_ACCESS;
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Write the header of a recording when its stream starts
+ */
+void _uvc_record_start(uvc_stream_handle_t *strmh, uvc_frame_desc_t *frame_desc) {
+  uvc_format_desc_t *format_desc = frame_desc->parent;
+  uvc_stream_ctrl_t *ctrl = &strmh->cur_ctrl;
+  uint8_t header[REPLAY_HEADER_SIZE];
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, REPLAY_MAGIC, 4);
+  SHORT_TO_SW(REPLAY_VERSION, header + 4);
+  header[6] = format_desc->bDescriptorSubtype;
+  header[7] = strmh->devh->is_isight;
+  memcpy(header + 8, format_desc->guidFormat, 16);
+  SHORT_TO_SW(frame_desc->wWidth, header + 24);
+  SHORT_TO_SW(frame_desc->wHeight, header + 26);
+  INT_TO_DW(ctrl->dwFrameInterval, header + 28);
+  INT_TO_DW(ctrl->dwMaxVideoFrameSize, header + 32);
+  INT_TO_DW(ctrl->dwMaxPayloadTransferSize, header + 36);
+  INT_TO_DW(ctrl->dwClockFrequency, header + 40);
+  SHORT_TO_SW(strmh->devh->info->ctrl_if.bcdUVC, header + 44);
+  header[46] = ctrl->bmFramingInfo;
+
+  if (fwrite(header, 1, sizeof(header), strmh->record_file) != sizeof(header)) {
+    UVC_DEBUG("can't write recording header");
+    fclose(strmh->record_file);
+    strmh->record_file = NULL;
+    return;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &strmh->record_time);
+}
+
+/** @internal
+ * @brief Append a payload to the recording, called for every payload
+ * while the stream records
+ */
+void _uvc_record_payload(uvc_stream_handle_t *strmh, const uint8_t *payload,
+    size_t payload_len) {
+  uint8_t record[REPLAY_RECORD_SIZE];
+  struct timespec now;
+  int64_t delta;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  delta = _uvc_timespec_us(&now) - _uvc_timespec_us(&strmh->record_time);
+  strmh->record_time = now;
+
+  INT_TO_DW((uint32_t) (delta > 0 ? delta : 0), record);
+  INT_TO_DW((uint32_t) payload_len, record + 4);
+
+  if (fwrite(record, 1, sizeof(record), strmh->record_file) != sizeof(record)
+      || fwrite(payload, 1, payload_len, strmh->record_file) != payload_len) {
+    /* Out of space most likely, keep what we have */
+    UVC_DEBUG("can't write recording, stopped");
+    fclose(strmh->record_file);
+    strmh->record_file = NULL;
+  }
+}
+
+/** @internal
+ * @brief Finish the recording of a stopped stream
+ */
+void _uvc_record_stop(uvc_stream_handle_t *strmh) {
+  if (!strmh->record_file)
+    return;
+
+  fclose(strmh->record_file);
+  strmh->record_file = NULL;
+}
+
+/** Open a recording as a device that streams its payloads.
+ * @ingroup replay
+ *
+ * The device offers the recorded format and frame size at the recorded
+ * frame rate and has no controls. Streams of it run like those of a
+ * camera, payloads come from the file instead of USB transfers. Close it
+ * with uvc_close().
+ *
+ * @param path Recording made with uvc_stream_record()
+ * @param flags UVC_REPLAY_MAX_SPEED, UVC_REPLAY_LOOP
+ * @param[out] devhp Handle on the replay device
+ */
+uvc_error_t uvc_replay_open(const char *path, int flags,
+    uvc_device_handle_t **devhp) {
+  uint8_t header[REPLAY_HEADER_SIZE];
+  struct uvc_replay *replay;
+  uvc_device_info_t *info = NULL;
+  uvc_streaming_interface_t *stream_if;
+  uvc_format_desc_t *format;
+  uvc_frame_desc_t *frame;
+  uvc_device_handle_t *devh;
+  const char *name;
+
+  UVC_ENTER();
+
+  replay = calloc(1, sizeof(*replay));
+  if (!replay) {
+    UVC_EXIT(UVC_ERROR_NO_MEM);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  replay->file = fopen(path, "rb");
+  if (!replay->file) {
+    free(replay);
+    UVC_EXIT(UVC_ERROR_NOT_FOUND);
+    return UVC_ERROR_NOT_FOUND;
+  }
+
+  if (fread(header, 1, sizeof(header), replay->file) != sizeof(header)
+      || memcmp(header, REPLAY_MAGIC, 4)
+      || SW_TO_SHORT(header + 4) != REPLAY_VERSION)
+    goto invalid;
+
+  replay->data_offset = REPLAY_HEADER_SIZE;
+  replay->flags = flags;
+
+  /* The recorded stream is the only one the device can negotiate */
+  replay->ctrl.bmHint = 1;
+  replay->ctrl.bFormatIndex = 1;
+  replay->ctrl.bFrameIndex = 1;
+  replay->ctrl.dwFrameInterval = DW_TO_INT(header + 28);
+  replay->ctrl.dwMaxVideoFrameSize = DW_TO_INT(header + 32);
+  replay->ctrl.dwMaxPayloadTransferSize = DW_TO_INT(header + 36);
+  replay->ctrl.dwClockFrequency = DW_TO_INT(header + 40);
+  replay->ctrl.bmFramingInfo = header[46];
+  replay->ctrl.bInterfaceNumber = 1;
+
+  if (replay->ctrl.dwFrameInterval == 0 || replay->ctrl.dwMaxVideoFrameSize == 0)
+    goto invalid;
+
+  name = strrchr(path, '/');
+  replay->name = strdup(name ? name + 1 : path);
+
+  info = calloc(1, sizeof(*info));
+  stream_if = calloc(1, sizeof(*stream_if));
+  format = calloc(1, sizeof(*format));
+  frame = calloc(1, sizeof(*frame));
+  devh = calloc(1, sizeof(*devh));
+  if (info)
+    info->ctrl_if.parent = info;
+  if (frame)
+    frame->intervals = calloc(2, sizeof(uint32_t));
+
+  if (!replay->name || !info || !stream_if || !format || !frame
+      || !frame->intervals || !devh) {
+    if (frame)
+      free(frame->intervals);
+    free(frame);
+    free(format);
+    free(stream_if);
+    free(info);
+    free(devh);
+    free(replay->name);
+    fclose(replay->file);
+    free(replay);
+    UVC_EXIT(UVC_ERROR_NO_MEM);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  info->ctrl_if.bcdUVC = SW_TO_SHORT(header + 44);
+  info->ctrl_if.dwClockFrequency = replay->ctrl.dwClockFrequency;
+
+  stream_if->parent = info;
+  stream_if->bInterfaceNumber = replay->ctrl.bInterfaceNumber;
+
+  format->parent = stream_if;
+  format->bDescriptorSubtype = header[6];
+  format->bFormatIndex = 1;
+  format->bNumFrameDescriptors = 1;
+  format->bDefaultFrameIndex = 1;
+  memcpy(format->guidFormat, header + 8, 16);
+
+  /* Frame descriptor subtypes follow those of their formats */
+  frame->parent = format;
+  frame->bDescriptorSubtype = header[6] + 1;
+  frame->bFrameIndex = 1;
+  frame->wWidth = SW_TO_SHORT(header + 24);
+  frame->wHeight = SW_TO_SHORT(header + 26);
+  frame->dwMaxVideoFrameBufferSize = replay->ctrl.dwMaxVideoFrameSize;
+  frame->dwDefaultFrameInterval = replay->ctrl.dwFrameInterval;
+  frame->dwMinFrameInterval = replay->ctrl.dwFrameInterval;
+  frame->dwMaxFrameInterval = replay->ctrl.dwFrameInterval;
+  frame->bFrameIntervalType = 1;
+  frame->intervals[0] = replay->ctrl.dwFrameInterval;
+
+  DL_APPEND(format->frame_descs, frame);
+  DL_APPEND(stream_if->format_descs, format);
+  DL_APPEND(info->stream_ifs, stream_if);
+
+  devh->info = info;
+  devh->is_isight = header[7];
+  devh->replay = replay;
+
+  *devhp = devh;
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+
+invalid:
+  fclose(replay->file);
+  free(replay);
+  UVC_EXIT(UVC_ERROR_INVALID_DEVICE);
+  return UVC_ERROR_INVALID_DEVICE;
+}
+
+/** Change how the recording of a replay device is played back.
+ * @ingroup replay
+ *
+ * Takes effect when the next stream starts.
+ *
+ * @param devh Replay device handle
+ * @param flags UVC_REPLAY_MAX_SPEED, UVC_REPLAY_LOOP
+ */
+uvc_error_t uvc_replay_set_flags(uvc_device_handle_t *devh, int flags) {
+  if (!devh->replay)
+    return UVC_ERROR_INVALID_DEVICE;
+
+  devh->replay->flags = flags;
+  return UVC_SUCCESS;
+}
+
+/** Check whether a device handle plays back a recording.
+ * @ingroup replay
+ */
+int uvc_is_replay(uvc_device_handle_t *devh) {
+  return devh->replay != NULL;
+}
+
+/** Get a descriptor for a replay device, named after its recording.
+ * @ingroup replay
+ *
+ * Free *desc with uvc_free_device_descriptor when you're done.
+ *
+ * @param devh Replay device handle
+ * @param[out] desc Descriptor
+ */
+uvc_error_t uvc_replay_get_device_descriptor(uvc_device_handle_t *devh,
+    uvc_device_descriptor_t **desc) {
+  uvc_device_descriptor_t *desc_internal;
+
+  if (!devh->replay)
+    return UVC_ERROR_INVALID_DEVICE;
+
+  desc_internal = calloc(1, sizeof(*desc_internal));
+  if (!desc_internal)
+    return UVC_ERROR_NO_MEM;
+
+  desc_internal->bcdUVC = devh->info->ctrl_if.bcdUVC;
+  desc_internal->product = strdup(devh->replay->name);
+  desc_internal->manufacturer = strdup("Recording");
+  desc_internal->serialNumber = strdup("replay");
+
+  *desc = desc_internal;
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Stream control queries of a replay device, it only knows the
+ * recorded block
+ */
+uvc_error_t _uvc_replay_query_stream_ctrl(uvc_device_handle_t *devh,
+    uvc_stream_ctrl_t *ctrl, enum uvc_req_code req) {
+  uint8_t interface_number;
+
+  if (req == UVC_SET_CUR)
+    return UVC_SUCCESS;
+
+  interface_number = ctrl->bInterfaceNumber;
+  *ctrl = devh->replay->ctrl;
+  ctrl->bInterfaceNumber = interface_number;
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Sleep until a point in time, unless the stream stops first
+ */
+static void _uvc_replay_sleep_until(uvc_stream_handle_t *strmh, int64_t until) {
+  struct timespec now, pause;
+  int64_t left;
+
+  while (strmh->running) {
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    left = until - _uvc_timespec_us(&now);
+    if (left <= 0)
+      return;
+    if (left > REPLAY_MAX_SLEEP_US)
+      left = REPLAY_MAX_SLEEP_US;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = left * 1000;
+    nanosleep(&pause, NULL);
+  }
+}
+
+/** @internal
+ * @brief Feeds the payloads of the recording to a stream of a replay
+ * device, in place of the transfer callbacks
+ */
+static void *_uvc_replay_thread(void *arg) {
+  uvc_stream_handle_t *strmh = (uvc_stream_handle_t *) arg;
+  struct uvc_replay *replay = strmh->devh->replay;
+  int max_speed = (replay->flags & UVC_REPLAY_MAX_SPEED) != 0;
+  uint8_t record[REPLAY_RECORD_SIZE];
+  uint8_t *payload = NULL;
+  size_t capacity = 0;
+  int pass_payloads = 0;
+  struct timespec now;
+  int64_t due;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &now);
+  due = _uvc_timespec_us(&now);
+
+  while (strmh->running) {
+    size_t payload_len;
+
+    if (fread(record, 1, sizeof(record), replay->file) != sizeof(record)) {
+      /* End of the recording, or a truncated last record */
+      if (!(replay->flags & UVC_REPLAY_LOOP) || pass_payloads == 0)
+        break;
+      fseek(replay->file, replay->data_offset, SEEK_SET);
+      pass_payloads = 0;
+      continue;
+    }
+
+    payload_len = DW_TO_INT(record + 4);
+    if (payload_len > capacity) {
+      uint8_t *buffer = realloc(payload, payload_len);
+      if (!buffer)
+        break;
+      payload = buffer;
+      capacity = payload_len;
+    }
+
+    if (fread(payload, 1, payload_len, replay->file) != payload_len) {
+      if (!(replay->flags & UVC_REPLAY_LOOP) || pass_payloads == 0)
+        break;
+      fseek(replay->file, replay->data_offset, SEEK_SET);
+      pass_payloads = 0;
+      continue;
+    }
+    pass_payloads++;
+
+    if (max_speed) {
+      /* As fast as frames are taken from the ring */
+      pthread_mutex_lock(&strmh->cb_mutex);
+      while (strmh->running && strmh->ring_count >= strmh->ring_size)
+        pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
+      pthread_mutex_unlock(&strmh->cb_mutex);
+    } else {
+      due += DW_TO_INT(record);
+      (void)clock_gettime(CLOCK_MONOTONIC, &now);
+      if (_uvc_timespec_us(&now) - due > REPLAY_MAX_LAG_US)
+        due = _uvc_timespec_us(&now);
+      _uvc_replay_sleep_until(strmh, due);
+    }
+
+    if (!strmh->running)
+      break;
+
+    if (strmh->devh->tracing)
+      (void)clock_gettime(CLOCK_MONOTONIC, &strmh->transfer_time);
+
+    _uvc_process_payload(strmh, payload, payload_len);
+  }
+
+  free(payload);
+  return NULL;
+}
+
+/** @internal
+ * @brief Start playing back the recording into a stream of a replay device
+ */
+uvc_error_t _uvc_replay_start(uvc_stream_handle_t *strmh) {
+  struct uvc_replay *replay = strmh->devh->replay;
+
+  if (fseek(replay->file, replay->data_offset, SEEK_SET) != 0)
+    return UVC_ERROR_IO;
+
+  if (pthread_create(&replay->thread, NULL, _uvc_replay_thread, (void*) strmh))
+    return UVC_ERROR_NO_MEM;
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Wait for the playback of a stopped stream to end
+ *
+ * The stream must no longer be running and cb_cond must have been
+ * broadcast, a replay at full speed may wait on it.
+ */
+void _uvc_replay_stop(uvc_stream_handle_t *strmh) {
+  pthread_join(strmh->devh->replay->thread, NULL);
+}
+
+/** @internal
+ * @brief Release the recording of a replay device being closed
+ */
+void _uvc_replay_close(uvc_device_handle_t *devh) {
+  fclose(devh->replay->file);
+  free(devh->replay->name);
+  free(devh->replay);
+  devh->replay = NULL;
+}
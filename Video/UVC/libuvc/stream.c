@@ -71,10 +71,12 @@ uvc_frame_desc_t *uvc_find_frame_desc_stream(uvc_stream_handle_t *strmh,
 uvc_frame_desc_t *uvc_find_frame_desc(uvc_device_handle_t *devh,
     uint16_t format_id, uint16_t frame_id);
 void *_uvc_user_caller(void *arg);
-void _uvc_populate_frame(uvc_stream_handle_t *strmh);
+void _uvc_populate_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *buf);
 
 static uvc_streaming_interface_t *_uvc_get_stream_if(uvc_device_handle_t *devh, int interface_idx);
 static uvc_stream_handle_t *_uvc_get_stream_by_interface(uvc_device_handle_t *devh, int interface_idx);
+static uvc_error_t _uvc_arm_still(uvc_stream_handle_t *strmh,
+    uvc_still_ctrl_t *still_ctrl);
 
 struct format_table_entry {
   enum uvc_frame_format format;
@@ -169,7 +171,13 @@ static uint8_t _uvc_frame_format_matches_guid(enum uvc_frame_format fmt, uint8_t
   return 0;
 }
 
-static enum uvc_frame_format uvc_frame_format_for_guid(uint8_t guid[16]) {
+/** @brief Look up the frame format of an uncompressed or frame based format GUID
+ * @ingroup streaming
+ *
+ * @param guid guidFormat of a format descriptor
+ * @return Matching format, or UVC_FRAME_FORMAT_UNKNOWN
+ */
+enum uvc_frame_format uvc_frame_format_for_guid(const uint8_t guid[16]) {
   struct format_table_entry *format;
   enum uvc_frame_format fmt;
 
@@ -200,6 +208,9 @@ uvc_error_t uvc_query_stream_ctrl(
   size_t len;
   uvc_error_t err;
 
+  if (devh->replay)
+    return _uvc_replay_query_stream_ctrl(devh, ctrl, req);
+
   memset(buf, 0, sizeof(buf));
 
   if (devh->info->ctrl_if.bcdUVC >= 0x0110)
@@ -300,6 +311,10 @@ uvc_error_t uvc_query_still_ctrl(
   const size_t len = 11;
   uvc_error_t err;
 
+  /* A recording has no camera to ask */
+  if (devh->replay)
+    return UVC_ERROR_NOT_SUPPORTED;
+
   memset(buf, 0, sizeof(buf));
 
   if (req == UVC_SET_CUR) {
@@ -337,9 +352,13 @@ uvc_error_t uvc_query_still_ctrl(
   return UVC_SUCCESS;
 }
 
-/** Initiate a method 2 (in stream) still capture
+/** Initiate a method 2 (in stream) or method 3 (still endpoint) still
+ * capture
  * @ingroup streaming
  *
+ * Either way the image is then read with uvc_read_still(). A method 2 still
+ * arrives through the video stream, its buffer is allocated here.
+ *
  * @param[in] devh Device handle
  * @param[in] still_ctrl Still capture control block
  */
@@ -351,18 +370,29 @@ uvc_error_t uvc_trigger_still(
   uint8_t buf;
   uvc_error_t err;
 
-  /* Stream must be running for method 2 to work */
+  if (devh->replay)
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  /* Stream must be running for method 2 and 3 to work */
   stream = _uvc_get_stream_by_interface(devh, still_ctrl->bInterfaceNumber);
   if (!stream || !stream->running)
     return UVC_ERROR_NOT_SUPPORTED;
 
-  /* Only method 2 is supported */
+  /* Method 1 only takes a frame of the stream, nothing to trigger */
   stream_if = _uvc_get_stream_if(devh, still_ctrl->bInterfaceNumber);
-  if(!stream_if || stream_if->bStillCaptureMethod != 2)
+  if(!stream_if || (stream_if->bStillCaptureMethod != 2
+      && stream_if->bStillCaptureMethod != 3))
       return UVC_ERROR_NOT_SUPPORTED;
 
-  /* prepare for a SET transfer */
-  buf = 1;
+  if (stream_if->bStillCaptureMethod == 2) {
+    err = _uvc_arm_still(stream, still_ctrl);
+    if (err != UVC_SUCCESS)
+      return err;
+  }
+
+  /* prepare for a SET transfer: transmit still image, or transmit it
+   * using the dedicated bulk pipe */
+  buf = stream_if->bStillCaptureMethod == 3 ? 2 : 1;
 
   /* do the transfer */
   err = libusb_control_transfer(
@@ -380,6 +410,359 @@ uvc_error_t uvc_trigger_still(
   return UVC_SUCCESS;
 }
 
+/** Get the still image capture method of a streaming interface
+ * @ingroup streaming
+ *
+ * @param[in] devh Device handle
+ * @param[in] interface_number Streaming interface
+ * @return 0 if the interface doesn't support still images, 1 if they are
+ * only frames of the video stream, 2 if they come in the video stream on
+ * request and 3 if they come from a bulk endpoint of their own
+ */
+int uvc_get_still_method(
+    uvc_device_handle_t *devh,
+    uint8_t interface_number) {
+  uvc_streaming_interface_t *stream_if;
+
+  stream_if = _uvc_get_stream_if(devh, interface_number);
+  if (!stream_if)
+    return 0;
+
+  return stream_if->bStillCaptureMethod;
+}
+
+/** @internal
+ * @brief Find the still frame descriptor and image size of a still control
+ */
+static uvc_still_frame_desc_t *_uvc_find_still_size(
+    uvc_streaming_interface_t *stream_if,
+    uvc_still_ctrl_t *still_ctrl,
+    uint16_t *width, uint16_t *height) {
+  uvc_format_desc_t *format;
+  uvc_still_frame_desc_t *still;
+  uvc_still_frame_res_t *sizePattern;
+
+  DL_FOREACH(stream_if->format_descs, format) {
+    if (format->bFormatIndex != still_ctrl->bFormatIndex)
+      continue;
+
+    DL_FOREACH(format->still_frame_desc, still) {
+      DL_FOREACH(still->imageSizePatterns, sizePattern) {
+        if (sizePattern->bResolutionIndex != still_ctrl->bFrameIndex)
+          continue;
+
+        *width = sizePattern->wWidth;
+        *height = sizePattern->wHeight;
+        return still;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/** @internal
+ * @brief Bytes per row of a frame, 0 for compressed formats
+ */
+static size_t _uvc_frame_step(enum uvc_frame_format format, uint32_t width) {
+  switch (format) {
+  case UVC_FRAME_FORMAT_BGR:
+    return width * 3;
+  case UVC_FRAME_FORMAT_YUYV:
+  case UVC_FRAME_FORMAT_UYVY:
+  case UVC_FRAME_FORMAT_GRAY16:
+  case UVC_FRAME_FORMAT_P010:
+    return width * 2;
+  case UVC_FRAME_FORMAT_NV12:
+  case UVC_FRAME_FORMAT_GRAY8:
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    return width;
+  default:
+    return 0;
+  }
+}
+
+/** @internal
+ * @brief Largest image a still control block may deliver
+ *
+ * Some cameras answer the still probe without a size, two bytes per pixel
+ * hold every format they send stills in.
+ */
+static size_t _uvc_still_max_bytes(uvc_still_ctrl_t *still_ctrl,
+    uint16_t width, uint16_t height) {
+  if (still_ctrl->dwMaxVideoFrameSize)
+    return still_ctrl->dwMaxVideoFrameSize;
+  return (size_t)width * height * 2;
+}
+
+/** @internal
+ * @brief Allocate the buffer of a method 2 still, the next still frame of
+ * the stream goes there
+ */
+static uvc_error_t _uvc_arm_still(uvc_stream_handle_t *strmh,
+    uvc_still_ctrl_t *still_ctrl) {
+  uint16_t width, height;
+  size_t size;
+  uvc_error_t ret = UVC_SUCCESS;
+
+  if (!_uvc_find_still_size(strmh->stream_if, still_ctrl, &width, &height))
+    return UVC_ERROR_INVALID_MODE;
+  size = _uvc_still_max_bytes(still_ctrl, width, height);
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+
+  if (strmh->still_state == UVC_STILL_FILLING) {
+    /* The image of an earlier trigger is still coming in */
+    ret = UVC_ERROR_BUSY;
+  } else {
+    if (strmh->still_size != size) {
+      free(strmh->still_buf);
+      strmh->still_buf = malloc(size);
+      strmh->still_size = strmh->still_buf ? size : 0;
+    }
+    if (strmh->still_buf) {
+      strmh->still_width = width;
+      strmh->still_height = height;
+      strmh->still_state = UVC_STILL_ARMED;
+    } else {
+      strmh->still_state = UVC_STILL_IDLE;
+      ret = UVC_ERROR_NO_MEM;
+    }
+  }
+
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  return ret;
+}
+
+/** @internal
+ * @brief Free the buffer of a method 2 still, must be called with cb_mutex
+ * held and the image not coming in
+ */
+static void _uvc_free_still(uvc_stream_handle_t *strmh) {
+  free(strmh->still_buf);
+  strmh->still_buf = NULL;
+  strmh->still_size = 0;
+  strmh->still_state = UVC_STILL_IDLE;
+}
+
+/** @internal
+ * @brief Wait for the method 2 still of the stream and copy it to frame
+ */
+static uvc_error_t _uvc_wait_still(uvc_stream_handle_t *strmh,
+    uvc_frame_t *frame, int timeout_ms) {
+  struct timespec ts;
+  uvc_error_t ret = UVC_SUCCESS;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeout_ms / 1000;
+  ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+  ts.tv_sec += ts.tv_nsec / 1000000000;
+  ts.tv_nsec = ts.tv_nsec % 1000000000;
+
+  pthread_mutex_lock(&strmh->cb_mutex);
+
+  while (strmh->still_state != UVC_STILL_READY && ret == UVC_SUCCESS) {
+    if (!strmh->running || strmh->still_cancel)
+      ret = UVC_ERROR_INTERRUPTED;
+    else if (strmh->still_state == UVC_STILL_IDLE)
+      ret = UVC_ERROR_INVALID_PARAM;
+    else if (timeout_ms == 0)
+      pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
+    else if (pthread_cond_timedwait(&strmh->cb_cond, &strmh->cb_mutex, &ts)
+        == ETIMEDOUT && strmh->still_state != UVC_STILL_READY)
+      ret = UVC_ERROR_TIMEOUT;
+  }
+
+  if (ret == UVC_SUCCESS) {
+    if (uvc_ensure_frame_size(frame, strmh->still_got_bytes) < 0) {
+      ret = UVC_ERROR_NO_MEM;
+    } else {
+      memcpy(frame->data, strmh->still_buf, strmh->still_got_bytes);
+      frame->data_bytes = strmh->still_got_bytes;
+      frame->width = strmh->still_width;
+      frame->height = strmh->still_height;
+    }
+  }
+
+  /* A still coming in late is dropped, the buffer goes with it */
+  if (strmh->still_state != UVC_STILL_FILLING)
+    _uvc_free_still(strmh);
+
+  pthread_mutex_unlock(&strmh->cb_mutex);
+
+  return ret;
+}
+
+/** Read a still image after uvc_trigger_still()
+ * @ingroup streaming
+ *
+ * A method 2 image is taken from the video stream, a method 3 one read
+ * from the still image endpoint. The video stream keeps running meanwhile.
+ * Blocks until the camera sent the whole image, the timeout runs out,
+ * the stream stops or uvc_cancel_still() is called.
+ *
+ * @param[in] devh Device handle
+ * @param[in] still_ctrl Still capture control block the trigger used
+ * @param[out] frame Frame to fill, like the ones uvc_allocate_frame() returns
+ * @param[in] timeout_ms Time the camera may take to send the image, for
+ * method 3 the time it may go without sending any of it; 0 for no limit
+ */
+uvc_error_t uvc_read_still(
+    uvc_device_handle_t *devh,
+    uvc_still_ctrl_t *still_ctrl,
+    uvc_frame_t *frame,
+    int timeout_ms) {
+  uvc_stream_handle_t *stream;
+  uvc_streaming_interface_t *stream_if;
+  uvc_still_frame_desc_t *still;
+  uint16_t width, height;
+  size_t max_bytes, got_bytes, packet_size, packet_bytes;
+  uint8_t *packet;
+  int transferred, eof, idle_ms, res;
+  enum uvc_frame_format format;
+  uvc_error_t ret;
+
+  if (devh->replay)
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  stream = _uvc_get_stream_by_interface(devh, still_ctrl->bInterfaceNumber);
+  stream_if = _uvc_get_stream_if(devh, still_ctrl->bInterfaceNumber);
+  if (!stream || !stream->running || !stream_if
+      || (stream_if->bStillCaptureMethod != 2
+        && stream_if->bStillCaptureMethod != 3))
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  /* The still has the format of the stream, which may stop meanwhile */
+  format = stream->frame_format;
+
+  if (stream_if->bStillCaptureMethod == 2) {
+    ret = _uvc_wait_still(stream, frame, timeout_ms);
+    if (ret < 0)
+      return ret;
+
+    frame->frame_format = format;
+    frame->step = _uvc_frame_step(format, frame->width);
+    frame->sequence = 0;
+    frame->still = 1;
+    (void)clock_gettime(CLOCK_MONOTONIC, &frame->capture_time_finished);
+    return UVC_SUCCESS;
+  }
+
+  still = _uvc_find_still_size(stream_if, still_ctrl, &width, &height);
+  if (!still || !still->bEndPointAddress)
+    return UVC_ERROR_INVALID_MODE;
+
+  max_bytes = _uvc_still_max_bytes(still_ctrl, width, height);
+  if (uvc_ensure_frame_size(frame, max_bytes) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  packet_size = still_ctrl->dwMaxPayloadTransferSize
+      ? still_ctrl->dwMaxPayloadTransferSize : 16 * 1024;
+  packet = malloc(packet_size);
+  if (!packet)
+    return UVC_ERROR_NO_MEM;
+
+  got_bytes = 0;
+  packet_bytes = 0;
+  idle_ms = 0;
+  eof = 0;
+  ret = UVC_SUCCESS;
+
+  while (!eof) {
+    size_t header_len, data_len;
+
+    /* Short transfers, so that a stop or uvc_cancel_still() never waits
+     * for the camera. Cancelled ones keep what they got. */
+    pthread_mutex_lock(&stream->cb_mutex);
+    if (!stream->running || stream->still_cancel)
+      ret = UVC_ERROR_INTERRUPTED;
+    pthread_mutex_unlock(&stream->cb_mutex);
+    if (ret < 0)
+      break;
+
+    res = libusb_bulk_transfer(devh->usb_devh, still->bEndPointAddress,
+        packet + packet_bytes, packet_size - packet_bytes, &transferred,
+        LIBUVC_STILL_POLL_MS);
+    packet_bytes += transferred;
+    if (res == LIBUSB_ERROR_TIMEOUT) {
+      idle_ms = transferred > 0 ? 0 : idle_ms + LIBUVC_STILL_POLL_MS;
+      if (timeout_ms && idle_ms >= timeout_ms) {
+        ret = UVC_ERROR_TIMEOUT;
+        break;
+      }
+      continue;
+    }
+    if (res < 0) {
+      ret = (uvc_error_t)res;
+      break;
+    }
+
+    /* The payload is complete, it starts with a header the same as in
+     * the stream */
+    transferred = packet_bytes;
+    packet_bytes = 0;
+    idle_ms = 0;
+    if (transferred < 2 || packet[0] < 2 || packet[0] > transferred)
+      continue;
+
+    header_len = packet[0];
+    if (packet[1] & UVC_STREAM_ERR) {
+      ret = UVC_ERROR_IO;
+      break;
+    }
+
+    data_len = transferred - header_len;
+    if (got_bytes + data_len > max_bytes)
+      data_len = max_bytes - got_bytes; /* Avoid overflow. */
+    memcpy((uint8_t *)frame->data + got_bytes, packet + header_len, data_len);
+    got_bytes += data_len;
+
+    eof = (packet[1] & UVC_STREAM_EOF) || got_bytes == max_bytes;
+  }
+
+  free(packet);
+
+  if (ret < 0)
+    return ret;
+
+  frame->data_bytes = got_bytes;
+  frame->width = width;
+  frame->height = height;
+  frame->frame_format = format;
+  frame->step = _uvc_frame_step(format, width);
+  frame->sequence = 0;
+  frame->still = 1;
+  (void)clock_gettime(CLOCK_MONOTONIC, &frame->capture_time_finished);
+
+  return UVC_SUCCESS;
+}
+
+/** Make uvc_read_still() give up
+ * @ingroup streaming
+ *
+ * A read in progress returns UVC_ERROR_INTERRUPTED soon, as does every
+ * later one until the stream is started again. Stop the stream only once
+ * the read returned.
+ *
+ * @param[in] devh Device handle
+ */
+void uvc_cancel_still(uvc_device_handle_t *devh) {
+  uvc_stream_handle_t *strmh;
+
+  DL_FOREACH(devh->streams, strmh) {
+    pthread_mutex_lock(&strmh->cb_mutex);
+    strmh->still_cancel = 1;
+    pthread_cond_broadcast(&strmh->cb_cond);
+    pthread_mutex_unlock(&strmh->cb_mutex);
+  }
+}
+
 /** @brief Reconfigure stream with a new stream format.
  * @ingroup streaming
  *
@@ -558,8 +941,9 @@ uvc_error_t uvc_get_still_ctrl_format_size(
 
   stream_if = _uvc_get_stream_if(devh, ctrl->bInterfaceNumber);
 
-  /* Only method 2 is supported */
-  if(!stream_if || stream_if->bStillCaptureMethod != 2)
+  /* Method 1 has no still image controls */
+  if(!stream_if || (stream_if->bStillCaptureMethod != 2
+      && stream_if->bStillCaptureMethod != 3))
     return UVC_ERROR_NOT_SUPPORTED;
 
   DL_FOREACH(stream_if->format_descs, format) {
@@ -652,38 +1036,281 @@ uvc_error_t uvc_probe_still_ctrl(
 }
 
 /** @internal
- * @brief Swap the working buffer with the presented buffer and notify consumers
+ * @brief Allocate the data of one more buffer and add it to the free list
+ * @return 0 if there is no room for it, in the pool or in memory
+ */
+static int _uvc_frame_pool_grow(struct uvc_frame_pool *pool) {
+  struct uvc_frame_buffer *buf;
+
+  if (pool->allocated == pool->count)
+    return 0;
+
+  buf = &pool->buffers[pool->allocated];
+  buf->data = malloc(pool->buffer_size + LIBUVC_XFER_META_BUF_SIZE);
+  if (!buf->data)
+    return 0;
+
+  buf->meta = buf->data + pool->buffer_size;
+  buf->pool = pool;
+  buf->next_free = pool->free_list;
+  pool->free_list = buf;
+  pool->free_count++;
+  pool->allocated++;
+
+  return 1;
+}
+
+/** @internal
+ * @brief Allocate the frame buffers of a stream
+ *
+ * The first prealloc buffers are allocated now, the rest up to count
+ * when they are first needed.
+ */
+static struct uvc_frame_pool *_uvc_frame_pool_create(int count, int prealloc,
+    size_t buffer_size) {
+  struct uvc_frame_pool *pool;
+
+  pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    return NULL;
+
+  pool->buffers = calloc(count, sizeof(*pool->buffers));
+  if (!pool->buffers) {
+    free(pool);
+    return NULL;
+  }
+
+  pool->count = count;
+  pool->buffer_size = buffer_size;
+
+  while (pool->allocated < prealloc) {
+    if (!_uvc_frame_pool_grow(pool)) {
+      while (pool->allocated-- > 0)
+        free(pool->buffers[pool->allocated].data);
+      free(pool->buffers);
+      free(pool);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+
+  return pool;
+}
+
+/** @internal
+ * @brief Free the pool, all of its buffers must be free
+ */
+static void _uvc_frame_pool_destroy(struct uvc_frame_pool *pool) {
+  int i;
+
+  for (i = 0; i < pool->allocated; i++)
+    free(pool->buffers[i].data);
+
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->buffers);
+  free(pool);
+}
+
+/** @internal
+ * @brief Take a free buffer with one reference
+ * @return NULL if the user holds all of them
+ */
+static struct uvc_frame_buffer *_uvc_frame_pool_take(struct uvc_frame_pool *pool) {
+  struct uvc_frame_buffer *buf;
+
+  pthread_mutex_lock(&pool->mutex);
+
+  /* Only the frames the user holds make it grow beyond what the stream
+   * needs for itself */
+  if (!pool->free_list)
+    _uvc_frame_pool_grow(pool);
+
+  buf = pool->free_list;
+  if (buf) {
+    pool->free_list = buf->next_free;
+    pool->free_count--;
+    buf->refs = 1;
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  return buf;
+}
+
+/** @internal
+ * @brief Take the oldest queued frame, must be called with cb_mutex held
+ */
+static struct uvc_frame_buffer *_uvc_ring_pop(uvc_stream_handle_t *strmh) {
+  struct uvc_frame_buffer *buf;
+
+  if (strmh->ring_count == 0)
+    return NULL;
+
+  buf = strmh->ring[strmh->ring_head];
+  strmh->ring_head = (strmh->ring_head + 1) % LIBUVC_MAX_FRAME_RING;
+  strmh->ring_count--;
+
+  /* A replay at full speed waits for room in the ring */
+  if (strmh->devh->replay)
+    pthread_cond_broadcast(&strmh->cb_cond);
+
+  return buf;
+}
+
+/** @internal
+ * @brief Give up the stream's buffers and its share of the pool
+ *
+ * The pool goes away now, or with the last buffer the user releases.
+ */
+static void _uvc_stream_close_pool(uvc_stream_handle_t *strmh) {
+  struct uvc_frame_pool *pool = strmh->pool;
+  struct uvc_frame_buffer *buf;
+  int destroy;
+
+  if (strmh->fill_buf)
+    uvc_release_frame_buffer(strmh->fill_buf);
+  while ((buf = _uvc_ring_pop(strmh)) != NULL)
+    uvc_release_frame_buffer(buf);
+
+  strmh->fill_buf = NULL;
+  strmh->outbuf = NULL;
+  strmh->meta_outbuf = NULL;
+  strmh->pool = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->closed = 1;
+  destroy = pool->free_count == pool->allocated;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (destroy)
+    _uvc_frame_pool_destroy(pool);
+}
+
+/** Keep the data of a frame of a zero-copy stream past the callback.
+ * @ingroup streaming
+ *
+ * May only be called from the frame callback. The buffer stays out of
+ * the stream's rotation until released with uvc_release_frame_buffer(),
+ * even after the stream is closed.
+ *
+ * @param frame Frame passed to the callback
+ * @return The buffer frame->data points into, NULL if the frame doesn't
+ * come from a zero-copy stream
+ */
+uvc_frame_buffer_t *uvc_hold_frame_buffer(const uvc_frame_t *frame) {
+  struct uvc_frame_buffer *buf = frame->buffer;
+
+  if (!buf)
+    return NULL;
+
+  pthread_mutex_lock(&buf->pool->mutex);
+  buf->refs++;
+  pthread_mutex_unlock(&buf->pool->mutex);
+
+  return buf;
+}
+
+/** Hand a buffer held with uvc_hold_frame_buffer() back to its stream.
+ * @ingroup streaming
+ *
+ * @param buffer Buffer to release, may be called from any thread
+ */
+void uvc_release_frame_buffer(uvc_frame_buffer_t *buffer) {
+  struct uvc_frame_pool *pool = buffer->pool;
+  int destroy = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+
+  if (--buffer->refs == 0) {
+    buffer->next_free = pool->free_list;
+    pool->free_list = buffer;
+    pool->free_count++;
+    destroy = pool->closed && pool->free_count == pool->allocated;
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (destroy)
+    _uvc_frame_pool_destroy(pool);
+}
+
+/** @internal
+ * @brief Queue the assembled frame and notify consumers
+ *
+ * A full ring either gives up its oldest frame or, with UVC_RING_BLOCKING,
+ * the new one. Every lost frame is counted.
  */
 void _uvc_swap_buffers(uvc_stream_handle_t *strmh) {
-  uint8_t *tmp_buf;
+  struct uvc_frame_buffer *buf = strmh->fill_buf;
+  struct uvc_frame_buffer *next;
+  int blocking = strmh->ring_policy == UVC_RING_BLOCKING;
 
   pthread_mutex_lock(&strmh->cb_mutex);
 
-  (void)clock_gettime(CLOCK_MONOTONIC, &strmh->capture_time_finished);
+  /* A still image is no frame of the video, uvc_read_still() takes it */
+  if (strmh->sti) {
+    if (strmh->sti == 1) {
+      strmh->still_got_bytes = strmh->got_bytes;
+      strmh->still_state = UVC_STILL_READY;
+      pthread_cond_broadcast(&strmh->cb_cond);
+    }
+    pthread_mutex_unlock(&strmh->cb_mutex);
+    goto reset;
+  }
 
-  /* swap the buffers */
-  tmp_buf = strmh->holdbuf;
-  strmh->hold_bytes = strmh->got_bytes;
-  strmh->holdbuf = strmh->outbuf;
-  strmh->outbuf = tmp_buf;
-  strmh->hold_last_scr = strmh->last_scr;
-  strmh->hold_pts = strmh->pts;
-  strmh->hold_seq = strmh->seq;
-  
-  /* swap metadata buffer */
-  tmp_buf = strmh->meta_holdbuf;
-  strmh->meta_holdbuf = strmh->meta_outbuf;
-  strmh->meta_outbuf = tmp_buf;
-  strmh->meta_hold_bytes = strmh->meta_got_bytes;
+  strmh->frames_completed++;
+
+  if (blocking && strmh->ring_count == strmh->ring_size) {
+    strmh->frames_dropped++;
+    pthread_mutex_unlock(&strmh->cb_mutex);
+    goto reset;
+  }
+
+  next = _uvc_frame_pool_take(strmh->pool);
+  if (!next && (blocking || strmh->ring_count == 0)) {
+    /* The user holds every other buffer */
+    strmh->frames_dropped++;
+    pthread_mutex_unlock(&strmh->cb_mutex);
+    goto reset;
+  }
+
+  if (!next || strmh->ring_count == strmh->ring_size) {
+    struct uvc_frame_buffer *oldest = _uvc_ring_pop(strmh);
+    strmh->frames_overwritten++;
+    if (next)
+      uvc_release_frame_buffer(oldest);
+    else
+      next = oldest;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &buf->capture_time_finished);
+  buf->bytes = strmh->got_bytes;
+  buf->meta_bytes = strmh->meta_got_bytes;
+  buf->seq = strmh->seq;
+  buf->pts = strmh->pts;
+  buf->scr = strmh->last_scr;
+  buf->scr_sof = strmh->last_scr_sof;
+  buf->scr_time = strmh->last_scr_time;
+  buf->transfer_time = strmh->transfer_time;
+
+  strmh->ring[(strmh->ring_head + strmh->ring_count) % LIBUVC_MAX_FRAME_RING] = buf;
+  strmh->ring_count++;
+
+  strmh->fill_buf = next;
+  strmh->outbuf = next->data;
+  strmh->meta_outbuf = next->meta;
 
   pthread_cond_broadcast(&strmh->cb_cond);
   pthread_mutex_unlock(&strmh->cb_mutex);
 
+reset:
   strmh->seq++;
   strmh->got_bytes = 0;
   strmh->meta_got_bytes = 0;
   strmh->last_scr = 0;
   strmh->pts = 0;
+  strmh->sti = 0;
 }
 
 /** @internal
@@ -700,6 +1327,7 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
   size_t header_len;
   uint8_t header_info;
   size_t data_len;
+  size_t max_bytes;
 
   /* magic numbers for identifying header packets from some iSight cameras */
   static uint8_t isight_tag[] = {
@@ -711,6 +1339,9 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
   if (payload_len == 0)
     return;
 
+  if (strmh->record_file)
+    _uvc_record_payload(strmh, payload, payload_len);
+
   /* Certain iSight cameras have strange behavior: They send header
    * information in a packet with no image data, and then the following
    * packets have only image data, with no more headers until the next frame.
@@ -761,14 +1392,29 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
 
     strmh->fid = header_info & 1;
 
+    /* The whole frame is a still image, it goes to the still buffer if
+     * uvc_trigger_still() armed one */
+    if ((header_info & UVC_STREAM_STI) && !strmh->sti) {
+      pthread_mutex_lock(&strmh->cb_mutex);
+      if (strmh->still_state == UVC_STILL_ARMED) {
+        strmh->still_state = UVC_STILL_FILLING;
+        strmh->sti = 1;
+      } else {
+        strmh->sti = 2;
+      }
+      pthread_mutex_unlock(&strmh->cb_mutex);
+      strmh->got_bytes = 0;
+    }
+
     if (header_info & (1 << 2)) {
       strmh->pts = DW_TO_INT(payload + variable_offset);
       variable_offset += 4;
     }
 
     if (header_info & (1 << 3)) {
-      /** @todo read the SOF token counter */
       strmh->last_scr = DW_TO_INT(payload + variable_offset);
+      strmh->last_scr_sof = SW_TO_SHORT(payload + variable_offset + 4) & 0x7ff;
+      (void)clock_gettime(CLOCK_MONOTONIC, &strmh->last_scr_time);
       variable_offset += 6;
     }
 
@@ -783,11 +1429,22 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
   }
 
   if (data_len > 0) {
-    if (strmh->got_bytes + data_len > strmh->cur_ctrl.dwMaxVideoFrameSize)
-      data_len = strmh->cur_ctrl.dwMaxVideoFrameSize - strmh->got_bytes; /* Avoid overflow. */
-    memcpy(strmh->outbuf + strmh->got_bytes, payload + header_len, data_len);
+    uint8_t *outbuf = strmh->outbuf;
+
+    max_bytes = strmh->cur_ctrl.dwMaxVideoFrameSize;
+    if (strmh->sti == 1) {
+      outbuf = strmh->still_buf;
+      max_bytes = strmh->still_size;
+    } else if (strmh->sti == 2) {
+      outbuf = NULL;
+      max_bytes = SIZE_MAX;
+    }
+    if (strmh->got_bytes + data_len > max_bytes)
+      data_len = max_bytes - strmh->got_bytes; /* Avoid overflow. */
+    if (outbuf)
+      memcpy(outbuf + strmh->got_bytes, payload + header_len, data_len);
     strmh->got_bytes += data_len;
-    if (header_info & (1 << 1) || strmh->got_bytes == strmh->cur_ctrl.dwMaxVideoFrameSize) {
+    if (header_info & (1 << 1) || strmh->got_bytes == max_bytes) {
       /* The EOF bit is set, so publish the complete frame */
       _uvc_swap_buffers(strmh);
     }
@@ -809,6 +1466,9 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
 
   switch (transfer->status) {
   case LIBUSB_TRANSFER_COMPLETED:
+    if (strmh->devh->tracing)
+      (void)clock_gettime(CLOCK_MONOTONIC, &strmh->transfer_time);
+
     if (transfer->num_iso_packets == 0) {
       /* This is a bulk mode transfer, so it just has one payload transfer */
       _uvc_process_payload(strmh, transfer->buffer, transfer->actual_length);
@@ -842,7 +1502,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
     pthread_mutex_lock(&strmh->cb_mutex);
 
     /* Mark transfer as deleted. */
-    for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    for(i=0; i < strmh->num_transfers; i++) {
       if(strmh->transfers[i] == transfer) {
         UVC_DEBUG("Freeing transfer %d (%p)", i, transfer);
         free(transfer->buffer);
@@ -851,7 +1511,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
         break;
       }
     }
-    if(i == LIBUVC_NUM_TRANSFER_BUFS ) {
+    if(i == strmh->num_transfers ) {
       UVC_DEBUG("transfer %p not found; not freeing!", transfer);
     }
 
@@ -878,7 +1538,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
         pthread_mutex_lock(&strmh->cb_mutex);
 
         /* Mark transfer as deleted. */
-        for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+        for (i = 0; i < strmh->num_transfers; i++) {
           if (strmh->transfers[i] == transfer) {
             UVC_DEBUG("Freeing failed transfer %d (%p)", i, transfer);
             free(transfer->buffer);
@@ -887,7 +1547,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
             break;
           }
         }
-        if (i == LIBUVC_NUM_TRANSFER_BUFS) {
+        if (i == strmh->num_transfers) {
           UVC_DEBUG("failed transfer %p not found; not freeing!", transfer);
         }
 
@@ -899,7 +1559,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
       pthread_mutex_lock(&strmh->cb_mutex);
 
       /* Mark transfer as deleted. */
-      for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+      for(i=0; i < strmh->num_transfers; i++) {
         if(strmh->transfers[i] == transfer) {
           UVC_DEBUG("Freeing orphan transfer %d (%p)", i, transfer);
           free(transfer->buffer);
@@ -908,7 +1568,7 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
           break;
         }
       }
-      if(i == LIBUVC_NUM_TRANSFER_BUFS ) {
+      if(i == strmh->num_transfers ) {
         UVC_DEBUG("orphan transfer %p not found; not freeing!", transfer);
       }
 
@@ -925,8 +1585,9 @@ void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
  * @param ctrl Control block, processed using {uvc_probe_stream_ctrl} or
  *             {uvc_get_stream_ctrl_format_size}
  * @param cb   User callback function. See {uvc_frame_callback_t} for restrictions.
- * @param flags Stream setup flags, currently undefined. Set this to zero. The lower bit
- * is reserved for backward compatibility.
+ * @param flags Stream setup flags, UVC_STREAM_ZERO_COPY and
+ * UVC_STREAM_FIX_BANDWIDTH. The lower bit is reserved for backward
+ * compatibility.
  */
 uvc_error_t uvc_start_streaming(
     uvc_device_handle_t *devh,
@@ -951,6 +1612,20 @@ uvc_error_t uvc_start_streaming(
   return UVC_SUCCESS;
 }
 
+/** Stamp frames with the times they pass through the library.
+ * @ingroup streaming
+ *
+ * Sets transfer_time and callback_time of the frames handed to the
+ * callback. Costs two clock reads per transfer and frame while enabled,
+ * nothing when disabled. Can be changed while streaming.
+ *
+ * @param devh UVC device
+ * @param enable Nonzero to enable tracing
+ */
+void uvc_set_tracing(uvc_device_handle_t *devh, int enable) {
+  devh->tracing = enable != 0;
+}
+
 /** Begin streaming video from the camera into the callback function.
  * @ingroup streaming
  *
@@ -1041,12 +1716,10 @@ uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t
   // Set up the streaming status and data space
   strmh->running = 0;
 
-  strmh->outbuf = malloc( ctrl->dwMaxVideoFrameSize );
-  strmh->holdbuf = malloc( ctrl->dwMaxVideoFrameSize );
+  strmh->ring_size = LIBUVC_DEFAULT_FRAME_RING;
+  strmh->ring_policy = UVC_RING_LATEST;
+  strmh->held_bufs = LIBUVC_NUM_HELD_BUFS;
 
-  strmh->meta_outbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
-  strmh->meta_holdbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
-   
   pthread_mutex_init(&strmh->cb_mutex, NULL);
   pthread_cond_init(&strmh->cb_cond, NULL);
 
@@ -1064,13 +1737,241 @@ fail:
   return ret;
 }
 
+/** @internal
+ * @brief Bytes per service interval of the endpoint of an altsetting
+ *
+ * @param altsetting Altsetting of the VS interface
+ * @param address Address of the video endpoint
+ * @param[out] endpoint The endpoint found
+ * @return 0 if the altsetting doesn't have the endpoint
+ */
+static size_t _uvc_endpoint_bytes_per_packet(
+    const struct libusb_interface_descriptor *altsetting, uint8_t address,
+    const struct libusb_endpoint_descriptor **endpoint) {
+  size_t bytes = 0;
+  int ep_idx;
+
+  for (ep_idx = 0; ep_idx < altsetting->bNumEndpoints; ep_idx++) {
+    const struct libusb_endpoint_descriptor *ep = altsetting->endpoint + ep_idx;
+    struct libusb_ss_endpoint_companion_descriptor *ep_comp = 0;
+
+    if (ep->bEndpointAddress != address)
+      continue;
+
+    *endpoint = ep;
+
+    libusb_get_ss_endpoint_companion_descriptor(NULL, ep, &ep_comp);
+    if (ep_comp) {
+      bytes = ep_comp->wBytesPerInterval;
+      libusb_free_ss_endpoint_companion_descriptor(ep_comp);
+    } else {
+      // wMaxPacketSize: [unused:2 (multiplier-1):3 size:11]
+      bytes = (ep->wMaxPacketSize & 0x07ff)
+          * (((ep->wMaxPacketSize >> 11) & 3) + 1);
+    }
+    break;
+  }
+
+  return bytes;
+}
+
+/** @internal
+ * @brief Whether libusb failed because the bus has no room for a stream
+ *
+ * Host controllers refuse periodic bandwidth or endpoint resources they
+ * can't schedule with ENOSPC or ENOMEM. libusb reports the latter as
+ * LIBUSB_ERROR_NO_MEM and, having no code for the former, ENOSPC as an
+ * I/O or other error with errno left as the system set it.
+ *
+ * @param err libusb error of the call
+ * @param err_errno errno right after the call, cleared before it
+ */
+static int _uvc_is_bandwidth_error(int err, int err_errno) {
+  if (err == LIBUSB_ERROR_NO_MEM)
+    return 1;
+
+  return (err == LIBUSB_ERROR_IO || err == LIBUSB_ERROR_OTHER)
+      && err_errno == ENOSPC;
+}
+
+/** @internal
+ * @brief Service interval of the packets of an isochronous endpoint
+ */
+static unsigned int _uvc_iso_packet_us(uvc_stream_handle_t *strmh,
+    const struct libusb_endpoint_descriptor *endpoint) {
+  int speed = libusb_get_device_speed(libusb_get_device(strmh->devh->usb_devh));
+  /* bInterval is 2^(bInterval-1) frames or microframes */
+  unsigned int exponent = endpoint->bInterval > 0 ? endpoint->bInterval - 1 : 0;
+
+  if (exponent > 15)
+    exponent = 15;
+
+  if (speed == LIBUSB_SPEED_LOW || speed == LIBUSB_SPEED_FULL)
+    return 1000 << exponent;
+  return 125 << exponent;
+}
+
+/** @internal
+ * @brief Bytes per packet the frames of an uncompressed stream take
+ *
+ * The frame spread over the packets of a frame interval plus the largest
+ * payload header, never more than the camera asked for.
+ */
+static size_t _uvc_uncompressed_bytes_per_packet(uvc_stream_handle_t *strmh,
+    unsigned int packet_us) {
+  uvc_stream_ctrl_t *ctrl = &strmh->cur_ctrl;
+  /* dwFrameInterval is in 100 ns units */
+  uint64_t frame_packets = ctrl->dwFrameInterval / (packet_us * 10);
+  size_t bytes;
+
+  if (frame_packets == 0)
+    return ctrl->dwMaxPayloadTransferSize;
+
+  bytes = (ctrl->dwMaxVideoFrameSize + frame_packets - 1) / frame_packets + 12;
+  /* Leave some room for cameras that don't send evenly */
+  if (bytes < 1024)
+    bytes = 1024;
+  if (bytes > ctrl->dwMaxPayloadTransferSize)
+    bytes = ctrl->dwMaxPayloadTransferSize;
+
+  return bytes;
+}
+
+/** @internal
+ * @brief Work out how many transfers of what size a stream needs
+ *
+ * Uses the negotiated maximum frame size and frame interval, unless
+ * overridden with uvc_stream_set_transfers().
+ *
+ * @param strmh UVC stream handle
+ * @param packet_bytes Bytes per isochronous packet, or per bulk transfer
+ * @param packet_us Service interval of the isochronous packets, 0 for bulk
+ * @param[out] packets_per_transfer Isochronous packets per transfer, 1 for bulk
+ * @param[out] num_transfers Number of transfers to keep in flight
+ */
+static void _uvc_size_transfers(uvc_stream_handle_t *strmh,
+    size_t packet_bytes, unsigned int packet_us,
+    size_t *packets_per_transfer, int *num_transfers) {
+  uvc_stream_ctrl_t *ctrl = &strmh->cur_ctrl;
+  /* dwFrameInterval is in 100 ns units, assume 30 fps if it isn't set */
+  uint64_t frame_us = ctrl->dwFrameInterval ? ctrl->dwFrameInterval / 10 : 33333;
+  uint64_t frame_packets, transfer_us, count;
+  size_t packets;
+
+  if (frame_us == 0)
+    frame_us = 1;
+  if (packet_bytes == 0)
+    packet_bytes = 1;
+
+  /* Packets or bulk payloads a frame takes: its maximum size, but no more
+   * isochronous packets than are sent in a frame interval */
+  frame_packets = (ctrl->dwMaxVideoFrameSize + packet_bytes - 1) / packet_bytes;
+  if (packet_us && frame_packets > frame_us / packet_us)
+    frame_packets = frame_us / packet_us;
+  if (frame_packets < 1)
+    frame_packets = 1;
+
+  if (!packet_us) {
+    /* A bulk transfer carries one payload */
+    packets = 1;
+  } else if (strmh->req_packets_per_transfer > 0) {
+    packets = strmh->req_packets_per_transfer;
+  } else {
+    packets = (frame_packets + LIBUVC_TRANSFERS_PER_FRAME - 1)
+        / LIBUVC_TRANSFERS_PER_FRAME;
+    if (packets < LIBUVC_MIN_PACKETS_PER_TRANSFER)
+      packets = LIBUVC_MIN_PACKETS_PER_TRANSFER;
+    /* Transfers will be at most one frame long */
+    if (packets > frame_packets)
+      packets = frame_packets;
+    if (packets > LIBUVC_MAX_PACKETS_PER_TRANSFER)
+      packets = LIBUVC_MAX_PACKETS_PER_TRANSFER;
+  }
+
+  if (strmh->req_num_transfers > 0) {
+    count = strmh->req_num_transfers;
+  } else {
+    /* Isochronous transfers take their packets' time, bulk ones their
+     * payload's share of a frame interval */
+    transfer_us = packet_us ? packets * packet_us : frame_us / frame_packets;
+    if (transfer_us < 1)
+      transfer_us = 1;
+
+    count = (LIBUVC_TRANSFER_QUEUE_US + transfer_us - 1) / transfer_us;
+    if (count < LIBUVC_MIN_TRANSFER_BUFS)
+      count = LIBUVC_MIN_TRANSFER_BUFS;
+    if (count > LIBUVC_MAX_TRANSFER_BUFS)
+      count = LIBUVC_MAX_TRANSFER_BUFS;
+  }
+
+  *packets_per_transfer = packets;
+  *num_transfers = (int)count;
+}
+
+/** @internal
+ * @brief Allocate the transfer tables of a starting stream
+ */
+static uvc_error_t _uvc_alloc_transfer_arrays(uvc_stream_handle_t *strmh,
+    int num_transfers) {
+  strmh->transfers = calloc(num_transfers, sizeof(*strmh->transfers));
+  strmh->transfer_bufs = calloc(num_transfers, sizeof(*strmh->transfer_bufs));
+  if (!strmh->transfers || !strmh->transfer_bufs)
+    return UVC_ERROR_NO_MEM;
+
+  strmh->num_transfers = num_transfers;
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Free the transfer tables once all transfers are gone
+ */
+static void _uvc_free_transfer_arrays(uvc_stream_handle_t *strmh) {
+  free(strmh->transfers);
+  free(strmh->transfer_bufs);
+  strmh->transfers = NULL;
+  strmh->transfer_bufs = NULL;
+  strmh->num_transfers = 0;
+}
+
+/** Override the transfers a stream sets up when it starts.
+ * @ingroup streaming
+ *
+ * By default they are worked out from the negotiated payload size, frame
+ * size and frame interval: about a quarter frame per transfer, and
+ * LIBUVC_TRANSFER_QUEUE_US of video in flight.
+ *
+ * @param strmh UVC stream handle, must not be streaming
+ * @param num_transfers Transfers to keep in flight, 0 to compute, at most
+ * LIBUVC_MAX_TRANSFER_BUFS
+ * @param packets_per_transfer Packets per isochronous transfer, 0 to
+ * compute, at most LIBUVC_MAX_PACKETS_PER_TRANSFER. Bulk streams ignore it.
+ */
+uvc_error_t uvc_stream_set_transfers(uvc_stream_handle_t *strmh,
+    int num_transfers, int packets_per_transfer) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (num_transfers < 0 || num_transfers > LIBUVC_MAX_TRANSFER_BUFS)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (packets_per_transfer < 0
+      || packets_per_transfer > LIBUVC_MAX_PACKETS_PER_TRANSFER)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh->req_num_transfers = num_transfers;
+  strmh->req_packets_per_transfer = packets_per_transfer;
+
+  return UVC_SUCCESS;
+}
+
 /** Begin streaming video from the stream into the callback function.
  * @ingroup streaming
  *
  * @param strmh UVC stream
  * @param cb   User callback function. See {uvc_frame_callback_t} for restrictions.
- * @param flags Stream setup flags, currently undefined. Set this to zero. The lower bit
- * is reserved for backward compatibility.
+ * @param flags Stream setup flags, UVC_STREAM_ZERO_COPY and
+ * UVC_STREAM_FIX_BANDWIDTH. The lower bit is reserved for backward
+ * compatibility.
  */
 uvc_error_t uvc_stream_start(
     uvc_stream_handle_t *strmh,
@@ -1090,6 +1991,9 @@ uvc_error_t uvc_stream_start(
   size_t total_transfer_size = 0;
   struct libusb_transfer *transfer;
   int transfer_id;
+  int num_transfers = 0;
+  int submit_errno = 0;
+  size_t buffer_size;
 
   ctrl = &strmh->cur_ctrl;
 
@@ -1100,7 +2004,48 @@ uvc_error_t uvc_stream_start(
     return UVC_ERROR_BUSY;
   }
 
+  /* Zero-copy frames are only ever lent to a callback */
+  if ((flags & UVC_STREAM_ZERO_COPY) && !cb) {
+    UVC_EXIT(UVC_ERROR_INVALID_PARAM);
+    return UVC_ERROR_INVALID_PARAM;
+  }
+
+  strmh->zero_copy = (flags & UVC_STREAM_ZERO_COPY) != 0;
+
+  /* One buffer being filled, the ring and one for the user caller are
+   * allocated now. With zero-copy the callback may hold on to up to
+   * held_bufs more, those are allocated once it does. Still images have
+   * a buffer of their own. */
+  buffer_size = ctrl->dwMaxVideoFrameSize;
+  strmh->pool = _uvc_frame_pool_create(strmh->ring_size + 2
+      + (strmh->zero_copy ? strmh->held_bufs : 0),
+      strmh->ring_size + 2, buffer_size);
+  if (!strmh->pool) {
+    UVC_EXIT(UVC_ERROR_NO_MEM);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  strmh->fill_buf = _uvc_frame_pool_take(strmh->pool);
+  strmh->outbuf = strmh->fill_buf->data;
+  strmh->meta_outbuf = strmh->fill_buf->meta;
+  strmh->got_bytes = 0;
+  strmh->meta_got_bytes = 0;
+  strmh->ring_head = 0;
+  strmh->ring_count = 0;
+  strmh->frames_completed = 0;
+  strmh->frames_overwritten = 0;
+  strmh->frames_dropped = 0;
+
+  if (strmh->zero_copy) {
+    if (strmh->frame.library_owns_data)
+      free(strmh->frame.data);
+    strmh->frame.data = NULL;
+    strmh->frame.data_bytes = 0;
+  }
+
   strmh->running = 1;
+  strmh->still_cancel = 0;
+  strmh->sti = 0;
   strmh->seq = 1;
   strmh->fid = 0;
   strmh->pts = 0;
@@ -1119,6 +2064,22 @@ uvc_error_t uvc_stream_start(
     goto fail;
   }
 
+  if (strmh->record_file)
+    _uvc_record_start(strmh, frame_desc);
+
+  if (strmh->devh->replay) {
+    /* Payloads come from the recording instead of transfers */
+    strmh->user_cb = cb;
+    strmh->user_ptr = user_ptr;
+
+    ret = _uvc_replay_start(strmh);
+    if (ret != UVC_SUCCESS) {
+      strmh->user_cb = NULL;
+      goto fail;
+    }
+    goto started;
+  }
+
   // Get the interface that provides the chosen format and frame configuration
   interface_id = strmh->stream_if->bInterfaceNumber;
   interface = &strmh->devh->info->config->interface[interface_id];
@@ -1140,73 +2101,75 @@ uvc_error_t uvc_stream_start(
     /* Size of packet transferable from the chosen endpoint */
     size_t endpoint_bytes_per_packet = 0;
     /* Index of the altsetting */
-    int alt_idx, ep_idx;
+    int alt_idx;
+    int fix_bandwidth;
     
     config_bytes_per_packet = strmh->cur_ctrl.dwMaxPayloadTransferSize;
+    fix_bandwidth = (flags & UVC_STREAM_FIX_BANDWIDTH)
+        && format_desc->bDescriptorSubtype == UVC_VS_FORMAT_UNCOMPRESSED;
 
-    /* Go through the altsettings and find one whose packets are at least
-     * as big as our format's maximum per-packet usage. Assume that the
-     * packet sizes are increasing. */
+    /* Go through the altsettings and take the one with the smallest
+     * packets that still hold our format's maximum per-packet usage.
+     * Cameras don't always list them by size, and a bigger one than needed
+     * takes bus bandwidth other devices on the bus may need. */
     for (alt_idx = 0; alt_idx < interface->num_altsetting; alt_idx++) {
-      altsetting = interface->altsetting + alt_idx;
-      endpoint_bytes_per_packet = 0;
-
-      /* Find the endpoint with the number specified in the VS header */
-      for (ep_idx = 0; ep_idx < altsetting->bNumEndpoints; ep_idx++) {
-        endpoint = altsetting->endpoint + ep_idx;
-
-        struct libusb_ss_endpoint_companion_descriptor *ep_comp = 0;
-        libusb_get_ss_endpoint_companion_descriptor(NULL, endpoint, &ep_comp);
-        if (ep_comp)
-        {
-          endpoint_bytes_per_packet = ep_comp->wBytesPerInterval;
-          libusb_free_ss_endpoint_companion_descriptor(ep_comp);
-          break;
-        }
-        else
-        {
-          if (endpoint->bEndpointAddress == format_desc->parent->bEndpointAddress) {
-              endpoint_bytes_per_packet = endpoint->wMaxPacketSize;
-            // wMaxPacketSize: [unused:2 (multiplier-1):3 size:11]
-            endpoint_bytes_per_packet = (endpoint_bytes_per_packet & 0x07ff) *
-              (((endpoint_bytes_per_packet >> 11) & 3) + 1);
-            break;
-          }
-        }
-      }
+      const struct libusb_endpoint_descriptor *alt_endpoint;
+      size_t alt_bytes_per_packet = _uvc_endpoint_bytes_per_packet(
+          interface->altsetting + alt_idx,
+          format_desc->parent->bEndpointAddress, &alt_endpoint);
 
-      if (endpoint_bytes_per_packet >= config_bytes_per_packet) {
-        /* Transfers will be at most one frame long: Divide the maximum frame size
-         * by the size of the endpoint and round up */
-        packets_per_transfer = (ctrl->dwMaxVideoFrameSize +
-                                endpoint_bytes_per_packet - 1) / endpoint_bytes_per_packet;
-
-        /* But keep a reasonable limit: Otherwise we start dropping data */
-        if (packets_per_transfer > 32)
-          packets_per_transfer = 32;
-        
-        total_transfer_size = packets_per_transfer * endpoint_bytes_per_packet;
-        break;
+      if (alt_bytes_per_packet == 0)
+        continue;
+
+      if (fix_bandwidth)
+        config_bytes_per_packet = _uvc_uncompressed_bytes_per_packet(strmh,
+            _uvc_iso_packet_us(strmh, alt_endpoint));
+
+      if (alt_bytes_per_packet >= config_bytes_per_packet
+          && (!altsetting || alt_bytes_per_packet < endpoint_bytes_per_packet)) {
+        altsetting = interface->altsetting + alt_idx;
+        endpoint = alt_endpoint;
+        endpoint_bytes_per_packet = alt_bytes_per_packet;
       }
     }
 
     /* If we searched through all the altsettings and found nothing usable */
-    if (alt_idx == interface->num_altsetting) {
+    if (!altsetting) {
       ret = UVC_ERROR_INVALID_MODE;
       goto fail;
     }
 
+    _uvc_size_transfers(strmh, endpoint_bytes_per_packet,
+        _uvc_iso_packet_us(strmh, endpoint),
+        &packets_per_transfer, &num_transfers);
+    total_transfer_size = packets_per_transfer * endpoint_bytes_per_packet;
+
     /* Select the altsetting */
+    errno = 0;
     ret = libusb_set_interface_alt_setting(strmh->devh->usb_devh,
                                            altsetting->bInterfaceNumber,
                                            altsetting->bAlternateSetting);
     if (ret != UVC_SUCCESS) {
       UVC_DEBUG("libusb_set_interface_alt_setting failed");
+      /* The host controller refuses altsettings it can't schedule */
+      if (_uvc_is_bandwidth_error(ret, errno))
+        ret = UVC_ERROR_NO_BANDWIDTH;
       goto fail;
     }
 
+    UVC_DEBUG("altsetting %d, %zu bytes per packet for %u",
+        altsetting->bAlternateSetting, endpoint_bytes_per_packet,
+        strmh->cur_ctrl.dwMaxPayloadTransferSize);
+
+    UVC_DEBUG("%d transfers of %zu packets of %zu bytes", num_transfers,
+        packets_per_transfer, endpoint_bytes_per_packet);
+
+    ret = _uvc_alloc_transfer_arrays(strmh, num_transfers);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
     /* Set up the transfers */
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; ++transfer_id) {
+    for (transfer_id = 0; transfer_id < num_transfers; ++transfer_id) {
       transfer = libusb_alloc_transfer(packets_per_transfer);
       strmh->transfers[transfer_id] = transfer;      
       strmh->transfer_bufs[transfer_id] = malloc(total_transfer_size);
@@ -1219,7 +2182,19 @@ uvc_error_t uvc_stream_start(
       libusb_set_iso_packet_lengths(transfer, endpoint_bytes_per_packet);
     }
   } else {
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+    size_t payloads_per_transfer;
+
+    _uvc_size_transfers(strmh, strmh->cur_ctrl.dwMaxPayloadTransferSize, 0,
+        &payloads_per_transfer, &num_transfers);
+
+    UVC_DEBUG("%d bulk transfers of %u bytes", num_transfers,
+        strmh->cur_ctrl.dwMaxPayloadTransferSize);
+
+    ret = _uvc_alloc_transfer_arrays(strmh, num_transfers);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
+    for (transfer_id = 0; transfer_id < num_transfers;
         ++transfer_id) {
       transfer = libusb_alloc_transfer(0);
       strmh->transfers[transfer_id] = transfer;
@@ -1236,35 +2211,58 @@ uvc_error_t uvc_stream_start(
   strmh->user_cb = cb;
   strmh->user_ptr = user_ptr;
 
-  /* If the user wants it, set up a thread that calls the user's function
-   * with the contents of each frame.
-   */
-  if (cb) {
-    pthread_create(&strmh->cb_thread, NULL, _uvc_user_caller, (void*) strmh);
-  }
-
-  for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+  for (transfer_id = 0; transfer_id < num_transfers;
       transfer_id++) {
+    errno = 0;
     ret = libusb_submit_transfer(strmh->transfers[transfer_id]);
     if (ret != UVC_SUCCESS) {
+      submit_errno = errno;
       UVC_DEBUG("libusb_submit_transfer failed: %d",ret);
       break;
     }
   }
 
   if ( ret != UVC_SUCCESS && transfer_id >= 0 ) {
-    for ( ; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; transfer_id++) {
+    int submitted = transfer_id;
+
+    for ( ; transfer_id < num_transfers; transfer_id++) {
       free ( strmh->transfers[transfer_id]->buffer );
       libusb_free_transfer ( strmh->transfers[transfer_id]);
       strmh->transfers[transfer_id] = 0;
     }
+
+    if (submitted == 0) {
+      /* Nothing is streaming, most likely the bus can't fit a single
+       * transfer of this altsetting. Give the bandwidth back. */
+      if (isochronous) {
+        libusb_set_interface_alt_setting(strmh->devh->usb_devh,
+            strmh->stream_if->bInterfaceNumber, 0);
+        if (_uvc_is_bandwidth_error(ret, submit_errno))
+          ret = UVC_ERROR_NO_BANDWIDTH;
+      }
+      strmh->user_cb = NULL;
+      goto fail;
+    }
+
     ret = UVC_SUCCESS;
   }
 
+started:
+  /* If the user wants it, set up a thread that calls the user's function
+   * with the contents of each frame.
+   */
+  if (cb) {
+    pthread_create(&strmh->cb_thread, NULL, _uvc_user_caller, (void*) strmh);
+  }
+
   UVC_EXIT(ret);
   return ret;
 fail:
   strmh->running = 0;
+  _uvc_record_stop(strmh);
+  _uvc_free_transfer_arrays(strmh);
+  if (strmh->pool)
+    _uvc_stream_close_pool(strmh);
   UVC_EXIT(ret);
   return ret;
 }
@@ -1296,12 +2294,12 @@ uvc_error_t uvc_stream_start_iso(
 void *_uvc_user_caller(void *arg) {
   uvc_stream_handle_t *strmh = (uvc_stream_handle_t *) arg;
 
-  uint32_t last_seq = 0;
+  struct uvc_frame_buffer *buf;
 
   do {
     pthread_mutex_lock(&strmh->cb_mutex);
 
-    while (strmh->running && last_seq == strmh->hold_seq) {
+    while (strmh->running && strmh->ring_count == 0) {
       pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
     }
 
@@ -1309,13 +2307,23 @@ void *_uvc_user_caller(void *arg) {
       pthread_mutex_unlock(&strmh->cb_mutex);
       break;
     }
-    
-    last_seq = strmh->hold_seq;
-    _uvc_populate_frame(strmh);
-    
+
+    buf = _uvc_ring_pop(strmh);
+
     pthread_mutex_unlock(&strmh->cb_mutex);
-    
+
+    _uvc_populate_frame(strmh, buf);
+
     strmh->user_cb(&strmh->frame, strmh->user_ptr);
+
+    /* A lent buffer goes back to the pool unless the callback held it */
+    if (strmh->frame.buffer) {
+      uvc_release_frame_buffer(strmh->frame.buffer);
+      strmh->frame.buffer = NULL;
+      strmh->frame.data = NULL;
+      strmh->frame.data_bytes = 0;
+      strmh->frame.library_owns_data = 1;
+    }
   } while(1);
 
   return NULL; // return value ignored
@@ -1323,9 +2331,11 @@ void *_uvc_user_caller(void *arg) {
 
 /** @internal
  * @brief Populate the fields of a frame to be handed to user code
- * must be called with stream cb lock held!
+ *
+ * Takes over the buffer popped from the ring: it is lent to the frame of a
+ * zero-copy stream, otherwise copied into the frame and released.
  */
-void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
+void _uvc_populate_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *buf) {
   uvc_frame_t *frame = &strmh->frame;
   uvc_frame_desc_t *frame_desc;
 
@@ -1338,53 +2348,125 @@ void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
 				   strmh->cur_ctrl.bFrameIndex);
 
   frame->frame_format = strmh->frame_format;
-  
+
+  frame->still = 0;
   frame->width = frame_desc->wWidth;
   frame->height = frame_desc->wHeight;
-  
-  switch (frame->frame_format) {
-  case UVC_FRAME_FORMAT_BGR:
-    frame->step = frame->width * 3;
-    break;
-  case UVC_FRAME_FORMAT_YUYV:
-    frame->step = frame->width * 2;
-    break;
-  case UVC_FRAME_FORMAT_NV12:
-    frame->step = frame->width;
-    break;
-  case UVC_FRAME_FORMAT_P010:
-    frame->step = frame->width * 2;
-        break;
-  case UVC_FRAME_FORMAT_MJPEG:
-    frame->step = 0;
-    break;
-  case UVC_FRAME_FORMAT_H264:
-    frame->step = 0;
-    break;
-  default:
-    frame->step = 0;
-    break;
-  }
 
-  frame->sequence = strmh->hold_seq;
-  frame->capture_time_finished = strmh->capture_time_finished;
+  frame->step = _uvc_frame_step(frame->frame_format, frame->width);
 
-  /* copy the image data from the hold buffer to the frame (unnecessary extra buf?) */
-  if (frame->data_bytes < strmh->hold_bytes) {
-    frame->data = realloc(frame->data, strmh->hold_bytes);
+  frame->sequence = buf->seq;
+  frame->capture_time_finished = buf->capture_time_finished;
+  frame->pts = buf->pts;
+  frame->scr = buf->scr;
+  frame->scr_sof = buf->scr_sof;
+  frame->scr_time = buf->scr_time;
+
+  if (strmh->devh->tracing) {
+    frame->transfer_time = buf->transfer_time;
+    (void)clock_gettime(CLOCK_MONOTONIC, &frame->callback_time);
+  } else {
+    memset(&frame->transfer_time, 0, sizeof(frame->transfer_time));
+    memset(&frame->callback_time, 0, sizeof(frame->callback_time));
   }
-  frame->data_bytes = strmh->hold_bytes;
-  memcpy(frame->data, strmh->holdbuf, frame->data_bytes);
 
-  if (strmh->meta_hold_bytes > 0)
+  if (buf->meta_bytes > 0)
   {
-      if (frame->metadata_bytes < strmh->meta_hold_bytes)
+      if (frame->metadata_bytes < buf->meta_bytes)
       {
-          frame->metadata = realloc(frame->metadata, strmh->meta_hold_bytes);
+          frame->metadata = realloc(frame->metadata, buf->meta_bytes);
       }
-      frame->metadata_bytes = strmh->meta_hold_bytes;
-      memcpy(frame->metadata, strmh->meta_holdbuf, frame->metadata_bytes);
+      frame->metadata_bytes = buf->meta_bytes;
+      memcpy(frame->metadata, buf->meta, frame->metadata_bytes);
   }
+
+  if (strmh->zero_copy) {
+    /* lend the assembled buffer, released after the callback returns */
+    frame->buffer = buf;
+    frame->data = buf->data;
+    frame->data_bytes = buf->bytes;
+    frame->library_owns_data = 0;
+  } else {
+    if (frame->data_bytes < buf->bytes) {
+      frame->data = realloc(frame->data, buf->bytes);
+    }
+    frame->data_bytes = buf->bytes;
+    memcpy(frame->data, buf->data, frame->data_bytes);
+    uvc_release_frame_buffer(buf);
+  }
+}
+
+/** Set how many completed frames a stream queues for its consumer.
+ * @ingroup streaming
+ *
+ * Frames the consumer doesn't pick up in time pile up in the ring. Once
+ * it is full, UVC_RING_LATEST replaces the oldest queued frame with the
+ * new one, UVC_RING_BLOCKING keeps the queue and drops the new frame
+ * instead, the camera can't be held up.
+ *
+ * @param strmh UVC stream handle, must not be streaming
+ * @param depth Number of frames, 1 to LIBUVC_MAX_FRAME_RING
+ * @param policy What to give up when the ring is full
+ */
+uvc_error_t uvc_stream_set_ring(uvc_stream_handle_t *strmh, int depth,
+    enum uvc_ring_policy policy) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (depth < 1 || depth > LIBUVC_MAX_FRAME_RING)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (policy != UVC_RING_LATEST && policy != UVC_RING_BLOCKING)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh->ring_size = depth;
+  strmh->ring_policy = policy;
+
+  return UVC_SUCCESS;
+}
+
+/** Set how many frame buffers the callback of a zero-copy stream holds
+ * on to at most.
+ * @ingroup streaming
+ *
+ * Every frame held with uvc_hold_frame_buffer() past its callback keeps a
+ * buffer out of the stream's rotation, the stream gets that many extra
+ * buffers for them. They are allocated when first held, a consumer that
+ * keeps up never costs more than the stream itself. A frame that finds
+ * all buffers held is dropped.
+ *
+ * @param strmh UVC stream handle, must not be streaming
+ * @param count Buffers held at once, 0 to LIBUVC_MAX_HELD_BUFS. The
+ * default is LIBUVC_NUM_HELD_BUFS.
+ */
+uvc_error_t uvc_stream_set_held_buffers(uvc_stream_handle_t *strmh,
+    int count) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (count < 0 || count > LIBUVC_MAX_HELD_BUFS)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh->held_bufs = count;
+
+  return UVC_SUCCESS;
+}
+
+/** Get the frame counters of a stream since it was started.
+ * @ingroup streaming
+ *
+ * @param strmh UVC stream handle
+ * @param[out] stats Completed, overwritten, dropped and queued frames
+ */
+void uvc_stream_get_stats(uvc_stream_handle_t *strmh, uvc_stream_stats_t *stats) {
+  pthread_mutex_lock(&strmh->cb_mutex);
+
+  stats->frames = strmh->frames_completed;
+  stats->overwritten = strmh->frames_overwritten;
+  stats->dropped = strmh->frames_dropped;
+  stats->queued = strmh->ring_count;
+
+  pthread_mutex_unlock(&strmh->cb_mutex);
 }
 
 /** Poll for a frame
@@ -1409,10 +2491,9 @@ uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
 
   pthread_mutex_lock(&strmh->cb_mutex);
 
-  if (strmh->last_polled_seq < strmh->hold_seq) {
-    _uvc_populate_frame(strmh);
+  if (strmh->ring_count > 0) {
+    _uvc_populate_frame(strmh, _uvc_ring_pop(strmh));
     *frame = &strmh->frame;
-    strmh->last_polled_seq = strmh->hold_seq;
   } else if (timeout_us != -1) {
     if (timeout_us == 0) {
       pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
@@ -1451,10 +2532,9 @@ uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
       }
     }
     
-    if (strmh->last_polled_seq < strmh->hold_seq) {
-      _uvc_populate_frame(strmh);
+    if (strmh->ring_count > 0) {
+      _uvc_populate_frame(strmh, _uvc_ring_pop(strmh));
       *frame = &strmh->frame;
-      strmh->last_polled_seq = strmh->hold_seq;
     } else {
       *frame = NULL;
     }
@@ -1503,25 +2583,34 @@ uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
    *   necessarily completed but they will be free'd in _uvc_stream_callback().
    */
 #ifndef __HAIKU__
-  for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+  for(i=0; i < strmh->num_transfers; i++) {
     if(strmh->transfers[i] != NULL)
       libusb_cancel_transfer(strmh->transfers[i]);
   }
 #endif
   /* Wait for transfers to complete/cancel */
   do {
-    for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    for(i=0; i < strmh->num_transfers; i++) {
       if(strmh->transfers[i] != NULL)
         break;
     }
-    if(i == LIBUVC_NUM_TRANSFER_BUFS )
+    if(i == strmh->num_transfers )
       break;
     pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
   } while(1);
+  _uvc_free_transfer_arrays(strmh);
+  /* No more payloads, a still coming in is lost */
+  _uvc_free_still(strmh);
   // Kick the user thread awake
   pthread_cond_broadcast(&strmh->cb_cond);
   pthread_mutex_unlock(&strmh->cb_mutex);
 
+  if (strmh->devh->replay)
+    _uvc_replay_stop(strmh);
+
+  /* No more payloads, the recording is complete */
+  _uvc_record_stop(strmh);
+
   /** @todo stop the actual stream, camera side? */
 
   if (strmh->user_cb) {
@@ -1530,6 +2619,10 @@ uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
     pthread_join(strmh->cb_thread, NULL);
   }
 
+  /* buffers the user still holds keep the pool alive */
+  if (strmh->pool)
+    _uvc_stream_close_pool(strmh);
+
   return UVC_SUCCESS;
 }
 
@@ -1549,11 +2642,7 @@ void uvc_stream_close(uvc_stream_handle_t *strmh) {
   if (strmh->frame.data)
     free(strmh->frame.data);
 
-  free(strmh->outbuf);
-  free(strmh->holdbuf);
-
-  free(strmh->meta_outbuf);
-  free(strmh->meta_holdbuf);
+  uvc_stream_record(strmh, NULL);
 
   pthread_cond_destroy(&strmh->cb_cond);
   pthread_mutex_destroy(&strmh->cb_mutex);
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Compares the YUYV to B_RGB32 conversion ColorConverter picked for this
+// CPU with the scalar IYUYV2BGR macros it replaced. The output of both is
+// checked to be identical for every Y, U and V combination first, then
+// each is timed on frames of the usual sizes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <OS.h>
+
+#include "ColorConverter.h"
+
+static const bigtime_t kMinRunTime = 500000;
+
+struct FrameSize {
+	uint32		width;
+	uint32		height;
+};
+
+static const FrameSize kSizes[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 3840, 2160 }
+};
+
+// What HandleFrame() did before, 8 pixels per step and pairs for the rest
+static void
+convert_scalar(const uint8* src, uint8* dst, size_t srcBytes)
+{
+	size_t i = 0;
+	for (; i + 16 <= srcBytes; i += 16, src += 16, dst += 32) {
+		IYUYV2BGR_8(src, dst);
+	}
+	for (; i + 4 <= srcBytes; i += 4, src += 4, dst += 8) {
+		IYUYV2BGR_2(src, dst);
+	}
+}
+
+static bool
+check_all_values()
+{
+	// For every U, all V and a pair of every Y, with three pairs at the
+	// end that don't fill a vector so the tail handling runs as well
+	const size_t pairs = 256 * 128;
+	const size_t srcBytes = pairs * 4 + 12;
+	uint8* src = (uint8*)malloc(srcBytes);
+	uint8* expected = (uint8*)malloc(srcBytes * 2);
+	uint8* result = (uint8*)malloc(srcBytes * 2);
+	if (src == NULL || expected == NULL || result == NULL) {
+		printf("FAIL: out of memory\n");
+		return false;
+	}
+
+	bool identical = true;
+	for (int u = 0; u < 256 && identical; u++) {
+		uint8* pair = src;
+		for (int v = 0; v < 256; v++) {
+			for (int y = 0; y < 256; y += 2) {
+				pair[0] = y;
+				pair[1] = u;
+				pair[2] = y + 1;
+				pair[3] = v;
+				pair += 4;
+			}
+		}
+		for (size_t i = pairs * 4; i < srcBytes; i++)
+			src[i] = (uint8)(i * 37 + u);
+
+		memset(expected, 0, srcBytes * 2);
+		memset(result, 0, srcBytes * 2);
+		convert_scalar(src, expected, srcBytes);
+		ColorConverter::YUYVToBGRA(src, result, srcBytes);
+
+		if (memcmp(expected, result, srcBytes * 2) != 0) {
+			for (size_t i = 0; i < srcBytes * 2; i++) {
+				if (expected[i] != result[i]) {
+					printf("FAIL: U %d, byte %zu is %d instead of %d\n", u, i,
+						result[i], expected[i]);
+					break;
+				}
+			}
+			identical = false;
+		}
+	}
+
+	free(src);
+	free(expected);
+	free(result);
+
+	printf("%s: %s output is identical to the macros for all values\n",
+		identical ? "ok  " : "FAIL", ColorConverter::YUYVToBGRAName());
+	return identical;
+}
+
+static bigtime_t
+time_conversion(ColorConverter::convert_func convert, const uint8* src,
+	uint8* dst, size_t srcBytes, int32* frames)
+{
+	// Once to fault the pages in, then for as long as it takes
+	convert(src, dst, srcBytes);
+
+	int32 count = 0;
+	bigtime_t start = system_time();
+	bigtime_t elapsed;
+	do {
+		convert(src, dst, srcBytes);
+		count++;
+		elapsed = system_time() - start;
+	} while (elapsed < kMinRunTime);
+
+	*frames = count;
+	return elapsed;
+}
+
+int
+main(int argc, char** argv)
+{
+	if (!check_all_values())
+		return 1;
+
+	printf("\n%11s  %18s  %18s  %7s\n", "frame", "scalar",
+		ColorConverter::YUYVToBGRAName(), "speedup");
+
+	for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+		uint32 width = kSizes[i].width;
+		uint32 height = kSizes[i].height;
+		size_t srcBytes = (size_t)width * height * 2;
+
+		uint8* src = (uint8*)malloc(srcBytes);
+		uint8* dst = (uint8*)malloc(srcBytes * 2);
+		if (src == NULL || dst == NULL) {
+			printf("out of memory\n");
+			return 1;
+		}
+
+		srand(width * height);
+		for (size_t j = 0; j < srcBytes; j++)
+			src[j] = rand();
+
+		int32 scalarFrames;
+		bigtime_t scalarTime = time_conversion(convert_scalar, src, dst,
+			srcBytes, &scalarFrames);
+		int32 simdFrames;
+		bigtime_t simdTime = time_conversion(ColorConverter::YUYVToBGRA, src,
+			dst, srcBytes, &simdFrames);
+
+		double scalarPerFrame = (double)scalarTime / scalarFrames;
+		double simdPerFrame = (double)simdTime / simdFrames;
+
+		char name[32];
+		snprintf(name, sizeof(name), "%" B_PRIu32 "x%" B_PRIu32, width,
+			height);
+		printf("%11s  %7.3f ms %6.0f fps  %7.3f ms %6.0f fps  %6.2fx\n", name,
+			scalarPerFrame / 1000, 1000000 / scalarPerFrame,
+			simdPerFrame / 1000, 1000000 / simdPerFrame,
+			scalarPerFrame / simdPerFrame);
+
+		free(src);
+		free(dst);
+	}
+
+	return 0;
+}
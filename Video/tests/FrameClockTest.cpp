@@ -0,0 +1,250 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Unit tests of FrameClock. Every frame of 24 hours at the usual rates is
+// compared to the exact time of the rational rate, no frame may be off by
+// more than the rounding to a microsecond and the error must not grow.
+
+#include <stdio.h>
+
+#include <SupportDefs.h>
+
+#include "FrameClock.h"
+
+static const uint64 kDay = 24 * 60 * 60;
+
+static int32 sFailures = 0;
+
+#define CHECK(condition, ...) \
+	do { \
+		if (!(condition)) { \
+			printf("FAIL: %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			sFailures++; \
+		} \
+	} while (false)
+
+struct Rate {
+	uint32		numerator;
+	uint32		denominator;
+	const char*	name;
+};
+
+static const Rate kRates[] = {
+	{ 24000, 1001, "23.976" },
+	{ 24, 1, "24" },
+	{ 25, 1, "25" },
+	{ 30000, 1001, "29.97" },
+	{ 30, 1, "30" },
+	{ 50, 1, "50" },
+	{ 60000, 1001, "59.94" },
+	{ 60, 1, "60" },
+	{ 15, 2, "7.5" },
+	{ 120, 1, "120" }
+};
+
+// Exact time of a frame in microseconds, rounded half up like FrameClock
+static int64
+exact_time(uint64 frames, uint32 numerator, uint32 denominator)
+{
+	unsigned __int128 product = (unsigned __int128)frames * 1000000
+		* denominator;
+	return (int64)((product + numerator / 2) / numerator);
+}
+
+static void
+report(const char* name, int32 failuresBefore)
+{
+	printf("%s: %s\n", sFailures == failuresBefore ? "ok  " : "FAIL", name);
+}
+
+static void
+test_day_without_drift()
+{
+	const bigtime_t base = 123456789;
+
+	for (size_t i = 0; i < sizeof(kRates) / sizeof(kRates[0]); i++) {
+		const Rate& rate = kRates[i];
+		FrameClock clock;
+		clock.SetRate(rate.numerator, rate.denominator);
+		clock.SetBase(base, 0);
+
+		// Frames shown in a day, the last one within a frame of 24 h
+		uint64 frames = kDay * rate.numerator / rate.denominator;
+		int64 minStep = 1000000LL * rate.denominator / rate.numerator;
+		int64 maxStep = minStep + 1;
+
+		int32 wrong = 0;
+		bigtime_t previous = clock.TimeFor(0);
+		CHECK(previous == base, "%s fps: frame 0 at %" B_PRIdBIGTIME,
+			rate.name, previous);
+
+		for (uint64 frame = 1; frame <= frames; frame++) {
+			bigtime_t time = clock.TimeFor((uint32)frame);
+			if (time - base != exact_time(frame, rate.numerator,
+					rate.denominator)) {
+				if (wrong++ == 0) {
+					CHECK(false, "%s fps: frame %" B_PRIu64 " at +%"
+						B_PRIdBIGTIME " instead of +%" B_PRId64, rate.name,
+						frame, time - base, exact_time(frame, rate.numerator,
+							rate.denominator));
+				}
+			}
+
+			bigtime_t step = time - previous;
+			if (step < minStep || step > maxStep) {
+				if (wrong++ == 0) {
+					CHECK(false, "%s fps: frame %" B_PRIu64 " came %"
+						B_PRIdBIGTIME " us after the one before", rate.name,
+						frame, step);
+				}
+			}
+			previous = time;
+		}
+
+		// The real time of the last frame, not only the reference above
+		double real = (double)frames * 1000000.0 * rate.denominator
+			/ rate.numerator;
+		double drift = (double)(previous - base) - real;
+		CHECK(drift > -0.5 && drift <= 0.5,
+			"%s fps: last frame of the day off by %.3f us", rate.name, drift);
+
+		// What the old per frame truncation used to do
+		bigtime_t oldPeriod = (bigtime_t)(1000000 / ((double)rate.numerator
+			/ rate.denominator));
+		double oldDrift = (double)frames * oldPeriod - real;
+
+		printf("%s: %6s fps, %7" B_PRIu64 " frames, drift after 24 h "
+			"%+.3f us (truncated periods: %+.0f us)\n",
+			wrong == 0 ? "ok  " : "FAIL", rate.name, frames, drift, oldDrift);
+	}
+}
+
+static void
+test_set_rate_from_float()
+{
+	int32 failures = sFailures;
+
+	struct {
+		float	rate;
+		uint32	numerator;
+		uint32	denominator;
+	} cases[] = {
+		{ 23.976f, 24000, 1001 },
+		{ 29.97f, 30000, 1001 },
+		{ 59.94f, 60000, 1001 },
+		{ 119.88f, 120000, 1001 },
+		{ 30.0f, 30, 1 },
+		{ 25.0f, 25, 1 },
+		{ 7.5f, 15, 2 },
+		{ 12.5f, 25, 2 },
+		{ 0.5f, 1, 2 },
+		{ 0.0f, 0, 1 },
+		{ -30.0f, 0, 1 }
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		FrameClock clock;
+		clock.SetRate(cases[i].rate);
+		CHECK(clock.RateNumerator() == cases[i].numerator
+			&& clock.RateDenominator() == cases[i].denominator,
+			"%g fps became %" B_PRIu32 "/%" B_PRIu32 " instead of %" B_PRIu32
+			"/%" B_PRIu32, cases[i].rate, clock.RateNumerator(),
+			clock.RateDenominator(), cases[i].numerator, cases[i].denominator);
+	}
+
+	FrameClock clock;
+	clock.SetRate(60, 2);
+	CHECK(clock.RateNumerator() == 30 && clock.RateDenominator() == 1,
+		"60/2 isn't reduced to 30/1");
+
+	report("rates from floats and fractions", failures);
+}
+
+static void
+test_rebase()
+{
+	int32 failures = sFailures;
+
+	FrameClock clock;
+	clock.SetRate(30, 1);
+	clock.SetBase(1000000, 10);
+
+	// A rate change continues from where the old rate got to
+	clock.Rebase(40);
+	CHECK(clock.TimeFor(40) == 2000000, "frame 40 at %" B_PRIdBIGTIME,
+		clock.TimeFor(40));
+
+	clock.SetRate(25, 1);
+	CHECK(clock.TimeFor(65) == 3000000, "frame 65 at %" B_PRIdBIGTIME
+		" after the rate change", clock.TimeFor(65));
+
+	// Frames before the base count back from it
+	CHECK(clock.TimeFor(15) == 1000000, "frame 15 at %" B_PRIdBIGTIME,
+		clock.TimeFor(15));
+
+	// A stopped clock stays at its base
+	clock.SetRate(0.0f);
+	CHECK(clock.TimeFor(1000) == 2000000 && clock.FramePeriod() == 0,
+		"a stopped clock moves");
+
+	report("rebase, rate changes and frames before the base", failures);
+}
+
+static void
+test_extremes()
+{
+	int32 failures = sFailures;
+
+	// Frame numbers near the end of the uint32 range
+	FrameClock clock;
+	clock.SetRate(30000, 1001);
+	clock.SetBase(0, 0xfffff000);
+	CHECK(clock.TimeFor(0xffffffff) == exact_time(0xfff, 30000, 1001),
+		"frames near the uint32 limit at %" B_PRIdBIGTIME,
+		clock.TimeFor(0xffffffff));
+
+	// A whole uint32 range of frames at a high rate with a large
+	// denominator, nothing may overflow
+	clock.SetRate(4000000000U, 3999999999U);
+	clock.SetBase(0, 0);
+	bigtime_t time = clock.TimeFor(0xffffffff);
+	int64 exact = exact_time(0xffffffff, 4000000000U, 3999999999U);
+	CHECK(time == exact, "4294967295 frames at 4000000000/3999999999 fps at %"
+		B_PRIdBIGTIME " instead of %" B_PRId64, time, exact);
+
+	// One frame every 1000 seconds
+	clock.SetRate(1, 1000);
+	CHECK(clock.TimeFor(100000) == 100000000000000LL,
+		"frame 100000 at 1/1000 fps at %" B_PRIdBIGTIME,
+		clock.TimeFor(100000));
+	CHECK(clock.FramePeriod() == 1000000000LL, "period of 1/1000 fps is %"
+		B_PRIdBIGTIME, clock.FramePeriod());
+
+	clock.SetRate(30000, 1001);
+	CHECK(clock.FramePeriod() == 33367, "period of 29.97 fps is %"
+		B_PRIdBIGTIME, clock.FramePeriod());
+
+	report("frame numbers and rates at the limits", failures);
+}
+
+int
+main(int argc, char** argv)
+{
+	test_day_without_drift();
+	test_set_rate_from_float();
+	test_rebase();
+	test_extremes();
+
+	if (sFailures != 0) {
+		printf("FrameClock tests FAILED, %" B_PRId32 " failures\n", sFailures);
+		return 1;
+	}
+
+	printf("All FrameClock tests passed\n");
+	return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Load test of a rig of cameras streaming at once, without any cameras.
+// Each camera is a replay device playing a generated MJPEG recording at
+// the pace it was recorded, like a camera sends its payloads. The frames
+// take the path they take in the add-on: libuvc frame assembly, a
+// FrameQueue and a decode thread per camera, and ParallelJpegDecoders
+// that all share one DecodePool. Reports fps, dropped frames and CPU time
+// per camera and for all of them.
+//
+//   MultiCameraLoadTest [cameras [WIDTHxHEIGHT [fps [seconds]]]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <OS.h>
+
+#include <libuvc/libuvc.h>
+
+#include "DecodePool.h"
+#include "FrameQueue.h"
+#include "ParallelJpegDecoder.h"
+#include "SampleRecording.h"
+
+// Frames of the recording, played in a loop
+static const uint32 kRecordedFrames = 30;
+static const bigtime_t kWarmUp = 1000000;
+
+struct Camera {
+							Camera(DecodePool* pool);
+							~Camera();
+
+	uvc_device_handle_t*	device;
+	uvc_stream_handle_t*	stream;
+	FrameQueue				queue;
+	ParallelJpegDecoder		decoder;
+	uint8*					buffer;
+	uint32					width;
+	uint32					height;
+	thread_id				decodeThread;
+
+	int32					frames;
+	int32					errors;
+	// CPU time of the callback and decode thread so far
+	int64					callbackTime;
+	int64					decodeTime;
+};
+
+struct Snapshot {
+	int32					frames;
+	uint32					dropped;
+	bigtime_t				callbackTime;
+	bigtime_t				decodeTime;
+};
+
+Camera::Camera(DecodePool* pool)
+	: device(NULL)
+	, stream(NULL)
+	, queue(2)
+	, decoder(pool)
+	, buffer(NULL)
+	, width(0)
+	, height(0)
+	, decodeThread(-1)
+	, frames(0)
+	, errors(0)
+	, callbackTime(0)
+	, decodeTime(0)
+{
+}
+
+Camera::~Camera()
+{
+	if (stream != NULL)
+		uvc_stream_close(stream);
+	queue.Close();
+	if (decodeThread >= B_OK)
+		wait_for_thread(decodeThread, &decodeThread);
+	if (device != NULL)
+		uvc_close(device);
+	free(buffer);
+}
+
+static bigtime_t
+cpu_time(clockid_t clock)
+{
+	struct timespec time;
+	clock_gettime(clock, &time);
+	return (bigtime_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static void
+frame_callback(uvc_frame_t* frame, void* data)
+{
+	// Like the add-on, only queue the frame on the libuvc thread
+	Camera* camera = (Camera*)data;
+	camera->queue.Push(frame);
+	atomic_set64(&camera->callbackTime, cpu_time(CLOCK_THREAD_CPUTIME_ID));
+}
+
+static int32
+decode_frames(void* data)
+{
+	Camera* camera = (Camera*)data;
+
+	uvc_frame_t* frame;
+	while ((frame = camera->queue.Pop()) != NULL) {
+		if (camera->decoder.Decode((const uint8*)frame->data,
+				frame->data_bytes, camera->buffer, camera->width,
+				camera->height, camera->width * 4) == B_OK)
+			atomic_add(&camera->frames, 1);
+		else
+			atomic_add(&camera->errors, 1);
+		camera->queue.Recycle(frame);
+		atomic_set64(&camera->decodeTime, cpu_time(CLOCK_THREAD_CPUTIME_ID));
+	}
+
+	return B_OK;
+}
+
+static status_t
+start_camera(Camera* camera, const char* recording, uint32 width,
+	uint32 height, uint32 fps)
+{
+	camera->width = width;
+	camera->height = height;
+	camera->buffer = (uint8*)malloc((size_t)width * height * 4);
+	if (camera->buffer == NULL)
+		return B_NO_MEMORY;
+
+	if (camera->decoder.InitCheck() != B_OK || camera->queue.Open() != B_OK)
+		return B_ERROR;
+
+	uvc_error_t res = uvc_replay_open(recording, UVC_REPLAY_LOOP,
+		&camera->device);
+	if (res < 0) {
+		printf("can't open %s: %s\n", recording, uvc_strerror(res));
+		return B_ERROR;
+	}
+
+	uvc_stream_ctrl_t control;
+	res = uvc_get_stream_ctrl_format_size(camera->device, &control,
+		UVC_FRAME_FORMAT_MJPEG, width, height, fps);
+	if (res >= 0)
+		res = uvc_stream_open_ctrl(camera->device, &camera->stream, &control);
+	if (res < 0) {
+		printf("can't open a stream: %s\n", uvc_strerror(res));
+		return B_ERROR;
+	}
+
+	camera->decodeThread = spawn_thread(decode_frames, "frame decoder",
+		B_NORMAL_PRIORITY, camera);
+	if (camera->decodeThread < B_OK)
+		return camera->decodeThread;
+	resume_thread(camera->decodeThread);
+
+	// As the add-on sets up its streams
+	uvc_stream_set_ring(camera->stream, 2, UVC_RING_LATEST);
+	uvc_stream_set_held_buffers(camera->stream, camera->queue.CountSlots());
+
+	res = uvc_stream_start(camera->stream, frame_callback, camera,
+		UVC_STREAM_ZERO_COPY);
+	if (res < 0) {
+		printf("can't start streaming: %s\n", uvc_strerror(res));
+		return B_ERROR;
+	}
+
+	return B_OK;
+}
+
+static void
+take_snapshot(Camera* camera, Snapshot& snapshot)
+{
+	snapshot.frames = atomic_get(&camera->frames);
+	snapshot.dropped = camera->queue.Dropped();
+	snapshot.callbackTime = atomic_get64(&camera->callbackTime);
+	snapshot.decodeTime = atomic_get64(&camera->decodeTime);
+}
+
+static bool
+parse_size(const char* arg, uint32* width, uint32* height)
+{
+	return sscanf(arg, "%" B_SCNu32 "x%" B_SCNu32, width, height) == 2
+		&& *width > 0 && *height > 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int32 count = 4;
+	uint32 width = 1280;
+	uint32 height = 720;
+	uint32 fps = 30;
+	int32 seconds = 5;
+
+	if ((argc > 1 && (count = atoi(argv[1])) <= 0)
+		|| (argc > 2 && !parse_size(argv[2], &width, &height))
+		|| (argc > 3 && (fps = atoi(argv[3])) == 0)
+		|| (argc > 4 && (seconds = atoi(argv[4])) <= 0)) {
+		printf("usage: %s [cameras [WIDTHxHEIGHT [fps [seconds]]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	char recording[64];
+	snprintf(recording, sizeof(recording), "/tmp/uvc-load-test-%d.uvcrec",
+		(int)getpid());
+	if (create_sample_recording(recording, width, height, fps,
+			kRecordedFrames, true) != B_OK) {
+		printf("can't write the recording %s\n", recording);
+		return 1;
+	}
+
+	DecodePool pool;
+	if (pool.InitCheck() != B_OK) {
+		printf("can't start the decode threads\n");
+		remove(recording);
+		return 1;
+	}
+
+	system_info info;
+	get_system_info(&info);
+	printf("%" B_PRId32 " cameras, %" B_PRIu32 "x%" B_PRIu32 " MJPEG at %"
+		B_PRIu32 " fps, %" B_PRIu32 " CPUs, %" B_PRId32 " shared decode "
+		"threads\n", count, width, height, fps, info.cpu_count,
+		pool.CountThreads());
+
+	Camera** cameras = new Camera*[count];
+	bool passed = true;
+	for (int32 i = 0; i < count; i++) {
+		cameras[i] = new Camera(&pool);
+		if (passed && start_camera(cameras[i], recording, width, height, fps)
+				!= B_OK) {
+			printf("camera %" B_PRId32 " doesn't stream\n", i + 1);
+			passed = false;
+		}
+	}
+
+	// Each replay opened its own handle on the file
+	remove(recording);
+
+	Snapshot* start = new Snapshot[count];
+	Snapshot* end = new Snapshot[count];
+	bigtime_t processStart = 0;
+	bigtime_t processEnd = 0;
+	bigtime_t elapsed = 0;
+
+	if (passed) {
+		snooze(kWarmUp);
+
+		bigtime_t startTime = system_time();
+		processStart = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+		for (int32 i = 0; i < count; i++)
+			take_snapshot(cameras[i], start[i]);
+
+		snooze((bigtime_t)seconds * 1000000);
+
+		for (int32 i = 0; i < count; i++)
+			take_snapshot(cameras[i], end[i]);
+		processEnd = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+		elapsed = system_time() - startTime;
+	}
+
+	for (int32 i = 0; i < count; i++) {
+		if (cameras[i]->stream != NULL)
+			uvc_stream_stop(cameras[i]->stream);
+	}
+
+	if (passed) {
+		printf("\n  camera   frames      fps  dropped  callback CPU  "
+			"decode CPU\n");
+
+		int32 totalFrames = 0;
+		uint32 totalDropped = 0;
+		bigtime_t totalTime = 0;
+		for (int32 i = 0; i < count; i++) {
+			int32 frames = end[i].frames - start[i].frames;
+			uint32 dropped = end[i].dropped - start[i].dropped;
+			bigtime_t callback = end[i].callbackTime - start[i].callbackTime;
+			bigtime_t decode = end[i].decodeTime - start[i].decodeTime;
+
+			printf("  %6" B_PRId32 "  %7" B_PRId32 "  %7.1f  %7" B_PRIu32
+				"  %10.1f %%  %8.1f %%\n", i + 1, frames,
+				frames * 1000000.0 / elapsed, dropped,
+				callback * 100.0 / elapsed, decode * 100.0 / elapsed);
+
+			if (frames == 0 || cameras[i]->errors > 0) {
+				printf("  camera %" B_PRId32 " decoded %" B_PRId32 " frames, "
+					"%" B_PRId32 " failed\n", i + 1, frames,
+					cameras[i]->errors);
+				passed = false;
+			}
+
+			totalFrames += frames;
+			totalDropped += dropped;
+			totalTime += callback + decode;
+		}
+
+		bigtime_t process = processEnd - processStart;
+		printf("   total  %7" B_PRId32 "  %7.1f  %7" B_PRIu32 "\n\n",
+			totalFrames, totalFrames * 1000000.0 / elapsed, totalDropped);
+		printf("CPU of the process %.1f %%, shared decode threads and "
+			"payload replay %.1f %%\n",
+			process * 100.0 / elapsed, (process - totalTime) * 100.0 / elapsed);
+	}
+
+	for (int32 i = 0; i < count; i++)
+		delete cameras[i];
+	delete[] cameras;
+	delete[] start;
+	delete[] end;
+
+	return passed ? 0 : 1;
+}
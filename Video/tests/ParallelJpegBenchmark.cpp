@@ -0,0 +1,201 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Measures MJPEG decoding fps against the number of threads. Each sample
+// is decoded by JpegDecoder alone and by ParallelJpegDecoder on pools of
+// 2 to 8 threads, and the parallel output is compared to the single pass.
+// Without arguments it uses generated 1080p and 4K frames with a restart
+// marker per MCU row, and a 1080p frame without restart markers that has
+// to fall back to one thread. JPEG files given as arguments, frames
+// grabbed from a camera for example, are measured as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <OS.h>
+
+#include <jpeglib.h>
+
+#include "DecodePool.h"
+#include "JpegDecoder.h"
+#include "ParallelJpegDecoder.h"
+#include "SampleJpeg.h"
+
+static const bigtime_t kMinRunTime = 1000000;
+static const int32 kMaxThreads = 8;
+
+struct Sample {
+	char		name[64];
+	uint8*		data;
+	size_t		size;
+	uint32		width;
+	uint32		height;
+};
+
+static bool
+read_size(Sample& sample)
+{
+	struct jpeg_decompress_struct info;
+	struct jpeg_error_mgr error;
+	info.err = jpeg_std_error(&error);
+	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, sample.data, sample.size);
+	bool valid = jpeg_read_header(&info, TRUE) == JPEG_HEADER_OK;
+	sample.width = info.image_width;
+	sample.height = info.image_height;
+	jpeg_destroy_decompress(&info);
+	return valid && sample.width > 0 && sample.height > 0;
+}
+
+static bool
+load_file(const char* path, Sample& sample)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	sample.data = (uint8*)malloc(size > 0 ? size : 1);
+	sample.size = size > 0 ? (size_t)size : 0;
+	bool loaded = sample.data != NULL
+		&& fread(sample.data, 1, sample.size, file) == sample.size;
+	fclose(file);
+
+	const char* name = strrchr(path, '/');
+	snprintf(sample.name, sizeof(sample.name), "%s", name ? name + 1 : path);
+	return loaded && read_size(sample);
+}
+
+static bool
+generate(uint32 width, uint32 height, bool restartMarkers, Sample& sample)
+{
+	if (create_sample_jpeg(width, height, 0, restartMarkers, &sample.data,
+			&sample.size) != B_OK)
+		return false;
+
+	snprintf(sample.name, sizeof(sample.name), "%" B_PRIu32 "x%" B_PRIu32
+		" 4:2:2%s", width, height, restartMarkers ? " RST" : "");
+	sample.width = width;
+	sample.height = height;
+	return true;
+}
+
+template<class Decoder>
+static double
+measure(Decoder& decoder, const Sample& sample, uint8* dest,
+	size_t bytesPerRow)
+{
+	if (decoder.Decode(sample.data, sample.size, dest, sample.width,
+			sample.height, bytesPerRow) != B_OK)
+		return -1;
+
+	int32 frames = 0;
+	bigtime_t start = system_time();
+	bigtime_t elapsed;
+	do {
+		decoder.Decode(sample.data, sample.size, dest, sample.width,
+			sample.height, bytesPerRow);
+		frames++;
+		elapsed = system_time() - start;
+	} while (elapsed < kMinRunTime);
+
+	return frames * 1000000.0 / elapsed;
+}
+
+static bool
+benchmark(const Sample& sample)
+{
+	size_t bytesPerRow = (size_t)sample.width * 4;
+	size_t size = bytesPerRow * sample.height;
+	uint8* reference = (uint8*)malloc(size);
+	uint8* dest = (uint8*)malloc(size);
+	if (reference == NULL || dest == NULL) {
+		printf("out of memory\n");
+		return false;
+	}
+
+	printf("\n%s, %zu bytes\n", sample.name, sample.size);
+	printf("  threads       fps   speedup  output\n");
+
+	JpegDecoder single;
+	double baseline = measure(single, sample, reference, bytesPerRow);
+	if (baseline < 0) {
+		printf("  can't decode the sample\n");
+		free(reference);
+		free(dest);
+		return false;
+	}
+	printf("  %7d  %8.1f  %7.2fx  reference\n", 1, baseline, 1.0);
+
+	bool passed = true;
+	for (int32 threads = 2; threads <= kMaxThreads; threads++) {
+		DecodePool pool(threads);
+		ParallelJpegDecoder decoder(&pool);
+		if (pool.InitCheck() != B_OK || decoder.InitCheck() != B_OK) {
+			printf("  can't start %" B_PRId32 " threads\n", threads);
+			passed = false;
+			break;
+		}
+
+		memset(dest, 0, size);
+		double fps = measure(decoder, sample, dest, bytesPerRow);
+
+		// Bands are cut at MCU rows, with 4:2:2 chroma nothing changes
+		size_t differing = 0;
+		for (size_t i = 0; i < size; i++) {
+			if (dest[i] != reference[i])
+				differing++;
+		}
+		if (fps < 0)
+			passed = false;
+
+		printf("  %7" B_PRId32 "  %8.1f  %7.2fx  %s\n", threads, fps,
+			fps / baseline, fps < 0 ? "failed"
+				: differing == 0 ? "identical" : "differs");
+	}
+
+	free(reference);
+	free(dest);
+	return passed;
+}
+
+int
+main(int argc, char** argv)
+{
+	system_info info;
+	get_system_info(&info);
+	printf("%" B_PRIu32 " CPUs, no gain is expected beyond that many "
+		"threads\n", info.cpu_count);
+
+	Sample samples[64];
+	int32 count = 0;
+	if (generate(1920, 1080, true, samples[count]))
+		count++;
+	if (generate(3840, 2160, true, samples[count]))
+		count++;
+	if (generate(1920, 1080, false, samples[count]))
+		count++;
+
+	for (int i = 1; i < argc && count < 64; i++) {
+		memset(&samples[count], 0, sizeof(Sample));
+		if (load_file(argv[i], samples[count]))
+			count++;
+		else
+			printf("%s isn't a JPEG file\n", argv[i]);
+	}
+
+	bool passed = true;
+	for (int32 i = 0; i < count; i++) {
+		passed &= benchmark(samples[i]);
+		free(samples[i].data);
+	}
+
+	return passed ? 0 : 1;
+}
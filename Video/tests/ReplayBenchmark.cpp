@@ -0,0 +1,320 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Throughput and latency of the UVC path from payload to decoded frame,
+// driven by payload recordings instead of a camera. Every recording is
+// played twice through libuvc's frame assembly and the decoder the add-on
+// uses for its format: once as fast as frames are decoded, for the
+// throughput, and once at the pace it was recorded, for the latency from
+// the payload that completed a frame to the frame being decoded.
+// Frames are decoded right in the stream callback so that at full speed
+// the replay waits for the decoder and no frame is dropped, the same
+// recording always gives the same frames.
+//
+// Without arguments generated 1280x720 and 1920x1080 MJPEG recordings are
+// used. Recordings the add-on made with "Record USB payloads" can be given
+// as arguments. H.264 frames are assembled but not decoded, the decoder
+// needs FFmpeg.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <OS.h>
+
+#include <libuvc/libuvc.h>
+
+#include "ColorConverter.h"
+#include "DecodePool.h"
+#include "ParallelJpegDecoder.h"
+#include "SampleRecording.h"
+
+static const uint32 kSampleFrames = 60;
+static const uint32 kSampleRate = 30;
+
+struct Pass {
+							Pass(DecodePool* pool);
+							~Pass();
+
+	ParallelJpegDecoder		decoder;
+	uint8*					buffer;
+	size_t					bufferSize;
+
+	int32					frames;
+	int32					errors;
+	int32					undecoded;
+	bigtime_t				decodeTime;
+	int64					lastFrame;
+
+	// From the payload that completed a frame, in microseconds
+	std::vector<bigtime_t>	callbackLatency;
+	std::vector<bigtime_t>	decodeLatency;
+};
+
+Pass::Pass(DecodePool* pool)
+	: decoder(pool)
+	, buffer(NULL)
+	, bufferSize(0)
+	, frames(0)
+	, errors(0)
+	, undecoded(0)
+	, decodeTime(0)
+	, lastFrame(0)
+{
+}
+
+Pass::~Pass()
+{
+	free(buffer);
+}
+
+static bigtime_t
+monotonic_time(const struct timespec& time)
+{
+	return (bigtime_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static bigtime_t
+monotonic_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return monotonic_time(now);
+}
+
+static void
+frame_callback(uvc_frame_t* frame, void* data)
+{
+	Pass* pass = (Pass*)data;
+
+	size_t bytesPerRow = (size_t)frame->width * 4;
+	if (bytesPerRow * frame->height > pass->bufferSize) {
+		pass->errors++;
+		return;
+	}
+
+	bigtime_t start = monotonic_now();
+	status_t status = B_OK;
+	if (frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+		status = pass->decoder.Decode((const uint8*)frame->data,
+			frame->data_bytes, pass->buffer, frame->width, frame->height,
+			bytesPerRow);
+	} else if (ColorConverter::IsSupported(frame->frame_format)) {
+		status = ColorConverter::Convert(frame, pass->buffer, frame->width,
+			frame->height, bytesPerRow, B_RGB32);
+	} else
+		pass->undecoded++;
+	bigtime_t end = monotonic_now();
+
+	if (status != B_OK)
+		pass->errors++;
+	pass->decodeTime += end - start;
+
+	if (frame->transfer_time.tv_sec != 0) {
+		bigtime_t transfer = monotonic_time(frame->transfer_time);
+		pass->callbackLatency.push_back(
+			monotonic_time(frame->callback_time) - transfer);
+		pass->decodeLatency.push_back(end - transfer);
+	}
+
+	atomic_set64(&pass->lastFrame, end);
+	atomic_add(&pass->frames, 1);
+}
+
+// Plays the recording once, returns the time from the start of the stream
+// to the last frame decoded
+static bigtime_t
+run_pass(const char* path, bool maxSpeed, Pass& pass)
+{
+	uvc_device_handle_t* device;
+	uvc_error_t res = uvc_replay_open(path,
+		maxSpeed ? UVC_REPLAY_MAX_SPEED : 0, &device);
+	if (res < 0) {
+		printf("  can't open the recording: %s\n", uvc_strerror(res));
+		return -1;
+	}
+
+	const uvc_format_desc_t* format = uvc_get_format_descs(device);
+	const uvc_frame_desc_t* frame = format->frame_descs;
+	pass.bufferSize = (size_t)frame->wWidth * frame->wHeight * 4;
+	pass.buffer = (uint8*)malloc(pass.bufferSize);
+
+	uvc_stream_ctrl_t control;
+	uvc_stream_handle_t* stream = NULL;
+	if (pass.buffer == NULL)
+		res = UVC_ERROR_NO_MEM;
+	if (res >= 0) {
+		res = uvc_get_stream_ctrl_format_size(device, &control,
+			UVC_FRAME_FORMAT_ANY, frame->wWidth, frame->wHeight, 0);
+	}
+	if (res >= 0)
+		res = uvc_stream_open_ctrl(device, &stream, &control);
+	if (res < 0) {
+		printf("  can't open a stream: %s\n", uvc_strerror(res));
+		uvc_close(device);
+		return -1;
+	}
+
+	// For the times of the transfers and the callback of every frame
+	uvc_set_tracing(device, !maxSpeed);
+
+	bigtime_t start = monotonic_now();
+	res = uvc_stream_start(stream, frame_callback, &pass, 0);
+	if (res < 0) {
+		printf("  can't start streaming: %s\n", uvc_strerror(res));
+		uvc_stream_close(stream);
+		uvc_close(device);
+		return -1;
+	}
+
+	// The stream runs on after the end of the recording, it's over once
+	// no frame came for a few frame intervals
+	bigtime_t quiet = max_c((bigtime_t)500000,
+		(bigtime_t)control.dwFrameInterval / 10 * 3);
+	int32 frames = -1;
+	bigtime_t lastChange = monotonic_now();
+	while (monotonic_now() - lastChange < quiet) {
+		snooze(10000);
+		int32 current = atomic_get(&pass.frames);
+		if (current != frames) {
+			frames = current;
+			lastChange = monotonic_now();
+		}
+	}
+
+	uvc_stream_close(stream);
+	uvc_close(device);
+
+	if (pass.frames == 0)
+		return 0;
+	return atomic_get64(&pass.lastFrame) - start;
+}
+
+static bigtime_t
+percentile(std::vector<bigtime_t>& values, int percent)
+{
+	if (values.empty())
+		return 0;
+
+	size_t index = (values.size() - 1) * percent / 100;
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static bool
+benchmark(const char* path, DecodePool* pool)
+{
+	uvc_device_handle_t* device;
+	if (uvc_replay_open(path, 0, &device) < 0) {
+		printf("\n%s isn't a payload recording\n", path);
+		return false;
+	}
+
+	const uvc_format_desc_t* format = uvc_get_format_descs(device);
+	const uvc_frame_desc_t* frame = format->frame_descs;
+	uvc_frame_format frameFormat = uvc_frame_format_for_guid(
+		format->guidFormat);
+	const char* name = strrchr(path, '/');
+	printf("\n%s, %s %ux%u at %.2f fps\n", name ? name + 1 : path,
+		frameFormat == UVC_FRAME_FORMAT_H264 ? "H.264"
+			: ColorConverter::FormatName(frameFormat),
+		frame->wWidth, frame->wHeight, 10000000.0 / frame->dwDefaultFrameInterval);
+	uvc_close(device);
+
+	Pass fast(pool);
+	bigtime_t fastTime = run_pass(path, true, fast);
+	if (fastTime < 0)
+		return false;
+
+	if (fast.frames == 0) {
+		printf("  no frames\n");
+		return false;
+	}
+
+	printf("  full speed     %6" B_PRId32 " frames  %8.1f fps  decode "
+		"%.2f ms\n", fast.frames, fast.frames * 1000000.0 / fastTime,
+		fast.decodeTime / 1000.0 / fast.frames);
+
+	Pass paced(pool);
+	bigtime_t pacedTime = run_pass(path, false, paced);
+	if (pacedTime < 0)
+		return false;
+
+	printf("  recorded pace  %6" B_PRId32 " frames  %8.1f fps  latency "
+		"median/99%%/max\n", paced.frames,
+		paced.frames * 1000000.0 / max_c(pacedTime, (bigtime_t)1));
+	printf("    to callback  %.2f / %.2f / %.2f ms\n",
+		percentile(paced.callbackLatency, 50) / 1000.0,
+		percentile(paced.callbackLatency, 99) / 1000.0,
+		percentile(paced.callbackLatency, 100) / 1000.0);
+	printf("    to decoded   %.2f / %.2f / %.2f ms\n",
+		percentile(paced.decodeLatency, 50) / 1000.0,
+		percentile(paced.decodeLatency, 99) / 1000.0,
+		percentile(paced.decodeLatency, 100) / 1000.0);
+
+	if (fast.undecoded > 0)
+		printf("  %" B_PRId32 " frames not decoded\n", fast.undecoded);
+
+	// Full speed waits for the decoder, every frame must be there
+	bool passed = fast.errors == 0 && paced.errors == 0;
+	if (!passed) {
+		printf("  %" B_PRId32 " frames failed to decode\n",
+			fast.errors + paced.errors);
+	}
+	if (paced.frames > fast.frames) {
+		printf("  %" B_PRId32 " frames lost at full speed\n",
+			paced.frames - fast.frames);
+		passed = false;
+	}
+
+	return passed;
+}
+
+int
+main(int argc, char** argv)
+{
+	DecodePool pool;
+	if (pool.InitCheck() != B_OK) {
+		printf("can't start the decode threads\n");
+		return 1;
+	}
+
+	bool passed = true;
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++)
+			passed &= benchmark(argv[i], &pool);
+		return passed ? 0 : 1;
+	}
+
+	static const struct {
+		uint32	width;
+		uint32	height;
+	} kSizes[] = {
+		{ 1280, 720 },
+		{ 1920, 1080 }
+	};
+
+	for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/tmp/sample-%" B_PRIu32 "x%" B_PRIu32
+			"-%d.uvcrec", kSizes[i].width, kSizes[i].height, (int)getpid());
+		if (create_sample_recording(path, kSizes[i].width, kSizes[i].height,
+				kSampleRate, kSampleFrames, true) != B_OK) {
+			printf("can't write the recording %s\n", path);
+			return 1;
+		}
+
+		passed &= benchmark(path, &pool);
+		remove(path);
+	}
+
+	return passed ? 0 : 1;
+}
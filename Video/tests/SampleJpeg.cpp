@@ -0,0 +1,74 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <jpeglib.h>
+
+#include "SampleJpeg.h"
+
+// Roughly what a camera uses for MJPEG
+static const int kQuality = 85;
+
+status_t
+create_sample_jpeg(uint32 width, uint32 height, uint32 frame,
+	bool restartMarkers, uint8** jpeg, size_t* size)
+{
+	uint8* row = (uint8*)malloc((size_t)width * 3);
+	if (row == NULL)
+		return B_NO_MEMORY;
+
+	struct jpeg_compress_struct info;
+	struct jpeg_error_mgr error;
+	info.err = jpeg_std_error(&error);
+	jpeg_create_compress(&info);
+
+	unsigned char* buffer = NULL;
+	unsigned long bufferSize = 0;
+	jpeg_mem_dest(&info, &buffer, &bufferSize);
+
+	info.image_width = width;
+	info.image_height = height;
+	info.input_components = 3;
+	info.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info, kQuality, TRUE);
+
+	info.comp_info[0].h_samp_factor = 2;
+	info.comp_info[0].v_samp_factor = 1;
+	if (restartMarkers)
+		info.restart_in_rows = 1;
+
+	jpeg_start_compress(&info, TRUE);
+
+	// Gradients, a moving bar and a little noise, so the entropy coder
+	// has about as much to do as with a real picture
+	uint32 noise = frame * 2654435761U + 1;
+	uint32 bar = (frame * 8) % width;
+	while (info.next_scanline < height) {
+		uint32 y = info.next_scanline;
+		for (uint32 x = 0; x < width; x++) {
+			noise = noise * 1103515245 + 12345;
+			int grain = (noise >> 16) & 0x0f;
+			uint8* pixel = row + x * 3;
+			bool inBar = x >= bar && x < bar + width / 16;
+			pixel[0] = inBar ? 240 : (x * 255 / width + grain) & 0xff;
+			pixel[1] = (y * 255 / height + grain) & 0xff;
+			pixel[2] = ((x + y + frame) & 0xff) ^ (grain << 2);
+		}
+		JSAMPROW rows[1] = { row };
+		jpeg_write_scanlines(&info, rows, 1);
+	}
+
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+	free(row);
+
+	*jpeg = buffer;
+	*size = bufferSize;
+	return B_OK;
+}
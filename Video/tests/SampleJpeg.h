@@ -0,0 +1,19 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _TESTS_SAMPLE_JPEG_H
+#define _TESTS_SAMPLE_JPEG_H
+
+#include <SupportDefs.h>
+
+// Compresses a synthetic picture the way UVC cameras send MJPEG, baseline
+// with 4:2:2 chroma, optionally with a restart marker after every MCU row.
+// The picture moves with frame, so consecutive frames differ like video.
+// Free *jpeg with free().
+status_t	create_sample_jpeg(uint32 width, uint32 height, uint32 frame,
+				bool restartMarkers, uint8** jpeg, size_t* size);
+
+#endif // _TESTS_SAMPLE_JPEG_H
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SampleJpeg.h"
+#include "SampleRecording.h"
+
+// What a high speed isochronous endpoint takes per microframe
+static const uint32 kMaxPayload = 3072;
+static const uint32 kHeaderSize = 12;
+static const uint32 kClockFrequency = 48000000;
+
+// Layout of replay.c
+static const size_t kRecordingHeaderSize = 48;
+static const uint8 kFormatMJPEG = 0x06;
+
+static void
+write16(uint8* data, uint16 value)
+{
+	data[0] = value & 0xff;
+	data[1] = value >> 8;
+}
+
+static void
+write32(uint8* data, uint32 value)
+{
+	write16(data, value & 0xffff);
+	write16(data + 2, value >> 16);
+}
+
+static bool
+write_payload(FILE* file, uint32 delay, const uint8* header,
+	const uint8* data, uint32 size)
+{
+	uint8 record[8];
+	write32(record, delay);
+	write32(record + 4, kHeaderSize + size);
+
+	return fwrite(record, 1, sizeof(record), file) == sizeof(record)
+		&& fwrite(header, 1, kHeaderSize, file) == kHeaderSize
+		&& fwrite(data, 1, size, file) == size;
+}
+
+status_t
+create_sample_recording(const char* path, uint32 width, uint32 height,
+	uint32 fps, uint32 frames, bool restartMarkers)
+{
+	if (width == 0 || width > 0xffff || height == 0 || height > 0xffff
+		|| fps == 0 || frames == 0)
+		return B_BAD_VALUE;
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return B_ERROR;
+
+	uint32 interval = 10000000 / fps;
+
+	uint8 header[kRecordingHeaderSize];
+	memset(header, 0, sizeof(header));
+	memcpy(header, "UVCR", 4);
+	write16(header + 4, 1);
+	header[6] = kFormatMJPEG;
+	// What libuvc puts in guidFormat for MJPEG, it has none of its own
+	memcpy(header + 8, "MJPG", 4);
+	write16(header + 24, width);
+	write16(header + 26, height);
+	write32(header + 28, interval);
+	// Cameras claim the size of an uncompressed frame for MJPEG too
+	write32(header + 32, width * height * 2);
+	write32(header + 36, kMaxPayload);
+	write32(header + 40, kClockFrequency);
+	write16(header + 44, 0x0100);
+	header[46] = 0x03;
+
+	status_t status = fwrite(header, 1, sizeof(header), file)
+		== sizeof(header) ? B_OK : B_ERROR;
+
+	uint32 ticksPerFrame = kClockFrequency / fps;
+	for (uint32 frame = 0; frame < frames && status == B_OK; frame++) {
+		uint8* jpeg;
+		size_t size;
+		status = create_sample_jpeg(width, height, frame, restartMarkers,
+			&jpeg, &size);
+		if (status != B_OK)
+			break;
+
+		// The frame ID toggles every frame, the last payload has EOF
+		uint8 payloadHeader[kHeaderSize];
+		payloadHeader[0] = kHeaderSize;
+		uint32 pts = frame * ticksPerFrame;
+		write32(payloadHeader + 2, pts);
+
+		uint32 maxData = kMaxPayload - kHeaderSize;
+		for (size_t offset = 0; offset < size; offset += maxData) {
+			uint32 chunk = (uint32)min_c(size - offset, (size_t)maxData);
+			bool last = offset + chunk == size;
+			payloadHeader[1] = 0x80 | 0x08 | 0x04 | (frame & 1)
+				| (last ? 0x02 : 0);
+
+			// The source clock a little later with every microframe
+			uint32 microframe = (uint32)(offset / maxData);
+			write32(payloadHeader + 6, pts + microframe
+				* (kClockFrequency / 8000));
+			write16(payloadHeader + 10,
+				(uint16)((frame * 1000 / fps + microframe / 8) & 0x7ff));
+
+			if (!write_payload(file, offset == 0 ? interval / 10 : 0,
+					payloadHeader, jpeg + offset, chunk)) {
+				status = B_ERROR;
+				break;
+			}
+		}
+
+		free(jpeg);
+	}
+
+	if (fclose(file) != 0 && status == B_OK)
+		status = B_ERROR;
+	if (status != B_OK)
+		remove(path);
+
+	return status;
+}
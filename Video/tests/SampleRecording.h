@@ -0,0 +1,21 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _TESTS_SAMPLE_RECORDING_H
+#define _TESTS_SAMPLE_RECORDING_H
+
+#include <SupportDefs.h>
+
+// Writes a payload recording, as uvc_stream_record() would make of a
+// camera sending frames of create_sample_jpeg() at fps, for playing back
+// with uvc_replay_open(). Every frame is split into payloads of
+// isochronous size with a full header, PTS and SCR included, and the
+// payloads of a frame arrive a frame interval after those of the last.
+status_t	create_sample_recording(const char* path, uint32 width,
+				uint32 height, uint32 fps, uint32 frames,
+				bool restartMarkers);
+
+#endif // _TESTS_SAMPLE_RECORDING_H
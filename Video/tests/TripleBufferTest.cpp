@@ -0,0 +1,199 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+// Stress test of the TripleBuffer frame mailbox. A writer thread publishes
+// frames that are filled with their sequence number as fast as it can,
+// while a reader thread checks that every frame it gets is complete, that
+// frames never go back in time and that the fresh flag tells the truth.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <OS.h>
+
+#include "TripleBuffer.h"
+
+// Small frames make the threads meet as often as possible, large ones
+// give a torn copy time to show
+static const size_t kFrameSizes[] = { 64, 4096, 1920 * 1080 * 4 };
+static const bigtime_t kRunTime = 2000000;
+
+struct StressState {
+	TripleBuffer	buffer;
+	size_t			words;
+	int32			stop;
+	int32			published;
+
+	int32			reads;
+	int32			freshReads;
+	int32			torn;
+	int32			backwards;
+	int32			staleFresh;
+	int32			changedNotFresh;
+};
+
+static int32
+writer_thread(void* data)
+{
+	StressState* state = (StressState*)data;
+
+	uint32 sequence = 0;
+	while (atomic_get(&state->stop) == 0) {
+		sequence++;
+		uint32* frame = (uint32*)state->buffer.WriteBuffer();
+		for (size_t i = 0; i < state->words; i++)
+			frame[i] = sequence;
+		state->buffer.Publish();
+		atomic_set(&state->published, sequence);
+	}
+
+	return B_OK;
+}
+
+static int32
+reader_thread(void* data)
+{
+	StressState* state = (StressState*)data;
+
+	uint32 last = 0;
+	while (atomic_get(&state->stop) == 0) {
+		bool fresh;
+		const uint32* frame = (const uint32*)state->buffer.ReadBuffer(&fresh);
+		if (frame == NULL)
+			continue;
+
+		// Every word of a frame comes from the same Publish()
+		uint32 sequence = frame[0];
+		for (size_t i = 1; i < state->words; i++) {
+			if (frame[i] != sequence) {
+				state->torn++;
+				break;
+			}
+		}
+
+		if (sequence < last)
+			state->backwards++;
+		if (fresh && sequence == last && last != 0)
+			state->staleFresh++;
+		if (!fresh && sequence != last)
+			state->changedNotFresh++;
+
+		state->reads++;
+		if (fresh)
+			state->freshReads++;
+		last = sequence;
+	}
+
+	return B_OK;
+}
+
+static bool
+run_stress(size_t frameSize)
+{
+	StressState* state = new StressState;
+	state->words = frameSize / sizeof(uint32);
+	state->stop = 0;
+	state->published = 0;
+	state->reads = 0;
+	state->freshReads = 0;
+	state->torn = 0;
+	state->backwards = 0;
+	state->staleFresh = 0;
+	state->changedNotFresh = 0;
+
+	if (state->buffer.SetSize(frameSize) != B_OK) {
+		printf("FAIL: can't allocate %zu byte frames\n", frameSize);
+		delete state;
+		return false;
+	}
+
+	thread_id writer = spawn_thread(writer_thread, "writer",
+		B_NORMAL_PRIORITY, state);
+	thread_id reader = spawn_thread(reader_thread, "reader",
+		B_NORMAL_PRIORITY, state);
+	resume_thread(writer);
+	resume_thread(reader);
+
+	snooze(kRunTime);
+	atomic_set(&state->stop, 1);
+
+	status_t result;
+	wait_for_thread(writer, &result);
+	wait_for_thread(reader, &result);
+
+	bool passed = state->torn == 0 && state->backwards == 0
+		&& state->staleFresh == 0 && state->changedNotFresh == 0
+		&& state->freshReads > 0;
+
+	printf("%s: %9zu byte frames, %" B_PRId32 " published, %" B_PRId32
+		" reads, %" B_PRId32 " fresh, %" B_PRId32 " torn, %" B_PRId32
+		" out of order, %" B_PRId32 " wrongly flagged\n",
+		passed ? "ok  " : "FAIL", frameSize, state->published, state->reads,
+		state->freshReads, state->torn, state->backwards,
+		state->staleFresh + state->changedNotFresh);
+
+	delete state;
+	return passed;
+}
+
+static bool
+test_single_thread()
+{
+	// Publish and read in turns, the reader gets every frame exactly once
+	TripleBuffer buffer;
+	if (buffer.SetSize(sizeof(uint32)) != B_OK)
+		return false;
+
+	bool fresh;
+	if (buffer.ReadBuffer(&fresh) != NULL || fresh) {
+		printf("FAIL: a frame before anything was published\n");
+		return false;
+	}
+
+	for (uint32 i = 1; i <= 1000; i++) {
+		*(uint32*)buffer.WriteBuffer() = i;
+		buffer.Publish();
+		if (i % 3 == 0) {
+			// Frames published in between are skipped, only the latest
+			// one counts
+			*(uint32*)buffer.WriteBuffer() = i + 1000000;
+			buffer.Publish();
+			*(uint32*)buffer.WriteBuffer() = i;
+			buffer.Publish();
+		}
+
+		uint32 value = *(const uint32*)buffer.ReadBuffer(&fresh);
+		if (!fresh || value != i) {
+			printf("FAIL: read %" B_PRIu32 " (%s) after publishing %"
+				B_PRIu32 "\n", value, fresh ? "fresh" : "not fresh", i);
+			return false;
+		}
+
+		value = *(const uint32*)buffer.ReadBuffer(&fresh);
+		if (fresh || value != i) {
+			printf("FAIL: read %" B_PRIu32 " (%s) again instead of %" B_PRIu32
+				"\n", value, fresh ? "fresh" : "not fresh", i);
+			return false;
+		}
+	}
+
+	printf("ok  : latest frame semantics on one thread\n");
+	return true;
+}
+
+int
+main(int argc, char** argv)
+{
+	bool passed = test_single_thread();
+
+	for (size_t i = 0; i < sizeof(kFrameSizes) / sizeof(kFrameSizes[0]); i++)
+		passed &= run_stress(kFrameSizes[i]);
+
+	printf(passed ? "All TripleBuffer tests passed\n"
+		: "TripleBuffer tests FAILED\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _AUTOLOCK_H
+#define _AUTOLOCK_H
+
+#include <Locker.h>
+
+class BAutolock {
+public:
+	BAutolock(BLocker& locker)
+		: fLocker(&locker)
+		, fLocked(locker.Lock())
+	{
+	}
+
+	BAutolock(BLocker* locker)
+		: fLocker(locker)
+		, fLocked(locker->Lock())
+	{
+	}
+
+	~BAutolock()
+	{
+		if (fLocked)
+			fLocker->Unlock();
+	}
+
+	bool IsLocked() const { return fLocked; }
+
+private:
+	BLocker*	fLocker;
+	bool		fLocked;
+};
+
+#endif // _AUTOLOCK_H
@@ -0,0 +1,19 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _GRAPHICS_DEFS_H
+#define _GRAPHICS_DEFS_H
+
+#include <SupportDefs.h>
+
+// The color spaces the decoders produce, with their Haiku values
+enum color_space {
+	B_NO_COLOR_SPACE	= 0x0000,
+	B_RGB32				= 0x0008,
+	B_YCbCr422			= 0x4000
+};
+
+#endif // _GRAPHICS_DEFS_H
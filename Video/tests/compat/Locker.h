@@ -0,0 +1,59 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _LOCKER_H
+#define _LOCKER_H
+
+#include <pthread.h>
+
+#include <SupportDefs.h>
+
+// Recursive lock like the Haiku BLocker
+class BLocker {
+public:
+	BLocker(const char* name = NULL)
+		: fOwner(0)
+		, fCount(0)
+	{
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&fMutex, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+	}
+
+	~BLocker()
+	{
+		pthread_mutex_destroy(&fMutex);
+	}
+
+	bool Lock()
+	{
+		pthread_mutex_lock(&fMutex);
+		fOwner = pthread_self();
+		fCount++;
+		return true;
+	}
+
+	void Unlock()
+	{
+		if (--fCount == 0)
+			fOwner = 0;
+		pthread_mutex_unlock(&fMutex);
+	}
+
+	bool IsLocked() const
+	{
+		return fCount > 0 && pthread_equal(fOwner, pthread_self());
+	}
+
+private:
+	pthread_mutex_t		fMutex;
+	pthread_t			fOwner;
+	int32				fCount;
+};
+
+#endif // _LOCKER_H
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <OS.h>
+
+// Ids are never reused, a test doesn't create anywhere near this many
+#define MAX_THREADS 1024
+#define MAX_SEMS 4096
+
+struct compat_thread {
+	pthread_t		thread;
+	thread_func		function;
+	void*			data;
+	int32			result;
+	bool			used;
+	bool			started;
+};
+
+struct compat_sem {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	condition;
+	int32			count;
+	bool			used;
+	bool			deleted;
+};
+
+static pthread_mutex_t sTableLock = PTHREAD_MUTEX_INITIALIZER;
+static compat_thread sThreads[MAX_THREADS];
+static int32 sThreadCount = 0;
+static compat_sem sSems[MAX_SEMS];
+static int32 sSemCount = 0;
+
+static __thread thread_id sCurrentThread = -1;
+
+
+static void*
+thread_entry(void* data)
+{
+	thread_id id = (thread_id)(intptr_t)data;
+	compat_thread& thread = sThreads[id];
+
+	sCurrentThread = id;
+	thread.result = thread.function(thread.data);
+	return NULL;
+}
+
+
+static compat_sem*
+get_sem(sem_id id)
+{
+	if (id < 0 || id >= MAX_SEMS || !sSems[id].used)
+		return NULL;
+	return &sSems[id];
+}
+
+
+static void
+to_timespec(bigtime_t time, struct timespec* spec)
+{
+	spec->tv_sec = time / 1000000;
+	spec->tv_nsec = (time % 1000000) * 1000;
+}
+
+
+thread_id
+spawn_thread(thread_func function, const char* name, int32 priority,
+	void* data)
+{
+	pthread_mutex_lock(&sTableLock);
+	if (sThreadCount == MAX_THREADS) {
+		pthread_mutex_unlock(&sTableLock);
+		return B_NO_MORE_THREADS;
+	}
+
+	thread_id id = sThreadCount++;
+	compat_thread& thread = sThreads[id];
+	thread.function = function;
+	thread.data = data;
+	thread.result = B_OK;
+	thread.used = true;
+	thread.started = false;
+	pthread_mutex_unlock(&sTableLock);
+
+	return id;
+}
+
+
+status_t
+resume_thread(thread_id id)
+{
+	if (id < 0 || id >= MAX_THREADS || !sThreads[id].used)
+		return B_BAD_THREAD_ID;
+
+	// Threads are only ever resumed once, right after they were spawned
+	compat_thread& thread = sThreads[id];
+	if (thread.started)
+		return B_BAD_THREAD_ID;
+
+	if (pthread_create(&thread.thread, NULL, thread_entry,
+			(void*)(intptr_t)id) != 0)
+		return B_NO_MORE_THREADS;
+
+	thread.started = true;
+	return B_OK;
+}
+
+
+status_t
+wait_for_thread(thread_id id, status_t* returnValue)
+{
+	if (id < 0 || id >= MAX_THREADS || !sThreads[id].used)
+		return B_BAD_THREAD_ID;
+
+	compat_thread& thread = sThreads[id];
+	if (!thread.started && resume_thread(id) != B_OK)
+		return B_BAD_THREAD_ID;
+
+	pthread_join(thread.thread, NULL);
+	thread.used = false;
+
+	if (returnValue != NULL)
+		*returnValue = thread.result;
+	return B_OK;
+}
+
+
+thread_id
+find_thread(const char* name)
+{
+	// Only the current thread can be looked up
+	if (name != NULL)
+		return B_NAME_NOT_FOUND;
+	return sCurrentThread;
+}
+
+
+status_t
+set_thread_priority(thread_id thread, int32 priority)
+{
+	return B_NORMAL_PRIORITY;
+}
+
+
+sem_id
+create_sem(int32 count, const char* name)
+{
+	pthread_mutex_lock(&sTableLock);
+	if (sSemCount == MAX_SEMS) {
+		pthread_mutex_unlock(&sTableLock);
+		return B_NO_MORE_SEMS;
+	}
+
+	sem_id id = sSemCount++;
+	compat_sem& sem = sSems[id];
+	pthread_mutex_init(&sem.mutex, NULL);
+	// Timeouts are in system_time(), which is the monotonic clock
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&sem.condition, &attributes);
+	pthread_condattr_destroy(&attributes);
+	sem.count = count;
+	sem.deleted = false;
+	sem.used = true;
+	pthread_mutex_unlock(&sTableLock);
+
+	return id;
+}
+
+
+status_t
+delete_sem(sem_id id)
+{
+	compat_sem* sem = get_sem(id);
+	if (sem == NULL)
+		return B_BAD_SEM_ID;
+
+	// Waiters wake up with B_BAD_SEM_ID, the slot itself is kept
+	pthread_mutex_lock(&sem->mutex);
+	if (sem->deleted) {
+		pthread_mutex_unlock(&sem->mutex);
+		return B_BAD_SEM_ID;
+	}
+	sem->deleted = true;
+	pthread_cond_broadcast(&sem->condition);
+	pthread_mutex_unlock(&sem->mutex);
+	return B_OK;
+}
+
+
+status_t
+acquire_sem(sem_id id)
+{
+	return acquire_sem_etc(id, 1, 0, 0);
+}
+
+
+status_t
+acquire_sem_etc(sem_id id, int32 count, uint32 flags, bigtime_t timeout)
+{
+	compat_sem* sem = get_sem(id);
+	if (sem == NULL || count <= 0)
+		return sem == NULL ? B_BAD_SEM_ID : B_BAD_VALUE;
+
+	bool timed = (flags & (B_RELATIVE_TIMEOUT | B_ABSOLUTE_TIMEOUT)) != 0
+		&& timeout != B_INFINITE_TIMEOUT;
+	bigtime_t deadline = timeout;
+	if ((flags & B_RELATIVE_TIMEOUT) != 0 && timed)
+		deadline = system_time() + timeout;
+
+	struct timespec until;
+	to_timespec(deadline, &until);
+
+	status_t status = B_OK;
+	pthread_mutex_lock(&sem->mutex);
+	while (!sem->deleted && sem->count < count) {
+		if (!timed) {
+			pthread_cond_wait(&sem->condition, &sem->mutex);
+			continue;
+		}
+		if ((flags & B_RELATIVE_TIMEOUT) != 0 && timeout <= 0) {
+			status = B_WOULD_BLOCK;
+			break;
+		}
+		if (pthread_cond_timedwait(&sem->condition, &sem->mutex, &until)
+				== ETIMEDOUT && sem->count < count && !sem->deleted) {
+			status = B_TIMED_OUT;
+			break;
+		}
+	}
+
+	if (sem->deleted)
+		status = B_BAD_SEM_ID;
+	else if (status == B_OK)
+		sem->count -= count;
+	pthread_mutex_unlock(&sem->mutex);
+
+	return status;
+}
+
+
+status_t
+release_sem(sem_id id)
+{
+	return release_sem_etc(id, 1, 0);
+}
+
+
+status_t
+release_sem_etc(sem_id id, int32 count, uint32 flags)
+{
+	compat_sem* sem = get_sem(id);
+	if (sem == NULL || count <= 0)
+		return sem == NULL ? B_BAD_SEM_ID : B_BAD_VALUE;
+
+	pthread_mutex_lock(&sem->mutex);
+	if (sem->deleted) {
+		pthread_mutex_unlock(&sem->mutex);
+		return B_BAD_SEM_ID;
+	}
+	sem->count += count;
+	pthread_cond_broadcast(&sem->condition);
+	pthread_mutex_unlock(&sem->mutex);
+	return B_OK;
+}
+
+
+status_t
+get_sem_count(sem_id id, int32* count)
+{
+	compat_sem* sem = get_sem(id);
+	if (sem == NULL)
+		return B_BAD_SEM_ID;
+
+	pthread_mutex_lock(&sem->mutex);
+	*count = sem->count;
+	pthread_mutex_unlock(&sem->mutex);
+	return B_OK;
+}
+
+
+bigtime_t
+system_time()
+{
+	// Like on Haiku, time since boot that never jumps
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (bigtime_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+status_t
+snooze(bigtime_t amount)
+{
+	if (amount <= 0)
+		return B_OK;
+
+	struct timespec spec;
+	to_timespec(amount, &spec);
+	while (nanosleep(&spec, &spec) != 0 && errno == EINTR)
+		;
+	return B_OK;
+}
+
+
+status_t
+snooze_until(bigtime_t time, int timeBase)
+{
+	return snooze(time - system_time());
+}
+
+
+status_t
+get_system_info(system_info* info)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	info->cpu_count = count > 0 ? (uint32)count : 1;
+	return B_OK;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _OS_H
+#define _OS_H
+
+// Threads, semaphores, atomics and time of the Haiku kernel kit on top of
+// pthreads, enough for the add-on sources the tests build
+
+#include <SupportDefs.h>
+
+typedef int32				thread_id;
+typedef int32				sem_id;
+
+typedef int32				(*thread_func)(void* data);
+
+#define B_OS_NAME_LENGTH	32
+#define B_INFINITE_TIMEOUT	(9223372036854775807LL)
+
+enum {
+	B_CAN_INTERRUPT			= 0x01,
+	B_DO_NOT_RESCHEDULE		= 0x02,
+	B_RELATIVE_TIMEOUT		= 0x08,
+	B_ABSOLUTE_TIMEOUT		= 0x10
+};
+
+enum {
+	B_SYSTEM_TIMEBASE		= 0
+};
+
+// Priorities are accepted and ignored
+enum {
+	B_LOW_PRIORITY				= 5,
+	B_NORMAL_PRIORITY			= 10,
+	B_DISPLAY_PRIORITY			= 15,
+	B_URGENT_DISPLAY_PRIORITY	= 20,
+	B_REAL_TIME_DISPLAY_PRIORITY = 100,
+	B_URGENT_PRIORITY			= 110,
+	B_REAL_TIME_PRIORITY		= 120
+};
+
+typedef struct {
+	uint32					cpu_count;
+} system_info;
+
+thread_id		spawn_thread(thread_func function, const char* name,
+					int32 priority, void* data);
+status_t		resume_thread(thread_id thread);
+status_t		wait_for_thread(thread_id thread, status_t* returnValue);
+thread_id		find_thread(const char* name);
+status_t		set_thread_priority(thread_id thread, int32 priority);
+
+sem_id			create_sem(int32 count, const char* name);
+status_t		delete_sem(sem_id sem);
+status_t		acquire_sem(sem_id sem);
+status_t		acquire_sem_etc(sem_id sem, int32 count, uint32 flags,
+					bigtime_t timeout);
+status_t		release_sem(sem_id sem);
+status_t		release_sem_etc(sem_id sem, int32 count, uint32 flags);
+status_t		get_sem_count(sem_id sem, int32* count);
+
+bigtime_t		system_time();
+status_t		snooze(bigtime_t amount);
+status_t		snooze_until(bigtime_t time, int timeBase);
+
+status_t		get_system_info(system_info* info);
+
+
+// Like on Haiku every one of them is a full barrier
+static inline int32
+atomic_add(int32* value, int32 addValue)
+{
+	return __atomic_fetch_add(value, addValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_and(int32* value, int32 andValue)
+{
+	return __atomic_fetch_and(value, andValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_or(int32* value, int32 orValue)
+{
+	return __atomic_fetch_or(value, orValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_get(int32* value)
+{
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+atomic_set(int32* value, int32 newValue)
+{
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_get_and_set(int32* value, int32 newValue)
+{
+	return __atomic_exchange_n(value, newValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int32
+atomic_test_and_set(int32* value, int32 newValue, int32 testAgainst)
+{
+	__atomic_compare_exchange_n(value, &testAgainst, newValue, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return testAgainst;
+}
+
+static inline int64
+atomic_add64(int64* value, int64 addValue)
+{
+	return __atomic_fetch_add(value, addValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int64
+atomic_get64(int64* value)
+{
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+atomic_set64(int64* value, int64 newValue)
+{
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+}
+
+static inline int64
+atomic_test_and_set64(int64* value, int64 newValue, int64 testAgainst)
+{
+	__atomic_compare_exchange_n(value, &testAgainst, newValue, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return testAgainst;
+}
+
+#endif // _OS_H
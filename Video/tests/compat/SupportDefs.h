@@ -0,0 +1,77 @@
+/*
+ * Copyright 2024, Gerasim Troeglazov (3dEyes**), 3dEyes@gmail.com.
+ * All rights reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#ifndef _SUPPORT_DEFS_H
+#define _SUPPORT_DEFS_H
+
+// The part of the Haiku SupportDefs.h the add-on sources use, for the
+// Linux builds of the tests and benchmarks
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef int8_t				int8;
+typedef uint8_t				uint8;
+typedef int16_t				int16;
+typedef uint16_t			uint16;
+typedef int32_t				int32;
+typedef uint32_t			uint32;
+typedef int64_t				int64;
+typedef uint64_t			uint64;
+
+typedef int32				status_t;
+typedef int64				bigtime_t;
+typedef uint32				type_code;
+
+#define B_PRId32			PRId32
+#define B_PRIu32			PRIu32
+#define B_PRIx32			PRIx32
+#define B_PRId64			PRId64
+#define B_PRIu64			PRIu64
+#define B_PRIdBIGTIME		PRId64
+#define B_SCNu32			SCNu32
+
+enum {
+	B_OK					= 0,
+	B_ERROR					= -1,
+
+	B_NO_MEMORY				= INT_MIN,
+	B_IO_ERROR,
+	B_PERMISSION_DENIED,
+	B_BAD_INDEX,
+	B_BAD_TYPE,
+	B_BAD_VALUE,
+	B_MISMATCHED_VALUES,
+	B_NAME_NOT_FOUND,
+	B_NAME_IN_USE,
+	B_TIMED_OUT,
+	B_INTERRUPTED,
+	B_WOULD_BLOCK,
+	B_CANCELED,
+	B_NO_INIT,
+	B_BUSY,
+	B_NOT_ALLOWED,
+	B_BAD_DATA,
+	B_NOT_SUPPORTED,
+
+	B_BAD_SEM_ID			= INT_MIN + 0x1000,
+	B_NO_MORE_SEMS,
+	B_BAD_THREAD_ID,
+	B_NO_MORE_THREADS
+};
+
+#ifdef __cplusplus
+template<class T> inline T min_c(T a, T b) { return a < b ? a : b; }
+template<class T> inline T max_c(T a, T b) { return a > b ? a : b; }
+#else
+#define min_c(a, b) ((a) < (b) ? (a) : (b))
+#define max_c(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#endif // _SUPPORT_DEFS_H